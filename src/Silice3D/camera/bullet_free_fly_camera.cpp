@@ -13,21 +13,23 @@ BulletFreeFlyCamera::BulletFreeFlyCamera(GameObject* parent, double fov, double
                     speed_per_sec, mouse_sensitivity) {
   double radius = 3.0f * z_near;
   btCollisionShape* shape = new btSphereShape(radius);
-  auto rbody = AddComponent<BulletRigidBody>(
+  rigid_body_ = AddComponent<BulletRigidBody>(
     1.0f, std::unique_ptr<btCollisionShape>{shape}, kColDynamic);
   BulletRigidBody::Restrains restrains;
   restrains.y_pos_lock = 1;
   restrains.manual_rot = 1;
-  rbody->SetRestrains(restrains);
-  bt_rigid_body_ = rbody->GetBtRigidBody();
-  bt_rigid_body_->setGravity(btVector3{0, 0, 0});
-  bt_rigid_body_->setActivationState(DISABLE_DEACTIVATION);
-  bt_rigid_body_->setMassProps(0.1f, btVector3(0, 0, 0));
-  bt_rigid_body_->setFriction(0.0f);
-  bt_rigid_body_->setRestitution(0.0f);
+  rigid_body_->SetRestrains(restrains);
+  // The body is already owned by the physics thread
+  rigid_body_->QueuePhysicsCommand([radius](btRigidBody* bt_rigid_body) {
+    bt_rigid_body->setGravity(btVector3{0, 0, 0});
+    bt_rigid_body->setActivationState(DISABLE_DEACTIVATION);
+    bt_rigid_body->setMassProps(0.1f, btVector3(0, 0, 0));
+    bt_rigid_body->setFriction(0.0f);
+    bt_rigid_body->setRestitution(0.0f);
 
-  bt_rigid_body_->setCcdMotionThreshold(radius);
-  bt_rigid_body_->setCcdSweptSphereRadius(radius/2.0f);
+    bt_rigid_body->setCcdMotionThreshold(radius);
+    bt_rigid_body->setCcdSweptSphereRadius(radius/2.0f);
+  });
 }
 
 void BulletFreeFlyCamera::Update() {
@@ -85,7 +87,7 @@ void BulletFreeFlyCamera::Update() {
   offset *= speed_per_sec_;
 
   // Update the "position"
-  bt_rigid_body_->setLinearVelocity(btVector3{offset.x, offset.y, offset.z});
+  rigid_body_->SetLinearVelocity(glm::vec3(offset));
 
   UpdateCache();
 }
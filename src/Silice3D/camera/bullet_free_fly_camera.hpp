@@ -20,7 +20,7 @@ class BulletFreeFlyCamera : public FreeFlyCamera {
   virtual void Update() override;
 
  private:
-  btRigidBody* bt_rigid_body_;
+  BulletRigidBody* rigid_body_;
 };
 
 }
@@ -18,13 +18,13 @@ bool BoundingBox::CollidesWithSphere(const glm::dvec3& center, double radius) co
 
 bool BoundingBox::CollidesWithFrustum(const Frustum& frustum) const {
   glm::dvec3 center = GetCenter();
-  glm::dvec3 extent = GetExtent();
+  glm::dvec3 half_extent = GetExtent() / 2.0;
 
   for (int i = 0; i < 6; ++i) {
     const Plane& plane = frustum.planes[i];
 
     double d = glm::dot(center, plane.normal);
-    double r = glm::dot(extent, glm::abs(plane.normal));
+    double r = glm::dot(half_extent, glm::abs(plane.normal));
 
     if (d + r < -plane.dist) {
       return false;
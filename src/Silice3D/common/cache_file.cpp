@@ -0,0 +1,56 @@
+// Copyright (c) Tamas Csala
+
+#include <cstdio>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <Silice3D/common/cache_file.hpp>
+
+namespace Silice3D {
+namespace CacheFile {
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string GetPath(const std::string& directory, uint64_t hash, const std::string& extension) {
+  std::string trimmed_directory = directory;
+  while (!trimmed_directory.empty() && trimmed_directory.back() == '/') {
+    trimmed_directory.pop_back();
+  }
+
+  std::stringstream ss;
+  ss << trimmed_directory << '/' << std::hex << std::setw(16) << std::setfill('0')
+     << hash << extension;
+  return ss.str();
+}
+
+bool WriteAtomically(const std::string& path, const std::function<void(std::ostream&)>& write) {
+  // The thread id keeps the temporary files of concurrent writers apart
+  std::string temp_path = path + ".tmp" +
+      std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+  bool written = false;
+  {
+    std::ofstream file(temp_path, std::ios::binary);
+    if (file) {
+      write(file);
+      written = bool(file);
+    }
+  }
+
+  if (written && std::rename(temp_path.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  std::remove(temp_path.c_str());
+  return false;
+}
+
+}  // namespace CacheFile
+}  // namespace Silice3D
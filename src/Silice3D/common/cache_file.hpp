@@ -0,0 +1,39 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_COMMON_CACHE_FILE_HPP_
+#define SILICE3D_COMMON_CACHE_FILE_HPP_
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <functional>
+
+namespace Silice3D {
+
+// The common parts of the on-disk caches (the compressed textures, the
+// collision shapes and the program binaries).
+namespace CacheFile {
+
+constexpr uint64_t kHashSeed = 14695981039346656037ull;
+
+// FNV-1a, can be chained by passing the previous result as the seed.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = kHashSeed);
+
+inline uint64_t HashString(const std::string& str, uint64_t hash = kHashSeed) {
+  return HashBytes(str.data(), str.size(), hash);
+}
+
+// Returns directory/<hash as 16 hex digits><extension>.
+std::string GetPath(const std::string& directory, uint64_t hash, const std::string& extension);
+
+// Writes the file through a temporary file, that is only renamed to the
+// path once it's complete, so a concurrent reader never sees a partially
+// written file. Returns false (and removes the temporary file) if the
+// stream failed at any point.
+bool WriteAtomically(const std::string& path, const std::function<void(std::ostream&)>& write);
+
+}  // namespace CacheFile
+}  // namespace Silice3D
+
+#endif  // SILICE3D_COMMON_CACHE_FILE_HPP_
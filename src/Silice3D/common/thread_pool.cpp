@@ -1,5 +1,6 @@
 // Copyright (c) Tamas Csala
 
+#include <algorithm>
 #include <Silice3D/common/thread_pool.hpp>
 
 namespace Silice3D {
@@ -61,4 +62,45 @@ void ThreadPool::Clear() {
   }
 }
 
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task,
+                             int priority) {
+  if (count == 0) {
+    return;
+  }
+
+  // The helper tasks might only start after everything is finished, so the
+  // shared state must outlive this call.
+  struct State {
+    std::function<void(size_t)> task;
+    size_t count;
+    std::atomic<size_t> next_index{0};
+    std::atomic<size_t> finished_count{0};
+    std::mutex mutex;
+    std::condition_variable all_finished;
+  };
+  auto state = std::make_shared<State>();
+  state->task = task;
+  state->count = count;
+
+  auto work = [state] {
+    size_t index;
+    while ((index = state->next_index++) < state->count) {
+      state->task(index);
+      if (++state->finished_count == state->count) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->all_finished.notify_all();
+      }
+    }
+  };
+
+  size_t helper_count = std::min(workers.size(), count - 1);
+  for (size_t i = 0; i < helper_count; ++i) {
+    Enqueue(priority, work);
+  }
+  work();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->all_finished.wait(lock, [&state] { return state->finished_count == state->count; });
+}
+
 }
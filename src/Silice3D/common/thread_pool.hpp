@@ -11,6 +11,7 @@
 #include <condition_variable>
 #include <future>
 #include <functional>
+#include <atomic>
 #include <stdexcept>
 
 namespace std {
@@ -35,6 +36,18 @@ public:
     void Enqueue(int priority, const std::function<void()>& task);
     void Clear();
 
+    size_t GetWorkerCount() const { return workers.size(); }
+
+    // Calls task(i) for every i in [0, count) on the workers and on the
+    // calling thread, and returns when all of them are finished. The calling
+    // thread takes part in the work, so this can't deadlock even if every
+    // worker is busy with some long running task.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task,
+                     int priority = kParallelForPriority);
+
+    // Higher than the priority of the background loading tasks
+    static constexpr int kParallelForPriority = 100;
+
 private:
     // need to keep track of threads so we can join them
     std::vector<std::thread> workers;
@@ -1,6 +1,7 @@
 // Copyright (c) Tamas Csala
 
 #include <string>
+#include <algorithm>
 
 #include <Silice3D/common/oglwrap.hpp>
 #include <GLFW/glfw3.h>
@@ -95,8 +96,14 @@ GameEngine::GameEngine(const std::string& application_name, WindowMode windowMod
 
   MeshRenderer::InitializeMeshDataStorage();
 
+  // Leave a core for the main thread
+  unsigned worker_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  thread_pool_ = make_unique<ThreadPool>(worker_count);
+  physics_thread_pool_ = make_unique<ThreadPool>(2);
+
   // Only initialize after the OpenGL context has been created
   shader_manager_ = make_unique<ShaderManager>();
+  texture_manager_ = make_unique<TextureManager>(thread_pool_.get());
 
   // OpenGL initialization
   gl::Enable(gl::kDepthTest);
@@ -117,6 +124,7 @@ GameEngine::~GameEngine() {
     shader_manager_.reset();
     scene_.reset();
     new_scene_.reset();
+    texture_manager_.reset();
     glfwDestroyWindow(window_);
     window_ = nullptr;
   }
@@ -135,6 +143,8 @@ void GameEngine::Run() {
       std::swap(scene_, new_scene_);
       new_scene_ = nullptr;
     }
+    texture_manager_->Update();
+
     if (!minimized_) {
       gl::Clear().Color().Depth();
       scene_->Turn();
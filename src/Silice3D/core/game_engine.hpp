@@ -7,7 +7,9 @@
 
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/common/thread_pool.hpp>
 #include <Silice3D/shaders/shader_manager.hpp>
+#include <Silice3D/texture/texture_manager.hpp>
 
 namespace Silice3D {
 
@@ -24,13 +26,24 @@ class GameEngine {
   Scene* GetScene() { return scene_.get(); }
   GLFWwindow* GetWindow() { return window_; }
   ShaderManager* GetShaderManager() { return shader_manager_.get(); }
+  TextureManager* GetTextureManager() { return texture_manager_.get(); }
+  ThreadPool* GetThreadPool() { return thread_pool_.get(); }
+  // The threads that run the physics of the scenes (see PhysicsThread). They
+  // are kept for the whole lifetime of the engine, instead of starting new
+  // ones for every scene, as Bullet can only be used by BT_MAX_THREAD_COUNT
+  // different threads. There are two, so a new scene's physics can start
+  // while the previous scene is still running.
+  ThreadPool* GetPhysicsThreadPool() { return physics_thread_pool_.get(); }
   glm::vec2 GetWindowSize();
 
  private:
   bool minimized_ = false;
   std::unique_ptr<Scene> scene_;
   std::unique_ptr<Scene> new_scene_;
+  std::unique_ptr<ThreadPool> thread_pool_;
+  std::unique_ptr<ThreadPool> physics_thread_pool_;
   std::unique_ptr<ShaderManager> shader_manager_;
+  std::unique_ptr<TextureManager> texture_manager_;
   GLFWwindow *window_;
 
   // GLFW Callbacks
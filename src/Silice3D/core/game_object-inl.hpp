@@ -43,7 +43,6 @@ inline Scene* GameObject::GetScene() { return scene_; }
 inline const Scene* GameObject::GetScene() const { return scene_; }
 
 inline bool GameObject::IsEnabled() const { return enabled_; }
-inline void GameObject::SetIsEnabled(bool value) { enabled_ = value; }
 
 }  // namespace Silice3D
 
@@ -98,15 +98,6 @@ void GameObject::UpdateRecursive() {
   }
 }
 
-void GameObject::UpdatePhysicsRecursive() {
-  if (!enabled_) { return; }
-
-  UpdatePhysics();
-  for (auto& component : components_) {
-    component->UpdatePhysicsRecursive();
-  }
-}
-
 void GameObject::AddedToSceneRecursive() {
   if (!enabled_) { return; }
 
@@ -125,6 +116,27 @@ void GameObject::RemovedFromSceneRecursive() {
   }
 }
 
+void GameObject::SetIsEnabled(bool value) {
+  if (enabled_ == value) { return; }
+  enabled_ = value;
+
+  // The state of the subtree only changes if the parents are enabled
+  for (GameObject* parent = parent_; parent != nullptr; parent = parent->parent_) {
+    if (!parent->enabled_) { return; }
+  }
+  EnabledChangedRecursive(value);
+}
+
+void GameObject::EnabledChangedRecursive(bool enabled) {
+  EnabledChanged(enabled);
+  for (auto& component : components_) {
+    // The disabled components stay disabled
+    if (component->enabled_) {
+      component->EnabledChangedRecursive(enabled);
+    }
+  }
+}
+
 void GameObject::KeyActionRecursive(int key, int scancode, int action, int mods) {
   if (!enabled_) { return; }
 
@@ -18,6 +18,7 @@ namespace Silice3D {
 // TODO: better place for these
 constexpr int kShadowTextureSlot = 0;
 constexpr int kDiffuseTextureSlot = 1;
+constexpr int kHiZTextureSlot = 2;
 
 class Scene;
 class ICamera;
@@ -83,9 +84,12 @@ class GameObject {
   virtual void RenderDepthOnly(const ICamera& /*camera*/) {}
   virtual void Render2D() {}
   virtual void Update() {}
-  virtual void UpdatePhysics() {}
   virtual void AddedToScene() {}
   virtual void RemovedFromScene() {}
+  // Called when this GameObject gets enabled or disabled, either by itself or
+  // through one of its parents (unlike the other callbacks, this is called
+  // for the disabled GameObjects too)
+  virtual void EnabledChanged(bool /*enabled*/) {}
   virtual void ScreenResized(size_t /*width*/, size_t /*height*/) {}
   virtual void KeyAction(int /*key*/, int /*scancode*/, int /*action*/, int /*mods*/) {}
   virtual void CharTyped(unsigned /*codepoint*/) {}
@@ -98,9 +102,9 @@ class GameObject {
   virtual void RenderDepthOnlyRecursive(const ICamera& camera);
   virtual void Render2DRecursive();
   virtual void UpdateRecursive();
-  virtual void UpdatePhysicsRecursive();
   virtual void AddedToSceneRecursive();
   virtual void RemovedFromSceneRecursive();
+  virtual void EnabledChangedRecursive(bool /*enabled*/);
   virtual void ScreenResizedRecursive(size_t /*width*/, size_t /*height*/);
   virtual void KeyActionRecursive(int /*key*/, int /*scancode*/, int /*action*/, int /*mods*/);
   virtual void CharTypedRecursive(unsigned /*codepoint*/);
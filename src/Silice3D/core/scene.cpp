@@ -1,32 +1,53 @@
 // Copyright (c) Tamas Csala
 
+#include <algorithm>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+
 #include <Silice3D/common/oglwrap.hpp>
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/core/game_engine.hpp>
+#include <Silice3D/culling/hi_z_buffer.hpp>
+#include <Silice3D/culling/software_occlusion_culler.hpp>
 #include <Silice3D/lighting/shadow_caster.hpp>
+#include <Silice3D/lighting/clustered_lighting.hpp>
+#include <Silice3D/lighting/deferred_shading.hpp>
+#include <Silice3D/lighting/point_light_shadows.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
+#include <Silice3D/mesh/mesh_object_batch_renderer.hpp>
+#include <Silice3D/physics/bullet_rigid_body.hpp>
+#include <Silice3D/physics/physics_task_scheduler.hpp>
 
 namespace Silice3D {
 
 // Because btDiscreteDynamicsWorld has O(n^2) destructor for n objects by default...
-class btFastDestructableDynamicsWorld : public btDiscreteDynamicsWorld {
+class btFastDestructable {
+public:
+  virtual ~btFastDestructable() {}
+  virtual void aboutToDestruct() = 0;
+};
+
+// Works with btDiscreteDynamicsWorld and btDiscreteDynamicsWorldMt too
+template<typename DiscreteDynamicsWorld>
+class btFastDestructableDynamicsWorld : public DiscreteDynamicsWorld, public btFastDestructable {
 public:
-  using btDiscreteDynamicsWorld::btDiscreteDynamicsWorld;
+  using DiscreteDynamicsWorld::DiscreteDynamicsWorld;
 
-  void aboutToDestruct() {
-    m_nonStaticRigidBodies = btAlignedObjectArray<btRigidBody*>();
-    m_collisionObjects = btAlignedObjectArray<btCollisionObject*>();
+  virtual void aboutToDestruct() override {
+    this->m_nonStaticRigidBodies = btAlignedObjectArray<btRigidBody*>();
+    this->m_collisionObjects = btAlignedObjectArray<btCollisionObject*>();
     m_aboutToDestruct = true;
   }
 
   virtual void removeRigidBody(btRigidBody *body) override {
     if (!m_aboutToDestruct) {
-      btDiscreteDynamicsWorld::removeRigidBody(body);
+      DiscreteDynamicsWorld::removeRigidBody(body);
     }
   }
 
   virtual void removeCollisionObject(btCollisionObject *collisionObject) override {
     if (!m_aboutToDestruct) {
-      btDiscreteDynamicsWorld::removeCollisionObject(collisionObject);
+      DiscreteDynamicsWorld::removeCollisionObject(collisionObject);
     } else {
       btBroadphaseProxy* bp = collisionObject->getBroadphaseHandle();
       if (bp) {
@@ -40,89 +61,60 @@ private:
   bool m_aboutToDestruct = false;
 };
 
-Scene::Scene(GameEngine* engine)
+Scene::Scene(GameEngine* engine, bool multithreaded_physics)
     : GameObject(nullptr)
     , camera_(nullptr)
-    , engine_(engine)
-    , physics_thread_should_quit_(false)
-    , physics_thread_{[this](){
-      while (true) {
-        physics_can_run_.WaitOne();
-        if (physics_thread_should_quit_) { return; }
-        UpdatePhysicsInBackgroundThread();
-        physics_finished_.Set();
-      }
-    }} {
+    , engine_(engine) {
   SetScene(this);
 
   { // Bullet initilization
     bt_collision_config_ = make_unique<btDefaultCollisionConfiguration>();
-    bt_dispatcher_ = make_unique<btCollisionDispatcher>(bt_collision_config_.get());
     bt_broadphase_ = make_unique<btDbvtBroadphase>();
-    bt_solver_ = make_unique<btSequentialImpulseConstraintSolver>();
 
-    bt_world_ = make_unique<btFastDestructableDynamicsWorld>(
-        bt_dispatcher_.get(), bt_broadphase_.get(),
-        bt_solver_.get(), bt_collision_config_.get());
+    if (multithreaded_physics) {
+      // The task scheduler is global in Bullet, and it has to be set from
+      // the main thread
+      physics_task_scheduler_ = make_unique<PhysicsTaskScheduler>(GetThreadPool());
+      btSetTaskScheduler(physics_task_scheduler_.get());
+
+      // The islands are solved in parallel, each by a solver of the pool
+      auto solver_pool = make_unique<btConstraintSolverPoolMt>(
+          physics_task_scheduler_->getMaxNumThreads());
+      bt_dispatcher_ = make_unique<btCollisionDispatcherMt>(bt_collision_config_.get());
+      bt_world_ = make_unique<btFastDestructableDynamicsWorld<btDiscreteDynamicsWorldMt>>(
+          bt_dispatcher_.get(), bt_broadphase_.get(),
+          solver_pool.get(), nullptr, bt_collision_config_.get());
+      bt_solver_ = std::move(solver_pool);
+    } else {
+      bt_dispatcher_ = make_unique<btCollisionDispatcher>(bt_collision_config_.get());
+      bt_solver_ = make_unique<btSequentialImpulseConstraintSolver>();
+      bt_world_ = make_unique<btFastDestructableDynamicsWorld<btDiscreteDynamicsWorld>>(
+          bt_dispatcher_.get(), bt_broadphase_.get(),
+          bt_solver_.get(), bt_collision_config_.get());
+    }
     bt_world_->setGravity(btVector3(0, -9.81, 0));
   }
+  physics_thread_ = make_unique<PhysicsThread>(bt_world_.get(), kPhysicsTimeStep,
+                                               engine_->GetPhysicsThreadPool());
 
-  GetShaderManager()->GetShader("Silice3D/lighting.frag")->SetUpdateFunc([this](const gl::Program& prog) {
-    static constexpr const size_t kMaxDirLightCount = 16;
-    static constexpr const size_t kMaxPointLightCount = 128;
-
-    size_t current_light_index = 0;
-    for (DirectionalLightSource* light : directional_light_sources_) {
-      if (current_light_index >= kMaxDirLightCount) {
-        break;
-      }
-
-      std::string uniform_name = "uDirectionalLights[" + std::to_string(current_light_index++) + "]";
-      gl::Uniform<glm::vec3>(prog, uniform_name + ".direction") = light->GetTransform().GetPos();
-      gl::Uniform<glm::vec3>(prog, uniform_name + ".color") = light->GetColor();
-      ShadowCaster* shadow_caster = light->GetShadowCaster();
-      if (shadow_caster == nullptr) {
-        gl::Uniform<int>(prog, uniform_name + ".cascades_count") = 0;
-      } else {
-        gl::Uniform<int>(prog, uniform_name + ".cascades_count") = shadow_caster->GetCascadesCount();
-        GLuint64 bindless_handle = shadow_caster->GetShadowTexture().bindless_handle();
-        static_assert(sizeof(GLuint64) == sizeof(glm::uvec2), "Expected 32 bit ints");
-        gl::Uniform<glm::uvec2>(prog, uniform_name + ".shadowMapId") = *reinterpret_cast<glm::uvec2*>(&bindless_handle);
-
-        for (int i = 0; i < shadow_caster->GetCascadesCount(); ++i) {
-          std::string shadow_cp_uniform_name = uniform_name + ".shadowCP[" + std::to_string(i) + "]";
-          gl::Uniform<glm::mat4>(prog, shadow_cp_uniform_name) = shadow_caster->GetProjectionMatrix(i) * shadow_caster->GetCameraMatrix(i);
-        }
-      }
-    }
-
-    current_light_index = 0;
-    for (PointLightSource* light : point_light_sources_) {
-      if (current_light_index >= kMaxPointLightCount) {
-        break;
-      }
-
-      std::string uniform_name = "uPointLights[" + std::to_string(current_light_index++) + "]";
-      gl::Uniform<glm::vec3>(prog, uniform_name + ".position") = light->GetTransform().GetPos();
-      gl::Uniform<glm::vec3>(prog, uniform_name + ".color") = light->GetColor();
-      gl::Uniform<glm::vec3>(prog, uniform_name + ".attenuation") = light->GetAttenuation();
-    }
-
-    gl::Uniform<int>(prog, "uDirectionalLightCount") = std::min(directional_light_sources_.size(), kMaxDirLightCount);
-    gl::Uniform<int>(prog, "uPointLightCount") = std::min(point_light_sources_.size(), kMaxPointLightCount);
-    gl::Uniform<glm::vec3>(prog, "w_uCamPos") = glm::vec3{GetScene()->GetCamera()->GetTransform().GetPos()};
-  });
+  frame_uniforms_ = make_unique<FrameUniforms>();
+  clustered_lighting_ = make_unique<ClusteredLighting>();
 }
 
 Scene::~Scene() {
   // Close the physics thread
-  physics_thread_should_quit_ = true;
-  physics_can_run_.Set();
-  physics_thread_.join();
+  physics_thread_->Stop();
+  interpolated_bodies_.clear();
 
   // Signal object's that they will be removed from the scene
-  dynamic_cast<btFastDestructableDynamicsWorld*>(bt_world_.get())->aboutToDestruct();
+  dynamic_cast<btFastDestructable*>(bt_world_.get())->aboutToDestruct();
   RemovedFromSceneRecursive();
+  // The removals of the bodies, on this thread
+  physics_thread_->RunQueuedCommands();
+
+  if (physics_task_scheduler_ && btGetTaskScheduler() == physics_task_scheduler_.get()) {
+    btSetTaskScheduler(btGetSequentialTaskScheduler());
+  }
 }
 
 GLFWwindow* Scene::GetWindow() const {
@@ -133,16 +125,96 @@ ShaderManager* Scene::GetShaderManager() const {
   return engine_->GetShaderManager();
 }
 
-void Scene::Turn() {
-  physics_finished_.WaitOne();
-  UpdatePhysicsRecursive();
-  physics_can_run_.Set();
+TextureManager* Scene::GetTextureManager() const {
+  return engine_->GetTextureManager();
+}
+
+ThreadPool* Scene::GetThreadPool() const {
+  return engine_->GetThreadPool();
+}
 
+void Scene::Turn() {
+  FinishMeshLoading();
   UpdateRecursive();
   RenderRecursive();
   Render2DRecursive();
 }
 
+void Scene::QueuePhysicsCommand(std::function<void()> command) {
+  physics_thread_->QueueCommand(std::move(command));
+}
+
+void Scene::SetPhysicsThreadCount(int value) {
+  if (physics_task_scheduler_) {
+    physics_task_scheduler_->setNumThreads(value);
+  }
+}
+
+int Scene::GetPhysicsThreadCount() const {
+  return physics_task_scheduler_ ? physics_task_scheduler_->GetThreadCount() : 1;
+}
+
+void Scene::AddRigidBody(BulletRigidBody* body, int group, int mask) {
+  rigid_bodies_[body->body_id_] = body;
+  btDynamicsWorld* world = bt_world_.get();
+  btRigidBody* rigid_body = body->GetBtRigidBody();
+  QueuePhysicsCommand([world, rigid_body, group, mask]() {
+    world->addRigidBody(rigid_body, group, mask);
+  });
+}
+
+void Scene::RemoveRigidBody(BulletRigidBody* body) {
+  rigid_bodies_.erase(body->body_id_);
+  interpolated_bodies_.erase(std::remove(interpolated_bodies_.begin(), interpolated_bodies_.end(),
+                                         body),
+                             interpolated_bodies_.end());
+
+  // The physics objects are destroyed on the physics thread, with the command
+  std::shared_ptr<BulletRigidBody::PhysicsObjects> physics_objects = std::move(body->physics_objects_);
+  if (physics_objects) {
+    btDynamicsWorld* world = bt_world_.get();
+    PhysicsThread* physics_thread = physics_thread_.get();
+    QueuePhysicsCommand([world, physics_thread, physics_objects]() {
+      world->removeCollisionObject(physics_objects->rigid_body.get());
+      physics_thread->RemoveBody(physics_objects->motion_state.get());
+    });
+  }
+}
+
+void Scene::SyncPhysics() {
+  const PhysicsThread::Snapshot* snapshot = physics_thread_->AcquireSnapshot();
+  if (snapshot != nullptr) {
+    // The bodies that aren't in the new snapshot have stopped moving
+    for (BulletRigidBody* body : interpolated_bodies_) {
+      body->previous_transform_ = body->current_transform_;
+      body->interpolation_alpha_ = 1.0f;
+      body->UpdatePhysics();
+    }
+    interpolated_bodies_.clear();
+
+    for (const PhysicsThread::BodyState& state : snapshot->bodies) {
+      auto iter = rigid_bodies_.find(state.body_id);
+      if (iter != rigid_bodies_.end()) {  // not removed since the snapshot
+        iter->second->previous_transform_ = state.previous;
+        iter->second->current_transform_ = state.current;
+        interpolated_bodies_.push_back(iter->second);
+      }
+    }
+    physics_snapshot_time_ = snapshot->time;
+    physics_step_time_ = snapshot->step_time;
+  }
+
+  // The latest snapshot can only contain the time of the previous Advance, so
+  // the bodies are rendered a step behind that, a frame behind the game time
+  double render_time = physics_advance_time_ - physics_thread_->GetTimeStep();
+  float interpolation_alpha = PhysicsThread::GetInterpolationAlpha(
+      render_time, physics_snapshot_time_, physics_thread_->GetTimeStep());
+  for (BulletRigidBody* body : interpolated_bodies_) {
+    body->interpolation_alpha_ = interpolation_alpha;
+    body->UpdatePhysics();
+  }
+}
+
 void Scene::RegisterLightSource(PointLightSource* light) {
   point_light_sources_.insert(light);
 }
@@ -167,16 +239,160 @@ size_t Scene::GetTriangleCount() {
   return sum_triangle_count;
 }
 
+size_t Scene::GetPendingMeshCount() const {
+  size_t pending_count = 0;
+  for (auto& pair : mesh_cache_) {
+    pending_count += !pair.second->IsReady();
+  }
+  return pending_count;
+}
+
+void Scene::FinishMeshLoading() {
+  size_t upload_count = 0;
+  for (auto& pair : mesh_cache_) {
+    if (mesh_upload_budget_ != 0 && upload_count >= mesh_upload_budget_) {
+      break;
+    }
+    if (!pair.second->IsReady() && pair.second->FinishLoading()) {
+      upload_count++;
+    }
+  }
+}
+
+void Scene::SetGpuCulling(bool value) {
+  if (value && !hi_z_buffer_) {
+    hi_z_buffer_ = make_unique<HiZBuffer>(GetShaderManager());
+  } else if (!value) {
+    hi_z_buffer_ = nullptr;
+  }
+}
+
+void Scene::SetDeferredShading(bool value) {
+  if (value && !deferred_shading_) {
+    deferred_shading_ = make_unique<DeferredShading>(GetShaderManager());
+  } else if (!value) {
+    deferred_shading_ = nullptr;
+  }
+}
+
+void Scene::SetSoftwareOcclusionCulling(bool value) {
+  if (value && !occlusion_culler_) {
+    occlusion_culler_ = make_unique<SoftwareOcclusionCuller>(GetThreadPool());
+  } else if (!value) {
+    occlusion_culler_ = nullptr;
+  }
+}
+
 void Scene::UpdateRecursive() {
   game_time_.Tick();
   environment_time_.Tick();
   camera_time_.Tick();
 
+  SyncPhysics();
   GameObject::UpdateRecursive();
+  // The commands of the update are handed over with the new time
+  physics_advance_time_ = game_time_.GetCurrentTime();
+  physics_thread_->Advance(physics_advance_time_);
+
+  // The MeshObjects only registered themselves during the update
+  if (occlusion_culler_ && camera_) {
+    occlusion_culler_->Cull(camera_->GetProjectionMatrix() * camera_->GetCameraMatrix());
+  }
+
+  CullVisibility();
+}
+
+void Scene::CullVisibility() {
+  visibility_cameras_.clear();
+  visibility_frustums_.clear();
+  if (!camera_) {
+    return;
+  }
+
+  visibility_cameras_.push_back(camera_);
+  for (DirectionalLightSource* light_source : directional_light_sources_) {
+    const ShadowCaster* shadow_caster = light_source->GetShadowCaster();
+    if (shadow_caster != nullptr) {
+      for (size_t i = 0; i < shadow_caster->GetCascadesCount(); ++i) {
+        visibility_cameras_.push_back(&shadow_caster->GetCascadeCamera(i));
+      }
+    }
+  }
+  for (const ICamera* camera : visibility_cameras_) {
+    visibility_frustums_.push_back(camera->GetFrustum());
+  }
+
+  for (auto& pair : mesh_cache_) {
+    pair.second->CullBatches(this);
+  }
+}
+
+PointLightShadows* Scene::GetPointLightShadows() {
+  if (!point_light_shadows_) {
+    point_light_shadows_ = make_unique<PointLightShadows>(this);
+  }
+  return point_light_shadows_.get();
+}
+
+int Scene::GetVisibilityView(const ICamera& camera) const {
+  for (size_t i = 0; i < visibility_cameras_.size(); ++i) {
+    if (visibility_cameras_[i] == &camera) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void Scene::RenderStaticShadowCasters(const ICamera& camera) {
+  depth_only_casters_ = ShadowCasters::kStatic;
+  for (auto& pair : mesh_cache_) {
+    pair.second->RenderDepthOnlyBatch(this, camera);
+  }
+  depth_only_casters_ = ShadowCasters::kAll;
+}
+
+void Scene::RenderDynamicShadowCasters(const ICamera& camera) {
+  depth_only_casters_ = ShadowCasters::kDynamic;
+  GameObject::RenderDepthOnlyRecursive(camera);
+  depth_only_casters_ = ShadowCasters::kAll;
+}
+
+void Scene::RenderLayeredShadowCasters(const std::vector<const ICamera*>& layer_cameras,
+                                       ShadowCasters casters) {
+  depth_only_casters_ = casters;
+  for (auto& pair : mesh_cache_) {
+    pair.second->RenderLayeredDepthOnlyBatch(this, layer_cameras);
+  }
+  depth_only_casters_ = ShadowCasters::kAll;
 }
 
 void Scene::RenderRecursive() {
   if (camera_) {
+    // The cameras and the lights are the same for every program
+    frame_uniforms_->UpdateCameras(visibility_cameras_);
+    frame_uniforms_->UpdateLights(directional_light_sources_);
+
+    // The point lights' shadows are rendered first, so the clusters know
+    // which of them have shadows in this frame
+    if (!point_light_shadows_) {
+      for (PointLightSource* light : point_light_sources_) {
+        if (light->GetCastsShadows()) {
+          GetPointLightShadows();
+          break;
+        }
+      }
+    }
+    if (point_light_shadows_) {
+      point_light_shadows_->Update(*camera_, point_light_sources_);
+      point_light_shadows_->Bind();
+    }
+
+    // The point lights are binned for the camera once per frame, and all the
+    // programs that use lighting.frag read the same buffers
+    clustered_lighting_->Update(*camera_, point_light_sources_, point_light_shadows_.get(),
+                                GetThreadPool());
+    clustered_lighting_->Bind();
+
     for (DirectionalLightSource* light_source : directional_light_sources_) {
       ShadowCaster* shadow_caster = light_source->GetShadowCaster();
       if (shadow_caster != nullptr) {
@@ -184,13 +400,32 @@ void Scene::RenderRecursive() {
       }
     }
 
-    gl::DepthFunc(gl::kLess);
-    gl::DrawBuffer(gl::kNone);  // don't write into the color buffer
-    GameObject::RenderDepthOnlyRecursive(*camera_);
-    // GameObject::RenderRecursive();
-    gl::DepthFunc(gl::kLequal);
-    gl::DrawBuffer(gl::kBack);
-    GameObject::RenderRecursive();
+    if (deferred_shading_) {
+      // The depth prepass and the mesh batches write the G-buffer, and the
+      // objects that aren't mesh batches are rendered forward after the
+      // lighting, which writes the G-buffer's depth into the default framebuffer
+      deferred_shading_->BeginDepthPrepass();
+      gl::DepthFunc(gl::kLess);
+      GameObject::RenderDepthOnlyRecursive(*camera_);
+      gl::DepthFunc(gl::kLequal);
+      deferred_shading_->BeginGeometryPass();
+      MeshObjectBatchRenderer::RenderBatches(this);
+      deferred_shading_->RenderLighting(this, *camera_, clustered_lighting_->GetLightSpheres());
+      GameObject::RenderRecursive();
+    } else {
+      gl::DepthFunc(gl::kLess);
+      gl::DrawBuffer(gl::kNone);  // don't write into the color buffer
+      GameObject::RenderDepthOnlyRecursive(*camera_);
+      // GameObject::RenderRecursive();
+      gl::DepthFunc(gl::kLequal);
+      gl::DrawBuffer(gl::kBack);
+      GameObject::RenderRecursive();
+    }
+
+    // The GPU culling of the next frame uses this frame's depth buffer
+    if (hi_z_buffer_) {
+      hi_z_buffer_->Build(camera_->GetProjectionMatrix() * camera_->GetCameraMatrix());
+    }
   }
 }
 
@@ -203,10 +438,4 @@ void Scene::Render2DRecursive() {
   GameObject::Render2DRecursive();
 }
 
-void Scene::UpdatePhysicsInBackgroundThread() {
-  if (bt_world_) {
-    bt_world_->stepSimulation(GetGameTime().GetDeltaTime(), 16, btScalar(1.0)/btScalar(60.0));
-  }
-}
-
 }  // namespace Silice3D
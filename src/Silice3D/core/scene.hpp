@@ -4,13 +4,15 @@
 #define SILICE3D_CORE_SCENE_HPP_
 
 #include <map>
+#include <string>
 #include <vector>
 #include <memory>
-#include <thread>
+#include <functional>
+#include <unordered_map>
 #include <btBulletDynamicsCommon.h>
 
 #include <Silice3D/common/timer.hpp>
-#include <Silice3D/common/auto_reset_event.hpp>
+#include <Silice3D/physics/physics_thread.hpp>
 #include <Silice3D/camera/icamera.hpp>
 #include <Silice3D/core/game_object.hpp>
 #include <Silice3D/lighting/point_light_source.hpp>
@@ -22,10 +24,27 @@ namespace Silice3D {
 class Scene;
 class GameEngine;
 class ShaderManager;
+class TextureManager;
+class ThreadPool;
+class HiZBuffer;
+class SoftwareOcclusionCuller;
+class ClusteredLighting;
+class DeferredShading;
+class PointLightShadows;
+class FrameUniforms;
+class BulletRigidBody;
+class PhysicsTaskScheduler;
 
 class Scene : public GameObject {
  public:
-  Scene(GameEngine* engine);
+  static constexpr size_t kDefaultMeshUploadBudget = 2;
+  static constexpr double kPhysicsTimeStep = 1.0 / 60.0;
+
+  // With multithreaded_physics, Bullet's multithreaded pipeline is used
+  // (btDiscreteDynamicsWorldMt), that runs the collision detection and the
+  // solving of the simulation islands on the ThreadPool. It's only worth it
+  // for a lot of interacting bodies.
+  Scene(GameEngine* engine, bool multithreaded_physics = false);
   ~Scene();
 
   virtual float GetGravity() const { return 9.81f; }
@@ -47,15 +66,124 @@ class Scene : public GameObject {
 
   ShaderManager* GetShaderManager() const;
 
+  TextureManager* GetTextureManager() const;
+
+  ThreadPool* GetThreadPool() const;
+
   GameEngine* GetEngine() const { return engine_; }
 
+  // The world is simulated on the physics thread, it can only be used from
+  // the physics commands.
   const btDynamicsWorld* GetBtWorld() const { return bt_world_.get(); }
   btDynamicsWorld* GetBtWorld() { return bt_world_.get(); }
 
+  // The physics runs on its own thread with a fixed time step, following the
+  // game time, but the frames never wait for it. The rigid bodies are
+  // rendered a frame and a step behind the game time, interpolated between
+  // the last two states of the simulation, and only the bodies that moved are
+  // synchronized.
+  PhysicsThread* GetPhysicsThread() { return physics_thread_.get(); }
+
+  bool GetMultithreadedPhysics() const { return physics_task_scheduler_ != nullptr; }
+  // How many threads a physics step uses (see PhysicsTaskScheduler), only
+  // with multithreaded physics.
+  void SetPhysicsThreadCount(int value);
+  int GetPhysicsThreadCount() const;
+  // The average time of the physics steps of the latest snapshot, in
+  // milliseconds.
+  double GetPhysicsStepTime() const { return physics_step_time_; }
+
+  // The command runs on the physics thread, before its next step, after the
+  // commands that were queued before it. The commands of a frame run together.
+  void QueuePhysicsCommand(std::function<void()> command);
+
+  // Destroys the object after the physics commands of this frame ran, for the
+  // objects that the physics might still use, like the shapes of the bodies
+  // that are removed in this frame.
+  template<typename T>
+  void DeleteAfterPhysicsCommands(std::unique_ptr<T>&& object) {
+    std::shared_ptr<T> shared_object{std::move(object)};
+    QueuePhysicsCommand([shared_object]() {});
+  }
+
+  // Used by the BulletRigidBodies, the world is changed by physics commands.
+  uint64_t GenerateRigidBodyId() { return next_rigid_body_id_++; }
+  void AddRigidBody(BulletRigidBody* body, int group, int mask);
+  void RemoveRigidBody(BulletRigidBody* body);
+
   MeshRendererCache* GetMeshCache() { return &mesh_cache_; }
 
   size_t GetTriangleCount();
 
+  // The MeshObjects created while this is enabled import and prepare their
+  // meshes on the ThreadPool, and aren't rendered until they are uploaded.
+  // At most GetMeshUploadBudget() meshes are uploaded in a frame (0 means
+  // unlimited).
+  void SetAsyncMeshLoading(bool value) { async_mesh_loading_ = value; }
+  bool GetAsyncMeshLoading() const { return async_mesh_loading_; }
+  void SetMeshUploadBudget(size_t value) { mesh_upload_budget_ = value; }
+  size_t GetMeshUploadBudget() const { return mesh_upload_budget_; }
+
+  // The number of mesh renderers that aren't ready yet.
+  size_t GetPendingMeshCount() const;
+
+  // The directory where the MeshObjects' collision shapes cache their BVHs.
+  // The directory has to exist. An empty string disables the cache.
+  void SetCollisionCacheDirectory(const std::string& directory) { collision_cache_directory_ = directory; }
+  const std::string& GetCollisionCacheDirectory() const { return collision_cache_directory_; }
+
+  // The MeshObjects created while this is enabled keep their transforms on the
+  // GPU, and are culled there against the frustum and the depth buffer of the
+  // previous frame (the Hi-Z buffer).
+  void SetGpuCulling(bool value);
+  bool GetGpuCulling() const { return hi_z_buffer_ != nullptr; }
+  const HiZBuffer* GetHiZBuffer() const { return hi_z_buffer_.get(); }
+
+  // Tests the visible MeshObjects against the occluder MeshObjects on the CPU
+  // before adding them to the render batches (see MeshObject::SetIsOccluder).
+  void SetSoftwareOcclusionCulling(bool value);
+  SoftwareOcclusionCuller* GetSoftwareOcclusionCuller() { return occlusion_culler_.get(); }
+  const SoftwareOcclusionCuller* GetSoftwareOcclusionCuller() const { return occlusion_culler_.get(); }
+
+  // The cameras of the frame (the main camera, and the cascades of the
+  // shadow casters), that the mesh batches are culled against at once, after
+  // the update. Returns the index of the camera's view, or -1 if the camera
+  // isn't one of them.
+  const std::vector<Frustum>& GetVisibilityFrustums() const { return visibility_frustums_; }
+  int GetVisibilityView(const ICamera& camera) const;
+
+  // Renders the mesh batches into a G-buffer, and lights them in screen space
+  // (see DeferredShading), instead of shading every fragment of them with
+  // every light that might reach it. The rest of the scene is still rendered
+  // forward, after the lighting.
+  void SetDeferredShading(bool value);
+  bool GetDeferredShading() const { return deferred_shading_ != nullptr; }
+
+  // The shadows of the point lights, in a shared shadow atlas. Created on the
+  // first call, or when a point light casts shadows first.
+  PointLightShadows* GetPointLightShadows();
+
+  // The uniform buffers of the cameras and the lights (see FrameUniforms).
+  FrameUniforms* GetFrameUniforms() { return frame_uniforms_.get(); }
+
+  // The shadow casters cache the depth of the static objects (see
+  // MeshObject::SetIsStatic), and only render the dynamic ones every frame.
+  // The version changes whenever a static caster is added, moved or removed.
+  uint64_t GetStaticShadowCastersVersion() const { return static_shadow_casters_version_; }
+  void InvalidateStaticShadowCasters() { static_shadow_casters_version_++; }
+
+  // Which casters the depth only passes render. Only the static ones are
+  // rendered through the mesh batches, without the rest of the scene graph.
+  enum class ShadowCasters { kAll, kStatic, kDynamic };
+  ShadowCasters GetDepthOnlyCasters() const { return depth_only_casters_; }
+  void RenderStaticShadowCasters(const ICamera& camera);
+  void RenderDynamicShadowCasters(const ICamera& camera);
+  // Renders the casters into every layer of the bound layered framebuffer at
+  // once (see IMeshObjectRenderer::RenderLayeredDepthOnlyBatch). Only the mesh
+  // batches are rendered, the RenderDepthOnly of the other objects isn't called.
+  void RenderLayeredShadowCasters(const std::vector<const ICamera*>& layer_cameras,
+                                  ShadowCasters casters);
+
   virtual void Turn();
 
   void RegisterLightSource(PointLightSource* light);
@@ -63,6 +191,7 @@ class Scene : public GameObject {
 
   void RegisterLightSource(DirectionalLightSource* light);
   void UnregisterLightSource(DirectionalLightSource* light);
+  size_t GetDirectionalLightCount() const { return directional_light_sources_.size(); }
 
  protected:
   ICamera* camera_;
@@ -71,28 +200,59 @@ class Scene : public GameObject {
 
   // Mesh loading
   MeshRendererCache mesh_cache_;
+  bool async_mesh_loading_ = false;
+  size_t mesh_upload_budget_ = kDefaultMeshUploadBudget;
+  std::string collision_cache_directory_;
+
+  // GPU culling
+  std::unique_ptr<HiZBuffer> hi_z_buffer_;
+  std::unique_ptr<SoftwareOcclusionCuller> occlusion_culler_;
+
+  // The views of the visibility stage
+  std::vector<const ICamera*> visibility_cameras_;
+  std::vector<Frustum> visibility_frustums_;
+  std::unique_ptr<FrameUniforms> frame_uniforms_;
 
   // Lighting
   std::set<PointLightSource*> point_light_sources_;
   std::set<DirectionalLightSource*> directional_light_sources_;
+  std::unique_ptr<ClusteredLighting> clustered_lighting_;
+  std::unique_ptr<PointLightShadows> point_light_shadows_;
+  std::unique_ptr<DeferredShading> deferred_shading_;
+  uint64_t static_shadow_casters_version_ = 0;
+  ShadowCasters depth_only_casters_ = ShadowCasters::kAll;
 
   // Bullet classes
+  std::unique_ptr<PhysicsTaskScheduler> physics_task_scheduler_;
   std::unique_ptr<btCollisionConfiguration> bt_collision_config_;
   std::unique_ptr<btDispatcher> bt_dispatcher_;
   std::unique_ptr<btBroadphaseInterface> bt_broadphase_;
   std::unique_ptr<btConstraintSolver> bt_solver_;
   std::unique_ptr<btDynamicsWorld> bt_world_;
 
-  // physics thread data
-  AutoResetEvent physics_can_run_{false}, physics_finished_{true};
-  bool physics_thread_should_quit_;
-  std::thread physics_thread_;
+  // Physics thread
+  std::unique_ptr<PhysicsThread> physics_thread_;
+  std::unordered_map<uint64_t, BulletRigidBody*> rigid_bodies_;
+  uint64_t next_rigid_body_id_ = 1;
+  // The bodies of the latest physics snapshot, that are interpolated
+  std::vector<BulletRigidBody*> interpolated_bodies_;
+  double physics_snapshot_time_ = 0.0;
+  // The time that the physics thread was last advanced to
+  double physics_advance_time_ = 0.0;
+  double physics_step_time_ = 0.0;
+
+  // Reads the latest physics snapshot, and interpolates the bodies that moved.
+  void SyncPhysics();
+
+  // Uploads the asynchronously loaded meshes that are ready, within the budget.
+  void FinishMeshLoading();
+
+  // Collects the views, and culls every mesh batch against all of them.
+  void CullVisibility();
 
   virtual void UpdateRecursive() override;
   virtual void RenderRecursive() override;
   virtual void Render2DRecursive() override;
-
-  virtual void UpdatePhysicsInBackgroundThread();
 };
 
 }  // namespace Silice3D
@@ -0,0 +1,346 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  // The AVX2 kernel is compiled with a target attribute and selected at
+  // runtime, so the rest of the engine doesn't need to be built for AVX2.
+  #include <immintrin.h>
+  #define SILICE3D_HAS_AVX2_KERNEL 1
+#endif
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/culling/frustum_culling.hpp>
+
+namespace Silice3D {
+
+void BoundingBoxArray::Clear() {
+  for (int axis = 0; axis < 3; ++axis) {
+    center_[axis].clear();
+    half_extent_[axis].clear();
+  }
+}
+
+void BoundingBoxArray::Reserve(size_t size) {
+  for (int axis = 0; axis < 3; ++axis) {
+    center_[axis].reserve(size);
+    half_extent_[axis].reserve(size);
+  }
+}
+
+void BoundingBoxArray::Add(const glm::vec3& center, const glm::vec3& half_extent) {
+  for (int axis = 0; axis < 3; ++axis) {
+    center_[axis].push_back(center[axis]);
+    half_extent_[axis].push_back(half_extent[axis]);
+  }
+}
+
+void BoundingBoxArray::Add(const BoundingBox& bbox) {
+  Add(glm::vec3(bbox.GetCenter()), glm::vec3(bbox.GetExtent() / 2.0));
+}
+
+void BoundingBoxArray::Add(const BoundingBox& model_space_bbox, const glm::mat4& transform) {
+  glm::vec3 center = glm::vec3(model_space_bbox.GetCenter());
+  glm::vec3 half_extent = glm::vec3(model_space_bbox.GetExtent() / 2.0);
+
+  // The extent of the transformed box along an axis is the sum of the
+  // projections of its transformed half axes.
+  glm::vec3 world_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+  glm::vec3 world_half_extent;
+  for (int axis = 0; axis < 3; ++axis) {
+    world_half_extent[axis] = std::abs(transform[0][axis]) * half_extent.x +
+                              std::abs(transform[1][axis]) * half_extent.y +
+                              std::abs(transform[2][axis]) * half_extent.z;
+  }
+  Add(world_center, world_half_extent);
+}
+
+BoundingBox BoundingBoxArray::Get(size_t index) const {
+  glm::dvec3 center{center_[0][index], center_[1][index], center_[2][index]};
+  glm::dvec3 half_extent{half_extent_[0][index], half_extent_[1][index], half_extent_[2][index]};
+  return BoundingBox{center - half_extent, center + half_extent};
+}
+
+namespace FrustumCulling {
+
+namespace {
+
+// The planes of the frustum in single precision
+struct FrustumPlanes {
+  float normal[3][6];
+  float abs_normal[3][6];
+  float dist[6];
+
+  explicit FrustumPlanes(const Frustum& frustum) {
+    for (int i = 0; i < 6; ++i) {
+      for (int axis = 0; axis < 3; ++axis) {
+        normal[axis][i] = frustum.planes[i].normal[axis];
+        abs_normal[axis][i] = std::abs(normal[axis][i]);
+      }
+      dist[i] = frustum.planes[i].dist;
+    }
+  }
+};
+
+// A box is outside, if it is fully behind any of the planes: the distance of
+// its center from the plane is less than minus its projected radius.
+// The kernels test the boxes in [begin, end) against every view, while their
+// data is loaded only once, and set the bits of the visible ones in the
+// views' masks. The SIMD kernels return the index of the first box that they
+// didn't process.
+void CullScalar(const FrustumPlanes* planes, size_t view_count, const BoundingBoxArray& boxes,
+                size_t begin, size_t end, uint64_t* const* masks) {
+  const float* cx = boxes.GetCenters(0);
+  const float* cy = boxes.GetCenters(1);
+  const float* cz = boxes.GetCenters(2);
+  const float* ex = boxes.GetHalfExtents(0);
+  const float* ey = boxes.GetHalfExtents(1);
+  const float* ez = boxes.GetHalfExtents(2);
+  for (size_t i = begin; i < end; ++i) {
+    for (size_t v = 0; v < view_count; ++v) {
+      const FrustumPlanes& view = planes[v];
+      bool visible = true;
+      for (int p = 0; p < 6 && visible; ++p) {
+        float d = cx[i] * view.normal[0][p] + cy[i] * view.normal[1][p] +
+                  cz[i] * view.normal[2][p] + view.dist[p];
+        float r = ex[i] * view.abs_normal[0][p] + ey[i] * view.abs_normal[1][p] +
+                  ez[i] * view.abs_normal[2][p];
+        visible = d + r >= 0.0f;
+      }
+      if (visible) {
+        masks[v][i / 64] |= uint64_t(1) << (i % 64);
+      }
+    }
+  }
+}
+
+#ifdef __SSE2__
+size_t CullSse2(const FrustumPlanes* planes, size_t view_count, const BoundingBoxArray& boxes,
+                size_t begin, size_t end, uint64_t* const* masks) {
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 cx = _mm_loadu_ps(boxes.GetCenters(0) + i);
+    __m128 cy = _mm_loadu_ps(boxes.GetCenters(1) + i);
+    __m128 cz = _mm_loadu_ps(boxes.GetCenters(2) + i);
+    __m128 ex = _mm_loadu_ps(boxes.GetHalfExtents(0) + i);
+    __m128 ey = _mm_loadu_ps(boxes.GetHalfExtents(1) + i);
+    __m128 ez = _mm_loadu_ps(boxes.GetHalfExtents(2) + i);
+
+    for (size_t v = 0; v < view_count; ++v) {
+      const FrustumPlanes& view = planes[v];
+      __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int p = 0; p < 6; ++p) {
+        __m128 d = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(view.normal[0][p])),
+                       _mm_mul_ps(cy, _mm_set1_ps(view.normal[1][p]))),
+            _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(view.normal[2][p])),
+                       _mm_set1_ps(view.dist[p])));
+        __m128 r = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(view.abs_normal[0][p])),
+                       _mm_mul_ps(ey, _mm_set1_ps(view.abs_normal[1][p]))),
+            _mm_mul_ps(ez, _mm_set1_ps(view.abs_normal[2][p])));
+        visible = _mm_and_ps(visible, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+      }
+
+      // i is a multiple of 4, so the bits don't straddle two words
+      masks[v][i / 64] |= uint64_t(_mm_movemask_ps(visible)) << (i % 64);
+    }
+  }
+  return i;
+}
+#endif
+
+#if SILICE3D_HAS_AVX2_KERNEL
+__attribute__((target("avx2")))
+size_t CullAvx2(const FrustumPlanes* planes, size_t view_count, const BoundingBoxArray& boxes,
+                size_t begin, size_t end, uint64_t* const* masks) {
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 cx = _mm256_loadu_ps(boxes.GetCenters(0) + i);
+    __m256 cy = _mm256_loadu_ps(boxes.GetCenters(1) + i);
+    __m256 cz = _mm256_loadu_ps(boxes.GetCenters(2) + i);
+    __m256 ex = _mm256_loadu_ps(boxes.GetHalfExtents(0) + i);
+    __m256 ey = _mm256_loadu_ps(boxes.GetHalfExtents(1) + i);
+    __m256 ez = _mm256_loadu_ps(boxes.GetHalfExtents(2) + i);
+
+    for (size_t v = 0; v < view_count; ++v) {
+      const FrustumPlanes& view = planes[v];
+      __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+      for (int p = 0; p < 6; ++p) {
+        __m256 d = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(view.normal[0][p])),
+                          _mm256_mul_ps(cy, _mm256_set1_ps(view.normal[1][p]))),
+            _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(view.normal[2][p])),
+                          _mm256_set1_ps(view.dist[p])));
+        __m256 r = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(view.abs_normal[0][p])),
+                          _mm256_mul_ps(ey, _mm256_set1_ps(view.abs_normal[1][p]))),
+            _mm256_mul_ps(ez, _mm256_set1_ps(view.abs_normal[2][p])));
+        visible = _mm256_and_ps(visible, _mm256_cmp_ps(_mm256_add_ps(d, r),
+                                                       _mm256_setzero_ps(), _CMP_GE_OQ));
+      }
+
+      // i is a multiple of 8, so the bits don't straddle two words
+      masks[v][i / 64] |= uint64_t(_mm256_movemask_ps(visible)) << (i % 64);
+    }
+  }
+  return i;
+}
+
+bool CpuSupportsAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+// begin has to be a multiple of 64
+void CullRange(const FrustumPlanes* planes, size_t view_count, const BoundingBoxArray& boxes,
+               size_t begin, size_t end, uint64_t* const* masks,
+               InstructionSet instruction_set) {
+  for (size_t v = 0; v < view_count; ++v) {
+    std::fill(masks[v] + begin / 64, masks[v] + (end + 63) / 64, 0);
+  }
+
+  size_t processed = begin;
+  switch (instruction_set) {
+#if SILICE3D_HAS_AVX2_KERNEL
+    case InstructionSet::kAvx2:
+      processed = CullAvx2(planes, view_count, boxes, begin, end, masks);
+      break;
+#endif
+#ifdef __SSE2__
+    case InstructionSet::kSse2:
+      processed = CullSse2(planes, view_count, boxes, begin, end, masks);
+      break;
+#endif
+    default:
+      break;
+  }
+  CullScalar(planes, view_count, boxes, processed, end, masks);
+}
+
+}  // namespace
+
+void CullToMask(const Frustum& frustum, const BoundingBoxArray& boxes,
+                std::vector<uint64_t>* visibility_mask) {
+  CullToMask(frustum, boxes, visibility_mask, GetInstructionSet());
+}
+
+void CullToMask(const Frustum& frustum, const BoundingBoxArray& boxes,
+                std::vector<uint64_t>* visibility_mask, InstructionSet instruction_set) {
+  size_t count = boxes.GetSize();
+  visibility_mask->resize((count + 63) / 64);
+  FrustumPlanes planes{frustum};
+  uint64_t* mask = visibility_mask->data();
+  CullRange(&planes, 1, boxes, 0, count, &mask, instruction_set);
+}
+
+void CullToMasks(const std::vector<Frustum>& frustums, const BoundingBoxArray& boxes,
+                 std::vector<std::vector<uint64_t>>* visibility_masks, ThreadPool* thread_pool) {
+  size_t count = boxes.GetSize();
+  std::vector<FrustumPlanes> planes;
+  std::vector<uint64_t*> masks;
+  visibility_masks->resize(frustums.size());
+  for (size_t v = 0; v < frustums.size(); ++v) {
+    planes.push_back(FrustumPlanes{frustums[v]});
+    (*visibility_masks)[v].resize((count + 63) / 64);
+    masks.push_back((*visibility_masks)[v].data());
+  }
+  if (count == 0 || frustums.empty()) {
+    return;
+  }
+
+  // The chunks don't share mask words, so they can be culled in parallel
+  InstructionSet instruction_set = GetInstructionSet();
+  size_t chunk_count = (count + kParallelChunkSize - 1) / kParallelChunkSize;
+  auto cull_chunk = [&](size_t chunk) {
+    size_t begin = chunk * kParallelChunkSize;
+    size_t end = std::min(begin + kParallelChunkSize, count);
+    CullRange(planes.data(), planes.size(), boxes, begin, end, masks.data(), instruction_set);
+  };
+  if (thread_pool != nullptr && chunk_count > 1) {
+    thread_pool->ParallelFor(chunk_count, cull_chunk);
+  } else {
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+      cull_chunk(chunk);
+    }
+  }
+}
+
+void CullToIndices(const Frustum& frustum, const BoundingBoxArray& boxes,
+                   std::vector<unsigned>* visible_indices) {
+  std::vector<uint64_t> visibility_mask;
+  CullToMask(frustum, boxes, &visibility_mask);
+  visible_indices->clear();
+  MaskToIndices(visibility_mask, boxes.GetSize(), visible_indices);
+}
+
+void MaskToIndices(const std::vector<uint64_t>& visibility_mask, size_t count,
+                   std::vector<unsigned>* visible_indices) {
+  for (size_t word_index = 0; word_index < visibility_mask.size(); ++word_index) {
+    uint64_t word = visibility_mask[word_index];
+    while (word != 0) {
+#ifdef __GNUC__
+      unsigned bit = __builtin_ctzll(word);
+#else
+      unsigned bit = 0;
+      while (((word >> bit) & 1) == 0) {
+        ++bit;
+      }
+#endif
+      size_t index = 64 * word_index + bit;
+      if (index >= count) {
+        break;
+      }
+      visible_indices->push_back(index);
+      word &= word - 1;  // clears the lowest set bit
+    }
+  }
+}
+
+InstructionSet GetInstructionSet() {
+  if (IsSupported(InstructionSet::kAvx2)) {
+    return InstructionSet::kAvx2;
+  } else if (IsSupported(InstructionSet::kSse2)) {
+    return InstructionSet::kSse2;
+  } else {
+    return InstructionSet::kScalar;
+  }
+}
+
+bool IsSupported(InstructionSet instruction_set) {
+  switch (instruction_set) {
+    case InstructionSet::kAvx2:
+#if SILICE3D_HAS_AVX2_KERNEL
+      return CpuSupportsAvx2();
+#else
+      return false;
+#endif
+    case InstructionSet::kSse2:
+#ifdef __SSE2__
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return true;
+  }
+}
+
+const char* GetName(InstructionSet instruction_set) {
+  switch (instruction_set) {
+    case InstructionSet::kAvx2:
+      return "AVX2";
+    case InstructionSet::kSse2:
+      return "SSE2";
+    default:
+      return "scalar";
+  }
+}
+
+}  // namespace FrustumCulling
+}  // namespace Silice3D
@@ -0,0 +1,86 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_CULLING_FRUSTUM_CULLING_HPP_
+#define SILICE3D_CULLING_FRUSTUM_CULLING_HPP_
+
+#include <vector>
+#include <cstdint>
+
+#include <Silice3D/common/glm.hpp>
+#include <Silice3D/collision/frustum.hpp>
+#include <Silice3D/collision/bounding_box.hpp>
+
+namespace Silice3D {
+
+class ThreadPool;
+
+// Axis aligned bounding boxes in a structure of arrays layout (their centers
+// and half extents, per coordinate), so they can be culled in batches.
+class BoundingBoxArray {
+ public:
+  size_t GetSize() const { return center_[0].size(); }
+  bool IsEmpty() const { return center_[0].empty(); }
+
+  void Clear();
+  void Reserve(size_t size);
+
+  void Add(const glm::vec3& center, const glm::vec3& half_extent);
+  void Add(const BoundingBox& bbox);
+  // Adds the world space bounds of a model space box transformed by the matrix.
+  void Add(const BoundingBox& model_space_bbox, const glm::mat4& transform);
+
+  BoundingBox Get(size_t index) const;
+
+  const float* GetCenters(int axis) const { return center_[axis].data(); }
+  const float* GetHalfExtents(int axis) const { return half_extent_[axis].data(); }
+
+ private:
+  std::vector<float> center_[3];
+  std::vector<float> half_extent_[3];
+};
+
+// Tests lots of boxes against a frustum with SIMD: 8 boxes at once with AVX2
+// (if the CPU supports it), 4 with SSE2, or one by one on other platforms.
+namespace FrustumCulling {
+
+enum class InstructionSet { kScalar, kSse2, kAvx2 };
+
+// Sets the (i % 64)th bit of (*visibility_mask)[i / 64] if the ith box
+// intersects the frustum, the others are cleared.
+void CullToMask(const Frustum& frustum, const BoundingBoxArray& boxes,
+                std::vector<uint64_t>* visibility_mask);
+
+// Culls the boxes against several frustums in one pass (loading each box
+// once), and writes a mask per frustum, like CullToMask. The boxes are split
+// into chunks between the thread pool's workers, if it isn't nullptr.
+void CullToMasks(const std::vector<Frustum>& frustums, const BoundingBoxArray& boxes,
+                 std::vector<std::vector<uint64_t>>* visibility_masks,
+                 ThreadPool* thread_pool = nullptr);
+
+// The number of boxes per parallel task in CullToMasks (a multiple of 64).
+constexpr size_t kParallelChunkSize = 4096;
+
+// Writes the indices of the boxes that intersect the frustum, in increasing order.
+void CullToIndices(const Frustum& frustum, const BoundingBoxArray& boxes,
+                   std::vector<unsigned>* visible_indices);
+
+// Appends the indices of the set bits of the mask (that are less than count).
+void MaskToIndices(const std::vector<uint64_t>& visibility_mask, size_t count,
+                   std::vector<unsigned>* visible_indices);
+
+// The kernel that the functions above use: the best one that is both
+// compiled in and supported by the CPU.
+InstructionSet GetInstructionSet();
+bool IsSupported(InstructionSet instruction_set);
+// "AVX2", "SSE2" or "scalar".
+const char* GetName(InstructionSet instruction_set);
+
+// CullToMask with the given kernel, which has to be supported, for comparing
+// the kernels in the tests and the benchmarks.
+void CullToMask(const Frustum& frustum, const BoundingBoxArray& boxes,
+                std::vector<uint64_t>* visibility_mask, InstructionSet instruction_set);
+
+}  // namespace FrustumCulling
+}  // namespace Silice3D
+
+#endif  // SILICE3D_CULLING_FRUSTUM_CULLING_HPP_
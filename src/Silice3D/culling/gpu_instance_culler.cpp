@@ -0,0 +1,244 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <string>
+#include <algorithm>
+
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/core/game_object.hpp>
+#include <Silice3D/camera/icamera.hpp>
+#include <Silice3D/culling/hi_z_buffer.hpp>
+#include <Silice3D/culling/gpu_instance_culler.hpp>
+#include <Silice3D/shaders/shader_manager.hpp>
+
+namespace Silice3D {
+
+static constexpr GLuint kInstanceActiveBit = 0x80000000u;  // see culling.comp
+static constexpr size_t kCullingWorkGroupSize = 64;
+static constexpr size_t kMinCapacity = 64;
+
+GpuInstanceCuller::GpuInstanceCuller(ShaderManager* shader_manager)
+    : cull_prog_(*shader_manager->GetProgram({"Silice3D/culling.comp"}))
+    , commands_prog_(*shader_manager->GetProgram({"Silice3D/culling_commands.comp"}))
+    , cp_uInstanceCount_(cull_prog_, "uInstanceCount")
+    , cp_uOutputCapacity_(cull_prog_, "uOutputCapacity")
+    , cp_uBoundingBoxMin_(cull_prog_, "uBoundingBoxMin")
+    , cp_uBoundingBoxMax_(cull_prog_, "uBoundingBoxMax")
+    , cp_uLodCameraPos_(cull_prog_, "uLodCameraPos")
+    , cp_uLodProjectionScale_(cull_prog_, "uLodProjectionScale")
+    , cp_uLodBias_(cull_prog_, "uLodBias")
+    , cp_uLodTransitionSize_(cull_prog_, "uLodTransitionSize")
+    , cp_uLodHysteresis_(cull_prog_, "uLodHysteresis")
+    , cp_uLodCount_(cull_prog_, "uLodCount")
+    , cp_uShadowPass_(cull_prog_, "uShadowPass")
+    , cp_uUseHiZ_(cull_prog_, "uUseHiZ")
+    , cp_uHiZViewProjection_(cull_prog_, "uHiZViewProjection")
+    , cp_uHiZSize_(cull_prog_, "uHiZSize")
+    , cp_uHiZLevelCount_(cull_prog_, "uHiZLevelCount")
+    , cmp_uCommandCount_(commands_prog_, "uCommandCount") {
+  for (int i = 0; i < 6; ++i) {
+    cp_uFrustumPlanes_[i] = make_unique<gl::LazyUniform<glm::vec4>>(
+        cull_prog_, "uFrustumPlanes[" + std::to_string(i) + "]");
+  }
+
+  gl::Use(cull_prog_);
+  gl::UniformSampler(cull_prog_, "uHiZ") = kHiZTextureSlot;
+  gl::Unuse(cull_prog_);
+}
+
+unsigned GpuInstanceCuller::AddInstance(const glm::mat4& transform) {
+  unsigned id;
+  if (!free_ids_.empty()) {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+    transforms_[id] = MeshRenderer::toAffineInstance(transform);
+    states_[id] = kInstanceActiveBit;
+    dirty_state_ids_.push_back(id);
+  } else {
+    id = transforms_.size();
+    transforms_.push_back(MeshRenderer::toAffineInstance(transform));
+    states_.push_back(kInstanceActiveBit);
+    dirty_state_ids_.push_back(id);
+  }
+  dirty_ids_.push_back(id);
+  return id;
+}
+
+void GpuInstanceCuller::UpdateInstance(unsigned id, const glm::mat4& transform) {
+  transforms_[id] = MeshRenderer::toAffineInstance(transform);
+  dirty_ids_.push_back(id);
+}
+
+void GpuInstanceCuller::RemoveInstance(unsigned id) {
+  states_[id] = 0;
+  free_ids_.push_back(id);
+  dirty_state_ids_.push_back(id);
+}
+
+void GpuInstanceCuller::SetDrawCommands(
+    const std::vector<std::vector<MeshRenderer::DrawElementsIndirectCommand>>& lod_commands) {
+  lod_commands_ = lod_commands;
+  commands_changed_ = true;
+}
+
+void GpuInstanceCuller::Reserve(size_t capacity) {
+  if (capacity <= capacity_) {
+    return;
+  }
+  size_t new_capacity = std::max(kMinCapacity, std::max(capacity, 2*capacity_));
+
+  // The old content is copied, so the levels of detail selected by the GPU are kept
+  auto realloc_buffer = [](gl::ArrayBuffer& buffer, size_t old_size, size_t new_size) {
+    gl::ArrayBuffer new_buffer;
+    gl::Bind(new_buffer);
+    new_buffer.data(new_size, nullptr, gl::kDynamicDraw);
+    gl::Unbind(new_buffer);
+    if (old_size > 0) {
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer.expose());
+      glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer.expose());
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+    }
+    buffer = std::move(new_buffer);
+  };
+
+  realloc_buffer(instance_buffer_, capacity_ * sizeof(MeshRenderer::AffineInstance),
+                 new_capacity * sizeof(MeshRenderer::AffineInstance));
+  realloc_buffer(instance_state_buffer_, capacity_ * sizeof(GLuint),
+                 new_capacity * sizeof(GLuint));
+
+  capacity_ = new_capacity;
+  commands_changed_ = true;  // the output regions moved
+}
+
+void GpuInstanceCuller::UploadChanges() {
+  Reserve(transforms_.size());
+
+  std::sort(dirty_ids_.begin(), dirty_ids_.end());
+  dirty_ids_.erase(std::unique(dirty_ids_.begin(), dirty_ids_.end()), dirty_ids_.end());
+
+  // Upload the consecutive runs of changed instances together
+  gl::Bind(instance_buffer_);
+  for (size_t begin = 0; begin < dirty_ids_.size(); ) {
+    size_t end = begin + 1;
+    while (end < dirty_ids_.size() && dirty_ids_[end] == dirty_ids_[end-1] + 1) {
+      ++end;
+    }
+    unsigned first_id = dirty_ids_[begin];
+    size_t count = end - begin;
+    instance_buffer_.subData(first_id * sizeof(MeshRenderer::AffineInstance),
+                             count * sizeof(MeshRenderer::AffineInstance),
+                             &transforms_[first_id]);
+    begin = end;
+  }
+  gl::Unbind(instance_buffer_);
+  dirty_ids_.clear();
+
+  // Resets the level of detail of the added instances too
+  gl::Bind(instance_state_buffer_);
+  for (unsigned id : dirty_state_ids_) {
+    instance_state_buffer_.subData(id * sizeof(GLuint), sizeof(GLuint), &states_[id]);
+  }
+  gl::Unbind(instance_state_buffer_);
+  dirty_state_ids_.clear();
+}
+
+void GpuInstanceCuller::UploadCommands() {
+  // Every level of detail has its own region of capacity_ instances in the
+  // output buffer, the commands select them with their base instance.
+  std::vector<MeshRenderer::DrawElementsIndirectCommand> commands;
+  std::vector<GLuint> command_lods;
+  for (size_t level = 0; level < lod_commands_.size(); ++level) {
+    for (MeshRenderer::DrawElementsIndirectCommand command : lod_commands_[level]) {
+      command.instance_count = 0;
+      command.base_instance = level * capacity_;
+      commands.push_back(command);
+      command_lods.push_back(level);
+    }
+  }
+  command_count_ = commands.size();
+
+  gl::Bind(command_buffer_);
+  command_buffer_.data(commands, gl::kDynamicCopy);
+  gl::Bind(command_lod_buffer_);
+  command_lod_buffer_.data(command_lods, gl::kStaticDraw);
+
+  std::vector<GLuint> lod_counts(std::max<size_t>(lod_commands_.size(), 1), 0);
+  gl::Bind(lod_count_buffer_);
+  lod_count_buffer_.data(lod_counts, gl::kDynamicCopy);
+
+  gl::Bind(output_buffer_);
+  output_buffer_.data(lod_counts.size() * capacity_ * sizeof(MeshRenderer::AffineInstance),
+                      nullptr, gl::kDynamicCopy);
+  gl::Unbind(output_buffer_);
+
+  commands_changed_ = false;
+}
+
+void GpuInstanceCuller::Cull(const ICamera& camera, const HiZBuffer* hi_z_buffer,
+                             const BoundingBox& model_space_bbox, const LodParameters& lod,
+                             bool shadow_pass) {
+  UploadChanges();
+  if (commands_changed_) {
+    UploadCommands();
+  }
+
+  GLuint zero = 0;
+  glClearNamedBufferData(lod_count_buffer_.expose(), GL_R32UI, GL_RED_INTEGER,
+                         GL_UNSIGNED_INT, &zero);
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kInstanceBufferBinding, instance_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kInstanceStateBufferBinding, instance_state_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kOutputBufferBinding, output_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kLodCountBufferBinding, lod_count_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCommandBufferBinding, command_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCommandLodBufferBinding, command_lod_buffer_.expose());
+
+  gl::Use(cull_prog_);
+  cp_uInstanceCount_.set(transforms_.size());
+  cp_uOutputCapacity_.set(capacity_);
+  cp_uBoundingBoxMin_.set(glm::vec3(model_space_bbox.GetMins()));
+  cp_uBoundingBoxMax_.set(glm::vec3(model_space_bbox.GetMaxes()));
+
+  const Frustum& frustum = camera.GetFrustum();
+  for (int i = 0; i < 6; ++i) {
+    const Plane& plane = frustum.planes[i];
+    cp_uFrustumPlanes_[i]->set(glm::vec4(glm::vec3(plane.normal), plane.dist));
+  }
+
+  cp_uLodCameraPos_.set(lod.camera_pos);
+  cp_uLodProjectionScale_.set(lod.projection_scale);
+  cp_uLodBias_.set(lod.bias);
+  cp_uLodTransitionSize_.set(lod.transition_size);
+  cp_uLodHysteresis_.set(lod.hysteresis);
+  cp_uLodCount_.set(std::max<size_t>(lod_commands_.size(), 1));
+  cp_uShadowPass_.set(shadow_pass);
+
+  bool use_hi_z = hi_z_buffer != nullptr && hi_z_buffer->IsValid();
+  cp_uUseHiZ_.set(use_hi_z);
+  if (use_hi_z) {
+    gl::BindToTexUnit(hi_z_buffer->GetTexture(), kHiZTextureSlot);
+    cp_uHiZViewProjection_.set(hi_z_buffer->GetViewProjectionMatrix());
+    cp_uHiZSize_.set(glm::vec2(hi_z_buffer->GetSize()));
+    cp_uHiZLevelCount_.set(hi_z_buffer->GetLevelCount());
+  }
+
+  if (!transforms_.empty()) {
+    glDispatchCompute((transforms_.size() + kCullingWorkGroupSize - 1) / kCullingWorkGroupSize, 1, 1);
+  }
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  gl::Use(commands_prog_);
+  cmp_uCommandCount_.set(command_count_);
+  glDispatchCompute(1, 1, 1);
+
+  // The results are consumed as indirect commands and instanced attributes
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                  GL_SHADER_STORAGE_BARRIER_BIT);
+
+  if (use_hi_z) {
+    glBindTextureUnit(kHiZTextureSlot, 0);
+  }
+  gl::Unuse(commands_prog_);
+}
+
+}  // namespace Silice3D
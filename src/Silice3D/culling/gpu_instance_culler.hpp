@@ -0,0 +1,111 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_CULLING_GPU_INSTANCE_CULLER_HPP_
+#define SILICE3D_CULLING_GPU_INSTANCE_CULLER_HPP_
+
+#include <memory>
+#include <vector>
+
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/collision/bounding_box.hpp>
+#include <Silice3D/mesh/mesh_renderer.hpp>
+#include <Silice3D/shaders/shader_program.hpp>
+
+namespace Silice3D {
+
+class ICamera;
+class HiZBuffer;
+class ShaderManager;
+
+// Keeps the transforms of a mesh's instances on the GPU, and culls them with
+// compute shaders (culling.comp and culling_commands.comp) against a camera's
+// frustum and optionally a Hi-Z buffer. The visible instances' transforms
+// (in MeshRenderer's affine instance format) are compacted into an output
+// buffer, grouped by their level of detail, and the instance counts are
+// written directly into the indirect draw commands, so nothing has to be read
+// back to the CPU.
+// Only the transforms that changed since the last cull are uploaded.
+class GpuInstanceCuller {
+ public:
+  // The shader storage buffer bindings used by the compute shaders
+  static constexpr GLuint kInstanceBufferBinding = 0;
+  static constexpr GLuint kInstanceStateBufferBinding = 1;
+  static constexpr GLuint kOutputBufferBinding = 2;
+  static constexpr GLuint kLodCountBufferBinding = 3;
+  static constexpr GLuint kCommandBufferBinding = 4;
+  static constexpr GLuint kCommandLodBufferBinding = 5;
+
+  // The level of detail selection of MeshObjectRenderer, evaluated on the GPU.
+  struct LodParameters {
+    glm::vec3 camera_pos;
+    float projection_scale = 1.0f;  // 1 / tan(fovy / 2)
+    float bias = 1.0f;
+    float transition_size = 0.0f;
+    float hysteresis = 0.0f;
+  };
+
+  explicit GpuInstanceCuller(ShaderManager* shader_manager);
+
+  // Returns the id of the new instance.
+  unsigned AddInstance(const glm::mat4& transform);
+  void UpdateInstance(unsigned id, const glm::mat4& transform);
+  void RemoveInstance(unsigned id);
+
+  size_t GetInstanceCount() const { return transforms_.size() - free_ids_.size(); }
+
+  // Sets up the draw commands of the levels of detail, see MeshRenderer::lodDrawCommands.
+  void SetDrawCommands(
+      const std::vector<std::vector<MeshRenderer::DrawElementsIndirectCommand>>& lod_commands);
+
+  // Writes the transforms of the visible instances into GetOutputBuffer(),
+  // and their count into the commands of GetCommandBuffer().
+  // The hi_z_buffer may be nullptr, it has to be built with the same camera.
+  void Cull(const ICamera& camera, const HiZBuffer* hi_z_buffer,
+            const BoundingBox& model_space_bbox, const LodParameters& lod,
+            bool shadow_pass);
+
+  const gl::ArrayBuffer& GetOutputBuffer() const { return output_buffer_; }
+  const gl::ArrayBuffer& GetCommandBuffer() const { return command_buffer_; }
+  size_t GetCommandCount() const { return command_count_; }
+
+ private:
+  // Shared by the cullers (see ShaderManager::GetProgram)
+  ShaderProgram& cull_prog_;
+  ShaderProgram& commands_prog_;
+
+  gl::LazyUniform<int> cp_uInstanceCount_, cp_uOutputCapacity_;
+  gl::LazyUniform<glm::vec3> cp_uBoundingBoxMin_, cp_uBoundingBoxMax_;
+  std::unique_ptr<gl::LazyUniform<glm::vec4>> cp_uFrustumPlanes_[6];
+  gl::LazyUniform<glm::vec3> cp_uLodCameraPos_;
+  gl::LazyUniform<float> cp_uLodProjectionScale_, cp_uLodBias_;
+  gl::LazyUniform<float> cp_uLodTransitionSize_, cp_uLodHysteresis_;
+  gl::LazyUniform<int> cp_uLodCount_, cp_uShadowPass_, cp_uUseHiZ_;
+  gl::LazyUniform<glm::mat4> cp_uHiZViewProjection_;
+  gl::LazyUniform<glm::vec2> cp_uHiZSize_;
+  gl::LazyUniform<int> cp_uHiZLevelCount_;
+  gl::LazyUniform<int> cmp_uCommandCount_;
+
+  gl::ArrayBuffer instance_buffer_, instance_state_buffer_, output_buffer_;
+  gl::ArrayBuffer lod_count_buffer_, command_buffer_, command_lod_buffer_;
+
+  // CPU side copies of the instances, and the ones that have to be uploaded
+  std::vector<MeshRenderer::AffineInstance> transforms_;
+  std::vector<GLuint> states_;
+  std::vector<unsigned> free_ids_;
+  std::vector<unsigned> dirty_ids_;
+  std::vector<unsigned> dirty_state_ids_;
+
+  std::vector<std::vector<MeshRenderer::DrawElementsIndirectCommand>> lod_commands_;
+  size_t command_count_ = 0;
+  bool commands_changed_ = false;
+
+  size_t capacity_ = 0;
+
+  void Reserve(size_t capacity);
+  void UploadChanges();
+  void UploadCommands();
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_CULLING_GPU_INSTANCE_CULLER_HPP_
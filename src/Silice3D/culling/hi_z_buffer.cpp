@@ -0,0 +1,91 @@
+// Copyright (c) Tamas Csala
+
+#include <algorithm>
+
+#include <Silice3D/core/game_object.hpp>
+#include <Silice3D/culling/hi_z_buffer.hpp>
+#include <Silice3D/shaders/shader_manager.hpp>
+
+namespace Silice3D {
+
+static constexpr int kHiZWorkGroupSize = 8;  // see hi_z.comp
+
+HiZBuffer::HiZBuffer(ShaderManager* shader_manager)
+    : downsample_prog_(*shader_manager->GetProgram({"Silice3D/hi_z.comp"})) {
+  gl::Use(downsample_prog_);
+  gl::UniformSampler(downsample_prog_, "uSource") = kHiZTextureSlot;
+  gl::Unuse(downsample_prog_);
+}
+
+void HiZBuffer::Resize(int width, int height) {
+  width_ = width;
+  height_ = height;
+  level_count_ = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    level_count_++;
+  }
+
+  // The textures are recreated, because the immutable storage can't be resized
+  depth_texture_ = gl::Texture2D{};
+  gl::Bind(depth_texture_);
+  glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+  depth_texture_.minFilter(gl::kNearest);
+  depth_texture_.magFilter(gl::kNearest);
+  gl::Unbind(depth_texture_);
+
+  hi_z_texture_ = gl::Texture2D{};
+  gl::Bind(hi_z_texture_);
+  glTexStorage2D(GL_TEXTURE_2D, level_count_, GL_R32F, width, height);
+  hi_z_texture_.minFilter(gl::kNearestMipmapNearest);
+  hi_z_texture_.magFilter(gl::kNearest);
+  hi_z_texture_.wrapS(gl::kClampToEdge);
+  hi_z_texture_.wrapT(gl::kClampToEdge);
+  gl::Unbind(hi_z_texture_);
+}
+
+void HiZBuffer::Build(const glm::mat4& view_projection_matrix) {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (viewport[2] <= 0 || viewport[3] <= 0) {
+    return;
+  }
+  if (viewport[2] != width_ || viewport[3] != height_) {
+    Resize(viewport[2], viewport[3]);
+  }
+  view_projection_matrix_ = view_projection_matrix;
+
+  gl::Bind(depth_texture_);
+  glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, viewport[0], viewport[1], width_, height_);
+  gl::Unbind(depth_texture_);
+
+  gl::Use(downsample_prog_);
+  int src_width = width_, src_height = height_;
+  for (int level = 0; level < level_count_; ++level) {
+    // Level 0 is a copy of the depth texture, the rest are reduced from the previous level
+    if (level == 0) {
+      gl::BindToTexUnit(depth_texture_, kHiZTextureSlot);
+    } else {
+      gl::BindToTexUnit(hi_z_texture_, kHiZTextureSlot);
+    }
+    int dst_width = std::max(level == 0 ? src_width : src_width / 2, 1);
+    int dst_height = std::max(level == 0 ? src_height : src_height / 2, 1);
+
+    gl::Uniform<int>(downsample_prog_, "uSourceLevel") = std::max(level - 1, 0);
+    gl::Uniform<glm::ivec2>(downsample_prog_, "uSourceSize") = glm::ivec2(src_width, src_height);
+    gl::Uniform<glm::ivec2>(downsample_prog_, "uDestinationSize") = glm::ivec2(dst_width, dst_height);
+    glBindImageTexture(0, hi_z_texture_.expose(), level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+    glDispatchCompute((dst_width + kHiZWorkGroupSize - 1) / kHiZWorkGroupSize,
+                      (dst_height + kHiZWorkGroupSize - 1) / kHiZWorkGroupSize, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    src_width = dst_width;
+    src_height = dst_height;
+  }
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glBindTextureUnit(kHiZTextureSlot, 0);
+  gl::Unuse(downsample_prog_);
+}
+
+}  // namespace Silice3D
@@ -0,0 +1,46 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_CULLING_HI_Z_BUFFER_HPP_
+#define SILICE3D_CULLING_HI_Z_BUFFER_HPP_
+
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/shaders/shader_program.hpp>
+
+namespace Silice3D {
+
+class ShaderManager;
+
+// A hierarchical depth buffer: a mip chain of the depth buffer, where every
+// texel of a level contains the farthest depth of the texels it covers.
+// It is built from the depth buffer of the rendered frame, and used by the
+// next frame's occlusion culling, together with the view-projection matrix
+// the depth buffer was rendered with.
+class HiZBuffer {
+ public:
+  explicit HiZBuffer(ShaderManager* shader_manager);
+
+  // Copies the depth buffer of the current read framebuffer (with the size of
+  // the viewport), and builds the pyramid from it with compute shaders.
+  void Build(const glm::mat4& view_projection_matrix);
+
+  // Returns false until the first Build call.
+  bool IsValid() const { return level_count_ > 0; }
+
+  const gl::Texture2D& GetTexture() const { return hi_z_texture_; }
+  const glm::mat4& GetViewProjectionMatrix() const { return view_projection_matrix_; }
+  glm::ivec2 GetSize() const { return glm::ivec2(width_, height_); }
+  int GetLevelCount() const { return level_count_; }
+
+ private:
+  gl::Texture2D depth_texture_;
+  gl::Texture2D hi_z_texture_;
+  ShaderProgram& downsample_prog_;
+  glm::mat4 view_projection_matrix_;
+  int width_ = 0, height_ = 0, level_count_ = 0;
+
+  void Resize(int width, int height);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_CULLING_HI_Z_BUFFER_HPP_
@@ -0,0 +1,351 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/culling/software_occlusion_culler.hpp>
+
+namespace Silice3D {
+
+// The number of occludees tested by a single task
+static constexpr size_t kOccludeeBatchSize = 256;
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+  return duration.count();
+}
+
+static int RoundUpToTileSize(int value) {
+  int tile_size = SoftwareOcclusionCuller::kTileSize;
+  return std::max((value + tile_size - 1) / tile_size, 1) * tile_size;
+}
+
+SoftwareOcclusionCuller::SoftwareOcclusionCuller(ThreadPool* thread_pool,
+                                                 int width, int height)
+    : thread_pool_(thread_pool)
+    , width_(RoundUpToTileSize(width))
+    , height_(RoundUpToTileSize(height))
+    , tile_count_x_(width_ / kTileSize)
+    , tile_count_y_(height_ / kTileSize)
+    , depth_buffer_(width_ * height_, 1.0f)
+    , tile_max_depths_(tile_count_x_ * tile_count_y_, 1.0f) {
+  // Every band is a row of tiles, so the bands can compute their tiles' depths
+  band_height_ = kTileSize;
+  band_count_ = tile_count_y_;
+}
+
+void SoftwareOcclusionCuller::AddOccluder(const OccluderMesh* mesh,
+                                          const glm::mat4& model_matrix) {
+  occluders_.push_back(Occluder{mesh, model_matrix});
+}
+
+void SoftwareOcclusionCuller::AddOccludee(const BoundingBox& world_space_bbox,
+                                          const std::function<void()>& on_visible) {
+  occludees_.push_back(Occludee{world_space_bbox, on_visible});
+}
+
+void SoftwareOcclusionCuller::Cull(const glm::mat4& view_projection_matrix) {
+  statistics_ = Statistics{};
+  statistics_.occluder_count = occluders_.size();
+  statistics_.tested_count = occludees_.size();
+  view_projection_matrix_ = view_projection_matrix;
+
+  auto raster_start = std::chrono::steady_clock::now();
+  screen_triangles_.resize(occluders_.size());
+  thread_pool_->ParallelFor(occluders_.size(), [this](size_t i) { SetupTriangles(i); });
+  for (size_t i = 0; i < occluders_.size(); ++i) {
+    statistics_.occluder_triangle_count += screen_triangles_[i].size();
+  }
+  thread_pool_->ParallelFor(band_count_, [this](size_t band) { RasterizeBand(band); });
+  statistics_.rasterization_time = MillisecondsSince(raster_start);
+
+  auto test_start = std::chrono::steady_clock::now();
+  occludee_visibility_.resize(occludees_.size());
+  size_t batch_count = (occludees_.size() + kOccludeeBatchSize - 1) / kOccludeeBatchSize;
+  thread_pool_->ParallelFor(batch_count, [this](size_t batch) {
+    size_t end = std::min((batch + 1) * kOccludeeBatchSize, occludees_.size());
+    for (size_t i = batch * kOccludeeBatchSize; i < end; ++i) {
+      occludee_visibility_[i] = !IsOccluded(occludees_[i].bbox);
+    }
+  });
+  statistics_.test_time = MillisecondsSince(test_start);
+
+  // The callbacks aren't thread safe (they add to the render batches)
+  for (size_t i = 0; i < occludees_.size(); ++i) {
+    if (occludee_visibility_[i]) {
+      occludees_[i].on_visible();
+    } else {
+      statistics_.culled_count++;
+    }
+  }
+
+  occluders_.clear();
+  occludees_.clear();
+}
+
+void SoftwareOcclusionCuller::SetupTriangles(size_t occluder_index) {
+  const Occluder& occluder = occluders_[occluder_index];
+  const OccluderMesh& mesh = *occluder.mesh;
+  std::vector<ScreenTriangle>& triangles = screen_triangles_[occluder_index];
+  triangles.clear();
+
+  glm::mat4 mvp = view_projection_matrix_ * occluder.model_matrix;
+  std::vector<glm::vec4> clip_positions(mesh.positions.size());
+  for (size_t i = 0; i < mesh.positions.size(); ++i) {
+    clip_positions[i] = mvp * glm::vec4(mesh.positions[i], 1.0f);
+  }
+
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+    const glm::vec4* vertices[3] = {&clip_positions[mesh.indices[i]],
+                                    &clip_positions[mesh.indices[i+1]],
+                                    &clip_positions[mesh.indices[i+2]]};
+
+    // Clips the triangle against the near plane (z >= 0 in clip space)
+    glm::vec4 polygon[4];
+    int polygon_size = 0;
+    for (int v = 0; v < 3; ++v) {
+      const glm::vec4& current = *vertices[v];
+      const glm::vec4& next = *vertices[(v + 1) % 3];
+      if (current.z >= 0.0f) {
+        polygon[polygon_size++] = current;
+      }
+      if ((current.z >= 0.0f) != (next.z >= 0.0f)) {
+        float t = current.z / (current.z - next.z);
+        polygon[polygon_size++] = current + (next - current) * t;
+      }
+    }
+
+    for (int v = 2; v < polygon_size; ++v) {
+      AddTriangle(polygon[0], polygon[v-1], polygon[v], &triangles);
+    }
+  }
+}
+
+void SoftwareOcclusionCuller::AddTriangle(const glm::vec4& c0, const glm::vec4& c1,
+                                          const glm::vec4& c2,
+                                          std::vector<ScreenTriangle>* triangles) const {
+  if (c0.w <= 0.0f || c1.w <= 0.0f || c2.w <= 0.0f) {
+    return;
+  }
+
+  glm::vec3 v[3];
+  const glm::vec4* clip[3] = {&c0, &c1, &c2};
+  for (int i = 0; i < 3; ++i) {
+    float inv_w = 1.0f / clip[i]->w;
+    v[i] = glm::vec3((clip[i]->x * inv_w * 0.5f + 0.5f) * width_,
+                     (clip[i]->y * inv_w * 0.5f + 0.5f) * height_,
+                     clip[i]->z * inv_w);
+  }
+
+  // Both facings are rasterized (the back faces can't change the nearest depth
+  // of a closed mesh, but this way the winding order doesn't matter).
+  float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (std::abs(area) < 1e-6f) {
+    return;
+  }
+  if (area < 0.0f) {
+    std::swap(v[1], v[2]);
+    area = -area;
+  }
+
+  ScreenTriangle triangle;
+  triangle.min_x = std::max(int(std::floor(std::min({v[0].x, v[1].x, v[2].x}))), 0);
+  triangle.max_x = std::min(int(std::ceil(std::max({v[0].x, v[1].x, v[2].x}))), width_ - 1);
+  triangle.min_y = std::max(int(std::floor(std::min({v[0].y, v[1].y, v[2].y}))), 0);
+  triangle.max_y = std::min(int(std::ceil(std::max({v[0].y, v[1].y, v[2].y}))), height_ - 1);
+  if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+    return;
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    const glm::vec3& a = v[i];
+    const glm::vec3& b = v[(i + 1) % 3];
+    triangle.edges[i][0] = a.y - b.y;
+    triangle.edges[i][1] = b.x - a.x;
+    triangle.edges[i][2] = -(triangle.edges[i][0] * a.x + triangle.edges[i][1] * a.y);
+  }
+
+  triangle.depth[0] = ((v[1].z - v[0].z) * (v[2].y - v[0].y) -
+                       (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+  triangle.depth[1] = ((v[1].x - v[0].x) * (v[2].z - v[0].z) -
+                       (v[2].x - v[0].x) * (v[1].z - v[0].z)) / area;
+  triangle.depth[2] = v[0].z - triangle.depth[0] * v[0].x - triangle.depth[1] * v[0].y;
+
+  triangles->push_back(triangle);
+}
+
+void SoftwareOcclusionCuller::RasterizeBand(int band) {
+  int y_begin = band * band_height_;
+  int y_end = std::min(y_begin + band_height_, height_);
+  std::fill(depth_buffer_.begin() + y_begin * width_, depth_buffer_.begin() + y_end * width_, 1.0f);
+
+  for (const std::vector<ScreenTriangle>& triangles : screen_triangles_) {
+    for (const ScreenTriangle& tri : triangles) {
+      int min_y = std::max(tri.min_y, y_begin);
+      int max_y = std::min(tri.max_y, y_end - 1);
+      for (int y = min_y; y <= max_y; ++y) {
+        float py = y + 0.5f;
+        float* row = &depth_buffer_[y * width_];
+#ifdef __SSE2__
+        if (sse_enabled_) {
+          // The width is a multiple of 4, so the 4 pixel groups never leave the row
+          const __m128 zero = _mm_setzero_ps();
+          const __m128 pixel_centers = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+          __m128 edge_a[3], edge_row[3];
+          for (int i = 0; i < 3; ++i) {
+            edge_a[i] = _mm_set1_ps(tri.edges[i][0]);
+            edge_row[i] = _mm_set1_ps(tri.edges[i][1] * py + tri.edges[i][2]);
+          }
+          __m128 depth_a = _mm_set1_ps(tri.depth[0]);
+          __m128 depth_row = _mm_set1_ps(tri.depth[1] * py + tri.depth[2]);
+
+          for (int x = tri.min_x & ~3; x <= tri.max_x; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), pixel_centers);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[0], px), edge_row[0]), zero);
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[1], px), edge_row[1]), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[2], px), edge_row[2]), zero));
+            if (_mm_movemask_ps(inside) == 0) {
+              continue;
+            }
+
+            __m128 depth = _mm_add_ps(_mm_mul_ps(depth_a, px), depth_row);
+            __m128 old_depth = _mm_loadu_ps(row + x);
+            __m128 new_depth = _mm_min_ps(old_depth, depth);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth),
+                                             _mm_andnot_ps(inside, old_depth)));
+          }
+          continue;
+        }
+#endif
+        // The same operations in the same order as above, so the two give
+        // identical results
+        float edge_row[3];
+        for (int i = 0; i < 3; ++i) {
+          edge_row[i] = tri.edges[i][1] * py + tri.edges[i][2];
+        }
+        float depth_row = tri.depth[1] * py + tri.depth[2];
+        for (int x = tri.min_x; x <= tri.max_x; ++x) {
+          float px = x + 0.5f;
+          bool inside = true;
+          for (int i = 0; i < 3; ++i) {
+            inside = inside && tri.edges[i][0] * px + edge_row[i] >= 0.0f;
+          }
+          if (inside) {
+            row[x] = std::min(row[x], tri.depth[0] * px + depth_row);
+          }
+        }
+      }
+    }
+  }
+
+  // The farthest depth of the band's tiles
+  for (int tile_y = y_begin / kTileSize; tile_y * kTileSize < y_end; ++tile_y) {
+    for (int tile_x = 0; tile_x < tile_count_x_; ++tile_x) {
+      float max_depth = 0.0f;
+      for (int y = tile_y * kTileSize; y < (tile_y + 1) * kTileSize; ++y) {
+        const float* row = &depth_buffer_[y * width_ + tile_x * kTileSize];
+        max_depth = std::max(max_depth, *std::max_element(row, row + kTileSize));
+      }
+      tile_max_depths_[tile_y * tile_count_x_ + tile_x] = max_depth;
+    }
+  }
+}
+
+bool SoftwareOcclusionCuller::IsSseSupported() {
+#ifdef __SSE2__
+  return true;
+#else
+  return false;
+#endif
+}
+
+void SoftwareOcclusionCuller::SetSseEnabled(bool enabled) {
+  sse_enabled_ = enabled && IsSseSupported();
+}
+
+bool SoftwareOcclusionCuller::IsOccluded(const BoundingBox& world_space_bbox) const {
+  glm::vec3 mins = glm::vec3(world_space_bbox.GetMins());
+  glm::vec3 maxes = glm::vec3(world_space_bbox.GetMaxes());
+
+  glm::vec2 screen_min{std::numeric_limits<float>::max()};
+  glm::vec2 screen_max{-std::numeric_limits<float>::max()};
+  float min_depth = std::numeric_limits<float>::max();
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 corner{i & 1 ? maxes.x : mins.x,
+                     i & 2 ? maxes.y : mins.y,
+                     i & 4 ? maxes.z : mins.z};
+    glm::vec4 clip = view_projection_matrix_ * glm::vec4(corner, 1.0f);
+    if (clip.z < 0.0f || clip.w <= 0.0f) {
+      return false;  // intersects the near plane
+    }
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    glm::vec2 screen{(ndc.x * 0.5f + 0.5f) * width_, (ndc.y * 0.5f + 0.5f) * height_};
+    screen_min = glm::min(screen_min, screen);
+    screen_max = glm::max(screen_max, screen);
+    min_depth = std::min(min_depth, ndc.z);
+  }
+
+  // Every pixel that the box's rectangle touches is tested
+  int min_x = std::max(int(std::floor(screen_min.x)), 0);
+  int max_x = std::min(int(std::floor(screen_max.x)), width_ - 1);
+  int min_y = std::max(int(std::floor(screen_min.y)), 0);
+  int max_y = std::min(int(std::floor(screen_max.y)), height_ - 1);
+  if (min_x > max_x || min_y > max_y) {
+    return false;  // outside of the screen, that's up to the frustum culling
+  }
+
+  return IsRectOccluded(min_x, max_x, min_y, max_y, min_depth);
+}
+
+bool SoftwareOcclusionCuller::IsRectOccluded(int min_x, int max_x, int min_y, int max_y,
+                                             float min_depth) const {
+  for (int tile_y = min_y / kTileSize; tile_y <= max_y / kTileSize; ++tile_y) {
+    for (int tile_x = min_x / kTileSize; tile_x <= max_x / kTileSize; ++tile_x) {
+      if (tile_max_depths_[tile_y * tile_count_x_ + tile_x] < min_depth) {
+        continue;  // the whole tile is in front of the box
+      }
+
+      // Only a part of the tile might be covered, the pixels have to be checked
+      int tile_min_x = std::max(min_x, tile_x * kTileSize);
+      int tile_max_x = std::min(max_x, (tile_x + 1) * kTileSize - 1);
+      int tile_min_y = std::max(min_y, tile_y * kTileSize);
+      int tile_max_y = std::min(max_y, (tile_y + 1) * kTileSize - 1);
+      for (int y = tile_min_y; y <= tile_max_y; ++y) {
+        const float* row = &depth_buffer_[y * width_];
+#ifdef __SSE2__
+        if (sse_enabled_) {
+          const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+          __m128 box_depth = _mm_set1_ps(min_depth);
+          __m128 first = _mm_set1_ps(float(tile_min_x));
+          __m128 last = _mm_set1_ps(float(tile_max_x));
+          for (int x = tile_min_x & ~3; x <= tile_max_x; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+            __m128 in_rect = _mm_and_ps(_mm_cmpge_ps(px, first), _mm_cmple_ps(px, last));
+            __m128 visible = _mm_and_ps(in_rect, _mm_cmpge_ps(_mm_loadu_ps(row + x), box_depth));
+            if (_mm_movemask_ps(visible) != 0) {
+              return false;
+            }
+          }
+          continue;
+        }
+#endif
+        for (int x = tile_min_x; x <= tile_max_x; ++x) {
+          if (row[x] >= min_depth) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+}  // namespace Silice3D
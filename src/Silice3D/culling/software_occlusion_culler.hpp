@@ -0,0 +1,120 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_CULLING_SOFTWARE_OCCLUSION_CULLER_HPP_
+#define SILICE3D_CULLING_SOFTWARE_OCCLUSION_CULLER_HPP_
+
+#include <vector>
+#include <functional>
+
+#include <Silice3D/common/glm.hpp>
+#include <Silice3D/collision/bounding_box.hpp>
+
+namespace Silice3D {
+
+class ThreadPool;
+
+// A low-poly mesh that is rasterized by the SoftwareOcclusionCuller,
+// see MeshRenderer::occluderProxy.
+struct OccluderMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned> indices;
+};
+
+// Rasterizes a few designated occluders into a low resolution depth buffer on
+// the CPU, and tests the bounding boxes of the other objects against it, so
+// the fully hidden objects don't have to be sent to the GPU at all.
+//
+// The occluders and the occludees are collected during the update, and are
+// processed together at the end of it by Cull(), with the final camera. The
+// triangles are rasterized with SSE (4 pixels at a time, with a coverage mask
+// selecting which pixels are updated), in horizontal bands on the ThreadPool.
+// Every 8x8 pixel tile also stores its farthest depth, most of the bounding
+// box tests only have to read these.
+class SoftwareOcclusionCuller {
+ public:
+  static constexpr int kTileSize = 8;
+
+  struct Statistics {
+    size_t occluder_count = 0;
+    size_t occluder_triangle_count = 0;  // after the near plane clipping
+    size_t tested_count = 0;
+    size_t culled_count = 0;
+    double rasterization_time = 0.0;  // in milliseconds
+    double test_time = 0.0;  // in milliseconds
+  };
+
+  // The size of the depth buffer is rounded up to a multiple of kTileSize.
+  explicit SoftwareOcclusionCuller(ThreadPool* thread_pool,
+                                   int width = 320, int height = 192);
+
+  // The mesh must stay alive until the next Cull().
+  void AddOccluder(const OccluderMesh* mesh, const glm::mat4& model_matrix);
+
+  // on_visible is called by Cull() if the bounding box isn't occluded.
+  void AddOccludee(const BoundingBox& world_space_bbox,
+                   const std::function<void()>& on_visible);
+
+  // Rasterizes the occluders, tests the occludees, and clears both lists.
+  void Cull(const glm::mat4& view_projection_matrix);
+
+  // Tests a bounding box against the depth buffer of the last Cull().
+  bool IsOccluded(const BoundingBox& world_space_bbox) const;
+
+  // The statistics of the last Cull().
+  const Statistics& GetStatistics() const { return statistics_; }
+
+  // The SSE2 rasterizer and depth tests are used if they are compiled in.
+  // The scalar ones give identical results, they can be selected for
+  // comparing the two.
+  static bool IsSseSupported();
+  bool IsSseEnabled() const { return sse_enabled_; }
+  void SetSseEnabled(bool enabled);
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+  const std::vector<float>& GetDepthBuffer() const { return depth_buffer_; }
+
+ private:
+  struct ScreenTriangle {
+    // Edge functions (a*x + b*y + c >= 0 inside) and the depth plane
+    float edges[3][3];
+    float depth[3];
+    int min_x, max_x, min_y, max_y;
+  };
+
+  struct Occluder {
+    const OccluderMesh* mesh;
+    glm::mat4 model_matrix;
+  };
+
+  struct Occludee {
+    BoundingBox bbox;
+    std::function<void()> on_visible;
+  };
+
+  ThreadPool* thread_pool_;
+  int width_, height_, tile_count_x_, tile_count_y_;
+  int band_height_, band_count_;
+  bool sse_enabled_ = IsSseSupported();
+
+  glm::mat4 view_projection_matrix_;
+  std::vector<float> depth_buffer_;
+  std::vector<float> tile_max_depths_;
+
+  std::vector<Occluder> occluders_;
+  std::vector<Occludee> occludees_;
+  std::vector<std::vector<ScreenTriangle>> screen_triangles_;  // per occluder
+  std::vector<char> occludee_visibility_;
+
+  Statistics statistics_;
+
+  void SetupTriangles(size_t occluder_index);
+  void AddTriangle(const glm::vec4& c0, const glm::vec4& c1, const glm::vec4& c2,
+                   std::vector<ScreenTriangle>* triangles) const;
+  void RasterizeBand(int band);
+  bool IsRectOccluded(int min_x, int max_x, int min_y, int max_y, float min_depth) const;
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_CULLING_SOFTWARE_OCCLUSION_CULLER_HPP_
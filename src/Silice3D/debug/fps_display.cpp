@@ -4,6 +4,7 @@
 
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/debug/fps_display.hpp>
+#include <Silice3D/culling/software_occlusion_culler.hpp>
 
 namespace Silice3D {
 
@@ -25,6 +26,14 @@ FpsDisplay::FpsDisplay(GameObject* parent)
   triangle_per_sec_label_ = AddComponent<Label> ("Triangle per sec:      ", glm::vec2{0.99, 0.07});
   triangle_per_sec_label_->SetHorizontalAlignment(HorizontalAlignment::kRight);
   triangle_per_sec_label_->SetVerticalAlignment(VerticalAlignment::kTop);
+
+  occlusion_culling_label_ = AddComponent<Label> ("", glm::vec2{0.99, 0.085});
+  occlusion_culling_label_->SetHorizontalAlignment(HorizontalAlignment::kRight);
+  occlusion_culling_label_->SetVerticalAlignment(VerticalAlignment::kTop);
+
+  physics_label_ = AddComponent<Label> ("Physics step:      ", glm::vec2{0.99, 0.1});
+  physics_label_->SetHorizontalAlignment(HorizontalAlignment::kRight);
+  physics_label_->SetVerticalAlignment(VerticalAlignment::kTop);
 }
 
 void FpsDisplay::Update() {
@@ -62,6 +71,27 @@ void FpsDisplay::Update() {
         triangle_per_sec_label_->SetText(ss.str());
       }
 
+      const SoftwareOcclusionCuller* occlusion_culler = GetScene()->GetSoftwareOcclusionCuller();
+      if (occlusion_culler != nullptr) {
+        const SoftwareOcclusionCuller::Statistics& stats = occlusion_culler->GetStatistics();
+        std::stringstream ss;
+        ss << "Occlusion culled: " << stats.culled_count << "/" << stats.tested_count
+           << " (raster: " << std::fixed << std::setprecision(2) << stats.rasterization_time
+           << " ms, test: " << stats.test_time << " ms)";
+        occlusion_culling_label_->SetText(ss.str());
+      } else {
+        occlusion_culling_label_->SetText("");
+      }
+
+      {
+        int thread_count = GetScene()->GetPhysicsThreadCount();
+        std::stringstream ss;
+        ss << "Physics step: " << std::fixed << std::setw(6) << std::setprecision(2)
+           << GetScene()->GetPhysicsStepTime() << " ms (" << thread_count
+           << (thread_count == 1 ? " thread)" : " threads)");
+        physics_label_->SetText(ss.str());
+      }
+
 
       sum_frame_num_ += calls_;
       sum_time_ += accum_time_;
@@ -83,6 +113,8 @@ void FpsDisplay::ScreenResized(size_t /*width*/, size_t height) {
   object_count_label_->SetScale(scale);
   triangle_count_label_->SetScale(scale);
   triangle_per_sec_label_->SetScale(scale);
+  occlusion_culling_label_->SetScale(scale);
+  physics_label_->SetScale(scale);
 }
 
 }
@@ -19,6 +19,8 @@ class FpsDisplay : public GameObject {
   Label* object_count_label_ = nullptr;
   Label* triangle_count_label_ = nullptr;
   Label* triangle_per_sec_label_ = nullptr;
+  Label* occlusion_culling_label_ = nullptr;
+  Label* physics_label_ = nullptr;
   double sum_frame_num_ = 0.0;
   double sum_time_ = 0.0;
   double accum_time_ = 0.0;
@@ -0,0 +1,66 @@
+// Copyright (c) Tamas Csala
+
+#include <Silice3D/camera/icamera.hpp>
+#include <Silice3D/lighting/point_light_source.hpp>
+#include <Silice3D/lighting/point_light_shadows.hpp>
+#include <Silice3D/lighting/clustered_lighting.hpp>
+
+namespace Silice3D {
+
+void ClusteredLighting::Update(const ICamera& camera,
+                               const std::set<PointLightSource*>& point_light_sources,
+                               const PointLightShadows* shadows, ThreadPool* thread_pool) {
+  light_spheres_.clear();
+  gpu_lights_.clear();
+  for (PointLightSource* light : point_light_sources) {
+    glm::vec3 position = light->GetTransform().GetPos();
+    float range = light->GetRange();
+    int shadow_face = shadows != nullptr ? shadows->GetFirstFaceIndex(light) : -1;
+    light_spheres_.push_back(glm::vec4(position, range));
+    gpu_lights_.push_back(GpuPointLight{glm::vec4(position, range),
+                                        glm::vec4(light->GetColor(), 0.0f),
+                                        glm::vec4(light->GetAttenuation(), 0.0f),
+                                        glm::ivec4(shadow_face, 0, 0, 0)});
+  }
+
+  grid_.Build(camera.GetCameraMatrix(), camera.GetProjectionMatrix(),
+              camera.GetZNear(), camera.GetZFar(), light_spheres_, thread_pool);
+
+  // Empty buffers can't be bound, so upload at least one element of each
+  if (gpu_lights_.empty()) {
+    gpu_lights_.push_back(GpuPointLight{glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f),
+                                        glm::ivec4(-1, 0, 0, 0)});
+  }
+  gl::Bind(point_light_buffer_);
+  point_light_buffer_.data(gpu_lights_, gl::kStreamDraw);
+
+  GpuClusterHeader header;
+  header.camera_matrix = camera.GetCameraMatrix();
+  header.projection_scale_z_near_slice_scale =
+      glm::vec4(grid_.GetProjectionScale(), grid_.GetZNear(), grid_.GetSliceScale());
+  header.size = glm::uvec4(grid_.GetSize(), light_spheres_.size());
+
+  const std::vector<glm::uvec2>& ranges = grid_.GetClusterRanges();
+  size_t ranges_size = ranges.size() * sizeof(glm::uvec2);
+  gl::Bind(cluster_buffer_);
+  cluster_buffer_.data(sizeof(header) + ranges_size, nullptr, gl::kStreamDraw);
+  cluster_buffer_.subData(0, sizeof(header), &header);
+  cluster_buffer_.subData(sizeof(header), ranges_size, ranges.data());
+
+  const std::vector<uint32_t>& indices = grid_.GetLightIndices();
+  gl::Bind(light_index_buffer_);
+  if (indices.empty()) {
+    light_index_buffer_.data(std::vector<uint32_t>(1, 0), gl::kStreamDraw);
+  } else {
+    light_index_buffer_.data(indices, gl::kStreamDraw);
+  }
+  gl::Unbind(light_index_buffer_);
+}
+
+void ClusteredLighting::Bind() const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kPointLightBufferBinding, point_light_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kClusterBufferBinding, cluster_buffer_.expose());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kLightIndexBufferBinding, light_index_buffer_.expose());
+}
+
+}  // namespace Silice3D
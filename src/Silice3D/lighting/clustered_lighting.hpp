@@ -0,0 +1,69 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_CLUSTERED_LIGHTING_HPP_
+#define SILICE3D_LIGHTING_CLUSTERED_LIGHTING_HPP_
+
+#include <set>
+#include <vector>
+
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/lighting/light_cluster_grid.hpp>
+
+namespace Silice3D {
+
+class ICamera;
+class ThreadPool;
+class PointLightSource;
+class PointLightShadows;
+
+// Bins the point lights into a LightClusterGrid for the camera every frame,
+// and uploads the lights and the clusters into shader storage buffers, that
+// lighting.frag reads. This way there is no limit on the number of point
+// lights, and a fragment only pays for the ones that might reach it.
+class ClusteredLighting {
+ public:
+  // The shader storage buffer bindings, see lighting.frag
+  static constexpr GLuint kPointLightBufferBinding = 8;
+  static constexpr GLuint kClusterBufferBinding = 9;
+  static constexpr GLuint kLightIndexBufferBinding = 10;
+
+  ClusteredLighting() = default;
+
+  // The shadows can be nullptr, if none of the lights casts shadows.
+  void Update(const ICamera& camera, const std::set<PointLightSource*>& point_light_sources,
+              const PointLightShadows* shadows, ThreadPool* thread_pool);
+
+  // Binds the buffers to their indexed binding points.
+  void Bind() const;
+
+  const LightClusterGrid& GetGrid() const { return grid_; }
+
+  // The bounding spheres of the lights, in the order of the point light buffer
+  const std::vector<glm::vec4>& GetLightSpheres() const { return light_spheres_; }
+
+ private:
+  // The std430 layout of a point light in lighting.frag
+  struct GpuPointLight {
+    glm::vec4 position_range;
+    glm::vec4 color;
+    glm::vec4 attenuation;
+    glm::ivec4 shadow;  // .x: the first face in PointLightShadows, or -1
+  };
+
+  // The std430 layout of the cluster buffer's header in lighting.frag
+  struct GpuClusterHeader {
+    glm::mat4 camera_matrix;
+    glm::vec4 projection_scale_z_near_slice_scale;
+    glm::uvec4 size;
+  };
+
+  LightClusterGrid grid_;
+  std::vector<glm::vec4> light_spheres_;
+  std::vector<GpuPointLight> gpu_lights_;
+
+  gl::ArrayBuffer point_light_buffer_, cluster_buffer_, light_index_buffer_;
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_CLUSTERED_LIGHTING_HPP_
@@ -0,0 +1,224 @@
+// Copyright (c) Tamas Csala
+
+#include <cstddef>
+#include <algorithm>
+
+#include <Silice3D/core/scene.hpp>
+#include <Silice3D/collision/sphere.hpp>
+#include <Silice3D/lighting/deferred_shading.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
+#include <Silice3D/shaders/shader_manager.hpp>
+
+namespace Silice3D {
+
+// The attribute locations of deferred_point.vert
+static constexpr GLuint kVolumePositionAttribLocation = 0;
+static constexpr GLuint kVolumeSphereAttribLocation = 1;
+static constexpr GLuint kVolumeLightIndexAttribLocation = 2;
+
+// The attachments of the G-buffer, the surface ones match mesh_gbuffer.frag
+static constexpr GLenum kSurfaceAttachments[] = {
+  GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2
+};
+static constexpr GLenum kLightAccumulationAttachment = GL_COLOR_ATTACHMENT3;
+
+DeferredShading::DeferredShading(ShaderManager* shader_manager)
+    : directional_prog_(*shader_manager->GetProgram({"Silice3D/deferred.vert",
+                                                     "Silice3D/deferred_directional.frag"}))
+    , point_prog_(*shader_manager->GetProgram({"Silice3D/deferred_point.vert",
+                                               "Silice3D/deferred_point.frag"}))
+    , composite_prog_(*shader_manager->GetProgram({"Silice3D/deferred.vert",
+                                                   "Silice3D/deferred_composite.frag"}))
+    , dp_uInverseProjectionCameraMatrix_(directional_prog_, "uInverseProjectionCameraMatrix")
+    , pp_uInverseProjectionCameraMatrix_(point_prog_, "uInverseProjectionCameraMatrix") {
+  // A cube around the unit sphere, with counter-clockwise outer faces
+  const std::vector<glm::vec3> positions = {
+    {-1, -1, -1}, {1, -1, -1}, {-1, 1, -1}, {1, 1, -1},
+    {-1, -1, 1}, {1, -1, 1}, {-1, 1, 1}, {1, 1, 1}
+  };
+  const std::vector<GLushort> indices = {
+    4, 6, 2, 4, 2, 0,  1, 3, 7, 1, 7, 5,  0, 1, 5, 0, 5, 4,
+    6, 7, 3, 6, 3, 2,  2, 3, 1, 2, 1, 0,  4, 5, 7, 4, 7, 6
+  };
+
+  gl::Bind(volume_vao_);
+  gl::Bind(volume_positions_buffer_);
+  volume_positions_buffer_.data(positions, gl::kStaticDraw);
+  gl::VertexAttribObject(kVolumePositionAttribLocation).setup<glm::vec3>().enable();
+
+  gl::Bind(volume_instance_buffer_);
+  glVertexAttribPointer(kVolumeSphereAttribLocation, 4, GL_FLOAT, GL_FALSE, sizeof(LightVolume),
+                        (void*)offsetof(LightVolume, sphere));
+  glVertexAttribDivisor(kVolumeSphereAttribLocation, 1);
+  glEnableVertexAttribArray(kVolumeSphereAttribLocation);
+  glVertexAttribIPointer(kVolumeLightIndexAttribLocation, 1, GL_UNSIGNED_INT, sizeof(LightVolume),
+                         (void*)offsetof(LightVolume, light_index));
+  glVertexAttribDivisor(kVolumeLightIndexAttribLocation, 1);
+  glEnableVertexAttribArray(kVolumeLightIndexAttribLocation);
+
+  gl::Bind(volume_indices_buffer_);
+  volume_indices_buffer_.data(indices, gl::kStaticDraw);
+  gl::Unbind(gl::kVertexArray);
+  gl::Unbind(gl::kArrayBuffer);
+}
+
+void DeferredShading::Resize(int width, int height) {
+  width_ = width;
+  height_ = height;
+
+  // The textures are recreated, because the immutable storage can't be resized
+  auto create_texture = [width, height](gl::Texture2D* texture, GLenum format) {
+    *texture = gl::Texture2D{};
+    gl::Bind(*texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    texture->minFilter(gl::kNearest);
+    texture->magFilter(gl::kNearest);
+    texture->wrapS(gl::kClampToEdge);
+    texture->wrapT(gl::kClampToEdge);
+    gl::Unbind(*texture);
+  };
+  create_texture(&normal_texture_, GL_RG16);
+  create_texture(&albedo_texture_, GL_RGBA8);
+  create_texture(&specular_texture_, GL_RGBA8);
+  create_texture(&depth_texture_, GL_DEPTH_COMPONENT32F);
+  create_texture(&light_accumulation_texture_, GL_RGBA16F);
+
+  gl::Bind(fbo_);
+  glFramebufferTexture(GL_FRAMEBUFFER, kSurfaceAttachments[0], normal_texture_.expose(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, kSurfaceAttachments[1], albedo_texture_.expose(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, kSurfaceAttachments[2], specular_texture_.expose(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, kLightAccumulationAttachment,
+                       light_accumulation_texture_.expose(), 0);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture_.expose(), 0);
+  fbo_.validate();
+  gl::Unbind(fbo_);
+}
+
+void DeferredShading::BeginDepthPrepass() {
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  if (viewport[2] != width_ || viewport[3] != height_) {
+    Resize(viewport[2], viewport[3]);
+  }
+
+  gl::Bind(fbo_);
+
+  // The uncovered parts of the surface attachments are never lit, but the
+  // ones that only the depth prepass covered are, and they should be black
+  const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  const GLfloat far_depth = 1.0f;
+  glDrawBuffers(3, kSurfaceAttachments);
+  for (GLint draw_buffer = 0; draw_buffer < 3; ++draw_buffer) {
+    glClearBufferfv(GL_COLOR, draw_buffer, zero);
+  }
+  glClearBufferfv(GL_DEPTH, 0, &far_depth);
+
+  gl::DrawBuffer(gl::kNone);
+}
+
+void DeferredShading::BeginGeometryPass() {
+  glDrawBuffers(3, kSurfaceAttachments);
+}
+
+void DeferredShading::RenderLighting(Scene* scene, const ICamera& camera,
+                                     const std::vector<glm::vec4>& light_spheres) {
+  glm::mat4 inverse_projection_camera_matrix =
+      glm::inverse(camera.GetProjectionMatrix() * camera.GetCameraMatrix());
+  scene->GetFrameUniforms()->BindCamera(camera);
+
+  gl::BindToTexUnit(normal_texture_, kGBufferTextureSlot);
+  gl::BindToTexUnit(albedo_texture_, kGBufferTextureSlot + 1);
+  gl::BindToTexUnit(specular_texture_, kGBufferTextureSlot + 2);
+  gl::BindToTexUnit(depth_texture_, kGBufferTextureSlot + 3);
+
+  // Only the light accumulation is written from here on, the depth is only
+  // tested, so the G-buffer can be sampled while it's attached
+  glDrawBuffer(kLightAccumulationAttachment);
+  glDepthMask(GL_FALSE);
+
+  // The directional lights (and their ambient light) write every covered
+  // pixel, so the accumulation doesn't have to be cleared
+  {
+    gl::TemporarySet capabilities{{{gl::kBlend, false},
+                                   {gl::kCullFace, false},
+                                   {gl::kDepthTest, false}}};
+    gl::Use(directional_prog_);
+    directional_prog_.Update();
+    dp_uInverseProjectionCameraMatrix_ = inverse_projection_camera_matrix;
+    gl::Bind(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl::Unbind(gl::kVertexArray);
+  }
+
+  gl::Use(point_prog_);
+  point_prog_.Update();
+  pp_uInverseProjectionCameraMatrix_ = inverse_projection_camera_matrix;
+  RenderLightVolumes(camera, light_spheres);
+
+  // The composition writes the depth with the color, so the forward passes
+  // after it are depth tested against the G-buffer's depth
+  gl::Unbind(fbo_);
+  gl::DrawBuffer(gl::kBack);
+  glDepthMask(GL_TRUE);
+  {
+    gl::TemporarySet capabilities{{{gl::kBlend, false},
+                                   {gl::kCullFace, false},
+                                   {gl::kDepthTest, true}}};
+    glDepthFunc(GL_ALWAYS);
+    gl::BindToTexUnit(light_accumulation_texture_, kLightAccumulationTextureSlot);
+    gl::Use(composite_prog_);
+    composite_prog_.Update();
+    gl::Bind(fullscreen_vao_);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl::Unbind(gl::kVertexArray);
+    gl::DepthFunc(gl::kLequal);
+  }
+  gl::UnuseProgram();
+}
+
+void DeferredShading::RenderLightVolumes(const ICamera& camera,
+                                         const std::vector<glm::vec4>& light_spheres) {
+  // The lit pixels are at most z far away from the camera, so the volumes of
+  // the lights without falloff can be limited to that
+  glm::vec3 camera_pos = camera.GetTransform().GetPos();
+  light_volumes_.clear();
+  for (size_t i = 0; i < light_spheres.size(); ++i) {
+    glm::vec3 center = glm::vec3(light_spheres[i]);
+    float range = light_spheres[i].w;
+    if (range <= 0.0f) {
+      continue;
+    }
+    float radius = std::min(range, glm::length(center - camera_pos) + float(camera.GetZFar()));
+    if (Sphere(center, radius).CollidesWithFrustum(camera.GetFrustum())) {
+      light_volumes_.push_back(LightVolume{glm::vec4(center, radius), GLuint(i)});
+    }
+  }
+  if (light_volumes_.empty()) {
+    return;
+  }
+
+  gl::Bind(volume_instance_buffer_);
+  volume_instance_buffer_.data(light_volumes_, gl::kStreamDraw);
+  gl::Unbind(volume_instance_buffer_);
+
+  // The back faces of the volumes are rendered, where they are behind the
+  // surface, which works even if the camera is inside the volume. The depth
+  // clamp keeps the back faces that are behind the far plane.
+  gl::TemporarySet capabilities{{{gl::kBlend, true},
+                                 {gl::kCullFace, true},
+                                 {gl::kDepthTest, true}}};
+  glEnable(GL_DEPTH_CLAMP);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glCullFace(GL_FRONT);
+  glDepthFunc(GL_GEQUAL);
+
+  gl::Bind(volume_vao_);
+  glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, nullptr, light_volumes_.size());
+  gl::Unbind(gl::kVertexArray);
+
+  glDepthFunc(GL_LEQUAL);
+  glCullFace(GL_BACK);
+  glDisable(GL_DEPTH_CLAMP);
+}
+
+}  // namespace Silice3D
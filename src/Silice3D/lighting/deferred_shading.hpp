@@ -0,0 +1,83 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_DEFERRED_SHADING_HPP_
+#define SILICE3D_LIGHTING_DEFERRED_SHADING_HPP_
+
+#include <vector>
+
+#include <Silice3D/common/glm.hpp>
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/shaders/shader_program.hpp>
+
+namespace Silice3D {
+
+class Scene;
+class ICamera;
+class ShaderManager;
+
+// An alternative to the forward shading of the mesh batches. The mesh batches
+// only write their surface properties into a G-buffer (see mesh_gbuffer.frag),
+// and the lighting is calculated once for every covered pixel: the directional
+// lights in a full-screen pass, and every point light in a box around its
+// sphere, so a point light only costs the pixels it can reach. The lights are
+// summed in a floating point buffer, that is post processed into the default
+// framebuffer together with the G-buffer's depth, so the objects that aren't
+// mesh batches can be rendered forward after it.
+class DeferredShading {
+ public:
+  // The texture units of the normal, albedo, specular and depth textures (in
+  // this order) in the lighting passes, these must match gbuffer.glsl
+  static constexpr int kGBufferTextureSlot = 3;
+  // This must match deferred_composite.frag
+  static constexpr int kLightAccumulationTextureSlot = 7;
+
+  explicit DeferredShading(ShaderManager* shader_manager);
+
+  // Resizes the G-buffer to the viewport if needed, binds and clears it. The
+  // depth prepass only writes its depth.
+  void BeginDepthPrepass();
+
+  // Enables the G-buffer's surface attachments for the mesh batches.
+  void BeginGeometryPass();
+
+  // Lights the G-buffer with the bound light buffers of ClusteredLighting,
+  // and writes the post processed result and the depth into the default
+  // framebuffer. The light_spheres are in the order of the point light buffer.
+  void RenderLighting(Scene* scene, const ICamera& camera,
+                      const std::vector<glm::vec4>& light_spheres);
+
+  glm::ivec2 GetSize() const { return glm::ivec2(width_, height_); }
+  const gl::Texture2D& GetDepthTexture() const { return depth_texture_; }
+
+ private:
+  // The per instance data of the light volumes, see deferred_point.vert
+  struct LightVolume {
+    glm::vec4 sphere;
+    GLuint light_index;
+  };
+
+  gl::Texture2D normal_texture_, albedo_texture_, specular_texture_;
+  gl::Texture2D depth_texture_, light_accumulation_texture_;
+  gl::Framebuffer fbo_;
+  int width_ = 0, height_ = 0;
+
+  ShaderProgram& directional_prog_;
+  ShaderProgram& point_prog_;
+  ShaderProgram& composite_prog_;
+  gl::LazyUniform<glm::mat4> dp_uInverseProjectionCameraMatrix_;
+  gl::LazyUniform<glm::mat4> pp_uInverseProjectionCameraMatrix_;
+
+  // The full-screen passes don't need any vertex data, but a bound VAO
+  gl::VertexArray fullscreen_vao_;
+  gl::VertexArray volume_vao_;
+  gl::ArrayBuffer volume_positions_buffer_, volume_instance_buffer_;
+  gl::IndexBuffer volume_indices_buffer_;
+  std::vector<LightVolume> light_volumes_;
+
+  void Resize(int width, int height);
+  void RenderLightVolumes(const ICamera& camera, const std::vector<glm::vec4>& light_spheres);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_DEFERRED_SHADING_HPP_
@@ -0,0 +1,149 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <algorithm>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/lighting/light_cluster_grid.hpp>
+
+namespace Silice3D {
+
+namespace {
+
+// The slopes (x / depth) of the two lines from the eye that are tangent to a
+// circle, in a plane that contains the view direction. Returns false if the
+// circle reaches behind the eye, and so its projection is unbounded.
+bool GetTangentSlopes(float center, float depth, float radius, float* min_slope, float* max_slope) {
+  if (depth <= radius) {
+    return false;
+  }
+
+  float denominator = depth*depth - radius*radius;
+  float root = radius * std::sqrt(center*center + denominator);
+  *min_slope = (center*depth - root) / denominator;
+  *max_slope = (center*depth + root) / denominator;
+  return true;
+}
+
+}  // namespace
+
+LightClusterGrid::LightClusterGrid(const glm::uvec3& size)
+    : size_(glm::max(size, glm::uvec3(1))) {
+  slice_light_indices_.resize(size_.z);
+}
+
+void LightClusterGrid::Build(const glm::mat4& camera_matrix, const glm::mat4& projection_matrix,
+                             float z_near, float z_far, const std::vector<glm::vec4>& light_spheres,
+                             ThreadPool* thread_pool) {
+  projection_scale_ = glm::vec2(projection_matrix[0][0], projection_matrix[1][1]);
+  z_near_ = z_near;
+  slice_scale_ = size_.z / std::log(z_far / z_near);
+
+  light_bounds_.resize(light_spheres.size());
+  for (size_t i = 0; i < light_spheres.size(); ++i) {
+    glm::vec3 view_pos = glm::vec3(camera_matrix * glm::vec4(glm::vec3(light_spheres[i]), 1.0f));
+    light_bounds_[i] = GetLightBounds(view_pos, light_spheres[i].w, z_far);
+  }
+
+  cluster_ranges_.resize(GetClusterCount());
+  if (thread_pool != nullptr) {
+    thread_pool->ParallelFor(size_.z, [this](size_t z) { BinSlice(z); });
+  } else {
+    for (unsigned z = 0; z < size_.z; ++z) {
+      BinSlice(z);
+    }
+  }
+
+  // Concatenate the slices' index lists, and offset their ranges accordingly
+  light_indices_.clear();
+  size_t slice_cluster_count = size_t(size_.x) * size_.y;
+  for (unsigned z = 0; z < size_.z; ++z) {
+    uint32_t slice_offset = light_indices_.size();
+    for (size_t i = 0; i < slice_cluster_count; ++i) {
+      cluster_ranges_[z * slice_cluster_count + i].x += slice_offset;
+    }
+    light_indices_.insert(light_indices_.end(), slice_light_indices_[z].begin(),
+                          slice_light_indices_[z].end());
+  }
+}
+
+LightClusterGrid::LightBounds LightClusterGrid::GetLightBounds(const glm::vec3& view_pos,
+                                                               float radius, float z_far) const {
+  LightBounds bounds;
+  float depth = -view_pos.z;  // the camera looks towards -z
+  if (depth + radius < z_near_ || depth - radius > z_far) {
+    return bounds;
+  }
+  bounds.first.z = GetSlice(depth - radius);
+  bounds.last.z = GetSlice(depth + radius);
+
+  for (int axis = 0; axis < 2; ++axis) {
+    bounds.first[axis] = 0;
+    bounds.last[axis] = size_[axis] - 1;
+
+    float min_slope, max_slope;
+    if (GetTangentSlopes(view_pos[axis], depth, radius, &min_slope, &max_slope)) {
+      float min_ndc = min_slope * projection_scale_[axis];
+      float max_ndc = max_slope * projection_scale_[axis];
+      if (min_ndc > 1.0f || max_ndc < -1.0f) {
+        return bounds;  // outside of the screen
+      }
+      float first = std::floor((min_ndc * 0.5f + 0.5f) * size_[axis]);
+      float last = std::floor((max_ndc * 0.5f + 0.5f) * size_[axis]);
+      bounds.first[axis] = std::max(first, 0.0f);
+      bounds.last[axis] = std::min(last, float(size_[axis] - 1));
+    }
+  }
+
+  bounds.visible = true;
+  return bounds;
+}
+
+unsigned LightClusterGrid::GetSlice(float depth) const {
+  if (depth <= z_near_) {
+    return 0;
+  }
+  float slice = std::floor(std::log(depth / z_near_) * slice_scale_);
+  return std::min(slice, float(size_.z - 1));
+}
+
+void LightClusterGrid::BinSlice(unsigned z) {
+  size_t slice_cluster_count = size_t(size_.x) * size_.y;
+  glm::uvec2* ranges = &cluster_ranges_[z * slice_cluster_count];
+  std::fill(ranges, ranges + slice_cluster_count, glm::uvec2(0));
+
+  // Count the lights of the clusters, then reserve space for them, and then
+  // write the indices (the ranges' x are relative to the slice here).
+  for (const LightBounds& bounds : light_bounds_) {
+    if (bounds.visible && bounds.first.z <= z && z <= bounds.last.z) {
+      for (unsigned y = bounds.first.y; y <= bounds.last.y; ++y) {
+        for (unsigned x = bounds.first.x; x <= bounds.last.x; ++x) {
+          ranges[x + size_.x * y].y++;
+        }
+      }
+    }
+  }
+
+  uint32_t offset = 0;
+  for (size_t i = 0; i < slice_cluster_count; ++i) {
+    ranges[i].x = offset;
+    offset += ranges[i].y;
+    ranges[i].y = 0;
+  }
+
+  std::vector<uint32_t>& indices = slice_light_indices_[z];
+  indices.resize(offset);
+  for (size_t light = 0; light < light_bounds_.size(); ++light) {
+    const LightBounds& bounds = light_bounds_[light];
+    if (bounds.visible && bounds.first.z <= z && z <= bounds.last.z) {
+      for (unsigned y = bounds.first.y; y <= bounds.last.y; ++y) {
+        for (unsigned x = bounds.first.x; x <= bounds.last.x; ++x) {
+          glm::uvec2& range = ranges[x + size_.x * y];
+          indices[range.x + range.y++] = light;
+        }
+      }
+    }
+  }
+}
+
+}  // namespace Silice3D
@@ -0,0 +1,78 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_LIGHT_CLUSTER_GRID_HPP_
+#define SILICE3D_LIGHTING_LIGHT_CLUSTER_GRID_HPP_
+
+#include <vector>
+#include <cstdint>
+
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+class ThreadPool;
+
+// Assigns the point lights to the clusters of a view frustum shaped grid
+// (froxels) on the CPU, for clustered forward shading: a fragment only has to
+// loop over the lights of its cluster. The grid is uniform in the screen's
+// x and y, and exponential in the view space depth.
+//
+// This class doesn't touch OpenGL, ClusteredLighting uploads its results.
+class LightClusterGrid {
+ public:
+  static constexpr unsigned kDefaultSizeX = 16;
+  static constexpr unsigned kDefaultSizeY = 9;
+  static constexpr unsigned kDefaultSizeZ = 24;
+
+  explicit LightClusterGrid(const glm::uvec3& size = glm::uvec3{kDefaultSizeX, kDefaultSizeY,
+                                                                kDefaultSizeZ});
+
+  // Bins the lights, given as world space bounding spheres (position as xyz,
+  // range as w), into the clusters of a symmetric perspective camera. The
+  // depth slices are split between the thread pool's workers, if it isn't nullptr.
+  void Build(const glm::mat4& camera_matrix, const glm::mat4& projection_matrix,
+             float z_near, float z_far, const std::vector<glm::vec4>& light_spheres,
+             ThreadPool* thread_pool = nullptr);
+
+  const glm::uvec3& GetSize() const { return size_; }
+  size_t GetClusterCount() const { return size_t(size_.x) * size_.y * size_.z; }
+  size_t GetClusterIndex(unsigned x, unsigned y, unsigned z) const {
+    return x + size_.x * (y + size_t(size_.y) * z);
+  }
+
+  // The offset and the count of each cluster's lights in GetLightIndices().
+  const std::vector<glm::uvec2>& GetClusterRanges() const { return cluster_ranges_; }
+  const std::vector<uint32_t>& GetLightIndices() const { return light_indices_; }
+
+  // The mapping from view space to clusters, as it has to be done by the shaders:
+  // the cluster's x and y are from the NDC (view_pos.xy * projection_scale / depth),
+  // its z is log(depth / z_near) * slice_scale.
+  glm::vec2 GetProjectionScale() const { return projection_scale_; }
+  float GetZNear() const { return z_near_; }
+  float GetSliceScale() const { return slice_scale_; }
+
+ private:
+  // The clusters that a light's sphere might touch (an inclusive range)
+  struct LightBounds {
+    glm::uvec3 first, last;
+    bool visible = false;
+  };
+
+  glm::uvec3 size_;
+  glm::vec2 projection_scale_;
+  float z_near_ = 0.0f;
+  float slice_scale_ = 0.0f;
+
+  std::vector<LightBounds> light_bounds_;
+  std::vector<std::vector<uint32_t>> slice_light_indices_;
+  std::vector<glm::uvec2> cluster_ranges_;
+  std::vector<uint32_t> light_indices_;
+
+  LightBounds GetLightBounds(const glm::vec3& view_pos, float radius, float z_far) const;
+  unsigned GetSlice(float depth) const;
+  void BinSlice(unsigned z);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_LIGHT_CLUSTER_GRID_HPP_
@@ -0,0 +1,184 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <Silice3D/core/scene.hpp>
+#include <Silice3D/collision/sphere.hpp>
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/lighting/point_light_source.hpp>
+#include <Silice3D/lighting/point_light_shadows.hpp>
+#include <Silice3D/lighting/shadow_caster_camera.hpp>
+
+namespace Silice3D {
+
+static_assert(sizeof(GLuint64) == sizeof(glm::uvec2), "Expected 32 bit ints");
+
+PointLightShadows::PointLightShadows(Scene* scene, unsigned atlas_size,
+                                     unsigned min_tile_size, unsigned max_tile_size)
+    : scene_(scene)
+    , atlas_(atlas_size, min_tile_size)
+    , max_tile_size_(max_tile_size) {
+  for (unsigned face = 0; face < kFaceCount; ++face) {
+    face_cameras_.push_back(make_unique<ShadowCasterCamera>(
+        scene, scene->GetTransform(), glm::mat4{}, glm::mat4{}, 0.0f));
+  }
+}
+
+PointLightShadows::~PointLightShadows() = default;
+
+void PointLightShadows::Update(const ICamera& camera,
+                               const std::set<PointLightSource*>& lights) {
+  // The static casters changing invalidates every face, the dynamic ones
+  // are only refreshed as the update budget allows
+  uint64_t static_version = scene_->GetStaticShadowCastersVersion();
+  bool casters_changed = static_version != static_casters_version_;
+  static_casters_version_ = static_version;
+
+  glm::vec3 camera_pos = camera.GetTransform().GetPos();
+  double tan_half_fovy = std::tan(camera.GetFovy() / 2);
+  std::set<const PointLightSource*> shadowed_lights;
+  requests_.clear();
+  for (PointLightSource* light : lights) {
+    float range = GetShadowRange(*light, camera);
+    if (!light->GetCastsShadows() || range <= 0.0f) {
+      continue;
+    }
+    shadowed_lights.insert(light);
+
+    // The projected size of the light's sphere, relative to the screen height
+    glm::vec3 position = light->GetTransform().GetPos();
+    float distance = glm::length(position - camera_pos);
+    float screen_size = 1.0f;
+    if (distance > range) {
+      screen_size = std::min(float(range / (distance * tan_half_fovy)), 1.0f);
+    }
+    float importance = screen_size;
+    if (!Sphere(position, range).CollidesWithFrustum(camera.GetFrustum())) {
+      importance *= kOffscreenImportance;
+    }
+
+    LightState& state = light_states_[light];
+    state.tile_size = SelectTileSize(screen_size, state.tile_size);
+    state.position = position;
+    state.range = range;
+    bool changed = casters_changed || position != state.rendered_position ||
+                   range != state.rendered_range;
+    requests_.push_back(ShadowAtlas::Request{light, kFaceCount, state.tile_size,
+                                             importance, changed});
+  }
+
+  for (auto iter = light_states_.begin(); iter != light_states_.end();) {
+    if (shadowed_lights.count(iter->first) == 0) {
+      iter = light_states_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  atlas_.Update(requests_);
+  for (const void* owner : atlas_.GetScheduledUpdates()) {
+    const PointLightSource* light = static_cast<const PointLightSource*>(owner);
+    RenderFaces(&light_states_[light], *atlas_.GetAllocation(owner));
+  }
+  atlas_.EndTiles();
+
+  UploadFaces();
+}
+
+unsigned PointLightShadows::SelectTileSize(float screen_size, unsigned current_tile_size) const {
+  float ideal_size = screen_size * max_tile_size_;
+  if (current_tile_size != 0 && current_tile_size <= max_tile_size_ &&
+      ideal_size > current_tile_size / 2 * (1.0f - kTileSizeHysteresis) &&
+      ideal_size <= current_tile_size * (1.0f + kTileSizeHysteresis)) {
+    return current_tile_size;
+  }
+
+  unsigned tile_size = atlas_.GetMinTileSize();
+  while (tile_size < max_tile_size_ && tile_size < ideal_size) {
+    tile_size *= 2;
+  }
+  return tile_size;
+}
+
+void PointLightShadows::RenderFaces(LightState* state, const ShadowAtlas::Allocation& allocation) {
+  glm::mat4 projection_matrix = GetFaceProjectionMatrix(state->range);
+  for (unsigned face = 0; face < kFaceCount; ++face) {
+    ShadowCasterCamera& face_camera = *face_cameras_[face];
+    face_camera.SetMatrices(projection_matrix, GetFaceCameraMatrix(face, state->position),
+                            state->range);
+    atlas_.BeginTile(allocation.tiles[face]);
+    scene_->RenderDepthOnlyRecursive(face_camera);
+  }
+  state->rendered_position = state->position;
+  state->rendered_range = state->range;
+}
+
+void PointLightShadows::UploadFaces() {
+  first_face_indices_.clear();
+  gpu_faces_.clear();
+  for (const auto& pair : light_states_) {
+    const ShadowAtlas::Allocation* allocation = atlas_.GetAllocation(pair.first);
+    if (allocation == nullptr || !allocation->valid) {
+      continue;
+    }
+
+    // The matrices the faces were rendered with, not the current ones
+    const LightState& state = pair.second;
+    first_face_indices_[pair.first] = gpu_faces_.size();
+    glm::mat4 projection_matrix = GetFaceProjectionMatrix(state.rendered_range);
+    for (unsigned face = 0; face < kFaceCount; ++face) {
+      glm::mat4 camera_matrix = GetFaceCameraMatrix(face, state.rendered_position);
+      gpu_faces_.push_back(GpuShadowFace{projection_matrix * camera_matrix,
+                                         atlas_.GetTileRect(allocation->tiles[face])});
+    }
+  }
+
+  GpuShadowFaceHeader header;
+  GLuint64 bindless_handle = atlas_.GetTexture().bindless_handle();
+  std::memcpy(&header.atlas_id, &bindless_handle, sizeof(bindless_handle));
+  header.padding = glm::uvec2(0);
+
+  // Empty buffers can't be bound, but the header is always there
+  size_t faces_size = gpu_faces_.size() * sizeof(GpuShadowFace);
+  gl::Bind(face_buffer_);
+  face_buffer_.data(sizeof(header) + faces_size, nullptr, gl::kStreamDraw);
+  face_buffer_.subData(0, sizeof(header), &header);
+  if (faces_size != 0) {
+    face_buffer_.subData(sizeof(header), faces_size, gpu_faces_.data());
+  }
+  gl::Unbind(face_buffer_);
+}
+
+void PointLightShadows::Bind() const {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kShadowFaceBufferBinding, face_buffer_.expose());
+}
+
+int PointLightShadows::GetFirstFaceIndex(const PointLightSource* light) const {
+  auto iter = first_face_indices_.find(light);
+  return iter != first_face_indices_.end() ? iter->second : -1;
+}
+
+float PointLightShadows::GetShadowRange(const PointLightSource& light, const ICamera& camera) {
+  // The lights without falloff have infinite range
+  return std::min(light.GetRange(), float(camera.GetZFar()));
+}
+
+glm::mat4 PointLightShadows::GetFaceProjectionMatrix(float range) {
+  float z_near = std::min(0.05f, 0.01f * range);
+  return glm::perspective<float>(M_PI_2, 1.0f, z_near, range);
+}
+
+glm::mat4 PointLightShadows::GetFaceCameraMatrix(unsigned face, const glm::vec3& position) {
+  // In the order of the cube map faces: +x, -x, +y, -y, +z, -z
+  static const glm::vec3 kDirections[kFaceCount] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}
+  };
+  static const glm::vec3 kUps[kFaceCount] = {
+    {0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}
+  };
+  return glm::lookAt(position, position + kDirections[face], kUps[face]);
+}
+
+}  // namespace Silice3D
@@ -0,0 +1,104 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_POINT_LIGHT_SHADOWS_HPP_
+#define SILICE3D_LIGHTING_POINT_LIGHT_SHADOWS_HPP_
+
+#include <map>
+#include <set>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/lighting/shadow_atlas.hpp>
+
+namespace Silice3D {
+
+class Scene;
+class ICamera;
+class PointLightSource;
+class ShadowCasterCamera;
+
+// Renders the shadows of the point lights that cast them into the six faces
+// of a cube, each face being a tile of a shared ShadowAtlas. The tile sizes
+// depend on the screen size of the lights' spheres, and the lights outside
+// of the view are less important. The faces are uploaded into a shader
+// storage buffer, that lighting.frag reads.
+class PointLightShadows {
+ public:
+  // The shader storage buffer binding, see lighting.frag
+  static constexpr GLuint kShadowFaceBufferBinding = 11;
+  static constexpr unsigned kFaceCount = 6;
+  // The importance of the lights, whose spheres aren't visible, is scaled by this
+  static constexpr float kOffscreenImportance = 0.1f;
+  // The relative change of the ideal tile size, that is required to switch
+  // to an other tile size, to avoid re-rendering at the transitions.
+  static constexpr float kTileSizeHysteresis = 0.2f;
+
+  PointLightShadows(Scene* scene, unsigned atlas_size = 4096,
+                    unsigned min_tile_size = 128, unsigned max_tile_size = 1024);
+  ~PointLightShadows();
+
+  // Assigns the tiles, renders the scheduled ones, and uploads the faces.
+  void Update(const ICamera& camera, const std::set<PointLightSource*>& lights);
+
+  // Binds the face buffer to its indexed binding point.
+  void Bind() const;
+
+  // The index of the light's first face in the face buffer, or -1 if its
+  // shadows aren't available in this frame.
+  int GetFirstFaceIndex(const PointLightSource* light) const;
+
+  ShadowAtlas& GetAtlas() { return atlas_; }
+  const ShadowAtlas& GetAtlas() const { return atlas_; }
+
+  unsigned GetMaxTileSize() const { return max_tile_size_; }
+  void SetMaxTileSize(unsigned value) { max_tile_size_ = value; }
+
+ private:
+  // The std430 layout of a face in lighting.frag
+  struct GpuShadowFace {
+    glm::mat4 shadow_cp;
+    glm::vec4 tile_rect;
+  };
+
+  // The std430 layout of the face buffer's header in lighting.frag
+  struct GpuShadowFaceHeader {
+    glm::uvec2 atlas_id;
+    glm::uvec2 padding;
+  };
+
+  struct LightState {
+    unsigned tile_size = 0;
+    glm::vec3 position = glm::vec3(0.0f);
+    float range = 0.0f;
+    // The light's sphere, when its faces were rendered
+    glm::vec3 rendered_position = glm::vec3(0.0f);
+    float rendered_range = 0.0f;
+  };
+
+  Scene* scene_;
+  ShadowAtlas atlas_;
+  unsigned max_tile_size_;
+  uint64_t static_casters_version_ = 0;
+
+  std::vector<std::unique_ptr<ShadowCasterCamera>> face_cameras_;
+  std::map<const PointLightSource*, LightState> light_states_;
+  std::vector<ShadowAtlas::Request> requests_;
+
+  std::map<const PointLightSource*, int> first_face_indices_;
+  std::vector<GpuShadowFace> gpu_faces_;
+  gl::ArrayBuffer face_buffer_;
+
+  unsigned SelectTileSize(float screen_size, unsigned current_tile_size) const;
+  void RenderFaces(LightState* state, const ShadowAtlas::Allocation& allocation);
+  void UploadFaces();
+
+  static float GetShadowRange(const PointLightSource& light, const ICamera& camera);
+  static glm::mat4 GetFaceProjectionMatrix(float range);
+  static glm::mat4 GetFaceCameraMatrix(unsigned face, const glm::vec3& position);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_POINT_LIGHT_SHADOWS_HPP_
@@ -1,5 +1,9 @@
 // Copyright (c) Tamas Csala
 
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
 #include <Silice3D/lighting/point_light_source.hpp>
 #include <Silice3D/core/scene.hpp>
 
@@ -11,6 +15,22 @@ PointLightSource::PointLightSource(GameObject* parent,
   : LightSource(parent, color), attenuation_(attenuation)
 { }
 
+float PointLightSource::GetRange() const {
+  // Solve color / (a*d^2 + b*d + c) = kMinIntensity for d
+  glm::vec3 color = GetColor();
+  float threshold = std::max(std::max(color.r, color.g), color.b) / kMinIntensity;
+  float a = attenuation_.x, b = attenuation_.y, c = attenuation_.z - threshold;
+  if (c >= 0) {
+    return 0.0f;
+  } else if (a > 0) {
+    return (-b + std::sqrt(b*b - 4*a*c)) / (2*a);
+  } else if (b > 0) {
+    return -c / b;
+  } else {
+    return std::numeric_limits<float>::max();  // no falloff
+  }
+}
+
 void PointLightSource::AddedToScene() {
   GetScene()->RegisterLightSource(this);
 }
@@ -15,9 +15,21 @@ public:
   glm::vec3 GetAttenuation() const { return attenuation_; }
   void SetAttenuation(const glm::vec3& attenuation) { attenuation_ = attenuation; }
 
+  // The distance where the light's attenuated intensity drops below
+  // kMinIntensity, the lighting ignores it beyond that.
+  float GetRange() const;
+
+  static constexpr float kMinIntensity = 1.0f / 256.0f;
+
+  // The shadows of the point lights are rendered into the scene's shared
+  // shadow atlas (see PointLightShadows), they are disabled by default.
+  bool GetCastsShadows() const { return casts_shadows_; }
+  void SetCastsShadows(bool value) { casts_shadows_ = value; }
+
 private:
   // .x: quadratic, .y: linear, .z: constant
   glm::vec3 attenuation_ = {0, 0, 1};
+  bool casts_shadows_ = false;
 
   virtual void AddedToScene() override;
   virtual void RemovedFromScene() override;
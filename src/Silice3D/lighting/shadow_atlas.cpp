@@ -0,0 +1,52 @@
+// Copyright (c) Tamas Csala
+
+#include <Silice3D/lighting/shadow_atlas.hpp>
+
+namespace Silice3D {
+
+ShadowAtlas::ShadowAtlas(unsigned size, unsigned min_tile_size)
+    : ShadowAtlasAllocator(size, min_tile_size) {
+  gl::Bind(depth_tex_);
+  depth_tex_.upload(static_cast<gl::enums::PixelDataInternalFormat>(GL_DEPTH_COMPONENT32),
+                    GetSize(), GetSize(), gl::kDepthComponent, gl::kFloat, nullptr);
+  depth_tex_.minFilter(gl::kLinear);
+  depth_tex_.magFilter(gl::kLinear);
+  depth_tex_.wrapS(gl::kClampToEdge);
+  depth_tex_.wrapT(gl::kClampToEdge);
+  depth_tex_.compareFunc(gl::kLequal);
+  depth_tex_.compareMode(gl::kCompareRefToTexture);
+  gl::Unbind(depth_tex_);
+
+  gl::Bind(fbo_);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_tex_.expose(), 0);
+  gl::DrawBuffer(gl::kNone);
+  gl::ReadBuffer(gl::kNone);
+  fbo_.validate();
+  gl::Unbind(fbo_);
+
+  depth_tex_.makeBindless();
+  depth_tex_.makeResident();
+}
+
+void ShadowAtlas::BeginTile(const Tile& tile) {
+  if (!rendering_tiles_) {
+    glGetIntegerv(GL_VIEWPORT, viewport_);
+    gl::Bind(fbo_);
+    glEnable(GL_SCISSOR_TEST);
+    rendering_tiles_ = true;
+  }
+  gl::Viewport(tile.offset.x, tile.offset.y, tile.size, tile.size);
+  glScissor(tile.offset.x, tile.offset.y, tile.size, tile.size);
+  gl::Clear().Depth();
+}
+
+void ShadowAtlas::EndTiles() {
+  if (rendering_tiles_) {
+    glDisable(GL_SCISSOR_TEST);
+    gl::Unbind(fbo_);
+    gl::Viewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+    rendering_tiles_ = false;
+  }
+}
+
+}  // namespace Silice3D
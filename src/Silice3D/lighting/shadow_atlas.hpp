@@ -0,0 +1,35 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_SHADOW_ATLAS_HPP_
+#define SILICE3D_LIGHTING_SHADOW_ATLAS_HPP_
+
+#include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/lighting/shadow_atlas_allocator.hpp>
+
+namespace Silice3D {
+
+// A single depth texture, that the shadow maps of many lights share. Its tiles
+// are assigned by the ShadowAtlasAllocator, this adds the texture, and the
+// framebuffer that renders into the tiles.
+class ShadowAtlas : public ShadowAtlasAllocator {
+ public:
+  explicit ShadowAtlas(unsigned size = 4096, unsigned min_tile_size = 128);
+
+  gl::Texture2D& GetTexture() { return depth_tex_; }
+  const gl::Texture2D& GetTexture() const { return depth_tex_; }
+
+  // Binds the atlas' framebuffer, restricts the rendering to the tile and
+  // clears its depth. EndTiles restores the viewport after the last tile.
+  void BeginTile(const Tile& tile);
+  void EndTiles();
+
+ private:
+  gl::Texture2D depth_tex_;
+  gl::Framebuffer fbo_;
+  bool rendering_tiles_ = false;
+  GLint viewport_[4] = {0, 0, 0, 0};
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_SHADOW_ATLAS_HPP_
@@ -0,0 +1,271 @@
+// Copyright (c) Tamas Csala
+
+#include <algorithm>
+
+#include <Silice3D/lighting/shadow_atlas_allocator.hpp>
+
+namespace Silice3D {
+
+ShadowAtlasAllocator::ShadowAtlasAllocator(unsigned size, unsigned min_tile_size)
+    : size_(size), min_tile_size_(std::min(std::max(min_tile_size, 1u), size)) {
+  unsigned level_count = 1;
+  while ((size_ >> level_count) >= min_tile_size_) {
+    level_count++;
+  }
+  free_tiles_.resize(level_count);
+  free_tiles_[0].push_back(glm::uvec2(0));
+
+  stats_.total_texel_count = size_t(size_) * size_;
+}
+
+void ShadowAtlasAllocator::Update(const std::vector<Request>& requests) {
+  frame_++;
+
+  std::vector<const Request*> order;
+  for (const Request& request : requests) {
+    order.push_back(&request);
+  }
+  std::stable_sort(order.begin(), order.end(), [](const Request* a, const Request* b) {
+    return a->importance > b->importance;
+  });
+
+  // If the requests don't fit, the least important ones get smaller tiles
+  // first, so as many owners as possible get at least the smallest tiles
+  std::map<const void*, unsigned> tile_sizes;
+  size_t requested_texel_count = 0;
+  for (const Request* request : order) {
+    unsigned tile_size = size_ >> GetLevel(request->tile_size);
+    tile_sizes[request->owner] = tile_size;
+    requested_texel_count += size_t(request->tile_count) * tile_size * tile_size;
+  }
+  for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+    unsigned& tile_size = tile_sizes[(*iter)->owner];
+    while (requested_texel_count > stats_.total_texel_count && tile_size > min_tile_size_) {
+      requested_texel_count -= size_t((*iter)->tile_count) * (tile_size * tile_size * 3 / 4);
+      tile_size /= 2;
+    }
+  }
+
+  // Release the tiles of the owners that aren't requested anymore, or that
+  // need different tiles than before
+  std::map<const void*, const Request*> requested;
+  for (const Request& request : requests) {
+    requested[request.owner] = &request;
+  }
+  for (auto iter = allocations_.begin(); iter != allocations_.end();) {
+    auto request = requested.find(iter->first);
+    if (request == requested.end() ||
+        request->second->tile_count != iter->second.tiles.size() ||
+        tile_sizes[iter->first] != iter->second.requested_tile_size) {
+      FreeTiles(iter->second.tiles);
+      iter = allocations_.erase(iter);
+    } else {
+      iter->second.importance = request->second->importance;
+      iter->second.dirty = iter->second.dirty || request->second->changed;
+      ++iter;
+    }
+  }
+
+  // The most important requests are served first, they can evict the less
+  // important ones, and only get smaller tiles if that isn't enough (the
+  // free space can be fragmented)
+  stats_.denied_count = 0;
+  for (const Request* request : order) {
+    if (allocations_.count(request->owner) != 0 || request->tile_count == 0) {
+      continue;
+    }
+
+    std::vector<Tile> tiles;
+    unsigned tile_size = tile_sizes[request->owner];
+    bool allocated = AllocateTiles(request->tile_count, tile_size, &tiles);
+    while (!allocated && EvictLessImportant(request->importance)) {
+      allocated = AllocateTiles(request->tile_count, tile_size, &tiles);
+    }
+    while (!allocated && tile_size > min_tile_size_) {
+      tile_size /= 2;
+      allocated = AllocateTiles(request->tile_count, tile_size, &tiles);
+    }
+
+    if (allocated) {
+      Allocation& allocation = allocations_[request->owner];
+      allocation.tiles = std::move(tiles);
+      allocation.requested_tile_size = tile_sizes[request->owner];
+      allocation.importance = request->importance;
+    } else {
+      stats_.denied_count++;
+    }
+  }
+
+  ScheduleUpdates();
+
+  stats_.requested_count = requests.size();
+  stats_.allocated_count = allocations_.size();
+  stats_.tile_count = 0;
+  stats_.used_texel_count = 0;
+  for (const auto& pair : allocations_) {
+    for (const Tile& tile : pair.second.tiles) {
+      stats_.tile_count++;
+      stats_.used_texel_count += size_t(tile.size) * tile.size;
+    }
+  }
+}
+
+void ShadowAtlasAllocator::ScheduleUpdates() {
+  // The invalid tiles first, by importance, then the others by their
+  // importance weighted by the time since their last update
+  struct Candidate {
+    bool dirty;
+    float priority;
+    const void* owner;
+    Allocation* allocation;
+  };
+  std::vector<Candidate> candidates;
+  for (auto& pair : allocations_) {
+    Allocation& allocation = pair.second;
+    bool dirty = allocation.dirty || !allocation.valid;
+    float age = frame_ - allocation.last_update_frame;
+    float priority = dirty ? allocation.importance : allocation.importance * age;
+    candidates.push_back(Candidate{dirty, priority, pair.first, &allocation});
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+    if (a.dirty != b.dirty) {
+      return a.dirty;
+    }
+    return a.priority > b.priority;
+  });
+
+  scheduled_updates_.clear();
+  size_t remaining_budget = update_budget_;
+  stats_.updated_tile_count = 0;
+  for (const Candidate& candidate : candidates) {
+    size_t tile_count = candidate.allocation->tiles.size();
+    if (tile_count > remaining_budget && !scheduled_updates_.empty()) {
+      continue;
+    }
+    scheduled_updates_.push_back(candidate.owner);
+    remaining_budget -= std::min(tile_count, remaining_budget);
+    stats_.updated_tile_count += tile_count;
+
+    candidate.allocation->dirty = false;
+    candidate.allocation->valid = true;
+    candidate.allocation->last_update_frame = frame_;
+  }
+}
+
+const ShadowAtlasAllocator::Allocation* ShadowAtlasAllocator::GetAllocation(
+    const void* owner) const {
+  auto iter = allocations_.find(owner);
+  return iter != allocations_.end() ? &iter->second : nullptr;
+}
+
+glm::vec4 ShadowAtlasAllocator::GetTileRect(const Tile& tile) const {
+  glm::vec2 min = glm::vec2(tile.offset) / float(size_);
+  glm::vec2 max = glm::vec2(tile.offset + glm::uvec2(tile.size)) / float(size_);
+  return glm::vec4(min, max);
+}
+
+std::vector<std::vector<glm::uvec2>> ShadowAtlasAllocator::GetFreeTiles() const {
+  std::vector<std::vector<glm::uvec2>> free_tiles = free_tiles_;
+  for (std::vector<glm::uvec2>& level : free_tiles) {
+    std::sort(level.begin(), level.end(), [](const glm::uvec2& a, const glm::uvec2& b) {
+      return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+  }
+  return free_tiles;
+}
+
+unsigned ShadowAtlasAllocator::GetLevel(unsigned tile_size) const {
+  // The largest tile that isn't larger than tile_size (but at least the
+  // smallest one), and never the whole atlas
+  unsigned level = 1;
+  while (level + 1 < free_tiles_.size() && (size_ >> level) > tile_size) {
+    level++;
+  }
+  return std::min<unsigned>(level, free_tiles_.size() - 1);
+}
+
+bool ShadowAtlasAllocator::AllocateTile(unsigned level, glm::uvec2* offset) {
+  std::vector<glm::uvec2>& free_tiles = free_tiles_[level];
+  if (!free_tiles.empty()) {
+    *offset = free_tiles.back();
+    free_tiles.pop_back();
+    return true;
+  }
+  if (level == 0) {
+    return false;
+  }
+
+  // Split a larger tile, and keep three of its quarters
+  glm::uvec2 parent;
+  if (!AllocateTile(level - 1, &parent)) {
+    return false;
+  }
+  unsigned tile_size = size_ >> level;
+  free_tiles.push_back(parent + glm::uvec2(tile_size, 0));
+  free_tiles.push_back(parent + glm::uvec2(0, tile_size));
+  free_tiles.push_back(parent + glm::uvec2(tile_size, tile_size));
+  *offset = parent;
+  return true;
+}
+
+void ShadowAtlasAllocator::FreeTile(unsigned level, const glm::uvec2& offset) {
+  std::vector<glm::uvec2>& free_tiles = free_tiles_[level];
+  if (level > 0) {
+    // Merge the tile with its buddies, if they are all free
+    unsigned parent_size = size_ >> (level - 1);
+    glm::uvec2 parent = offset / parent_size * parent_size;
+    auto is_buddy = [&](const glm::uvec2& tile) {
+      return tile / parent_size * parent_size == parent;
+    };
+    if (std::count_if(free_tiles.begin(), free_tiles.end(), is_buddy) == 3) {
+      free_tiles.erase(std::remove_if(free_tiles.begin(), free_tiles.end(), is_buddy),
+                       free_tiles.end());
+      FreeTile(level - 1, parent);
+      return;
+    }
+  }
+  free_tiles.push_back(offset);
+}
+
+bool ShadowAtlasAllocator::AllocateTiles(unsigned tile_count, unsigned tile_size,
+                                         std::vector<Tile>* tiles) {
+  unsigned level = GetLevel(tile_size);
+  tiles->clear();
+  for (unsigned i = 0; i < tile_count; ++i) {
+    Tile tile;
+    tile.size = size_ >> level;
+    if (!AllocateTile(level, &tile.offset)) {
+      FreeTiles(*tiles);
+      tiles->clear();
+      return false;
+    }
+    tiles->push_back(tile);
+  }
+  return true;
+}
+
+void ShadowAtlasAllocator::FreeTiles(const std::vector<Tile>& tiles) {
+  for (const Tile& tile : tiles) {
+    FreeTile(GetLevel(tile.size), tile.offset);
+  }
+}
+
+bool ShadowAtlasAllocator::EvictLessImportant(float importance) {
+  auto least_important = allocations_.end();
+  for (auto iter = allocations_.begin(); iter != allocations_.end(); ++iter) {
+    if (iter->second.importance < importance &&
+        (least_important == allocations_.end() ||
+         iter->second.importance < least_important->second.importance)) {
+      least_important = iter;
+    }
+  }
+  if (least_important == allocations_.end()) {
+    return false;
+  }
+
+  FreeTiles(least_important->second.tiles);
+  allocations_.erase(least_important);
+  return true;
+}
+
+}  // namespace Silice3D
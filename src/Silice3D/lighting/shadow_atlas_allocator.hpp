@@ -0,0 +1,125 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_SHADOW_ATLAS_ALLOCATOR_HPP_
+#define SILICE3D_LIGHTING_SHADOW_ATLAS_ALLOCATOR_HPP_
+
+#include <map>
+#include <vector>
+#include <cstdint>
+
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// Assigns the square tiles of a ShadowAtlas to the owners (the lights), that
+// request them every frame, in the order of their importance. If the requests
+// don't fit, the less important owners get smaller tiles, or are evicted. The
+// tiles are power of two sized, and are managed by a buddy allocator, so the
+// memory doesn't grow with the number of shadowed lights, only their
+// resolution drops.
+//
+// Only a limited number of tiles are rendered every frame: the new and
+// changed ones first, and then the rest, in the order of their importance
+// multiplied by the frames since their last update.
+//
+// This is only the bookkeeping, it doesn't need an OpenGL context, the
+// texture is owned by the ShadowAtlas.
+class ShadowAtlasAllocator {
+ public:
+  struct Tile {
+    glm::uvec2 offset;
+    unsigned size = 0;
+  };
+
+  struct Request {
+    const void* owner;
+    unsigned tile_count;
+    unsigned tile_size;
+    float importance;
+    // The content of the owner's tiles is outdated (for ex. the light moved)
+    bool changed;
+  };
+
+  struct Allocation {
+    std::vector<Tile> tiles;
+    // The tile size that was assigned to the request (smaller than the
+    // requested one if the atlas is full), the tiles themselves can be even
+    // smaller, if the free space was fragmented
+    unsigned requested_tile_size = 0;
+    float importance = 0.0f;
+    // The tiles can only be sampled once they have been rendered
+    bool valid = false;
+    bool dirty = true;
+    uint64_t last_update_frame = 0;
+  };
+
+  struct Stats {
+    size_t requested_count = 0;
+    size_t allocated_count = 0;
+    size_t denied_count = 0;
+    size_t tile_count = 0;
+    size_t updated_tile_count = 0;
+    size_t used_texel_count = 0;
+    size_t total_texel_count = 0;
+
+    float GetOccupancy() const {
+      return total_texel_count == 0 ? 0.0f : float(used_texel_count) / total_texel_count;
+    }
+  };
+
+  explicit ShadowAtlasAllocator(unsigned size = 4096, unsigned min_tile_size = 128);
+
+  // Assigns the tiles for this frame's requests, and schedules the updates.
+  // The owners that aren't requested lose their tiles.
+  void Update(const std::vector<Request>& requests);
+
+  // Returns nullptr if the owner didn't get any tiles.
+  const Allocation* GetAllocation(const void* owner) const;
+
+  // The owners whose tiles have to be rendered in this frame (after Update),
+  // their allocations are considered valid after it.
+  const std::vector<const void*>& GetScheduledUpdates() const { return scheduled_updates_; }
+
+  // The number of tiles that are rendered in a frame. An owner's tiles are
+  // updated together, and at least one owner is updated in every frame, even
+  // if it has more tiles than the budget.
+  unsigned GetUpdateBudget() const { return update_budget_; }
+  void SetUpdateBudget(unsigned value) { update_budget_ = value; }
+
+  const Stats& GetStats() const { return stats_; }
+
+  unsigned GetSize() const { return size_; }
+  unsigned GetMinTileSize() const { return min_tile_size_; }
+  unsigned GetMaxTileSize() const { return size_ >> 1; }
+
+  // The tile's area in texture coordinates: min x, min y, max x, max y
+  glm::vec4 GetTileRect(const Tile& tile) const;
+
+  // The free tiles of every level (for ex. the sizes of the free tiles
+  // are size >> level), sorted by their offsets
+  std::vector<std::vector<glm::uvec2>> GetFreeTiles() const;
+
+ private:
+  unsigned size_, min_tile_size_;
+  unsigned update_budget_ = 24;
+  uint64_t frame_ = 0;
+
+  // The free tiles of every level, the level's tile size is size_ >> level
+  std::vector<std::vector<glm::uvec2>> free_tiles_;
+  std::map<const void*, Allocation> allocations_;
+  std::vector<const void*> scheduled_updates_;
+  Stats stats_;
+
+  unsigned GetLevel(unsigned tile_size) const;
+  bool AllocateTile(unsigned level, glm::uvec2* offset);
+  void FreeTile(unsigned level, const glm::uvec2& offset);
+  bool AllocateTiles(unsigned tile_count, unsigned tile_size, std::vector<Tile>* tiles);
+  void FreeTiles(const std::vector<Tile>& tiles);
+  // Frees the least important allocation, if it's less important than importance.
+  bool EvictLessImportant(float importance);
+  void ScheduleUpdates();
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_SHADOW_ATLAS_ALLOCATOR_HPP_
@@ -1,11 +1,15 @@
 // Copyright (c) Tamas Csala
 
+#include <cmath>
 #include <vector>
 #include <Silice3D/common/oglwrap.hpp>
+#include <Silice3D/common/make_unique.hpp>
 
 #include <Silice3D/lighting/shadow_caster.hpp>
+#include <Silice3D/lighting/shadow_caster_camera.hpp>
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/camera/perspective_camera.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
 
 namespace Silice3D {
 
@@ -14,7 +18,15 @@ ShadowCaster::ShadowCaster(GameObject* parent, size_t shadow_map_size, size_t ca
     , fbos_(cascades_count)
     , w_(0), h_(0)
     , size_(shadow_map_size)
-    , target_bounding_spheres_(cascades_count) {
+    , target_bounding_spheres_(cascades_count)
+    , cascade_bounding_spheres_(cascades_count)
+    , static_cache_dirty_(cascades_count, true)
+    , static_cache_versions_(cascades_count, 0) {
+  for (size_t i = 0; i < cascades_count; ++i) {
+    cascade_cameras_.push_back(make_unique<ShadowCasterCamera>(
+        this, GetTransform(), glm::mat4{}, glm::mat4{}, 0.0f));
+  }
+
   assert(dynamic_cast<DirectionalLightSource*>(parent) != nullptr);
   gl::Bind(depth_tex_);
   depth_tex_.upload(static_cast<gl::enums::PixelDataInternalFormat>(GL_DEPTH_COMPONENT32),
@@ -41,22 +53,61 @@ ShadowCaster::ShadowCaster(GameObject* parent, size_t shadow_map_size, size_t ca
 
   depth_tex_.makeBindless();
   depth_tex_.makeResident();
+
+  // The cached depth of the static casters is only copied, never sampled
+  gl::Bind(static_depth_tex_);
+  static_depth_tex_.upload(static_cast<gl::enums::PixelDataInternalFormat>(GL_DEPTH_COMPONENT32),
+                           size_, size_, cascades_count, gl::kDepthComponent, gl::kFloat, nullptr);
+  static_depth_tex_.minFilter(gl::kNearest);
+  static_depth_tex_.magFilter(gl::kNearest);
+  gl::Unbind(static_depth_tex_);
+
+  static_fbos_.resize(cascades_count);
+  for (int i = 0; i < static_fbos_.size(); ++i) {
+    gl::Bind(static_fbos_[i]);
+    static_fbos_[i].attachTextureLayer(gl::kDepthAttachment, static_depth_tex_, 0, i);
+    gl::DrawBuffer(gl::kNone);
+    gl::ReadBuffer(gl::kNone);
+    static_fbos_[i].validate();
+    gl::Unbind(static_fbos_[i]);
+  }
+
+  gl::Bind(layered_fbo_);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_tex_.expose(), 0);
+  gl::DrawBuffer(gl::kNone);
+  gl::ReadBuffer(gl::kNone);
+  layered_fbo_.validate();
+  gl::Unbind(layered_fbo_);
+
+  gl::Bind(static_layered_fbo_);
+  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, static_depth_tex_.expose(), 0);
+  gl::DrawBuffer(gl::kNone);
+  gl::ReadBuffer(gl::kNone);
+  static_layered_fbo_.validate();
+  gl::Unbind(static_layered_fbo_);
+
+  gl::Bind(layer_matrix_buffer_);
+  layer_matrix_buffer_.data(FrameUniforms::kMaxShadowLayers * sizeof(glm::mat4), nullptr,
+                            gl::kDynamicDraw);
+  gl::Unbind(layer_matrix_buffer_);
 }
 
+ShadowCaster::~ShadowCaster() = default;
+
 void ShadowCaster::ScreenResized(size_t width, size_t height) {
   w_ = width;
   h_ = height;
 }
 
 glm::mat4 ShadowCaster::GetProjectionMatrix(unsigned cascade_idx) const {
-  float size = target_bounding_spheres_[cascade_idx].w;
+  float size = cascade_bounding_spheres_[cascade_idx].w;
   return glm::ortho<float>(-size, size, -size, size, 0, 2*z_far_);
 }
 
 glm::mat4 ShadowCaster::GetCameraMatrix(unsigned cascade_idx) const {
   return glm::lookAt(
-    glm::vec3(target_bounding_spheres_[cascade_idx]) + z_far_ * glm::normalize(glm::vec3(GetTransform().GetPos())),
-    glm::vec3(target_bounding_spheres_[cascade_idx]),
+    glm::vec3(cascade_bounding_spheres_[cascade_idx]) + z_far_ * light_dir_,
+    glm::vec3(cascade_bounding_spheres_[cascade_idx]),
     glm::vec3(0, 1, 0));
 }
 
@@ -68,52 +119,139 @@ const gl::Texture2DArray& ShadowCaster::GetShadowTexture() const {
   return depth_tex_;
 }
 
-class ShadowCasterCamera : public ICamera {
-public:
-  ShadowCasterCamera (GameObject* parent,
-                      Transform transform,
-                      const glm::mat4& projection_matrix,
-                      const glm::mat4& camera_matrix,
-                      float z_far)
-      : ICamera(parent, transform)
-      , projection_matrix_(projection_matrix)
-      , camera_matrix_(camera_matrix)
-      , z_far_(z_far)
-  {
-    UpdateFrustum();
+void ShadowCaster::FillShadowMap(Scene* scene) {
+  if (layered_rendering_ && fbos_.size() <= FrameUniforms::kMaxShadowLayers) {
+    gl::Viewport(0, 0, size_, size_);
+    FillShadowMapLayered(scene);
+    gl::Viewport(0, 0, w_, h_);
+    frame_++;
+    return;
   }
 
-  virtual const glm::mat4& GetProjectionMatrix() const override {
-    return projection_matrix_;
+  uint64_t static_version = scene->GetStaticShadowCastersVersion();
+  gl::Viewport(0, 0, size_, size_);
+  for (int i = 0; i < fbos_.size(); ++i) {
+    if (!caching_) {
+      gl::Bind(fbos_[i]);
+      gl::Clear().Depth();
+      scene->RenderDepthOnlyRecursive(*cascade_cameras_[i]);
+      gl::Unbind(fbos_[i]);
+      continue;
+    }
+
+    bool refresh_static = static_cache_dirty_[i] || static_cache_versions_[i] != static_version;
+    if (!refresh_static && !IsCascadeScheduled(i)) {
+      continue;  // keeps its shadows from an earlier frame
+    }
+
+    if (refresh_static) {
+      gl::Bind(static_fbos_[i]);
+      gl::Clear().Depth();
+      scene->RenderStaticShadowCasters(*cascade_cameras_[i]);
+      gl::Unbind(static_fbos_[i]);
+      static_cache_dirty_[i] = false;
+      static_cache_versions_[i] = static_version;
+    }
+
+    // Start from the static depth, and add the dynamic casters on top of it
+    glCopyImageSubData(static_depth_tex_.expose(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                       depth_tex_.expose(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size_, size_, 1);
+    gl::Bind(fbos_[i]);
+    scene->RenderDynamicShadowCasters(*cascade_cameras_[i]);
+    gl::Unbind(fbos_[i]);
   }
+  gl::Viewport(0, 0, w_, h_);
+  frame_++;
+}
 
-  virtual const glm::mat4& GetCameraMatrix() const override {
-   return camera_matrix_;
+void ShadowCaster::FillShadowMapLayered(Scene* scene) {
+  std::vector<glm::mat4> layer_matrices(fbos_.size());
+  std::vector<const ICamera*> all_layers(fbos_.size());
+  for (size_t i = 0; i < fbos_.size(); ++i) {
+    all_layers[i] = cascade_cameras_[i].get();
+    layer_matrices[i] = GetProjectionMatrix(i) * GetCameraMatrix(i);
   }
+  gl::Bind(layer_matrix_buffer_);
+  layer_matrix_buffer_.subData(0, layer_matrices.size() * sizeof(glm::mat4), layer_matrices.data());
+  gl::Unbind(layer_matrix_buffer_);
+  glBindBufferBase(GL_UNIFORM_BUFFER, FrameUniforms::kShadowLayerBlockBinding,
+                   layer_matrix_buffer_.expose());
 
-  virtual double GetFovx() const override { return M_PI_2; }
-  virtual double GetFovy() const override { return M_PI_2; }
-  virtual double GetZNear() const override { return 0.0; }
-  virtual double GetZFar() const override { return z_far_; }
+  if (!caching_) {
+    gl::Bind(layered_fbo_);
+    gl::Clear().Depth();
+    scene->RenderLayeredShadowCasters(all_layers, Scene::ShadowCasters::kAll);
+    gl::Unbind(layered_fbo_);
+    return;
+  }
 
-private:
-  glm::mat4 projection_matrix_;
-  glm::mat4 camera_matrix_;
-  float z_far_;
-};
+  // Same as the per cascade passes, but the cascades that don't need an
+  // update are skipped by leaving their cameras out of the passes
+  uint64_t static_version = scene->GetStaticShadowCastersVersion();
+  std::vector<const ICamera*> static_layers(fbos_.size(), nullptr);
+  std::vector<const ICamera*> dynamic_layers(fbos_.size(), nullptr);
+  bool has_static_layers = false, has_dynamic_layers = false;
+  for (size_t i = 0; i < fbos_.size(); ++i) {
+    bool refresh_static = static_cache_dirty_[i] || static_cache_versions_[i] != static_version;
+    if (refresh_static) {
+      // Clearing the layered framebuffer would clear the valid layers too
+      float clear_depth = 1.0f;
+      glClearTexSubImage(static_depth_tex_.expose(), 0, 0, 0, i, size_, size_, 1,
+                         GL_DEPTH_COMPONENT, GL_FLOAT, &clear_depth);
+      static_layers[i] = all_layers[i];
+      has_static_layers = true;
+      static_cache_dirty_[i] = false;
+      static_cache_versions_[i] = static_version;
+    }
+    if (refresh_static || IsCascadeScheduled(i)) {
+      dynamic_layers[i] = all_layers[i];
+      has_dynamic_layers = true;
+    }
+  }
 
-void ShadowCaster::FillShadowMap(Scene* scene) {
-  for (int i = 0; i < fbos_.size(); ++i) {
-    gl::Bind(fbos_[i]);
-    gl::Clear().Color().Depth();
-    gl::Viewport(0, 0, size_, size_);
+  if (has_static_layers) {
+    gl::Bind(static_layered_fbo_);
+    scene->RenderLayeredShadowCasters(static_layers, Scene::ShadowCasters::kStatic);
+    gl::Unbind(static_layered_fbo_);
+  }
 
-    ShadowCasterCamera shadowCamera(this, GetTransform(), GetProjectionMatrix(i), GetCameraMatrix(i), z_far_);
-    scene->RenderDepthOnlyRecursive(shadowCamera);
+  if (has_dynamic_layers) {
+    for (size_t i = 0; i < fbos_.size(); ++i) {
+      if (dynamic_layers[i] != nullptr) {
+        glCopyImageSubData(static_depth_tex_.expose(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, i,
+                           depth_tex_.expose(), GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, size_, size_, 1);
+      }
+    }
+    gl::Bind(layered_fbo_);
+    scene->RenderLayeredShadowCasters(dynamic_layers, Scene::ShadowCasters::kDynamic);
+    gl::Unbind(layered_fbo_);
+  }
+}
 
-    gl::Unbind(fbos_[i]);
-    gl::Viewport(0, 0, w_, h_);
+void ShadowCaster::SetCaching(bool value) {
+  caching_ = value;
+  static_cache_dirty_.assign(static_cache_dirty_.size(), true);
+}
+
+bool ShadowCaster::IsCascadeScheduled(size_t cascade_idx) const {
+  if (!staggered_updates_ || cascade_idx < kEveryFrameCascades) {
+    return true;
   }
+  // Every second frame for the first staggered cascade, every fourth for the
+  // next one..., with different phases, so they don't update in the same frame.
+  uint64_t interval = uint64_t(1) << std::min<size_t>(cascade_idx - kEveryFrameCascades + 1, 6);
+  return (frame_ + cascade_idx) % interval == 0;
+}
+
+glm::vec3 ShadowCaster::SnapToTexels(const glm::vec3& center, float radius) const {
+  // The rotation of the light's view, so the snapping is done along the
+  // texel grid of the shadow map (this makes it stable when it moves).
+  glm::mat3 light_rotation = glm::mat3(glm::lookAt(glm::vec3(0), -light_dir_, glm::vec3(0, 1, 0)));
+  float texel_size = 2*radius / size_;
+  glm::vec3 light_space_center = light_rotation * center;
+  light_space_center.x = std::floor(light_space_center.x / texel_size) * texel_size;
+  light_space_center.y = std::floor(light_space_center.y / texel_size) * texel_size;
+  return glm::transpose(light_rotation) * light_space_center;
 }
 
 size_t ShadowCaster::GetCascadesCount() const {
@@ -124,7 +262,11 @@ void ShadowCaster::Update() {
   ICamera* cam = GetScene()->GetCamera();
   glm::vec3 cam_pos = cam->GetTransform().GetPos();
   glm::vec3 cam_dir = cam->GetTransform().GetForward();
+  glm::vec3 light_dir = glm::normalize(glm::vec3(GetTransform().GetPos()));
 
+  // Every cascade's cache is invalid if the light turns, or its depth range changes
+  bool move_all = light_dir != light_dir_ || z_far_ != cam->GetZFar();
+  light_dir_ = light_dir;
   z_near_ = cam->GetZNear();
   z_far_ = cam->GetZFar();
 
@@ -134,6 +276,35 @@ void ShadowCaster::Update() {
     target_bounding_spheres_[i] = glm::vec4{cam_pos + (last_depth+max_depth)/2.0f*cam_dir, max_depth-last_depth};
     last_depth = 0.8*max_depth;
   }
+
+  for (int i = 0; i < fbos_.size(); ++i) {
+    const glm::vec4& target = target_bounding_spheres_[i];
+    glm::vec4& cascade = cascade_bounding_spheres_[i];
+    if (!caching_) {
+      cascade = target;
+      continue;
+    }
+
+    // Move the cascade if the target isn't inside it anymore, or if it got
+    // much smaller (it would waste the resolution)
+    float distance = glm::length(glm::vec3(target) - glm::vec3(cascade));
+    bool outside = distance + target.w > cascade.w;
+    bool too_large = cascade.w > target.w * cache_margin_ * cache_margin_;
+    if (move_all || outside || too_large) {
+      float radius = target.w * cache_margin_;
+      cascade = glm::vec4(SnapToTexels(glm::vec3(target), radius), radius);
+      static_cache_dirty_[i] = true;
+    }
+  }
+
+  // The scene culls against these before the shadow maps are rendered
+  for (int i = 0; i < fbos_.size(); ++i) {
+    cascade_cameras_[i]->SetMatrices(GetProjectionMatrix(i), GetCameraMatrix(i), z_far_);
+  }
+}
+
+const ICamera& ShadowCaster::GetCascadeCamera(unsigned cascade_idx) const {
+  return *cascade_cameras_[cascade_idx];
 }
 
 }
@@ -4,15 +4,23 @@
 #define SILICE3D_SHADOW_CASTER_HPP_
 
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
 #include <Silice3D/common/oglwrap.hpp>
 #include <Silice3D/core/game_object.hpp>
 
 namespace Silice3D {
 
-// TODO: Shadow caster for point lights
+class ICamera;
+class ShadowCasterCamera;
+
+// The cascaded shadow maps of a directional light. The point lights'
+// shadows are rendered by PointLightShadows.
 class ShadowCaster : public GameObject {
  public:
   ShadowCaster(GameObject* parent, size_t shadow_map_size, size_t cascades_count);
+  virtual ~ShadowCaster();
 
   gl::Texture2DArray& GetShadowTexture();
   const gl::Texture2DArray& GetShadowTexture() const;
@@ -22,17 +30,69 @@ class ShadowCaster : public GameObject {
   glm::mat4 GetProjectionMatrix(unsigned cascade_idx) const;
   glm::mat4 GetCameraMatrix(unsigned cascade_idx) const;
 
+  // The camera that renders the cascade, updated in every Update.
+  const ICamera& GetCascadeCamera(unsigned cascade_idx) const;
+
   size_t GetCascadesCount() const;
 
+  // With caching, every cascade keeps the depth of the static casters (see
+  // MeshObject::SetIsStatic) in a separate texture, and only the dynamic
+  // casters are rendered on top of a copy of it every frame. The cascades
+  // cover a larger area than needed (by the margin), and only move (snapped
+  // to their texel grid) when the camera's view leaves them, or the cache is
+  // refreshed anyway. Off by default, as it only pays off if a large part of
+  // the casters are static.
+  bool GetCaching() const { return caching_; }
+  void SetCaching(bool value);
+  float GetCacheMargin() const { return cache_margin_; }
+  void SetCacheMargin(float value) { cache_margin_ = std::max(value, 1.0f); }
+
+  // With caching, the distant cascades (after the first kEveryFrameCascades)
+  // are only updated in every second, fourth... frame, unless they moved or
+  // their static casters changed. Off by default.
+  static constexpr size_t kEveryFrameCascades = 2;
+  bool GetStaggeredUpdates() const { return staggered_updates_; }
+  void SetStaggeredUpdates(bool value) { staggered_updates_ = value; }
+
+  // With layered rendering, the cascades are rendered into the layers of the
+  // texture at once, so every mesh batch is only culled, uploaded and drawn
+  // once per pass, instead of once per cascade. Only the mesh batches are
+  // rendered this way (see Scene::RenderLayeredShadowCasters). It is only used
+  // with at most FrameUniforms::kMaxShadowLayers cascades.
+  bool GetLayeredRendering() const { return layered_rendering_; }
+  void SetLayeredRendering(bool value) { layered_rendering_ = value; }
+
  private:
-  gl::Texture2DArray depth_tex_;
-  std::vector<gl::Framebuffer> fbos_;
+  gl::Texture2DArray depth_tex_, static_depth_tex_;
+  std::vector<gl::Framebuffer> fbos_, static_fbos_;
+  // The whole textures are attached to these, for the layered passes
+  gl::Framebuffer layered_fbo_, static_layered_fbo_;
+  // The cascades' view-projection matrices, for shadow_layered.vert
+  gl::ArrayBuffer layer_matrix_buffer_;
+  bool layered_rendering_ = false;
 
   size_t w_ = 0, h_ = 0, size_ = 0;
+  // The areas that the cascades should cover, and the ones they do cover
   std::vector<glm::vec4> target_bounding_spheres_;
+  std::vector<glm::vec4> cascade_bounding_spheres_;
+  std::vector<std::unique_ptr<ShadowCasterCamera>> cascade_cameras_;
+  glm::vec3 light_dir_;
   float z_near_ = 0.0f;
   float z_far_ = 0.0f;
 
+  bool caching_ = false;
+  bool staggered_updates_ = false;
+  float cache_margin_ = 1.25f;
+  uint64_t frame_ = 0;
+  // The cascades that moved since their static depth was rendered, and the
+  // scene's static caster versions they were rendered with
+  std::vector<bool> static_cache_dirty_;
+  std::vector<uint64_t> static_cache_versions_;
+
+  glm::vec3 SnapToTexels(const glm::vec3& center, float radius) const;
+  void FillShadowMapLayered(Scene* scene);
+  bool IsCascadeScheduled(size_t cascade_idx) const;
+
   virtual void ScreenResized(size_t width, size_t height) override;
   virtual void Update() override;
 };
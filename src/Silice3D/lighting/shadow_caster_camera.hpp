@@ -0,0 +1,56 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_LIGHTING_SHADOW_CASTER_CAMERA_HPP_
+#define SILICE3D_LIGHTING_SHADOW_CASTER_CAMERA_HPP_
+
+#include <cmath>
+#include <Silice3D/camera/icamera.hpp>
+
+namespace Silice3D {
+
+// A camera with explicitly set matrices, that the shadow maps are rendered with.
+class ShadowCasterCamera : public ICamera {
+public:
+  ShadowCasterCamera (GameObject* parent,
+                      Transform transform,
+                      const glm::mat4& projection_matrix,
+                      const glm::mat4& camera_matrix,
+                      float z_far)
+      : ICamera(parent, transform)
+      , projection_matrix_(projection_matrix)
+      , camera_matrix_(camera_matrix)
+      , z_far_(z_far)
+  {
+    UpdateFrustum();
+  }
+
+  void SetMatrices(const glm::mat4& projection_matrix, const glm::mat4& camera_matrix,
+                   float z_far) {
+    projection_matrix_ = projection_matrix;
+    camera_matrix_ = camera_matrix;
+    z_far_ = z_far;
+    UpdateFrustum();
+  }
+
+  virtual const glm::mat4& GetProjectionMatrix() const override {
+    return projection_matrix_;
+  }
+
+  virtual const glm::mat4& GetCameraMatrix() const override {
+   return camera_matrix_;
+  }
+
+  virtual double GetFovx() const override { return M_PI_2; }
+  virtual double GetFovy() const override { return M_PI_2; }
+  virtual double GetZNear() const override { return 0.0; }
+  virtual double GetZFar() const override { return z_far_; }
+
+private:
+  glm::mat4 projection_matrix_;
+  glm::mat4 camera_matrix_;
+  float z_far_;
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_LIGHTING_SHADOW_CASTER_CAMERA_HPP_
@@ -5,7 +5,9 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <memory>
+#include <cstdint>
 
 namespace Silice3D {
 
@@ -20,8 +22,29 @@ public:
   virtual void ClearRenderDepthOnlyBatch() = 0;
   virtual void RenderDepthOnlyBatch(Scene* scene, const ICamera& camera) = 0;
 
+  // Renders the depth only batch into every layer of a layered framebuffer in
+  // a single pass, the i-th layer with layer_cameras[i] (nullptr skips the
+  // layer). The layers' matrices have to be bound to the shadow layer block
+  // (see FrameUniforms). The renderers that don't support it render nothing.
+  virtual void RenderLayeredDepthOnlyBatch(Scene* /*scene*/,
+                                           const std::vector<const ICamera*>& /*layer_cameras*/) {}
+
+  // Called after the batches are filled, to cull them against every view of
+  // the frame at once (see Scene::GetVisibilityFrustums).
+  virtual void CullBatches(Scene* /*scene*/) {}
+
   virtual size_t GetTriangleCount() const = 0;
 
+  // The renderers that are loaded asynchronously can't render until they are
+  // ready. FinishLoading does the loading's GL side work if the rest of it is
+  // done, and returns true if the renderer is ready after the call.
+  virtual bool IsReady() const { return true; }
+  virtual bool FinishLoading() { return true; }
+
+  // The batches are rendered in increasing order of this key. It should
+  // order them by program, then material, then front-to-back depth.
+  virtual uint64_t GetRenderSortKey() const = 0;
+
   virtual ~IMeshObjectRenderer();
 };
 using MeshRendererCache = std::map<std::string, std::unique_ptr<IMeshObjectRenderer>>;
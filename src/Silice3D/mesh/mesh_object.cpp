@@ -10,15 +10,86 @@ MeshObject::MeshObject(GameObject* parent, const std::string& mesh_path,
                        const std::string& vertex_shader)
     : GameObject(parent, initial_transform)
     , renderer_(GetMeshRenderer(mesh_path, GetScene()->GetShaderManager(),
-                                GetScene()->GetMeshCache(), vertex_shader))
-{
+                                GetScene()->GetTextureManager(),
+                                GetScene()->GetMeshCache(), vertex_shader,
+                                MeshRenderer::LodSettings{},
+                                GetScene()->GetAsyncMeshLoading() ? GetScene()->GetThreadPool()
+                                                                  : nullptr))
+    , gpu_culled_(GetScene()->GetGpuCulling())
+{ }
 
+MeshObject::~MeshObject() {
+  // The renderer is owned by the scene's mesh cache, so it's alive while the
+  // scene is, and the scene removes every object before destructing it
+  RemoveGpuInstance();
+  RemoveStaticShadowCaster();
 }
 
-MeshObject::~MeshObject() = default;
+void MeshObject::RemoveGpuInstance() {
+  if (gpu_instance_id_ != unsigned(-1)) {
+    renderer_->RemoveGpuInstance(gpu_instance_id_);
+    gpu_instance_id_ = unsigned(-1);
+  }
+}
+
+void MeshObject::RemoveStaticShadowCaster() {
+  if (is_cached_static_caster_) {
+    GetScene()->InvalidateStaticShadowCasters();
+    is_cached_static_caster_ = false;
+  }
+}
+
+void MeshObject::EnabledChanged(bool enabled) {
+  // The instance and the static caster are added back by the next Update
+  if (!enabled) {
+    RemoveGpuInstance();
+    RemoveStaticShadowCaster();
+  }
+}
+
+void MeshObject::RemovedFromScene() {
+  RemoveGpuInstance();
+  if (has_scaled_collision_shape_) {
+    // The body that uses it is only removed by the physics thread
+    GetScene()->DeleteAfterPhysicsCommands(
+        renderer_->ReleaseScaledCollisionShape(collision_shape_scale_));
+    has_scaled_collision_shape_ = false;
+  }
+  RemoveStaticShadowCaster();
+}
+
+void MeshObject::SetIsStatic(bool value) {
+  if (is_static_ != value) {
+    is_static_ = value;
+    RemoveStaticShadowCaster();
+  }
+}
 
 btCollisionShape* MeshObject::GetCollisionShape() {
-  return renderer_->GetCollisionShape();
+  return renderer_->GetCollisionShape(GetScene()->GetCollisionCacheDirectory());
+}
+
+btCollisionShape* MeshObject::GetConvexHullShape() {
+  return renderer_->GetConvexHullShape(GetScene()->GetCollisionCacheDirectory());
+}
+
+btCollisionShape* MeshObject::GetConvexDecompositionShape() {
+  return renderer_->GetConvexDecompositionShape(GetScene()->GetCollisionCacheDirectory());
+}
+
+btCollisionShape* MeshObject::GetScaledCollisionShape() {
+  glm::vec3 scale = GetTransform().GetScale();
+  // Acquire before the release, so the shape isn't freed and rebuilt if the
+  // scale is the same.
+  btCollisionShape* shape = renderer_->AcquireScaledCollisionShape(
+      scale, GetScene()->GetCollisionCacheDirectory());
+  if (has_scaled_collision_shape_) {
+    GetScene()->DeleteAfterPhysicsCommands(
+        renderer_->ReleaseScaledCollisionShape(collision_shape_scale_));
+  }
+  has_scaled_collision_shape_ = true;
+  collision_shape_scale_ = scale;
+  return shape;
 }
 
 BoundingBox MeshObject::GetBoundingBox() const {
@@ -26,14 +97,58 @@ BoundingBox MeshObject::GetBoundingBox() const {
 }
 
 void MeshObject::Update() {
-  auto bbox = GetBoundingBox();
+  if (!renderer_->IsReady()) {
+    return;  // the mesh is still loading
+  }
+
+  if (gpu_culled_) {
+    // Culling and the level of detail selection are done on the GPU,
+    // only the changed transforms have to be uploaded.
+    glm::mat4 transform = GetTransform().GetMatrix();
+    if (gpu_instance_id_ == unsigned(-1)) {
+      gpu_instance_transform_ = transform;
+      gpu_instance_id_ = renderer_->AddGpuInstance(transform);
+    } else if (transform != gpu_instance_transform_) {
+      gpu_instance_transform_ = transform;
+      renderer_->UpdateGpuInstance(gpu_instance_id_, transform);
+    }
+    return;
+  }
+
+  // Computed once, and used by the culling of both batches
+  bbox_ = GetBoundingBox();
   const auto& cam = *GetScene()->GetCamera();
-  bool is_visible = bbox.CollidesWithFrustum(cam.GetFrustum());
-  if (is_visible) {
-    renderer_->AddInstanceToRenderBatch(this);
+
+  float screen_size = MeshObjectRenderer::GetScreenSize(bbox_, cam);
+  lod_level_ = renderer_->SelectLodLevel(screen_size, lod_level_, false);
+  shadow_lod_level_ = renderer_->SelectLodLevel(screen_size, shadow_lod_level_, true);
+
+  SoftwareOcclusionCuller* occlusion_culler = GetScene()->GetSoftwareOcclusionCuller();
+  if (occlusion_culler != nullptr) {
+    // The occlusion culler only needs the objects inside the frustum
+    if (bbox_.CollidesWithFrustum(cam.GetFrustum())) {
+      if (is_occluder_) {
+        occlusion_culler->AddOccluder(renderer_->GetOccluderMesh(), GetTransform().GetMatrix());
+      }
+      // Can only be decided after every occluder is known
+      occlusion_culler->AddOccludee(bbox_, [this] {
+        renderer_->AddInstanceToRenderBatch(this, bbox_, lod_level_);
+      });
+    }
+  } else {
+    // The renderer frustum culls its whole batch at once
+    renderer_->AddInstanceToRenderBatch(this, bbox_, lod_level_);
   }
 
-  renderer_->AddInstanceToRenderDepthOnlyBatch(this);
+  if (is_static_) {
+    glm::mat4 transform = GetTransform().GetMatrix();
+    if (!is_cached_static_caster_ || transform != static_caster_transform_) {
+      GetScene()->InvalidateStaticShadowCasters();
+      is_cached_static_caster_ = true;
+      static_caster_transform_ = transform;
+    }
+  }
+  renderer_->AddInstanceToRenderDepthOnlyBatch(this, bbox_, shadow_lod_level_, is_static_);
 }
 
 }   // namespace Silice3D
@@ -14,14 +14,73 @@ class MeshObject : public GameObject {
              const std::string& vertex_shader = "Silice3D/mesh.vert");
   virtual ~MeshObject();
 
+  // The unscaled triangle mesh shape of the mesh.
   btCollisionShape* GetCollisionShape();
+
+  // The triangle mesh shape with this object's current scale. The objects
+  // with the same mesh and scale share it, and every scale shares the
+  // unscaled shape's BVH. It stays valid until the next call, or until the
+  // object is removed from the scene.
+  btCollisionShape* GetScaledCollisionShape();
+
+  // Convex approximations of the mesh for dynamic rigid bodies: a single
+  // simplified hull, or a compound of the hulls of a convex decomposition.
+  // They are shared by the objects with the same mesh, and ignore the scale.
+  btCollisionShape* GetConvexHullShape();
+  btCollisionShape* GetConvexDecompositionShape();
   BoundingBox GetBoundingBox() const;
   MeshObjectRenderer* GetRenderer() const { return renderer_; }
 
+  // The occluders are rasterized by the scene's software occlusion culler
+  // (if it's enabled), and can hide the other objects behind them. Only the
+  // large objects should be occluders, like walls and buildings.
+  bool IsOccluder() const { return is_occluder_; }
+  void SetIsOccluder(bool value) { is_occluder_ = value; }
+
+  // The static objects are expected to never move. The shadow casters cache
+  // their depth, and only render the dynamic objects every frame. Moving a
+  // static object (or changing this flag) is allowed, but it makes every
+  // cascade re-render its cache. The GPU culled objects are always dynamic.
+  bool IsStatic() const { return is_static_; }
+  void SetIsStatic(bool value);
+
  protected:
   MeshObjectRenderer* renderer_;
 
+  // The currently used levels of detail (these are kept as state for the
+  // hysteresis of the level selection).
+  unsigned lod_level_ = 0;
+  unsigned shadow_lod_level_ = 0;
+
+  bool is_occluder_ = false;
+
+  // The world space bounding box of the current frame
+  BoundingBox bbox_;
+
+  bool is_static_ = false;
+  // Whether this object is in the shadow casters' static cache, and its
+  // transform there
+  bool is_cached_static_caster_ = false;
+  glm::mat4 static_caster_transform_;
+
+  // The id of this object in the renderer's GPU culled instances, and its
+  // last uploaded transform (-1 if the object is culled on the CPU, it's
+  // disabled, or its renderer isn't ready yet).
+  bool gpu_culled_ = false;
+  unsigned gpu_instance_id_ = unsigned(-1);
+  glm::mat4 gpu_instance_transform_;
+
+  // The scale of the acquired scaled collision shape
+  bool has_scaled_collision_shape_ = false;
+  glm::vec3 collision_shape_scale_;
+
+  void RemoveGpuInstance();
+  // Makes the shadow casters re-render their static cache without this object
+  void RemoveStaticShadowCaster();
+
   virtual void Update() override;
+  virtual void EnabledChanged(bool enabled) override;
+  virtual void RemovedFromScene() override;
 };
 
 }   // namespace Silice3D
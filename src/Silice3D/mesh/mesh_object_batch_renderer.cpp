@@ -1,5 +1,7 @@
 // Copyright (c) Tamas Csala
 
+#include <algorithm>
+
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/mesh/mesh_object_batch_renderer.hpp>
 
@@ -17,9 +19,28 @@ void MeshObjectBatchRenderer::Update() {
 }
 
 void MeshObjectBatchRenderer::Render() {
-  MeshRendererCache* cache = GetScene()->GetMeshCache();
+  // Already rendered into the G-buffer
+  if (!GetScene()->GetDeferredShading()) {
+    RenderBatches(GetScene());
+  }
+}
+
+void MeshObjectBatchRenderer::RenderBatches(Scene* scene) {
+  MeshRendererCache* cache = scene->GetMeshCache();
+  std::vector<std::pair<uint64_t, IMeshObjectRenderer*>> draw_list;
   for (auto& pair : *cache) {
-    pair.second->RenderBatch(GetScene());
+    draw_list.emplace_back(pair.second->GetRenderSortKey(), pair.second.get());
+  }
+
+  // Sort by program, material, then depth to minimize the state changes
+  std::sort(draw_list.begin(), draw_list.end(),
+            [](const std::pair<uint64_t, IMeshObjectRenderer*>& a,
+               const std::pair<uint64_t, IMeshObjectRenderer*>& b) {
+    return a.first < b.first;
+  });
+
+  for (auto& pair : draw_list) {
+    pair.second->RenderBatch(scene);
   }
 }
 
@@ -11,6 +11,11 @@ class MeshObjectBatchRenderer : public GameObject {
  public:
   MeshObjectBatchRenderer(GameObject* parent);
 
+  // Renders the batches of every mesh renderer of the scene, sorted by their
+  // render sort keys. The deferred shaded scenes call this for their
+  // geometry pass, instead of the Render of this object.
+  static void RenderBatches(Scene* scene);
+
  private:
   virtual void Update() override;
   virtual void Render() override;
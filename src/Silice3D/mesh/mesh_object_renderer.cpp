@@ -1,139 +1,691 @@
 // Copyright (c) Tamas Csala
 
+#include <cmath>
+#include <tuple>
+#include <cassert>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+
+#include <Silice3D/common/oglwrap.hpp>
+
 #include <Silice3D/core/scene.hpp>
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
 #include <Silice3D/mesh/mesh_object_renderer.hpp>
 
 namespace Silice3D {
 
+// Runs the CPU side of the loading, on any thread
+static std::unique_ptr<MeshRenderer> ImportMesh(const std::string& mesh_path,
+                                                TextureManager* texture_manager,
+                                                const MeshRenderer::LodSettings& lod_settings) {
+  auto mesh = make_unique<MeshRenderer>("src/resource/" + mesh_path,
+                                        aiProcessPreset_TargetRealtime_Fast |
+                                        aiProcess_FlipUVs |
+                                        aiProcess_PreTransformVertices |
+                                        aiProcess_Triangulate |
+                                        aiProcess_CalcTangentSpace,
+                                        texture_manager);
+  mesh->prepare(lod_settings);
+  return mesh;
+}
+
 MeshObjectRenderer::MeshObjectRenderer (const std::string& mesh_path,
                                         ShaderManager* shader_manager,
-                                        const std::string& vertex_shader)
-    : mesh_("src/resource/" + mesh_path, aiProcessPreset_TargetRealtime_Fast |
-                                         aiProcess_FlipUVs |
-                                         aiProcess_PreTransformVertices |
-                                         aiProcess_Triangulate |
-                                         aiProcess_CalcTangentSpace)
-    , prog_data_(shader_manager, vertex_shader) {
-  mesh_.setup();
-  mesh_.setupDiffuseTextures(kDiffuseTextureSlot);
+                                        TextureManager* texture_manager,
+                                        const std::string& vertex_shader,
+                                        const MeshRenderer::LodSettings& lod_settings,
+                                        ThreadPool* thread_pool)
+    : prog_data_(shader_manager, vertex_shader)
+    , shader_manager_(shader_manager) {
+  if (thread_pool == nullptr) {
+    imported_mesh_ = ImportMesh(mesh_path, texture_manager, lod_settings);
+    FinishLoading();
+    return;
+  }
+
+  is_importing_ = true;
+  thread_pool->Enqueue(0, [this, mesh_path, texture_manager, lod_settings] {
+    std::unique_ptr<MeshRenderer> mesh;
+    std::exception_ptr error;
+    try {
+      mesh = ImportMesh(mesh_path, texture_manager, lod_settings);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> lock(loading_mutex_);
+    imported_mesh_ = std::move(mesh);
+    import_error_ = error;
+    is_importing_ = false;
+    import_finished_.notify_all();
+  });
+}
+
+MeshObjectRenderer::~MeshObjectRenderer() {
+  // The import task references this object, it must finish before it dies.
+  std::unique_lock<std::mutex> lock(loading_mutex_);
+  import_finished_.wait(lock, [this] { return !is_importing_; });
+}
+
+bool MeshObjectRenderer::FinishLoading() {
+  if (is_ready_) {
+    return true;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(loading_mutex_);
+    if (is_importing_) {
+      return false;
+    }
+    if (import_error_) {
+      std::rethrow_exception(import_error_);
+    }
+    mesh_ = std::move(imported_mesh_);
+  }
+
+  mesh_->upload();
+  mesh_->setupDiffuseTextures();
+  is_ready_ = true;
+  return true;
+}
+
+void MeshObjectRenderer::WaitForLoading() {
+  {
+    std::unique_lock<std::mutex> lock(loading_mutex_);
+    import_finished_.wait(lock, [this] { return !is_importing_; });
+  }
+  FinishLoading();
 }
 
 MeshObjectRenderer::ProgramData::ProgramData(ShaderManager* shader_manager,
                                              const std::string& vertex_shader)
-    : basic_prog_(shader_manager->GetShader(vertex_shader),
-                  shader_manager->GetShader("Silice3D/mesh.frag"))
-    , shadow_recieve_prog_(shader_manager->GetShader(vertex_shader),
-                           shader_manager->GetShader("Silice3D/mesh_shadow.frag"))
-    , shadow_cast_prog_(shader_manager->GetShader(vertex_shader),
-                        shader_manager->GetShader("Silice3D/shadow.frag"))
-
-    , bp_uProjectionMatrix_(basic_prog_, "uProjectionMatrix")
-    , bp_uCameraMatrix_(basic_prog_, "uCameraMatrix")
+    : vertex_shader_(vertex_shader)
+    , basic_prog_(*shader_manager->GetProgram({vertex_shader, "Silice3D/mesh.frag"}))
+    , shadow_cast_prog_(*shader_manager->GetProgram({vertex_shader, "Silice3D/shadow.frag"}))
+    , gbuffer_prog_(*shader_manager->GetProgram({vertex_shader, "Silice3D/mesh_gbuffer.frag"}))
+
     , bp_uModelMatrix_(basic_prog_, "uModelMatrix")
+    , bp_uSimilarityInstances_(basic_prog_, "uSimilarityInstances")
+    , bp_uRecieveShadows_(basic_prog_, "uRecieveShadows")
 
-    , srp_uProjectionMatrix_(shadow_recieve_prog_, "uProjectionMatrix")
-    , srp_uCameraMatrix_(shadow_recieve_prog_, "uCameraMatrix")
-    , srp_uModelMatrix_(shadow_recieve_prog_, "uModelMatrix")
-    , srp_uShadowCP_(shadow_recieve_prog_, "uShadowCP")
+    , scp_uModelMatrix_(shadow_cast_prog_, "uModelMatrix")
+    , scp_uSimilarityInstances_(shadow_cast_prog_, "uSimilarityInstances")
 
-    , scp_uProjectionMatrix_(shadow_cast_prog_, "uProjectionMatrix")
-    , scp_uCameraMatrix_(shadow_cast_prog_, "uCameraMatrix")
-    , scp_uModelMatrix_(shadow_cast_prog_, "uModelMatrix") {
+    , gp_uSimilarityInstances_(gbuffer_prog_, "uSimilarityInstances")
+    , gp_uRecieveShadows_(gbuffer_prog_, "uRecieveShadows") {
   gl::Use(basic_prog_);
-  gl::UniformSampler(basic_prog_, "uDiffuseTexture").set(kDiffuseTextureSlot);
   basic_prog_.validate();
+  gl::Unuse(basic_prog_);
+}
+
+// The vertex shaders can only select the layer with the extension
+static bool SupportsVertexShaderLayer() {
+  return GLAD_GL_ARB_shader_viewport_layer_array != 0;
+}
+
+static std::vector<std::string> GetLayeredShaders() {
+  std::vector<std::string> shaders = {"Silice3D/shadow_layered.vert", "Silice3D/shadow.frag"};
+  if (!SupportsVertexShaderLayer()) {
+    shaders.push_back("Silice3D/shadow_layered.geom");
+  }
+  return shaders;
+}
 
-  gl::Use(shadow_recieve_prog_);
-  gl::UniformSampler(shadow_recieve_prog_, "uDiffuseTexture").set(kDiffuseTextureSlot);
-  shadow_recieve_prog_.validate();
-  gl::Unuse(shadow_recieve_prog_);
+MeshObjectRenderer::LayeredProgramData::LayeredProgramData(ShaderManager* shader_manager)
+    : shadow_cast_prog_(*shader_manager->GetProgram(GetLayeredShaders()))
+    , scp_uSimilarityInstances_(shadow_cast_prog_, "uSimilarityInstances") { }
+
+const OccluderMesh* MeshObjectRenderer::GetOccluderMesh() {
+  if (!occluder_mesh_) {
+    occluder_mesh_ = make_unique<OccluderMesh>();
+    mesh_->occluderProxy(kOccluderTriangleCount, kOccluderMaxError,
+                        &occluder_mesh_->positions, &occluder_mesh_->indices);
+  }
+
+  return occluder_mesh_.get();
 }
 
-btCollisionShape* MeshObjectRenderer::GetCollisionShape() {
-  if (!bt_shape_) {
-    bt_triangles_ = make_unique<btTriangleIndexVertexArray>();
-    bt_indices_ = mesh_.btTriangles(bt_triangles_.get());
-    bt_shape_ = make_unique<btBvhTriangleMeshShape>(bt_triangles_.get(), true);
+btCollisionShape* MeshObjectRenderer::GetCollisionShape(const std::string& cache_directory) {
+  WaitForLoading();
+  if (!collision_shape_) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    mesh_->triangles(&positions, &indices);
+    collision_shape_ = make_unique<TriangleMeshShape>(positions, indices, cache_directory);
   }
 
-  return bt_shape_.get();
+  return collision_shape_->GetShape();
 }
 
-void MeshObjectRenderer::AddInstanceToRenderBatch(const GameObject* game_object) {
-  instance_transforms_.push_back(game_object->GetTransform().GetMatrix());
+btCollisionShape* MeshObjectRenderer::GetConvexHullShape(const std::string& cache_directory) {
+  WaitForLoading();
+  if (!convex_hull_shape_) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    mesh_->triangles(&positions, &indices);
+    convex_hull_shape_ = make_unique<ConvexProxyShape>(
+        positions, indices, ConvexProxyShape::Type::kHull,
+        ConvexDecomposition::Parameters{}, cache_directory);
+  }
+
+  return convex_hull_shape_->GetShape();
+}
+
+btCollisionShape* MeshObjectRenderer::GetConvexDecompositionShape(const std::string& cache_directory) {
+  WaitForLoading();
+  if (!convex_decomposition_shape_) {
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned> indices;
+    mesh_->triangles(&positions, &indices);
+    convex_decomposition_shape_ = make_unique<ConvexProxyShape>(
+        positions, indices, ConvexProxyShape::Type::kDecomposition,
+        convex_decomposition_parameters_, cache_directory);
+  }
+
+  return convex_decomposition_shape_->GetShape();
+}
+
+btCollisionShape* MeshObjectRenderer::AcquireScaledCollisionShape(
+    const glm::vec3& scale, const std::string& cache_directory) {
+  ScaledCollisionShape& scaled_shape = scaled_collision_shapes_[ScaleKey(scale)];
+  if (!scaled_shape.shape) {
+    btBvhTriangleMeshShape* shape =
+        static_cast<btBvhTriangleMeshShape*>(GetCollisionShape(cache_directory));
+    scaled_shape.shape = make_unique<btScaledBvhTriangleMeshShape>(
+        shape, btVector3(scale.x, scale.y, scale.z));
+  }
+  scaled_shape.ref_count++;
+  return scaled_shape.shape.get();
+}
+
+std::unique_ptr<btCollisionShape> MeshObjectRenderer::ReleaseScaledCollisionShape(
+    const glm::vec3& scale) {
+  auto iter = scaled_collision_shapes_.find(ScaleKey(scale));
+  assert(iter != scaled_collision_shapes_.end());
+  std::unique_ptr<btCollisionShape> released_shape;
+  if (--iter->second.ref_count == 0) {
+    released_shape = std::move(iter->second.shape);
+    scaled_collision_shapes_.erase(iter);
+  }
+  return released_shape;
+}
+
+MeshObjectRenderer::ScaleKey::ScaleKey(const glm::vec3& scale) {
+  // The scales are rounded, so the float noise of the transform
+  // calculations doesn't create new shapes.
+  x = std::lround(scale.x * kScaleKeyPrecision);
+  y = std::lround(scale.y * kScaleKeyPrecision);
+  z = std::lround(scale.z * kScaleKeyPrecision);
+}
+
+bool MeshObjectRenderer::ScaleKey::operator<(const ScaleKey& other) const {
+  return std::tie(x, y, z) < std::tie(other.x, other.y, other.z);
+}
+
+void MeshObjectRenderer::AddInstanceToRenderBatch(const GameObject* game_object,
+                                                  const BoundingBox& world_space_bbox,
+                                                  unsigned lod_level) {
+  const Transform& transform = game_object->GetTransform();
+  glm::dvec3 cam_pos = game_object->GetScene()->GetCamera()->GetTransform().GetPos();
+  batches_culled_ = false;
+  instance_transforms_.push_back(transform.GetMatrix());
+  instance_bboxes_.Add(world_space_bbox);
+  instance_depths_.push_back(glm::length(transform.GetPos() - cam_pos));
+  instance_lod_levels_.push_back(lod_level);
 }
 
 void MeshObjectRenderer::ClearRenderBatch() {
+  batches_culled_ = false;
   instance_transforms_.clear();
+  instance_bboxes_.Clear();
+  instance_depths_.clear();
+  instance_lod_levels_.clear();
 }
 
 void MeshObjectRenderer::RenderBatch(Scene* scene) {
+  if (!is_ready_) {
+    return;
+  }
   const auto& cam = *scene->GetCamera();
 
-  if (recieve_shadows_) {
-    gl::Use(prog_data_.shadow_recieve_prog_);
-    prog_data_.shadow_recieve_prog_.Update();
+  // The compute passes change the program, so they have to be done first
+  bool has_gpu_instances = HasGpuInstances();
+  if (has_gpu_instances) {
+    CullGpuInstances(scene, cam);
+  }
 
-    prog_data_.srp_uProjectionMatrix_ = cam.GetProjectionMatrix();
-    prog_data_.srp_uCameraMatrix_ = cam.GetCameraMatrix();
+  // The deferred shading only needs the surface, the shadows are received in
+  // its lighting passes
+  gl::LazyUniform<int>* uSimilarityInstances;
+  if (scene->GetDeferredShading()) {
+    gl::Use(prog_data_.gbuffer_prog_);
+    prog_data_.gbuffer_prog_.Update();
+    prog_data_.gp_uRecieveShadows_ = recieve_shadows_;
+    uSimilarityInstances = &prog_data_.gp_uSimilarityInstances_;
   } else {
-    gl::Use(prog_data_.basic_prog_);
-    prog_data_.basic_prog_.Update();
+    uSimilarityInstances = UseForwardProgram(scene);
+  }
+  scene->GetFrameUniforms()->BindCamera(cam);
 
-    prog_data_.bp_uProjectionMatrix_ = cam.GetProjectionMatrix();
-    prog_data_.bp_uCameraMatrix_ = cam.GetCameraMatrix();
+  // The visible instances, grouped by the level of detail (for renderLods),
+  // and front-to-back inside the groups, for the early depth test
+  if (batches_culled_ && scene->GetVisibilityView(cam) == 0) {
+    instance_order_.clear();
+    FrustumCulling::MaskToIndices(instance_visibility_masks_[0], instance_bboxes_.GetSize(),
+                                  &instance_order_);
+  } else {
+    FrustumCulling::CullToIndices(cam.GetFrustum(), instance_bboxes_, &instance_order_);
   }
+  std::sort(instance_order_.begin(), instance_order_.end(), [this](unsigned a, unsigned b) {
+    if (instance_lod_levels_[a] != instance_lod_levels_[b]) {
+      return instance_lod_levels_[a] < instance_lod_levels_[b];
+    }
+    return instance_depths_[a] < instance_depths_[b];
+  });
+  sorted_instance_transforms_.clear();
+  lod_instance_counts_.assign(mesh_->lodCount(), 0);
+  for (unsigned idx : instance_order_) {
+    sorted_instance_transforms_.push_back(instance_transforms_[idx]);
+    lod_instance_counts_[instance_lod_levels_[idx]]++;
+  }
+
+  MeshRenderer::InstanceFormat format = UploadInstances(sorted_instance_transforms_);
+  *uSimilarityInstances = format == MeshRenderer::InstanceFormat::kSimilarity;
+  RenderLods(sorted_instance_transforms_, cam, meshlet_cone_culling_);
 
-  mesh_.uploadModelMatrices(instance_transforms_);
-  mesh_.render(instance_transforms_.size());
+  if (has_gpu_instances) {
+    *uSimilarityInstances = false;  // the culler outputs affine instances
+    mesh_->renderIndirect(gpu_culler_->GetOutputBuffer(), gpu_culler_->GetCommandBuffer(),
+                         gpu_culler_->GetCommandCount());
+  }
   gl::UnuseProgram();
 }
 
-void MeshObjectRenderer::AddInstanceToRenderDepthOnlyBatch(const GameObject* game_object) {
+gl::LazyUniform<int>* MeshObjectRenderer::UseForwardProgram(Scene* scene) {
+  size_t light_count = std::min(scene->GetDirectionalLightCount(),
+                                FrameUniforms::kMaxDirectionalLightCount);
+  ShaderDefines features = {
+    {"SILICE3D_RECIEVE_SHADOWS", recieve_shadows_ ? "1" : "0"},
+    {"SILICE3D_DIRECTIONAL_LIGHT_COUNT", std::to_string(light_count)}
+  };
+  ShaderProgram* variant = shader_manager_->GetProgramAsync(
+      {prog_data_.vertex_shader_, "Silice3D/mesh.frag"}, features);
+
+  if (variant == nullptr) {
+    forward_prog_ = &prog_data_.basic_prog_;
+    gl::Use(prog_data_.basic_prog_);
+    prog_data_.basic_prog_.Update();
+    prog_data_.bp_uRecieveShadows_ = recieve_shadows_;
+    return &prog_data_.bp_uSimilarityInstances_;
+  }
+
+  forward_prog_ = variant;
+  gl::Use(*variant);
+  variant->Update();
+  auto& uSimilarityInstances = prog_data_.variant_uSimilarityInstances_[variant];
+  if (!uSimilarityInstances) {
+    uSimilarityInstances = make_unique<gl::LazyUniform<int>>(*variant, "uSimilarityInstances");
+  }
+  return uSimilarityInstances.get();
+}
+
+void MeshObjectRenderer::AddInstanceToRenderDepthOnlyBatch(const GameObject* game_object,
+                                                           const BoundingBox& world_space_bbox,
+                                                           unsigned lod_level, bool is_static) {
+  batches_culled_ = false;
   depth_only_instance_transforms_.push_back(game_object->GetTransform().GetMatrix());
+  // Used by every shadow pass
+  depth_only_instance_bboxes_.Add(world_space_bbox);
+  depth_only_instance_lod_levels_.push_back(lod_level);
+  depth_only_instance_is_static_.push_back(is_static);
+}
+
+void MeshObjectRenderer::CullBatches(Scene* scene) {
+  const std::vector<Frustum>& frustums = scene->GetVisibilityFrustums();
+  if (!is_ready_ || frustums.empty()) {
+    return;
+  }
+
+  // The main batch is only rendered by the camera (the first view), the
+  // depth only batch is rendered by every view.
+  FrustumCulling::CullToMasks({frustums[0]}, instance_bboxes_,
+                              &instance_visibility_masks_, scene->GetThreadPool());
+  FrustumCulling::CullToMasks(frustums, depth_only_instance_bboxes_,
+                              &depth_only_visibility_masks_, scene->GetThreadPool());
+  batches_culled_ = true;
 }
 
 void MeshObjectRenderer::ClearRenderDepthOnlyBatch() {
+  batches_culled_ = false;
   depth_only_instance_transforms_.clear();
+  depth_only_instance_bboxes_.Clear();
+  depth_only_instance_lod_levels_.clear();
+  depth_only_instance_is_static_.clear();
 }
 
 void MeshObjectRenderer::RenderDepthOnlyBatch(Scene* scene, const ICamera& camera) {
-  if (cast_shadows_) {
+  if (cast_shadows_ && is_ready_) {
+    // The GPU culled instances are always treated as dynamic casters
+    Scene::ShadowCasters casters = scene->GetDepthOnlyCasters();
+    bool has_gpu_instances = HasGpuInstances() && casters != Scene::ShadowCasters::kStatic;
+    if (has_gpu_instances) {
+      CullGpuInstances(scene, camera);
+    }
+
     auto prog_user = gl::MakeTemporaryBind(prog_data_.shadow_cast_prog_);
     prog_data_.shadow_cast_prog_.Update();
+    scene->GetFrameUniforms()->BindCamera(camera);
 
-    prog_data_.scp_uProjectionMatrix_ = camera.GetProjectionMatrix();
-    prog_data_.scp_uCameraMatrix_ = camera.GetCameraMatrix();
+    // Counting sort by the level of detail, into a single buffer
+    unsigned lod_count = mesh_->lodCount();
+    CullDepthOnlyBatch(scene, camera);
+    lod_instance_counts_.assign(lod_count, 0);
+    for (unsigned i : visible_instance_indices_) {
+      lod_instance_counts_[depth_only_instance_lod_levels_[i]]++;
+    }
+    lod_instance_offsets_.resize(lod_count);
+    size_t offset = 0;
+    for (unsigned level = 0; level < lod_count; ++level) {
+      lod_instance_offsets_[level] = offset;
+      offset += lod_instance_counts_[level];
+    }
+    visible_depth_only_transforms_.resize(visible_instance_indices_.size());
+    for (unsigned i : visible_instance_indices_) {
+      size_t& level_offset = lod_instance_offsets_[depth_only_instance_lod_levels_[i]];
+      visible_depth_only_transforms_[level_offset++] = depth_only_instance_transforms_[i];
+    }
+
+    MeshRenderer::InstanceFormat format = UploadInstances(visible_depth_only_transforms_);
+    prog_data_.scp_uSimilarityInstances_ = format == MeshRenderer::InstanceFormat::kSimilarity;
+    // The shadow maps are rendered with the back faces too
+    bool shadow_pass = &camera != scene->GetCamera();
+    RenderLods(visible_depth_only_transforms_, camera, meshlet_cone_culling_ && !shadow_pass);
+
+    if (has_gpu_instances) {
+      prog_data_.scp_uSimilarityInstances_ = false;
+      mesh_->renderIndirect(gpu_culler_->GetOutputBuffer(), gpu_culler_->GetCommandBuffer(),
+                           gpu_culler_->GetCommandCount());
+    }
+  }
+}
+
+void MeshObjectRenderer::RenderLayeredDepthOnlyBatch(Scene* scene,
+                                                     const std::vector<const ICamera*>& layer_cameras) {
+  if (!cast_shadows_ || !is_ready_) {
+    return;
+  }
+  if (!layered_prog_data_) {
+    layered_prog_data_ = make_unique<LayeredProgramData>(shader_manager_);
+  }
+  ShaderProgram& prog = layered_prog_data_->shadow_cast_prog_;
+
+  // Every layer's visible instances, grouped by the level of detail, so a
+  // single renderLods call draws all of them
+  unsigned lod_count = mesh_->lodCount();
+  layered_lod_transforms_.resize(lod_count);
+  layered_lod_layers_.resize(lod_count);
+  for (unsigned level = 0; level < lod_count; ++level) {
+    layered_lod_transforms_[level].clear();
+    layered_lod_layers_[level].clear();
+  }
+  for (GLuint layer = 0; layer < layer_cameras.size(); ++layer) {
+    if (layer_cameras[layer] == nullptr) {
+      continue;
+    }
+    CullDepthOnlyBatch(scene, *layer_cameras[layer]);
+    for (unsigned i : visible_instance_indices_) {
+      unsigned level = depth_only_instance_lod_levels_[i];
+      layered_lod_transforms_[level].push_back(depth_only_instance_transforms_[i]);
+      layered_lod_layers_[level].push_back(layer);
+    }
+  }
+
+  sorted_instance_transforms_.clear();
+  instance_layers_.clear();
+  lod_instance_counts_.assign(lod_count, 0);
+  for (unsigned level = 0; level < lod_count; ++level) {
+    sorted_instance_transforms_.insert(sorted_instance_transforms_.end(),
+                                       layered_lod_transforms_[level].begin(),
+                                       layered_lod_transforms_[level].end());
+    instance_layers_.insert(instance_layers_.end(), layered_lod_layers_[level].begin(),
+                            layered_lod_layers_[level].end());
+    lod_instance_counts_[level] = layered_lod_transforms_[level].size();
+  }
+
+  gl::Use(prog);
+  prog.Update();
+  MeshRenderer::InstanceFormat format = UploadInstances(sorted_instance_transforms_);
+  mesh_->uploadInstanceLayers(instance_layers_);
+  layered_prog_data_->scp_uSimilarityInstances_ = format == MeshRenderer::InstanceFormat::kSimilarity;
+  // The meshlets could only be culled against one of the layers' frustums
+  mesh_->renderLods(lod_instance_counts_);
 
-    std::vector<glm::mat4> visibile_object_transforms;
-    for (const glm::mat4& transform : depth_only_instance_transforms_) {
-      BoundingBox bbox = GetBoundingBox(transform);
-      bool is_visible = bbox.CollidesWithFrustum(camera.GetFrustum());
-      if (is_visible) {
-        visibile_object_transforms.push_back(transform);
+  // The GPU culled instances are always treated as dynamic casters, and
+  // they are culled separately for every layer
+  if (HasGpuInstances() && scene->GetDepthOnlyCasters() != Scene::ShadowCasters::kStatic) {
+    for (GLuint layer = 0; layer < layer_cameras.size(); ++layer) {
+      if (layer_cameras[layer] == nullptr) {
+        continue;
       }
+      CullGpuInstances(scene, *layer_cameras[layer]);  // changes the program
+      gl::Use(prog);
+      layered_prog_data_->scp_uSimilarityInstances_ = false;
+      mesh_->setInstanceLayer(layer);
+      mesh_->renderIndirect(gpu_culler_->GetOutputBuffer(), gpu_culler_->GetCommandBuffer(),
+                           gpu_culler_->GetCommandCount());
     }
-    mesh_.uploadModelMatrices(visibile_object_transforms);
-    mesh_.render(visibile_object_transforms.size());
+  }
+  mesh_->setInstanceLayer(0);
+  gl::UnuseProgram();
+}
+
+unsigned MeshObjectRenderer::AddGpuInstance(const glm::mat4& transform) {
+  if (!gpu_culler_) {
+    gpu_culler_ = make_unique<GpuInstanceCuller>(shader_manager_);
+    gpu_culler_->SetDrawCommands(mesh_->lodDrawCommands());
+  }
+  return gpu_culler_->AddInstance(transform);
+}
+
+void MeshObjectRenderer::UpdateGpuInstance(unsigned id, const glm::mat4& transform) {
+  gpu_culler_->UpdateInstance(id, transform);
+}
+
+void MeshObjectRenderer::RemoveGpuInstance(unsigned id) {
+  gpu_culler_->RemoveInstance(id);
+}
+
+MeshRenderer::InstanceFormat MeshObjectRenderer::UploadInstances(
+    const std::vector<glm::mat4>& transforms) {
+  // Most objects are only rotated and uniformly scaled, they fit in 32 bytes
+  similarity_instances_.clear();
+  for (const glm::mat4& transform : transforms) {
+    MeshRenderer::SimilarityInstance instance;
+    if (!MeshRenderer::toSimilarityInstance(transform, &instance)) {
+      break;
+    }
+    similarity_instances_.push_back(instance);
+  }
+  if (similarity_instances_.size() == transforms.size()) {
+    mesh_->uploadInstances(similarity_instances_);
+    return MeshRenderer::InstanceFormat::kSimilarity;
+  }
+
+  affine_instances_.clear();
+  for (const glm::mat4& transform : transforms) {
+    affine_instances_.push_back(MeshRenderer::toAffineInstance(transform));
+  }
+  mesh_->uploadInstances(affine_instances_);
+  return MeshRenderer::InstanceFormat::kAffine;
+}
+
+void MeshObjectRenderer::RenderLods(const std::vector<glm::mat4>& transforms,
+                                    const ICamera& camera, bool cone_culling) {
+  if (mesh_->hasMeshlets()) {
+    mesh_->renderLods(lod_instance_counts_, transforms, camera.GetFrustum(),
+                     glm::vec3(camera.GetTransform().GetPos()), cone_culling);
+  } else {
+    mesh_->renderLods(lod_instance_counts_);
+  }
+}
+
+void MeshObjectRenderer::CullDepthOnlyBatch(Scene* scene, const ICamera& camera) {
+  int view = scene->GetVisibilityView(camera);
+  if (batches_culled_ && view != -1) {
+    visible_instance_indices_.clear();
+    FrustumCulling::MaskToIndices(depth_only_visibility_masks_[view],
+                                  depth_only_instance_bboxes_.GetSize(),
+                                  &visible_instance_indices_);
+  } else {
+    FrustumCulling::CullToMask(camera.GetFrustum(), depth_only_instance_bboxes_,
+                               &visibility_mask_);
+    visible_instance_indices_.clear();
+    FrustumCulling::MaskToIndices(visibility_mask_, depth_only_instance_bboxes_.GetSize(),
+                                  &visible_instance_indices_);
+  }
+
+  Scene::ShadowCasters casters = scene->GetDepthOnlyCasters();
+  if (casters != Scene::ShadowCasters::kAll) {
+    bool is_static = casters == Scene::ShadowCasters::kStatic;
+    visible_instance_indices_.erase(
+        std::remove_if(visible_instance_indices_.begin(), visible_instance_indices_.end(),
+                       [this, is_static](unsigned i) {
+                         return depth_only_instance_is_static_[i] != is_static;
+                       }),
+        visible_instance_indices_.end());
+  }
+}
+
+bool MeshObjectRenderer::HasGpuInstances() const {
+  return gpu_culler_ && gpu_culler_->GetInstanceCount() > 0;
+}
+
+void MeshObjectRenderer::CullGpuInstances(Scene* scene, const ICamera& camera) {
+  // The levels of detail are selected based on the main camera in every
+  // pass, the Hi-Z buffer is only valid for the main camera too.
+  const ICamera& main_camera = *scene->GetCamera();
+  bool shadow_pass = &camera != &main_camera;
+
+  GpuInstanceCuller::LodParameters lod;
+  lod.camera_pos = glm::vec3(main_camera.GetTransform().GetPos());
+  lod.projection_scale = 1.0 / std::tan(main_camera.GetFovy() / 2);
+  lod.bias = shadow_pass ? shadow_lod_bias_ : lod_bias_;
+  lod.transition_size = kLodTransitionScreenSize;
+  lod.hysteresis = kLodHysteresis;
+
+  const HiZBuffer* hi_z_buffer = shadow_pass ? nullptr : scene->GetHiZBuffer();
+  gpu_culler_->Cull(camera, hi_z_buffer, mesh_->boundingBox(), lod, shadow_pass);
+}
+
+float MeshObjectRenderer::GetScreenSize(const BoundingBox& bbox, const ICamera& camera) {
+  glm::dvec3 extent = bbox.GetExtent();
+  double radius = glm::length(extent) / 2;
+  double distance = glm::length(bbox.GetCenter() - camera.GetTransform().GetPos());
+  if (distance <= radius) {
+    return std::numeric_limits<float>::max();  // the camera is inside the sphere
+  }
+
+  return radius / (distance * std::tan(camera.GetFovy() / 2));
+}
+
+unsigned MeshObjectRenderer::GetLodLevelForScreenSize(float screen_size,
+                                                      float transition_scale) const {
+  unsigned lod_level = 0;
+  float transition_size = kLodTransitionScreenSize * transition_scale;
+  while (lod_level + 1 < mesh_->lodCount() && screen_size < transition_size) {
+    lod_level++;
+    transition_size /= 2;
+  }
+  return lod_level;
+}
+
+unsigned MeshObjectRenderer::SelectLodLevel(float screen_size, unsigned current_level,
+                                            bool shadow_pass) const {
+  screen_size *= shadow_pass ? shadow_lod_bias_ : lod_bias_;
+
+  // Only switch to a coarser level if the size is clearly below the
+  // transition, and to a finer one if it is clearly above.
+  unsigned coarsest_stable_level = GetLodLevelForScreenSize(screen_size, 1.0f + kLodHysteresis);
+  unsigned finest_stable_level = GetLodLevelForScreenSize(screen_size, 1.0f - kLodHysteresis);
+  if (current_level < finest_stable_level) {
+    return finest_stable_level;
+  } else if (current_level > coarsest_stable_level) {
+    return coarsest_stable_level;
+  } else {
+    return current_level;
   }
 }
 
 size_t MeshObjectRenderer::GetTriangleCount() const {
-  return instance_transforms_.size() * mesh_.triangleCount();
+  if (!is_ready_) {
+    return 0;
+  }
+  size_t triangle_count = 0;
+  for (unsigned lod_level : instance_lod_levels_) {
+    triangle_count += mesh_->triangleCount(lod_level);
+  }
+
+  // The visibility of the GPU culled instances isn't read back,
+  // this is an upper bound for them.
+  if (gpu_culler_) {
+    triangle_count += gpu_culler_->GetInstanceCount() * mesh_->triangleCount();
+  }
+  return triangle_count;
+}
+
+uint64_t MeshObjectRenderer::GetRenderSortKey() const {
+  // The variant is only known after the first RenderBatch
+  const ShaderProgram& prog = forward_prog_ != nullptr ? *forward_prog_ : prog_data_.basic_prog_;
+  uint64_t program_key = prog.expose() & 0xFFFF;
+  uint64_t material_key = is_ready_ ? mesh_->materialBase() & 0xFFFF : 0;
+
+  // Non-negative floats compare the same way as their bit patterns do
+  float min_depth = instance_depths_.empty()
+      ? std::numeric_limits<float>::max()
+      : *std::min_element(instance_depths_.begin(), instance_depths_.end());
+  uint32_t depth_key;
+  static_assert(sizeof(depth_key) == sizeof(min_depth), "Expected 32 bit floats");
+  std::memcpy(&depth_key, &min_depth, sizeof(depth_key));
+
+  return (program_key << 48) | (material_key << 32) | depth_key;
 }
 
 BoundingBox MeshObjectRenderer::GetBoundingBox(const glm::mat4& transform) const {
-  return mesh_.boundingBox(transform);
+  if (!is_ready_) {
+    glm::vec3 origin = glm::vec3(transform[3]);
+    return BoundingBox{origin, origin};
+  }
+
+  // The extent of the transformed box along an axis is the sum of the
+  // projections of its transformed half axes, so the result contains the
+  // whole rotated box (like BoundingBoxArray::Add).
+  BoundingBox model_space_bbox = mesh_->boundingBox();
+  glm::dvec3 center = glm::dvec3(transform * glm::vec4(glm::vec3(model_space_bbox.GetCenter()), 1.0f));
+  glm::dvec3 half_extent = model_space_bbox.GetExtent() / 2.0;
+  glm::dvec3 world_half_extent;
+  for (int axis = 0; axis < 3; ++axis) {
+    world_half_extent[axis] = std::abs(transform[0][axis]) * half_extent.x +
+                              std::abs(transform[1][axis]) * half_extent.y +
+                              std::abs(transform[2][axis]) * half_extent.z;
+  }
+  return BoundingBox{center - world_half_extent, center + world_half_extent};
 }
 
 }   // namespace Silice3D
 
 Silice3D::MeshObjectRenderer* Silice3D::GetMeshRenderer(const std::string& str, ShaderManager* shader_manager,
+                                                        TextureManager* texture_manager,
                                                         std::map<std::string, std::unique_ptr<IMeshObjectRenderer>>* mesh_cache,
-                                                        const std::string& vertex_shader) {
+                                                        const std::string& vertex_shader,
+                                                        const MeshRenderer::LodSettings& lod_settings,
+                                                        ThreadPool* thread_pool) {
   auto iter = mesh_cache->find(str);
   if (iter == mesh_cache->end()) {
-    MeshObjectRenderer* renderer = new MeshObjectRenderer(str, shader_manager, vertex_shader);
+    MeshObjectRenderer* renderer = new MeshObjectRenderer(str, shader_manager, texture_manager,
+                                                          vertex_shader, lod_settings, thread_pool);
     (*mesh_cache)[str] = std::unique_ptr<IMeshObjectRenderer>{renderer};
     return renderer;
   } else {
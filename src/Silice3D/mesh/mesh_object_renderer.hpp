@@ -3,6 +3,11 @@
 #ifndef SILICE3D_MESH_MESH_OBJECT_RENDERER_HPP_
 #define SILICE3D_MESH_MESH_OBJECT_RENDERER_HPP_
 
+#include <map>
+#include <mutex>
+#include <exception>
+#include <condition_variable>
+
 #include <Silice3D/common/oglwrap.hpp>
 #include <Silice3D/common/make_unique.hpp>
 #include <Silice3D/core/game_object.hpp>
@@ -10,78 +15,289 @@
 #include <Silice3D/mesh/mesh_renderer.hpp>
 #include <Silice3D/mesh/imesh_object_renderer.hpp>
 #include <Silice3D/physics/bullet_rigid_body.hpp>
+#include <Silice3D/physics/triangle_mesh_shape.hpp>
+#include <Silice3D/physics/convex_proxy_shape.hpp>
+#include <Silice3D/culling/frustum_culling.hpp>
+#include <Silice3D/culling/gpu_instance_culler.hpp>
+#include <Silice3D/culling/software_occlusion_culler.hpp>
 
 namespace Silice3D {
 
 class ShaderManager;
+class TextureManager;
+class ThreadPool;
 class Scene;
 
 class MeshObjectRenderer : public IMeshObjectRenderer {
 public:
+  // The projected size of the bounding sphere (relative to the screen height),
+  // below which the first simplified level of detail is used. Every further
+  // level is used from half the size of the previous one.
+  static constexpr float kLodTransitionScreenSize = 0.25f;
+  // The relative distance from a transition size that is required to switch
+  // to an other level, to avoid popping back and forth at the transitions.
+  static constexpr float kLodHysteresis = 0.1f;
+  // The size of the occluder proxies used by the software occlusion culling.
+  static constexpr size_t kOccluderTriangleCount = 256;
+  static constexpr float kOccluderMaxError = 0.01f;
+
+  // If thread_pool isn't nullptr, the mesh is imported and prepared on its
+  // workers, and the renderer isn't ready until FinishLoading() uploads it.
   MeshObjectRenderer (const std::string& mesh_path, ShaderManager* shader_manager,
-                      const std::string& vertex_shader);
+                      TextureManager* texture_manager, const std::string& vertex_shader,
+                      const MeshRenderer::LodSettings& lod_settings = MeshRenderer::LodSettings{},
+                      ThreadPool* thread_pool = nullptr);
+  virtual ~MeshObjectRenderer();
+
+  // Most of the functions below can only be used after the renderer is ready,
+  // the batches of a not yet ready renderer aren't rendered.
+  virtual bool IsReady() const override { return is_ready_; }
+  // Uploads the mesh if its import is finished. Must be called from the GL
+  // thread. Returns true if the renderer is ready.
+  virtual bool FinishLoading() override;
+  // Blocks until the import is finished, and uploads the mesh.
+  void WaitForLoading();
+
+  // Returns a static triangle mesh shape, its BVH is cached in the
+  // cache_directory if it isn't empty (see TriangleMeshShape).
+  // Waits for the loading if it isn't finished yet.
+  btCollisionShape* GetCollisionShape(const std::string& cache_directory = "");
 
-  btCollisionShape* GetCollisionShape();
+  // Convex approximations of the mesh, that can be used for dynamic rigid
+  // bodies (see ConvexProxyShape). They are cached in the cache_directory if
+  // it isn't empty. These wait for the loading if it isn't finished yet.
+  btCollisionShape* GetConvexHullShape(const std::string& cache_directory = "");
+  btCollisionShape* GetConvexDecompositionShape(const std::string& cache_directory = "");
 
-  void AddInstanceToRenderBatch(const GameObject* game_object);
+  // Only affects the decomposition if it hasn't been created yet.
+  const ConvexDecomposition::Parameters& convex_decomposition_parameters() const {
+    return convex_decomposition_parameters_;
+  }
+  void set_convex_decomposition_parameters(const ConvexDecomposition::Parameters& value) {
+    convex_decomposition_parameters_ = value;
+  }
+
+  // Returns a scaled wrapper of GetCollisionShape(), that shares its BVH.
+  // The wrappers are cached per scale and reference counted, every acquire
+  // has to be matched by a release with the same scale. The last release
+  // returns the wrapper, that has to be kept alive until the physics thread
+  // might use it (see Scene::DeleteAfterPhysicsCommands).
+  btCollisionShape* AcquireScaledCollisionShape(const glm::vec3& scale,
+                                                const std::string& cache_directory = "");
+  std::unique_ptr<btCollisionShape> ReleaseScaledCollisionShape(const glm::vec3& scale);
+
+  // The world space bounding box is computed once per frame by the object
+  // (see GetBoundingBox), and is shared by the two batches.
+  void AddInstanceToRenderBatch(const GameObject* game_object, const BoundingBox& world_space_bbox,
+                                unsigned lod_level = 0);
   virtual void ClearRenderBatch() override;
   virtual void RenderBatch(Scene* scene) override;
 
-  void AddInstanceToRenderDepthOnlyBatch(const GameObject* game_object);
+  // The static instances are only rendered by the passes of the static
+  // shadow casters, and are skipped by the dynamic ones (see Scene::ShadowCasters).
+  void AddInstanceToRenderDepthOnlyBatch(const GameObject* game_object,
+                                         const BoundingBox& world_space_bbox,
+                                         unsigned lod_level = 0, bool is_static = false);
   virtual void ClearRenderDepthOnlyBatch() override;
   virtual void RenderDepthOnlyBatch(Scene* scene, const ICamera& camera) override;
+  // Always uses the builtin layered vertex shader, so the custom vertex
+  // shaders don't affect the layered passes.
+  virtual void RenderLayeredDepthOnlyBatch(Scene* scene,
+                                           const std::vector<const ICamera*>& layer_cameras) override;
+
+  // Culls both batches against every visibility view of the scene in one pass.
+  // The render functions use the results for the cameras of those views, and
+  // cull on their own for the other cameras, or if the batch changed since.
+  virtual void CullBatches(Scene* scene) override;
+
+  // The instances added with these are stored on the GPU, and are culled and
+  // rendered in every batch, without having to be added to it every frame.
+  // Only their changed transforms have to be updated.
+  unsigned AddGpuInstance(const glm::mat4& transform);
+  void UpdateGpuInstance(unsigned id, const glm::mat4& transform);
+  void RemoveGpuInstance(unsigned id);
 
+  // Until the renderer is ready, this is only the origin of the transform.
   BoundingBox GetBoundingBox(const glm::mat4& transform) const;
 
+  // Returns the low-poly proxy of the mesh, that is created on the first call.
+  const OccluderMesh* GetOccluderMesh();
+
+  // Returns the radius of the bounding sphere of bbox, projected by the camera,
+  // relative to the half of the screen height.
+  static float GetScreenSize(const BoundingBox& bbox, const ICamera& camera);
+
+  // Selects the level of detail for an instance with the given screen size,
+  // keeping current_level while the size is within the hysteresis.
+  unsigned SelectLodLevel(float screen_size, unsigned current_level, bool shadow_pass) const;
+
+  unsigned GetLodCount() const { return mesh_->lodCount(); }
+
   ShaderProgram& basic_prog() { return prog_data_.basic_prog_; }
-  ShaderProgram& shadow_recieve_prog() { return prog_data_.shadow_recieve_prog_; }
   ShaderProgram& shadow_cast_prog() { return prog_data_.shadow_cast_prog_; }
+  ShaderProgram& gbuffer_prog() { return prog_data_.gbuffer_prog_; }
 
   void set_cast_shadows(bool value) { cast_shadows_ = value; }
   void set_recieve_shadows(bool value) { recieve_shadows_ = value; }
 
+  // The screen sizes are multiplied by these before selecting the level of
+  // detail, values smaller than 1 choose the simplified levels sooner.
+  float lod_bias() const { return lod_bias_; }
+  void set_lod_bias(float value) { lod_bias_ = value; }
+  float shadow_lod_bias() const { return shadow_lod_bias_; }
+  void set_shadow_lod_bias(float value) { shadow_lod_bias_ = value; }
+
+  // If enabled, the meshlets of the large meshes that face away from the
+  // camera are culled. Should be disabled for meshes with visible back faces.
+  bool meshlet_cone_culling() const { return meshlet_cone_culling_; }
+  void set_meshlet_cone_culling(bool value) { meshlet_cone_culling_ = value; }
+
   virtual size_t GetTriangleCount() const override;
+  virtual uint64_t GetRenderSortKey() const override;
 
 private:
-  MeshRenderer mesh_;
+  std::unique_ptr<MeshRenderer> mesh_;
+  bool is_ready_ = false;
+
+  // The results of the asynchronous import, protected by the mutex
+  std::mutex loading_mutex_;
+  std::condition_variable import_finished_;
+  bool is_importing_ = false;
+  std::unique_ptr<MeshRenderer> imported_mesh_;
+  std::exception_ptr import_error_;
 
+  // The programs are shared by the renderers with the same vertex shader
+  // (see ShaderManager::GetProgram)
   struct ProgramData {
-    ShaderProgram basic_prog_;
-    ShaderProgram shadow_recieve_prog_;
-    ShaderProgram shadow_cast_prog_;
+    std::string vertex_shader_;
+    // The generic forward program, that decides the features at runtime. It's
+    // used until the variant for the features of the draw call is compiled.
+    ShaderProgram& basic_prog_;
+    ShaderProgram& shadow_cast_prog_;
+    // Used instead of the forward programs when the scene is deferred shaded
+    ShaderProgram& gbuffer_prog_;
 
     // basic_prog uniforms
-    gl::LazyUniform<glm::mat4> bp_uProjectionMatrix_, bp_uCameraMatrix_, bp_uModelMatrix_;
+    gl::LazyUniform<glm::mat4> bp_uModelMatrix_;
+    gl::LazyUniform<int> bp_uSimilarityInstances_, bp_uRecieveShadows_;
 
-    // shadow_recieve_prog_ uniforms
-    gl::LazyUniform<glm::mat4> srp_uProjectionMatrix_, srp_uCameraMatrix_, srp_uModelMatrix_, srp_uShadowCP_;
+    // The uniforms of the forward variants, by their programs
+    std::map<const ShaderProgram*, std::unique_ptr<gl::LazyUniform<int>>> variant_uSimilarityInstances_;
 
     // shadow_cast_prog_ uniforms
-    gl::LazyUniform<glm::mat4> scp_uProjectionMatrix_, scp_uCameraMatrix_, scp_uModelMatrix_;
+    gl::LazyUniform<glm::mat4> scp_uModelMatrix_;
+    gl::LazyUniform<int> scp_uSimilarityInstances_;
+
+    // gbuffer_prog_ uniforms
+    gl::LazyUniform<int> gp_uSimilarityInstances_, gp_uRecieveShadows_;
 
     ProgramData(ShaderManager* shader_manager,
                 const std::string& vertex_shader);
   };
 
+  // Created on the first layered pass. The layer is selected in the vertex
+  // shader if the driver supports it, and by a geometry shader otherwise.
+  struct LayeredProgramData {
+    ShaderProgram& shadow_cast_prog_;
+    gl::LazyUniform<int> scp_uSimilarityInstances_;
+
+    explicit LayeredProgramData(ShaderManager* shader_manager);
+  };
+
   ProgramData prog_data_;
+  std::unique_ptr<LayeredProgramData> layered_prog_data_;
+  // The forward program of the last RenderBatch
+  const ShaderProgram* forward_prog_ = nullptr;
+  ShaderManager* shader_manager_;
 
-  std::vector<int> bt_indices_;
-  std::unique_ptr<btTriangleIndexVertexArray> bt_triangles_;
-  std::unique_ptr<btCollisionShape> bt_shape_;
+  std::unique_ptr<GpuInstanceCuller> gpu_culler_;
+  std::unique_ptr<OccluderMesh> occluder_mesh_;
+
+  std::unique_ptr<TriangleMeshShape> collision_shape_;
+  std::unique_ptr<ConvexProxyShape> convex_hull_shape_, convex_decomposition_shape_;
+  ConvexDecomposition::Parameters convex_decomposition_parameters_;
+
+  // The scales that are closer than 1/kScaleKeyPrecision share a shape.
+  static constexpr float kScaleKeyPrecision = 1024.0f;
+  struct ScaleKey {
+    long x, y, z;
+    explicit ScaleKey(const glm::vec3& scale);
+    bool operator<(const ScaleKey& other) const;
+  };
+  struct ScaledCollisionShape {
+    std::unique_ptr<btScaledBvhTriangleMeshShape> shape;
+    unsigned ref_count = 0;
+  };
+  std::map<ScaleKey, ScaledCollisionShape> scaled_collision_shapes_;
 
   std::vector<glm::mat4> instance_transforms_;
   std::vector<glm::mat4> depth_only_instance_transforms_;
 
+  // The world space bounding boxes of the instances in the two batches,
+  // culled together in CullBatches (or in RenderBatch and RenderDepthOnlyBatch).
+  BoundingBoxArray instance_bboxes_;
+  BoundingBoxArray depth_only_instance_bboxes_;
+  std::vector<unsigned> visible_instance_indices_;
+
+  // The results of CullBatches, a mask per visibility view
+  std::vector<std::vector<uint64_t>> instance_visibility_masks_;
+  std::vector<std::vector<uint64_t>> depth_only_visibility_masks_;
+  bool batches_culled_ = false;
+  // The mask of the views that aren't culled in CullBatches
+  std::vector<uint64_t> visibility_mask_;
+
+  // Camera distances of the instances in instance_transforms_
+  std::vector<float> instance_depths_;
+  std::vector<unsigned> instance_order_;
+  std::vector<glm::mat4> sorted_instance_transforms_;
+
+  // The visible instances of a depth only pass, sorted by the level of detail
+  std::vector<glm::mat4> visible_depth_only_transforms_;
+  std::vector<size_t> lod_instance_offsets_;
+
+  // The per level of detail lists of the layered passes, and their layers
+  std::vector<std::vector<glm::mat4>> layered_lod_transforms_;
+  std::vector<std::vector<GLuint>> layered_lod_layers_;
+  std::vector<GLuint> instance_layers_;
+
+  // The GPU side copies of the transforms, in the most compact format that
+  // can represent all of them
+  std::vector<MeshRenderer::AffineInstance> affine_instances_;
+  std::vector<MeshRenderer::SimilarityInstance> similarity_instances_;
+
+  // The levels of detail of the instances in the two batches
+  std::vector<unsigned> instance_lod_levels_;
+  std::vector<unsigned> depth_only_instance_lod_levels_;
+  std::vector<bool> depth_only_instance_is_static_;
+  std::vector<size_t> lod_instance_counts_;
+
   bool cast_shadows_ = true;
   bool recieve_shadows_ = true;
+  float lod_bias_ = 1.0f;
+  float shadow_lod_bias_ = 0.5f;
+  bool meshlet_cone_culling_ = true;
 
-  void EnsureModelMatrixBufferSize(size_t size);
-  void SetupModelMatrixAttrib();
+  unsigned GetLodLevelForScreenSize(float screen_size, float transition_scale) const;
+  MeshRenderer::InstanceFormat UploadInstances(const std::vector<glm::mat4>& transforms);
+  void RenderLods(const std::vector<glm::mat4>& transforms, const ICamera& camera,
+                  bool cone_culling);
+  bool HasGpuInstances() const;
+  // Uses the forward program variant for the features of the draw call if
+  // it's compiled, or the generic program until then. Returns the uniform of
+  // the used program, that selects the instance format.
+  gl::LazyUniform<int>* UseForwardProgram(Scene* scene);
+  void CullGpuInstances(Scene* scene, const ICamera& camera);
+  // Collects the depth only instances that the camera sees, and the scene's
+  // current pass renders, into visible_instance_indices_.
+  void CullDepthOnlyBatch(Scene* scene, const ICamera& camera);
 };
 
 MeshObjectRenderer* GetMeshRenderer(const std::string& str, ShaderManager* shader_manager,
+                                    TextureManager* texture_manager,
                                     std::map<std::string, std::unique_ptr<IMeshObjectRenderer>>* mesh_cache,
-                                    const std::string& vertex_shader_path);
+                                    const std::string& vertex_shader_path,
+                                    const MeshRenderer::LodSettings& lod_settings = MeshRenderer::LodSettings{},
+                                    ThreadPool* thread_pool = nullptr);
 
 }
 
@@ -0,0 +1,329 @@
+// Copyright (c) Tamas Csala
+
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+
+#include <Silice3D/mesh/mesh_optimizer.hpp>
+
+namespace Silice3D {
+namespace MeshOptimizer {
+
+namespace {
+
+// The triangles that use each vertex, in CSR format.
+struct Adjacency {
+  std::vector<unsigned> offsets, triangles;
+
+  Adjacency(const std::vector<unsigned>& indices, size_t vertex_count)
+      : offsets(vertex_count + 1, 0), triangles(indices.size()) {
+    for (unsigned index : indices) {
+      offsets[index + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+    std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+      triangles[fill[indices[i]]++] = i / 3;
+    }
+  }
+
+  const unsigned* begin(unsigned vertex) const { return &triangles[0] + offsets[vertex]; }
+  const unsigned* end(unsigned vertex) const { return &triangles[0] + offsets[vertex + 1]; }
+  unsigned count(unsigned vertex) const { return offsets[vertex + 1] - offsets[vertex]; }
+};
+
+template<typename T>
+void Remap(const std::vector<unsigned>& new_index_of_vertex, size_t new_vertex_count,
+           std::vector<T>* data) {
+  std::vector<T> result(new_vertex_count);
+  for (size_t v = 0; v < data->size(); ++v) {
+    if (new_index_of_vertex[v] != unsigned(-1)) {
+      result[new_index_of_vertex[v]] = (*data)[v];
+    }
+  }
+  *data = std::move(result);
+}
+
+void RemapVertices(const std::vector<unsigned>& new_index_of_vertex,
+                   size_t new_vertex_count, MeshData* mesh) {
+  Remap(new_index_of_vertex, new_vertex_count, &mesh->positions);
+  Remap(new_index_of_vertex, new_vertex_count, &mesh->normals);
+  Remap(new_index_of_vertex, new_vertex_count, &mesh->tangents);
+  Remap(new_index_of_vertex, new_vertex_count, &mesh->texcoords);
+  for (unsigned& index : mesh->indices) {
+    index = new_index_of_vertex[index];
+  }
+}
+
+}  // namespace
+
+CacheStatistics AnalyzeVertexCache(const std::vector<unsigned>& indices,
+                                   size_t vertex_count, unsigned cache_size) {
+  CacheStatistics result;
+  if (indices.empty()) {
+    return result;
+  }
+
+  // A vertex is in the FIFO if less than cache_size misses happened since
+  // it was inserted.
+  std::vector<size_t> insertion_time(vertex_count, 0);
+  std::vector<bool> used(vertex_count, false);
+  size_t misses = 0, used_vertex_count = 0;
+  for (unsigned index : indices) {
+    if (!used[index]) {
+      used[index] = true;
+      used_vertex_count++;
+    }
+    if (insertion_time[index] == 0 || misses - insertion_time[index] >= cache_size) {
+      misses++;
+      insertion_time[index] = misses;
+    }
+  }
+
+  result.acmr = float(misses) / (indices.size() / 3);
+  result.atvr = float(misses) / used_vertex_count;
+  return result;
+}
+
+void WeldVertices(MeshData* mesh) {
+  size_t vertex_count = mesh->positions.size();
+
+  // Sorts the vertices by their attributes' bit patterns, so the identical
+  // ones get next to each other.
+  struct Vertex {
+    float data[11];
+  };
+  std::vector<Vertex> vertices(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    float* data = vertices[v].data;
+    std::memcpy(data, &mesh->positions[v], sizeof(glm::vec3));
+    std::memcpy(data + 3, &mesh->normals[v], sizeof(glm::vec3));
+    std::memcpy(data + 6, &mesh->tangents[v], sizeof(glm::vec3));
+    std::memcpy(data + 9, &mesh->texcoords[v], sizeof(glm::vec2));
+  }
+
+  std::vector<unsigned> order(vertex_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&vertices](unsigned a, unsigned b) {
+    return std::memcmp(vertices[a].data, vertices[b].data, sizeof(Vertex)) < 0;
+  });
+
+  // Every vertex is mapped to the first one of its group
+  std::vector<unsigned> representative(vertex_count);
+  for (size_t i = 0; i < order.size(); ++i) {
+    bool same_as_previous = i > 0 && std::memcmp(vertices[order[i]].data,
+                                                 vertices[order[i-1]].data,
+                                                 sizeof(Vertex)) == 0;
+    representative[order[i]] = same_as_previous ? representative[order[i-1]] : order[i];
+  }
+
+  for (unsigned& index : mesh->indices) {
+    index = representative[index];
+  }
+  // The unreferenced vertices are removed by OptimizeVertexFetch
+}
+
+void OptimizeVertexCache(std::vector<unsigned>* indices, size_t vertex_count,
+                         unsigned cache_size) {
+  size_t triangle_count = indices->size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  Adjacency adjacency{*indices, vertex_count};
+  std::vector<unsigned> live_triangles(vertex_count);
+  for (size_t v = 0; v < vertex_count; ++v) {
+    live_triangles[v] = adjacency.count(v);
+  }
+
+  std::vector<unsigned> cache_time(vertex_count, 0);
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<unsigned> dead_end_stack;
+  std::vector<unsigned> candidates;
+  std::vector<unsigned> result;
+  result.reserve(indices->size());
+
+  unsigned time = cache_size + 1;
+  size_t cursor = 0;
+
+  // Returns a vertex that still has triangles, first from the recently used
+  // ones, and then in the input order. Returns -1 if everything is emitted.
+  auto skip_dead_end = [&]() -> int {
+    while (!dead_end_stack.empty()) {
+      unsigned vertex = dead_end_stack.back();
+      dead_end_stack.pop_back();
+      if (live_triangles[vertex] > 0) {
+        return vertex;
+      }
+    }
+    while (cursor < vertex_count) {
+      unsigned vertex = cursor++;
+      if (live_triangles[vertex] > 0) {
+        return vertex;
+      }
+    }
+    return -1;
+  };
+
+  int fanning_vertex = skip_dead_end();
+  while (fanning_vertex >= 0) {
+    // Emits every remaining triangle around the fanning vertex
+    candidates.clear();
+    for (const unsigned* t = adjacency.begin(fanning_vertex);
+         t != adjacency.end(fanning_vertex); ++t) {
+      if (emitted[*t]) {
+        continue;
+      }
+      emitted[*t] = true;
+      for (int i = 0; i < 3; ++i) {
+        unsigned vertex = (*indices)[3 * *t + i];
+        result.push_back(vertex);
+        dead_end_stack.push_back(vertex);
+        candidates.push_back(vertex);
+        live_triangles[vertex]--;
+        if (time - cache_time[vertex] > cache_size) {
+          cache_time[vertex] = time++;
+        }
+      }
+    }
+
+    // The next fanning vertex is the candidate that stays in the cache for
+    // the longest time after its triangles are emitted.
+    int best_vertex = -1;
+    int best_priority = -1;
+    for (unsigned vertex : candidates) {
+      if (live_triangles[vertex] == 0) {
+        continue;
+      }
+      int priority = 0;
+      if (time - cache_time[vertex] + 2 * live_triangles[vertex] <= cache_size) {
+        priority = time - cache_time[vertex];
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        best_vertex = vertex;
+      }
+    }
+
+    fanning_vertex = best_vertex >= 0 ? best_vertex : skip_dead_end();
+  }
+
+  *indices = std::move(result);
+}
+
+void OptimizeOverdraw(std::vector<unsigned>* indices,
+                      const std::vector<glm::vec3>& positions,
+                      float threshold, unsigned cache_size) {
+  size_t triangle_count = indices->size() / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // A new cluster starts at every triangle that misses the cache with all
+  // of its vertices, these are where the cache optimizer had to jump.
+  std::vector<size_t> cluster_starts;
+  std::vector<size_t> insertion_time(positions.size(), 0);
+  size_t misses = 0;
+  for (size_t t = 0; t < triangle_count; ++t) {
+    int triangle_misses = 0;
+    for (int i = 0; i < 3; ++i) {
+      unsigned index = (*indices)[3*t + i];
+      if (insertion_time[index] == 0 || misses - insertion_time[index] >= cache_size) {
+        misses++;
+        insertion_time[index] = misses;
+        triangle_misses++;
+      }
+    }
+    if (t == 0 || triangle_misses == 3) {
+      cluster_starts.push_back(t);
+    }
+  }
+  if (cluster_starts.size() <= 1) {
+    return;
+  }
+  cluster_starts.push_back(triangle_count);
+  size_t cluster_count = cluster_starts.size() - 1;
+
+  // Sort key: how much the cluster faces away from the mesh's center
+  glm::vec3 mesh_centroid{0.0f};
+  float mesh_area = 0.0f;
+  std::vector<glm::vec3> cluster_centroids(cluster_count, glm::vec3{0.0f});
+  std::vector<glm::vec3> cluster_normals(cluster_count, glm::vec3{0.0f});
+  std::vector<float> cluster_areas(cluster_count, 0.0f);
+  for (size_t c = 0; c < cluster_count; ++c) {
+    for (size_t t = cluster_starts[c]; t < cluster_starts[c+1]; ++t) {
+      const glm::vec3& p0 = positions[(*indices)[3*t]];
+      const glm::vec3& p1 = positions[(*indices)[3*t + 1]];
+      const glm::vec3& p2 = positions[(*indices)[3*t + 2]];
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);  // length = 2*area
+      float area = glm::length(normal);
+
+      cluster_centroids[c] += (p0 + p1 + p2) * (area / 3.0f);
+      cluster_normals[c] += normal;
+      cluster_areas[c] += area;
+    }
+    mesh_centroid += cluster_centroids[c];
+    mesh_area += cluster_areas[c];
+  }
+  if (mesh_area == 0.0f) {
+    return;
+  }
+  mesh_centroid /= mesh_area;
+
+  std::vector<float> sort_keys(cluster_count, 0.0f);
+  for (size_t c = 0; c < cluster_count; ++c) {
+    float normal_length = glm::length(cluster_normals[c]);
+    if (cluster_areas[c] > 0.0f && normal_length > 0.0f) {
+      glm::vec3 centroid = cluster_centroids[c] / cluster_areas[c];
+      sort_keys[c] = glm::dot(centroid - mesh_centroid, cluster_normals[c] / normal_length);
+    }
+  }
+
+  std::vector<size_t> cluster_order(cluster_count);
+  std::iota(cluster_order.begin(), cluster_order.end(), 0);
+  std::stable_sort(cluster_order.begin(), cluster_order.end(), [&sort_keys](size_t a, size_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<unsigned> result;
+  result.reserve(indices->size());
+  for (size_t c : cluster_order) {
+    result.insert(result.end(), indices->begin() + 3*cluster_starts[c],
+                  indices->begin() + 3*cluster_starts[c+1]);
+  }
+
+  float original_acmr = AnalyzeVertexCache(*indices, positions.size(), cache_size).acmr;
+  float new_acmr = AnalyzeVertexCache(result, positions.size(), cache_size).acmr;
+  if (new_acmr <= original_acmr * threshold) {
+    *indices = std::move(result);
+  }
+}
+
+void OptimizeVertexFetch(MeshData* mesh) {
+  std::vector<unsigned> new_index_of_vertex(mesh->positions.size(), unsigned(-1));
+  unsigned new_vertex_count = 0;
+  for (unsigned index : mesh->indices) {
+    if (new_index_of_vertex[index] == unsigned(-1)) {
+      new_index_of_vertex[index] = new_vertex_count++;
+    }
+  }
+
+  RemapVertices(new_index_of_vertex, new_vertex_count, mesh);
+}
+
+OptimizationResult Optimize(MeshData* mesh) {
+  OptimizationResult result;
+  result.before = AnalyzeVertexCache(mesh->indices, mesh->positions.size());
+
+  WeldVertices(mesh);
+  OptimizeVertexCache(&mesh->indices, mesh->positions.size());
+  OptimizeOverdraw(&mesh->indices, mesh->positions);
+  OptimizeVertexFetch(mesh);
+
+  result.after = AnalyzeVertexCache(mesh->indices, mesh->positions.size());
+  return result;
+}
+
+}  // namespace MeshOptimizer
+}  // namespace Silice3D
@@ -0,0 +1,74 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_MESH_MESH_OPTIMIZER_HPP_
+#define SILICE3D_MESH_MESH_OPTIMIZER_HPP_
+
+#include <vector>
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// Reorders the indices and the vertices of the triangle lists to make them
+// faster to render: the post-transform vertex cache, the early depth test and
+// the vertex fetch all work best with different orders, these functions
+// should be called in the order they are declared here (Optimize does that).
+namespace MeshOptimizer {
+
+// The FIFO cache size used by the simulations. Most GPUs have a larger cache,
+// but an order that is optimal for a smaller one works well with them too.
+constexpr unsigned kDefaultCacheSize = 16;
+
+struct MeshData {
+  std::vector<glm::vec3> positions, normals, tangents;
+  std::vector<glm::vec2> texcoords;
+  std::vector<unsigned> indices;
+};
+
+// The result of simulating a FIFO post-transform vertex cache.
+struct CacheStatistics {
+  // Average cache miss ratio: vertex shader invocations per triangle
+  // (between 0.5 and 3, lower is better).
+  float acmr = 0.0f;
+  // Average transform to vertex ratio: vertex shader invocations per used
+  // vertex (1 is optimal).
+  float atvr = 0.0f;
+};
+
+// Simulates a FIFO vertex cache with the given size.
+CacheStatistics AnalyzeVertexCache(const std::vector<unsigned>& indices,
+                                   size_t vertex_count,
+                                   unsigned cache_size = kDefaultCacheSize);
+
+// Merges the vertices that have exactly the same attributes.
+void WeldVertices(MeshData* mesh);
+
+// Reorders the triangles for the post-transform vertex cache, with the
+// Tipsify algorithm (Sander, Nehab and Barczak: "Fast Triangle Reordering
+// for Vertex Locality and Reduced Overdraw").
+void OptimizeVertexCache(std::vector<unsigned>* indices, size_t vertex_count,
+                         unsigned cache_size = kDefaultCacheSize);
+
+// Reorders the clusters of a vertex cache optimized triangle list, so that the
+// outward facing parts of the mesh are drawn first, which are likely to occlude
+// the rest. The new order is only kept if its ACMR is at most threshold times
+// the original one.
+void OptimizeOverdraw(std::vector<unsigned>* indices,
+                      const std::vector<glm::vec3>& positions,
+                      float threshold = 1.05f,
+                      unsigned cache_size = kDefaultCacheSize);
+
+// Reorders the vertices in the order of their first use, and removes the
+// unused ones, so the vertex fetch accesses the memory sequentially.
+void OptimizeVertexFetch(MeshData* mesh);
+
+struct OptimizationResult {
+  CacheStatistics before, after;
+};
+
+// Runs all the optimizations above.
+OptimizationResult Optimize(MeshData* mesh);
+
+}  // namespace MeshOptimizer
+}  // namespace Silice3D
+
+#endif  // SILICE3D_MESH_MESH_OPTIMIZER_HPP_
@@ -1,11 +1,16 @@
 // Copyright (c) Tamas Csala
 
+#include <cmath>
 #include <vector>
-#include <lodepng.h>
+#include <iostream>
+#include <algorithm>
 
 #include <Silice3D/common/oglwrap.hpp>
 #include <Silice3D/common/make_unique.hpp>
 #include <Silice3D/mesh/mesh_renderer.hpp>
+#include <Silice3D/mesh/mesh_optimizer.hpp>
+#include <Silice3D/mesh/mesh_simplifier.hpp>
+#include <Silice3D/texture/texture_manager.hpp>
 
 namespace Silice3D {
 
@@ -13,11 +18,13 @@ void MeshRenderer::MeshDataStorage::uploadVertexData(
           const std::vector<glm::vec3>& positions,
           const std::vector<glm::vec3>& normals,
           const std::vector<glm::vec3>& tangets,
-          const std::vector<glm::vec2>& texcoords) {
+          const std::vector<glm::vec2>& texcoords,
+          const std::vector<GLuint>& material_ids) {
   size_t vertex_count_to_upload = positions.size();
   assert(normals.size() == vertex_count_to_upload);
   assert(tangets.size() == vertex_count_to_upload);
   assert(texcoords.size() == vertex_count_to_upload);
+  assert(material_ids.size() == vertex_count_to_upload);
 
   gl::Bind(vao);
   if (vertex_allocation < vertex_count + vertex_count_to_upload) {
@@ -31,6 +38,7 @@ void MeshRenderer::MeshDataStorage::uploadVertexData(
     reallocUploadNewData(normals, normals_buffer, vertex_allocation, vertex_count);
     reallocUploadNewData(tangets, tangents_buffer, vertex_allocation, vertex_count);
     reallocUploadNewData(texcoords, texcoords_buffer, vertex_allocation, vertex_count);
+    reallocUploadNewData(material_ids, material_ids_buffer, vertex_allocation, vertex_count);
 
     gl::Bind(positions_buffer);
     gl::VertexAttribObject(kPositionAttribLocation).setup<glm::vec3>().enable();
@@ -44,15 +52,19 @@ void MeshRenderer::MeshDataStorage::uploadVertexData(
     gl::Bind(texcoords_buffer);
     gl::VertexAttribObject(kTexcoordAttribLocation).setup<glm::vec2>().enable();
 
+    gl::Bind(material_ids_buffer);
+    setupMaterialIdAttrib();
+
   } else {
     uploadNewData(positions, positions_buffer, vertex_allocation, vertex_count);
     uploadNewData(normals, normals_buffer, vertex_allocation, vertex_count);
     uploadNewData(tangets, tangents_buffer, vertex_allocation, vertex_count);
     uploadNewData(texcoords, texcoords_buffer, vertex_allocation, vertex_count);
+    uploadNewData(material_ids, material_ids_buffer, vertex_allocation, vertex_count);
   }
 
-  gl::Bind(model_matrix_buffer);
-  setupModelMatrixAttrib();
+  gl::Bind(instance_buffer);
+  setupInstanceAttrib(instance_format);
 
   vertex_count += vertex_count_to_upload;
   gl::Unbind(gl::kArrayBuffer);
@@ -79,14 +91,103 @@ void MeshRenderer::MeshDataStorage::uploadIndexData(const std::vector<GLuint>& i
   gl::Unbind(gl::kVertexArray);
 }
 
-void MeshRenderer::MeshDataStorage::uploadModelMatrices(const std::vector<glm::mat4>& matrices) {
+void MeshRenderer::MeshDataStorage::uploadInstances(const void* data, size_t size,
+                                                    InstanceFormat format) {
   gl::Bind(vao);
-  gl::Bind(model_matrix_buffer);
-  model_matrix_buffer.data(matrices, gl::kStreamDraw);
-  gl::Unbind(model_matrix_buffer);
+  gl::Bind(instance_buffer);
+  instance_buffer.data(size, data, gl::kStreamDraw);
+  if (format != instance_format) {
+    instance_format = format;
+    setupInstanceAttrib(format);
+  }
+  gl::Unbind(instance_buffer);
   gl::Unbind(vao);
 }
 
+void MeshRenderer::MeshDataStorage::uploadInstanceLayers(const std::vector<GLuint>& layers) {
+  gl::Bind(vao);
+  gl::Bind(instance_layer_buffer);
+  instance_layer_buffer.data(layers, gl::kStreamDraw);
+  glVertexAttribIPointer(kInstanceLayerAttribLocation, 1, GL_UNSIGNED_INT, 0, nullptr);
+  glVertexAttribDivisor(kInstanceLayerAttribLocation, 1);
+  glEnableVertexAttribArray(kInstanceLayerAttribLocation);
+  gl::Unbind(instance_layer_buffer);
+  gl::Unbind(vao);
+}
+
+void MeshRenderer::MeshDataStorage::setInstanceLayer(GLuint layer) {
+  gl::Bind(vao);
+  glDisableVertexAttribArray(kInstanceLayerAttribLocation);
+  gl::Unbind(vao);
+  // The current value of a disabled attribute isn't part of the VAO's state
+  glVertexAttribI4ui(kInstanceLayerAttribLocation, layer, 0, 0, 1);
+}
+
+unsigned MeshRenderer::MeshDataStorage::allocateMaterials(unsigned count) {
+  unsigned first_material = materials.size();
+  materials.resize(materials.size() + count);
+  materials_changed = true;
+  return first_material;
+}
+
+void MeshRenderer::MeshDataStorage::updateMaterialBuffer(const TextureManager& texture_manager) {
+  if (!materials_changed &&
+      material_texture_upload_count == texture_manager.GetUploadCount()) {
+    return;
+  }
+
+  // Matches the Silice3D_Material struct in material.frag (std430)
+  struct MaterialData {
+    GLuint64 diffuse_texture;
+    GLuint64 specular_texture;
+  };
+
+  std::vector<MaterialData> material_data;
+  material_data.reserve(materials.size());
+  for (const Material& material : materials) {
+    material_data.push_back({texture_manager.GetBindlessHandle(material.diffuse_texture),
+                             texture_manager.GetBindlessHandle(material.specular_texture)});
+  }
+
+  gl::Bind(material_buffer);
+  material_buffer.data(material_data, gl::kDynamicDraw);
+  gl::Unbind(material_buffer);
+
+  materials_changed = false;
+  material_texture_upload_count = texture_manager.GetUploadCount();
+}
+
+void MeshRenderer::MeshDataStorage::drawIndirect(
+    const std::vector<DrawElementsIndirectCommand>& commands) {
+  auto bind = gl::MakeTemporaryBind(vao);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialBufferBinding, material_buffer.expose());
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer.expose());
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand),
+               commands.data(), GL_STREAM_DRAW);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commands.size(), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void MeshRenderer::MeshDataStorage::drawIndirect(const gl::ArrayBuffer& instances,
+                                                 const gl::ArrayBuffer& commands,
+                                                 size_t command_count) {
+  auto bind = gl::MakeTemporaryBind(vao);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMaterialBufferBinding, material_buffer.expose());
+
+  // Temporarily point the instanced attributes to the other buffer
+  glBindBuffer(GL_ARRAY_BUFFER, instances.expose());
+  setupInstanceAttrib(InstanceFormat::kAffine);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.expose());
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, command_count, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  gl::Bind(instance_buffer);
+  setupInstanceAttrib(instance_format);
+  gl::Unbind(gl::kArrayBuffer);
+}
+
 template<typename T, typename Buffer>
 void MeshRenderer::MeshDataStorage::uploadNewData(const std::vector<T>& data, Buffer& buffer,
                    size_t allocation, size_t count) {
@@ -122,22 +223,39 @@ void MeshRenderer::MeshDataStorage::reallocUploadNewData(const std::vector<T>& d
   buffer = std::move(temp_buffer);
 }
 
-void MeshRenderer::MeshDataStorage::setupModelMatrixAttrib() {
-  for (int i = 0; i < 4; ++i) {
-    auto attrib = gl::VertexAttribObject(kModelMatrixAttributeLocation + i);
-    attrib.pointer(4, gl::kFloat, false, sizeof(glm::mat4), (void*)(i*sizeof(glm::vec4)));
-    attrib.divisor(1);
-    attrib.enable();
+void MeshRenderer::MeshDataStorage::setupInstanceAttrib(InstanceFormat format) {
+  size_t stride = format == InstanceFormat::kAffine ? sizeof(AffineInstance)
+                                                    : sizeof(SimilarityInstance);
+  size_t used_location_count = stride / sizeof(glm::vec4);
+  for (size_t i = 0; i < 3; ++i) {
+    if (i < used_location_count) {
+      auto attrib = gl::VertexAttribObject(kInstanceDataAttribLocation + i);
+      attrib.pointer(4, gl::kFloat, false, stride, (void*)(i*sizeof(glm::vec4)));
+      attrib.divisor(1);
+      attrib.enable();
+    } else {
+      // The shader reads the constant (0, 0, 0, 1) from the disabled ones
+      glDisableVertexAttribArray(kInstanceDataAttribLocation + i);
+    }
   }
 }
 
+void MeshRenderer::MeshDataStorage::setupMaterialIdAttrib() {
+  // Integer attributes need the I variant, that would be converted to float otherwise
+  glVertexAttribIPointer(kMaterialIdAttribLocation, 1, GL_UNSIGNED_INT, 0, nullptr);
+  glEnableVertexAttribArray(kMaterialIdAttribLocation);
+}
+
 /// Loads in the mesh from a file, and does some post-processing on it.
 /** @param filename - The name of the file to load in.
-  * @param flags - The assimp post-process flags. */
+  * @param flags - The assimp post-process flags.
+  * @param texture_manager - Used to load the textures of the materials. */
 MeshRenderer::MeshRenderer(const std::string& filename,
-                           gl::Bitfield<aiPostProcessSteps> flags)
+                           gl::Bitfield<aiPostProcessSteps> flags,
+                           TextureManager* texture_manager)
     : scene_(importer_.ReadFile(filename.c_str(), flags|aiProcess_Triangulate))
     , filename_(filename)
+    , texture_manager_(texture_manager)
     , entries_(scene_ ? scene_->mNumMeshes : 0) {
   if (!scene_) {
     throw std::runtime_error("Error parsing " + filename_ + " : " +
@@ -166,44 +284,63 @@ void MeshRenderer::FreeMeshDataStorage() {
 }
 
 
-/// Sets up a btTriangleIndexVertexArray, and returns a vector of indices
-/// that should be stored throughout the lifetime of the bullet object
-std::vector<int> MeshRenderer::btTriangles(btTriangleIndexVertexArray* triangles) {
-  std::vector<int> indices_vector;
-
+/// Returns the positions and the indices of every mesh merged together.
+void MeshRenderer::triangles(std::vector<glm::vec3>* positions,
+                             std::vector<unsigned>* indices) const {
+  positions->clear();
+  indices->clear();
   for (unsigned mesh_idx = 0; mesh_idx < scene_->mNumMeshes; ++mesh_idx) {
     const aiMesh* mesh = scene_->mMeshes[mesh_idx];
-    btIndexedMesh btMesh;
-    btMesh.m_numVertices = mesh->mNumVertices;
-    btMesh.m_vertexBase = (const unsigned char*)mesh->mVertices;
-    btMesh.m_vertexStride = sizeof(aiVector3D);
-    btMesh.m_vertexType = PHY_FLOAT;
-
-    auto indices_begin_idx = indices_vector.size();
-    indices_vector.reserve(indices_vector.size() + mesh->mNumFaces * 3);
+    unsigned vertex_offset = positions->size();
+    for (size_t i = 0; i < mesh->mNumVertices; ++i) {
+      const aiVector3D& pos = mesh->mVertices[i];
+      positions->push_back(glm::vec3{pos.x, pos.y, pos.z});
+    }
     for (size_t face_idx = 0; face_idx < mesh->mNumFaces; face_idx++) {
       const aiFace& face = mesh->mFaces[face_idx];
       if (face.mNumIndices == 3) {  // The invalid faces are just ignored.
-        indices_vector.push_back(face.mIndices[0]);
-        indices_vector.push_back(face.mIndices[1]);
-        indices_vector.push_back(face.mIndices[2]);
+        indices->push_back(vertex_offset + face.mIndices[0]);
+        indices->push_back(vertex_offset + face.mIndices[1]);
+        indices->push_back(vertex_offset + face.mIndices[2]);
       }
     }
-    btMesh.m_numTriangles = (indices_vector.size()-indices_begin_idx)/3;
-    btMesh.m_triangleIndexBase = (const unsigned char*)(indices_vector.data() + indices_begin_idx);
-    btMesh.m_triangleIndexStride = 3*sizeof(int);
-    btMesh.m_indexType = PHY_INTEGER;
+  }
+}
 
-    triangles->addIndexedMesh(btMesh, PHY_INTEGER);
+void MeshRenderer::occluderProxy(size_t max_triangle_count, float max_error,
+                                 std::vector<glm::vec3>* positions,
+                                 std::vector<unsigned>* indices) const {
+  triangles(positions, indices);
+
+  if (indices->size() > 3 * max_triangle_count) {
+    // Only the shape matters, the normals and texcoords don't restrict the collapses
+    std::vector<glm::vec3> normals(positions->size(), glm::vec3{0.0f});
+    std::vector<glm::vec2> texcoords(positions->size(), glm::vec2{0.0f});
+    calculateModelSpaceBoundBox();
+    float max_model_space_error = max_error * glm::length(model_space_bounding_box_.GetExtent());
+    *indices = MeshSimplifier::Simplify(*positions, normals, texcoords, *indices,
+                                        3 * max_triangle_count, max_model_space_error);
   }
 
-  return indices_vector;
+  MeshOptimizer::MeshData mesh_data;
+  mesh_data.positions = std::move(*positions);
+  mesh_data.normals.resize(mesh_data.positions.size());
+  mesh_data.tangents.resize(mesh_data.positions.size());
+  mesh_data.texcoords.resize(mesh_data.positions.size());
+  mesh_data.indices = std::move(*indices);
+  MeshOptimizer::OptimizeVertexFetch(&mesh_data);  // drops the collapsed vertices
+  *positions = std::move(mesh_data.positions);
+  *indices = std::move(mesh_data.indices);
 }
 
-void MeshRenderer::setup()
-{
-  if (!is_setup_) {
-    is_setup_ = true;
+void MeshRenderer::setup(const LodSettings& lod_settings) {
+  prepare(lod_settings);
+  upload();
+}
+
+void MeshRenderer::prepare(const LodSettings& lod_settings) {
+  if (!is_prepared_) {
+    is_prepared_ = true;
   } else {
     std::cerr << "MeshRenderer::setup is called multiple times on the "
                  "same object. If the two calls want to set positions up into "
@@ -216,23 +353,150 @@ void MeshRenderer::setup()
     std::terminate();
   }
 
+  calculateModelSpaceBoundBox();
+  float max_lod_error = lod_settings.max_error *
+                        glm::length(model_space_bounding_box_.GetExtent());
+  unsigned lod_count = std::max(lod_settings.level_count, 1u);
+
+  size_t optimized_index_count = 0;
+  MeshOptimizer::CacheStatistics stats_before, stats_after;
+
+  prepared_meshes_.resize(entries_.size());
+  for (size_t i = 0; i < entries_.size(); i++) {
+    const aiMesh* mesh = scene_->mMeshes[i];
+    PreparedMesh& prepared = prepared_meshes_[i];
+    MeshOptimizer::MeshData& mesh_data = prepared.data;
+    mesh_data.indices = getIndices(mesh);
+    mesh_data.positions = getPositions(mesh);
+    mesh_data.normals = getNormals(mesh);
+    mesh_data.tangents = getTangents(mesh);
+    mesh_data.texcoords = getTexCoords(i);
+
+    MeshOptimizer::OptimizationResult optimization = MeshOptimizer::Optimize(&mesh_data);
+
+    // The large meshes are split into meshlets. That changes the order of the
+    // triangles, so the vertex fetch has to be optimized again.
+    if (mesh_data.indices.size() / 3 >= kMeshletMinTriangleCount) {
+      prepared.meshlets = MeshletBuilder::Build(mesh_data.positions, &mesh_data.indices);
+      MeshOptimizer::OptimizeVertexFetch(&mesh_data);
+      optimization.after = MeshOptimizer::AnalyzeVertexCache(mesh_data.indices,
+                                                             mesh_data.positions.size());
+    }
+
+    size_t index_count = mesh_data.indices.size();
+    stats_before.acmr += optimization.before.acmr * index_count;
+    stats_before.atvr += optimization.before.atvr * index_count;
+    stats_after.acmr += optimization.after.acmr * index_count;
+    stats_after.atvr += optimization.after.atvr * index_count;
+    optimized_index_count += index_count;
+
+    // Every level is simplified from the previous one. If a level can't be
+    // simplified further, its indices are left empty, and the previous
+    // level's index range is reused.
+    prepared.lod_indices.resize(lod_count);
+    const std::vector<GLuint>* lod_indices = &mesh_data.indices;
+    for (unsigned level = 1; level < lod_count; ++level) {
+      size_t target_index_count = size_t(lod_indices->size() * lod_settings.reduction) / 3 * 3;
+      std::vector<GLuint> simplified_indices = MeshSimplifier::Simplify(
+          mesh_data.positions, mesh_data.normals, mesh_data.texcoords, *lod_indices,
+          target_index_count, max_lod_error);
+
+      if (simplified_indices.size() < lod_indices->size()) {
+        MeshOptimizer::OptimizeVertexCache(&simplified_indices, mesh_data.positions.size());
+        prepared.lod_indices[level] = std::move(simplified_indices);
+        lod_indices = &prepared.lod_indices[level];
+      }
+    }
+  }
+
+  if (optimized_index_count > 0) {
+    stats_before.acmr /= optimized_index_count;
+    stats_before.atvr /= optimized_index_count;
+    stats_after.acmr /= optimized_index_count;
+    stats_after.atvr /= optimized_index_count;
+  }
+  vertex_cache_statistics_before_ = stats_before;
+  vertex_cache_statistics_after_ = stats_after;
+}
+
+void MeshRenderer::upload() {
+  assert(is_prepared_);
+  if (!is_setup_) {
+    is_setup_ = true;
+  } else {
+    std::cerr << "MeshRenderer::upload is called multiple times on the same object.";
+    std::terminate();
+  }
+
   MeshDataStorage& mesh_data_storage = getMeshDataStorage();
   gl::Bind(mesh_data_storage.vao);
 
+  material_base_ = mesh_data_storage.allocateMaterials(scene_->mNumMaterials);
+
+  unsigned lod_count = prepared_meshes_.empty() ? 1 : prepared_meshes_[0].lod_indices.size();
+  lod_draw_commands_.resize(lod_count);
+  lod_triangle_counts_.assign(lod_count, 0);
+
+  // Uploads the mesh-local indices offseted to the vertices of the mesh
+  auto upload_indices = [&mesh_data_storage](const std::vector<GLuint>& indices,
+                                             GLuint vertex_offset) {
+    std::vector<GLuint> offseted_indices = indices;
+    for (GLuint& index : offseted_indices) {
+      index += vertex_offset;
+    }
+    mesh_data_storage.uploadIndexData(offseted_indices);
+  };
+
   for (size_t i = 0; i < entries_.size(); i++) {
     entries_[i].base_idx = mesh_data_storage.idx_count;
 
     const aiMesh* mesh = scene_->mMeshes[i];
-    std::vector<GLuint> indices = getIndices(mesh);
-    std::vector<glm::vec3> positions = getPositions(mesh);
-    std::vector<glm::vec3> normals = getNormals(mesh);
-    std::vector<glm::vec3> tangents = getTangents(mesh);
-    std::vector<glm::vec2> texcoords = getTexCoords(i);
+    const PreparedMesh& prepared = prepared_meshes_[i];
+    const MeshOptimizer::MeshData& mesh_data = prepared.data;
+    std::vector<GLuint> material_ids(mesh_data.positions.size(),
+                                     material_base_ + mesh->mMaterialIndex);
 
-    mesh_data_storage.uploadVertexData(positions, normals, tangents, texcoords);
-    mesh_data_storage.uploadIndexData(indices);
+    GLuint vertex_offset = mesh_data_storage.vertex_count;
+    mesh_data_storage.uploadVertexData(mesh_data.positions, mesh_data.normals,
+                                       mesh_data.tangents, mesh_data.texcoords,
+                                       material_ids);
+    upload_indices(mesh_data.indices, vertex_offset);
 
     entries_[i].idx_count = mesh_data_storage.idx_count - entries_[i].base_idx;
+
+    entries_[i].first_meshlet = meshlets_.size();
+    entries_[i].meshlet_count = prepared.meshlets.size();
+    for (MeshletBuilder::Meshlet meshlet : prepared.meshlets) {
+      meshlet.first_index += entries_[i].base_idx;
+      meshlets_.push_back(meshlet);
+    }
+
+    DrawElementsIndirectCommand command;
+    command.count = entries_[i].idx_count;
+    command.first_index = entries_[i].base_idx;
+    lod_draw_commands_[0].push_back(command);
+    lod_triangle_counts_[0] += command.count / 3;
+
+    for (unsigned level = 1; level < lod_count; ++level) {
+      const std::vector<GLuint>& lod_indices = prepared.lod_indices[level];
+      if (!lod_indices.empty()) {
+        command.first_index = mesh_data_storage.idx_count;
+        command.count = lod_indices.size();
+        upload_indices(lod_indices, vertex_offset);
+      }
+
+      lod_draw_commands_[level].push_back(command);
+      lod_triangle_counts_[level] += command.count / 3;
+    }
+  }
+  prepared_meshes_.clear();
+  prepared_meshes_.shrink_to_fit();
+
+  // Drop the levels that are identical to the previous one
+  while (lod_draw_commands_.size() > 1 &&
+         lod_triangle_counts_.back() == lod_triangle_counts_[lod_triangle_counts_.size() - 2]) {
+    lod_draw_commands_.pop_back();
+    lod_triangle_counts_.pop_back();
   }
 }
 
@@ -241,13 +505,12 @@ std::vector<GLuint> MeshRenderer::getIndices(const aiMesh* mesh) {
   indices_vector.reserve(mesh->mNumFaces * 3);
   bool invalid_triangles = false;
 
-  size_t idx_offset = getMeshDataStorage().vertex_count;
   for (size_t i = 0; i < mesh->mNumFaces; i++) {
     const aiFace& face = mesh->mFaces[i];
     if (face.mNumIndices == 3) {  // The invalid faces are just ignored.
-      indices_vector.push_back(idx_offset + face.mIndices[0]);
-      indices_vector.push_back(idx_offset + face.mIndices[1]);
-      indices_vector.push_back(idx_offset + face.mIndices[2]);
+      indices_vector.push_back(face.mIndices[0]);
+      indices_vector.push_back(face.mIndices[1]);
+      indices_vector.push_back(face.mIndices[2]);
     } else {
       invalid_triangles = true;
     }
@@ -325,8 +588,57 @@ std::vector<glm::vec2> MeshRenderer::getTexCoords(size_t index,
   return tex_coords_vector;
 }
 
-void MeshRenderer::uploadModelMatrices(const std::vector<glm::mat4>& matrices) {
-  getMeshDataStorage().uploadModelMatrices(matrices);
+MeshRenderer::AffineInstance MeshRenderer::toAffineInstance(const glm::mat4& model_matrix) {
+  glm::mat4 transposed = glm::transpose(model_matrix);
+  return AffineInstance{{transposed[0], transposed[1], transposed[2]}};
+}
+
+bool MeshRenderer::toSimilarityInstance(const glm::mat4& model_matrix,
+                                        SimilarityInstance* instance) {
+  static constexpr float kEpsilon = 1e-4f;
+
+  if (model_matrix[0][3] != 0.0f || model_matrix[1][3] != 0.0f ||
+      model_matrix[2][3] != 0.0f || model_matrix[3][3] != 1.0f) {
+    return false;
+  }
+
+  glm::vec3 x = glm::vec3(model_matrix[0]);
+  glm::vec3 y = glm::vec3(model_matrix[1]);
+  glm::vec3 z = glm::vec3(model_matrix[2]);
+  float scale = glm::length(x);
+  if (scale == 0.0f ||
+      std::abs(glm::length(y) - scale) > kEpsilon * scale ||
+      std::abs(glm::length(z) - scale) > kEpsilon * scale ||
+      std::abs(glm::dot(x, y)) > kEpsilon * scale * scale ||
+      std::abs(glm::dot(y, z)) > kEpsilon * scale * scale ||
+      std::abs(glm::dot(z, x)) > kEpsilon * scale * scale ||
+      glm::dot(glm::cross(x, y), z) < 0.0f) {
+    return false;
+  }
+
+  glm::quat rotation = glm::quat_cast(glm::mat3(x / scale, y / scale, z / scale));
+  instance->translation_and_scale = glm::vec4(glm::vec3(model_matrix[3]), scale);
+  instance->rotation = glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+  return true;
+}
+
+void MeshRenderer::uploadInstances(const std::vector<AffineInstance>& instances) {
+  getMeshDataStorage().uploadInstances(instances.data(), instances.size() * sizeof(AffineInstance),
+                                       InstanceFormat::kAffine);
+}
+
+void MeshRenderer::uploadInstances(const std::vector<SimilarityInstance>& instances) {
+  getMeshDataStorage().uploadInstances(instances.data(),
+                                       instances.size() * sizeof(SimilarityInstance),
+                                       InstanceFormat::kSimilarity);
+}
+
+void MeshRenderer::uploadInstanceLayers(const std::vector<GLuint>& layers) {
+  getMeshDataStorage().uploadInstanceLayers(layers);
+}
+
+void MeshRenderer::setInstanceLayer(GLuint layer) {
+  getMeshDataStorage().setInstanceLayer(layer);
 }
 
 /// Checks if every mesh in the scene has tex_coords
@@ -349,26 +661,25 @@ bool MeshRenderer::hasTexCoords(unsigned char tex_coord_set) {
  *        a single color is specified, then sets up an 1x1 texture with that
  *        color (so you can use the same shader).
  *
- * Changes the currently active texture unit and Texture2D binding.
- * @param texture_unit      Specifies the texture unit to use for the textures.
- * @param tex_type          The type of the texture to load in. For ex
- *                          aiTextureType_DIFFUSE.
+ * The image files are decoded asynchronously by the TextureManager, the
+ * material table contains a placeholder until they are uploaded.
+ * Must be called after setup().
+ *
+ * @param tex_type          The type of the texture to load in. Either
+ *                          aiTextureType_DIFFUSE or aiTextureType_SPECULAR.
  * @param pKey, type, idx   These parameters identify the color parameter to
  *                          load in case there isn't any texture specified.
  *                          Use the assimp macros to fill these 3 parameters
  *                          all at once, for ex: AI_MATKEY_COLOR_DIFFUSE
  * @param srgb              Specifies weather the image is in srgb colorspace
  */
-void MeshRenderer::setupTextures(unsigned short texture_unit,
-                                 aiTextureType tex_type,
+void MeshRenderer::setupTextures(aiTextureType tex_type,
                                  const char *pKey,
                                  unsigned int type,
                                  unsigned int idx,
                                  bool srgb) {
-  gl::ActiveTexture(texture_unit);
-
-  materials_[tex_type].active = true;
-  materials_[tex_type].tex_unit = texture_unit;
+  assert(is_setup_);
+  assert(tex_type == aiTextureType_DIFFUSE || tex_type == aiTextureType_SPECULAR);
 
   if (scene_->mNumMaterials) {
     // Extract the directory part from the file name
@@ -383,97 +694,206 @@ void MeshRenderer::setupTextures(unsigned short texture_unit,
       dir = filename_.substr(0, slash_idx + 1);
     }
 
+    MeshDataStorage& mesh_data_storage = getMeshDataStorage();
+
     // Initialize the materials
     for (unsigned int i = 0; i < scene_->mNumMaterials; ++i) {
       const aiMaterial* mat = scene_->mMaterials[i];
-      materials_[tex_type].textures.push_back(gl::Texture2D{});
+      gl::Texture2D* texture = nullptr;
 
       aiString filepath;
       if (mat->GetTexture(tex_type, 0, &filepath) == AI_SUCCESS) {
-        gl::Bind(materials_[tex_type].textures[i]);
-        unsigned width, height;
-        std::vector<unsigned char> data;
         std::string path = dir + filepath.data;
-        unsigned error = lodepng::decode(data, width, height, path, LCT_RGBA, 8);
-        if (error) {
-          std::cerr << "Image decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-          throw std::runtime_error("Image decoder error");
-        }
-        materials_[tex_type].textures[i].upload(gl::kSrgb8Alpha8, width, height,
-            gl::kRgba, gl::kUnsignedByte, data.data());
-        materials_[tex_type].textures[i].minFilter(gl::kLinear);
-        materials_[tex_type].textures[i].magFilter(gl::kLinear);
+        texture = texture_manager_->GetTexture(path, srgb);
       } else {
         aiColor4D color(0.f, 0.f, 0.f, 1.0f);
         mat->Get(pKey, type, idx, color);
 
-        gl::Bind(materials_[tex_type].textures[i]);
-        materials_[tex_type].textures[i].upload(gl::kRgba32F, 1, 1, gl::kRgba,
-                                                gl::kFloat, &color.r);
-        materials_[tex_type].textures[i].minFilter(gl::kNearest);
-        materials_[tex_type].textures[i].magFilter(gl::kNearest);
+        glm::vec4 glm_color{color.r, color.g, color.b, color.a};
+        texture = texture_manager_->GetColorTexture(glm_color);
+      }
+
+      Material& material = mesh_data_storage.materials[material_base_ + i];
+      if (tex_type == aiTextureType_DIFFUSE) {
+        material.diffuse_texture = texture;
+      } else {
+        material.specular_texture = texture;
       }
     }
-  }
 
-  gl::Unbind(gl::kTexture2D);
+    mesh_data_storage.materials_changed = true;
+  }
 }
 
-/// Sets the diffuse textures up to a specified texture unit.
-/** Changes the currently active texture unit and Texture2D binding.
-  * @param texture_unit Specifies the texture unit to use for the diffuse textures. */
-void MeshRenderer::setupDiffuseTextures(unsigned short texture_unit, bool srbg) {
-  setupTextures(texture_unit, aiTextureType_DIFFUSE,
-                AI_MATKEY_COLOR_DIFFUSE, srbg);
+/// Sets the diffuse textures of the materials up.
+void MeshRenderer::setupDiffuseTextures(bool srbg) {
+  setupTextures(aiTextureType_DIFFUSE, AI_MATKEY_COLOR_DIFFUSE, srbg);
 }
 
-/// Sets the specular textures up to a specified texture unit.
-/** Changes the currently active texture unit and Texture2D binding.
-  * @param texture_unit Specifies the texture unit to use for the specular textures. */
-void MeshRenderer::setupSpecularTextures(unsigned short texture_unit) {
-  setupTextures(texture_unit, aiTextureType_SPECULAR,
-                AI_MATKEY_COLOR_SPECULAR, false);
+/// Sets the specular textures of the materials up.
+void MeshRenderer::setupSpecularTextures() {
+  setupTextures(aiTextureType_SPECULAR, AI_MATKEY_COLOR_SPECULAR, false);
 }
 
 /// Renders the mesh.
-/** Changes the currently active VAO and may change the Texture2D binding */
+/** All the entries are drawn with a single multi-draw call, the textures
+  * are accessed by the shaders through the material table (see material.frag).
+  * Changes the currently active VAO. */
 void MeshRenderer::render(size_t instance_count) {
-  if (!is_setup_) {
+  renderLods(std::vector<size_t>{instance_count});
+}
+
+/// Renders the instances with different levels of detail in a single call.
+/** The instance_counts[i] instances that use the i-th level have to follow
+  * each other in the model matrix buffer, in the order of the levels. */
+void MeshRenderer::renderLods(const std::vector<size_t>& instance_counts) {
+  if (!is_setup_ || entries_.empty()) {
     return;  // we can't render the mesh, if we don't have any vertex.
   }
-  for (size_t i = 0 ; i < entries_.size(); i++) {
-    auto bind = gl::MakeTemporaryBind(getMeshDataStorage().vao);
+  assert(instance_counts.size() <= lod_draw_commands_.size());
+
+  // The levels read their model matrices from consecutive ranges of the
+  // instanced attributes, selected by the base instance.
+  draw_commands_.clear();
+  size_t base_instance = 0;
+  for (size_t level = 0; level < instance_counts.size(); ++level) {
+    if (instance_counts[level] == 0) {
+      continue;
+    }
+    for (DrawElementsIndirectCommand command : lod_draw_commands_[level]) {
+      command.instance_count = instance_counts[level];
+      command.base_instance = base_instance;
+      draw_commands_.push_back(command);
+    }
+    base_instance += instance_counts[level];
+  }
 
-    const size_t material_index = entries_[i].material_index;
+  if (draw_commands_.empty()) {
+    return;
+  }
 
-    if (textures_enabled_) {
-      for (auto iter = materials_.begin(); iter != materials_.end(); iter++) {
-        auto& material = iter->second;
-        if (material.active == true && material_index < scene_->mNumMaterials) {
-          gl::ActiveTexture(material.tex_unit);
-        }
-        gl::Bind(material.textures[material_index]);
-      }
+  MeshDataStorage& mesh_data_storage = getMeshDataStorage();
+  mesh_data_storage.updateMaterialBuffer(*texture_manager_);
+  mesh_data_storage.drawIndirect(draw_commands_);
+}
+
+void MeshRenderer::renderLods(const std::vector<size_t>& instance_counts,
+                              const std::vector<glm::mat4>& transforms,
+                              const Frustum& frustum, const glm::vec3& camera_position,
+                              bool cone_culling) {
+  if (!is_setup_ || entries_.empty()) {
+    return;
+  }
+  if (meshlets_.empty() || instance_counts.empty() || instance_counts[0] == 0 ||
+      instance_counts[0] > kMeshletCullingMaxInstanceCount) {
+    renderLods(instance_counts);
+    return;
+  }
+  assert(instance_counts.size() <= lod_draw_commands_.size());
+  assert(instance_counts[0] <= transforms.size());
+
+  draw_commands_.clear();
+  addCulledMeshletCommands(instance_counts[0], 0, transforms, frustum,
+                           camera_position, cone_culling);
+
+  size_t base_instance = instance_counts[0];
+  for (size_t level = 1; level < instance_counts.size(); ++level) {
+    if (instance_counts[level] == 0) {
+      continue;
+    }
+    for (DrawElementsIndirectCommand command : lod_draw_commands_[level]) {
+      command.instance_count = instance_counts[level];
+      command.base_instance = base_instance;
+      draw_commands_.push_back(command);
     }
+    base_instance += instance_counts[level];
+  }
+
+  if (draw_commands_.empty()) {
+    return;
+  }
 
-    glDrawElementsInstanced(GL_TRIANGLES,
-                            entries_[i].idx_count,
-                            GL_UNSIGNED_INT,
-                            (void*)(entries_[i].base_idx * sizeof(unsigned)),
-                            instance_count);
-
-    if (textures_enabled_) {
-      for (auto iter = materials_.begin(); iter != materials_.end(); iter++) {
-        auto& material = iter->second;
-        if (material.active == true && material_index < scene_->mNumMaterials) {
-          gl::ActiveTexture(material.tex_unit);
+  MeshDataStorage& mesh_data_storage = getMeshDataStorage();
+  mesh_data_storage.updateMaterialBuffer(*texture_manager_);
+  mesh_data_storage.drawIndirect(draw_commands_);
+}
+
+void MeshRenderer::addCulledMeshletCommands(size_t instance_count, size_t base_instance,
+                                            const std::vector<glm::mat4>& transforms,
+                                            const Frustum& frustum,
+                                            const glm::vec3& camera_position,
+                                            bool cone_culling) {
+  // The entries without meshlets are drawn for all the instances at once
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (entries_[i].meshlet_count == 0) {
+      DrawElementsIndirectCommand command = lod_draw_commands_[0][i];
+      command.instance_count = instance_count;
+      command.base_instance = base_instance;
+      draw_commands_.push_back(command);
+    }
+  }
+
+  for (size_t instance = 0; instance < instance_count; ++instance) {
+    // The view is transformed into the model space, instead of transforming
+    // every meshlet. The plane equations stay exact with any affine transform,
+    // and so does the cone test, unless the transform mirrors the mesh.
+    const glm::mat4& model_matrix = transforms[instance];
+    glm::vec4 planes[6];
+    for (int p = 0; p < 6; ++p) {
+      const Plane& plane = frustum.planes[p];
+      planes[p] = glm::vec4(glm::vec3(plane.normal), plane.dist) * model_matrix;
+      planes[p] /= glm::length(glm::vec3(planes[p]));
+    }
+    bool instance_cone_culling =
+        cone_culling && glm::determinant(glm::mat3(model_matrix)) > 0.0f;
+    glm::vec3 model_space_camera_position =
+        glm::vec3(glm::inverse(model_matrix) * glm::vec4(camera_position, 1.0f));
+
+    for (const MeshEntry& entry : entries_) {
+      size_t first_command = draw_commands_.size();
+      for (unsigned m = entry.first_meshlet; m < entry.first_meshlet + entry.meshlet_count; ++m) {
+        const MeshletBuilder::Meshlet& meshlet = meshlets_[m];
+        glm::vec3 center = glm::vec3(meshlet.bounding_sphere);
+        float radius = meshlet.bounding_sphere.w;
+        bool visible = true;
+        for (int p = 0; p < 6 && visible; ++p) {
+          visible = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -radius;
+        }
+        if (!visible || (instance_cone_culling &&
+                         MeshletBuilder::IsBackFacing(meshlet, model_space_camera_position))) {
+          continue;
+        }
+
+        // The consecutive visible meshlets are merged into one command
+        if (draw_commands_.size() > first_command &&
+            draw_commands_.back().first_index + draw_commands_.back().count == meshlet.first_index) {
+          draw_commands_.back().count += meshlet.index_count;
+        } else {
+          DrawElementsIndirectCommand command;
+          command.count = meshlet.index_count;
+          command.first_index = meshlet.first_index;
+          command.instance_count = 1;
+          command.base_instance = base_instance + instance;
+          draw_commands_.push_back(command);
         }
-        gl::Unbind(material.textures[material_index]);
       }
     }
   }
 }
 
+/// Renders with draw commands and model matrices that are already on the GPU.
+/** The commands have to be based on lodDrawCommands(). */
+void MeshRenderer::renderIndirect(const gl::ArrayBuffer& instances,
+                                  const gl::ArrayBuffer& commands, size_t command_count) {
+  if (!is_setup_ || command_count == 0) {
+    return;
+  }
+
+  MeshDataStorage& mesh_data_storage = getMeshDataStorage();
+  mesh_data_storage.updateMaterialBuffer(*texture_manager_);
+  mesh_data_storage.drawIndirect(instances, commands, command_count);
+}
+
 /// The transformation that takes the model's world coordinates to the OpenGL style world coordinates.
 /** i.e if you see that a character is laying on ground instead of standing, it is probably
   * because the character is defined in a space where XY is flat, and Z is up. Right
@@ -484,8 +904,6 @@ glm::mat4 MeshRenderer::worldTransform() const {
 
 /// Ensures that the model-space bounding box is calculated.
 void MeshRenderer::calculateModelSpaceBoundBox() const {
-  assert(is_setup_);
-
   if (!is_setup_model_space_bounding_box_) {
     float zero = 0.0f;  // This is needed to bypass a visual c++ compile error
     float infty = 1.0f / zero;
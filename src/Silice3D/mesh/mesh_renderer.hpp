@@ -10,10 +10,15 @@
 
 #include <Silice3D/common/oglwrap.hpp>
 #include <Silice3D/mesh/assimp.hpp>
+#include <Silice3D/mesh/mesh_optimizer.hpp>
+#include <Silice3D/mesh/meshlet_builder.hpp>
+#include <Silice3D/collision/frustum.hpp>
 #include <Silice3D/collision/bounding_box.hpp>
 
 namespace Silice3D {
 
+class TextureManager;
+
 /// A class that can load in and draw meshes using assimp.
 class MeshRenderer {
  public:
@@ -22,33 +27,128 @@ class MeshRenderer {
     kTexcoordAttribLocation = 1,
     kNormalAttribLocation = 2,
     kTangentAttribLocation = 3,
-    kModelMatrixAttributeLocation = 4
+    kInstanceDataAttribLocation = 4,  // takes 3 locations
+    kInstanceLayerAttribLocation = 7,
+    kMaterialIdAttribLocation = 8
+  };
+
+  /// The shader storage buffer binding point of the material table.
+  static constexpr GLuint kMaterialBufferBinding = 0;
+
+  /// Controls the generation of the simplified levels of detail.
+  struct LodSettings {
+    /// The number of levels including the full resolution mesh. 1 disables the LODs.
+    unsigned level_count = 4;
+    /// The target triangle count ratio between the consecutive levels.
+    float reduction = 0.5f;
+    /// The maximal geometric error, relative to the bounding box's diagonal.
+    float max_error = 0.05f;
+  };
+
+  /// The meshes with at least this many triangles are split into meshlets,
+  /// that are culled separately (see renderLods).
+  static constexpr unsigned kMeshletMinTriangleCount = 4096;
+
+  /// The meshlets are only culled per instance below this many instances
+  /// of the base level, the cost grows with instances * meshlets, and with
+  /// many instances a single instanced draw is cheaper (see renderLods).
+  static constexpr size_t kMeshletCullingMaxInstanceCount = 32;
+
+  /// The formats of the per instance data (see instance.glsl).
+  enum class InstanceFormat {
+    /// The first three rows of the model matrix (48 bytes).
+    kAffine,
+    /// Translation, uniform scale and rotation (32 bytes).
+    kSimilarity
+  };
+
+  struct AffineInstance {
+    glm::vec4 rows[3];
+  };
+
+  struct SimilarityInstance {
+    glm::vec4 translation_and_scale;
+    glm::vec4 rotation;  // quaternion as (x, y, z, w)
+  };
+
+  /// Converts a model matrix to the affine instance format.
+  static AffineInstance toAffineInstance(const glm::mat4& model_matrix);
+
+  /// Converts a model matrix to the similarity instance format. Returns false
+  /// if the matrix has a non-uniform scale, shear, mirroring or projection.
+  static bool toSimilarityInstance(const glm::mat4& model_matrix,
+                                   SimilarityInstance* instance);
+
+  /// The layout of glMultiDrawElementsIndirect's commands.
+  struct DrawElementsIndirectCommand {
+    GLuint count = 0;
+    GLuint instance_count = 0;
+    GLuint first_index = 0;
+    GLint base_vertex = 0;
+    GLuint base_instance = 0;
   };
 
  protected:
+
+  /// The textures of a material. The textures are owned by the TextureManager.
+  struct Material {
+    gl::Texture2D* diffuse_texture = nullptr;
+    gl::Texture2D* specular_texture = nullptr;
+  };
+
   struct MeshDataStorage {
     gl::VertexArray vao;
     gl::ArrayBuffer positions_buffer,
                     normals_buffer,
                     tangents_buffer,
                     texcoords_buffer,
-                    model_matrix_buffer;
+                    material_ids_buffer,
+                    instance_buffer,
+                    instance_layer_buffer;
+    InstanceFormat instance_format = InstanceFormat::kAffine;
     gl::IndexBuffer indices_buffer;
 
+    /// The materials of every mesh, and the bindless handles of their
+    /// textures on the GPU side, indexed by the per vertex material id.
+    std::vector<Material> materials;
+    gl::ArrayBuffer material_buffer;
+    bool materials_changed = false;
+    size_t material_texture_upload_count = 0;
+
+    gl::ArrayBuffer indirect_buffer;
+
     size_t vertex_count = 0;
     size_t vertex_allocation = 0;
     size_t idx_count = 0;
     size_t idx_allocation = 0;
-    size_t model_matrix_buffer_allocation = 0;
 
     void uploadVertexData(const std::vector<glm::vec3>& positions,
                           const std::vector<glm::vec3>& normals,
                           const std::vector<glm::vec3>& tangets,
-                          const std::vector<glm::vec2>& texcoords);
+                          const std::vector<glm::vec2>& texcoords,
+                          const std::vector<GLuint>& material_ids);
 
     void uploadIndexData(const std::vector<GLuint>& indices);
 
-    void uploadModelMatrices(const std::vector<glm::mat4>& matrices);
+    void uploadInstances(const void* data, size_t size, InstanceFormat format);
+    void uploadInstanceLayers(const std::vector<GLuint>& layers);
+    void setInstanceLayer(GLuint layer);
+
+    /// Reserves count consecutive materials, returns the index of the first.
+    unsigned allocateMaterials(unsigned count);
+
+    /// Uploads the bindless handles of the material textures if a material
+    /// or the content of any texture has changed since the last call.
+    void updateMaterialBuffer(const TextureManager& texture_manager);
+
+    /// Issues all the commands in a single multi-draw call.
+    void drawIndirect(const std::vector<DrawElementsIndirectCommand>& commands);
+
+    /// Issues the commands stored in a buffer (for ex. written by a compute
+    /// shader), reading affine instances from an other buffer than
+    /// instance_buffer.
+    void drawIndirect(const gl::ArrayBuffer& instances,
+                      const gl::ArrayBuffer& commands, size_t command_count);
 
    private:
     template<typename T, typename Buffer>
@@ -59,7 +159,8 @@ class MeshRenderer {
     void reallocUploadNewData(const std::vector<T>& data, Buffer& buffer,
                               size_t allocation, size_t count);
 
-    void setupModelMatrixAttrib();
+    void setupInstanceAttrib(InstanceFormat format);
+    void setupMaterialIdAttrib();
   };
 
   static std::unique_ptr<MeshDataStorage> mesh_data_storage_;
@@ -76,6 +177,10 @@ class MeshRenderer {
 
     unsigned base_idx = 0;
     unsigned idx_count = 0;
+
+    /// The range of the entry's meshlets in meshlets_ (empty for small meshes).
+    unsigned first_meshlet = 0;
+    unsigned meshlet_count = 0;
   };
 
   /// The assimp importer. The scene actually belongs to this.
@@ -87,23 +192,32 @@ class MeshRenderer {
   /// The name of the file loaded in. It is stored to be able to print it out if an error happens.
   std::string filename_;
 
+  /// Loads (and deduplicates) the textures of the materials.
+  TextureManager* texture_manager_;
+
   /// The vao-s and buffers per mesh.
   std::vector<MeshEntry> entries_;
 
-  /// The transformation that takes the model's world coordinates to the OpenGL style world coordinates.
-  glm::mat4 world_transformation_;
+  /// One indirect draw command per entry for every level of detail. The
+  /// simplified levels share the vertices of the base mesh, only their index
+  /// ranges differ.
+  std::vector<std::vector<DrawElementsIndirectCommand>> lod_draw_commands_;
 
-  /// A struct containin the state and data of a material type.
-  struct MaterialInfo {
-    bool active;
-    int tex_unit;
-    std::vector<gl::Texture2D> textures;
+  /// The commands of all the levels that are drawn together.
+  std::vector<DrawElementsIndirectCommand> draw_commands_;
 
-    MaterialInfo() : active(false), tex_unit(0) {}
-  };
+  /// The meshlets of the base level of every entry, their index ranges are
+  /// offseted to the MeshDataStorage's index buffer.
+  std::vector<MeshletBuilder::Meshlet> meshlets_;
+
+  /// The triangle count of every level of detail.
+  std::vector<unsigned> lod_triangle_counts_;
 
-  /// The materials.
-  std::map<aiTextureType, MaterialInfo> materials_;
+  /// The index of this mesh's first material in the MeshDataStorage.
+  unsigned material_base_ = 0;
+
+  /// The transformation that takes the model's world coordinates to the OpenGL style world coordinates.
+  glm::mat4 world_transformation_;
 
   /// Model-space bounding box of the mesh (without transformations applied)
   mutable BoundingBox model_space_bounding_box_;
@@ -111,11 +225,26 @@ class MeshRenderer {
 
   /// Stores if the setup function was called (it shouldn't be called more than once).
   bool is_setup_ = false;
-  /// Textures can be disabled, and not used for rendering
-  bool textures_enabled_ = true;
+  bool is_prepared_ = false;
+
+  /// The results of prepare() for every entry, freed by upload().
+  struct PreparedMesh {
+    MeshOptimizer::MeshData data;
+    /// The indices of the simplified levels. A level that couldn't be
+    /// simplified further is empty, it reuses the previous level.
+    std::vector<std::vector<GLuint>> lod_indices;
+    /// Their index ranges are relative to data.indices.
+    std::vector<MeshletBuilder::Meshlet> meshlets;
+  };
+  std::vector<PreparedMesh> prepared_meshes_;
 
   unsigned triangle_count = 0;
 
+  /// The simulated vertex cache efficiency of the base mesh, before and after
+  /// the import-time optimizations (averaged over the meshes).
+  MeshOptimizer::CacheStatistics vertex_cache_statistics_before_;
+  MeshOptimizer::CacheStatistics vertex_cache_statistics_after_;
+
   /// It shouldn't be copyable.
   MeshRenderer(const MeshRenderer& src) = delete;
   /// It shouldn't be copyable.
@@ -124,19 +253,42 @@ class MeshRenderer {
 public:
   /// Loads in the mesh from a file, and does some post-processing on it.
   /** @param filename - The name of the file to load in.
-    * @param flags - The assimp post-process flags. */
+    * @param flags - The assimp post-process flags.
+    * @param texture_manager - Used to load the textures of the materials. */
   MeshRenderer(const std::string& filename,
-               gl::Bitfield<aiPostProcessSteps> flags);
+               gl::Bitfield<aiPostProcessSteps> flags,
+               TextureManager* texture_manager);
 
   static void InitializeMeshDataStorage();
   static void FreeMeshDataStorage();
 
-  /// Sets up a btTriangleIndexVertexArray, and returns a vector of indices
-  /// that should be stored throughout the lifetime of the bullet object
-  std::vector<int> btTriangles(btTriangleIndexVertexArray* triangles);
+  /// Returns the positions and the indices of every mesh merged together
+  /// (for ex. for a collision shape).
+  void triangles(std::vector<glm::vec3>* positions, std::vector<unsigned>* indices) const;
+
+  /// Creates a low-poly version of the whole mesh, for occlusion culling.
+  /** The meshes are merged and simplified to at most max_triangle_count
+    * triangles (if that's possible within max_error, relative to the size of
+    * the bounding box). The simplification only moves the surface by a few
+    * percent, but an occluder should be used only if it's still covering
+    * less than the original mesh. */
+  void occluderProxy(size_t max_triangle_count, float max_error,
+                     std::vector<glm::vec3>* positions,
+                     std::vector<unsigned>* indices) const;
 
 public:
-  void setup();
+  /// Optimizes and uploads the mesh data, and generates the simplified levels of detail.
+  /** Same as calling prepare() and upload(). */
+  void setup(const LodSettings& lod_settings);
+  void setup() { setup(LodSettings{}); }
+
+  /// Does the CPU side work of setup(): builds the optimized vertex streams,
+  /// the meshlets and the simplified levels of detail.
+  /** Doesn't use OpenGL, so it can run on any thread (as can the constructor). */
+  void prepare(const LodSettings& lod_settings);
+
+  /// Uploads the data built by prepare(). Must be called from the GL thread.
+  void upload();
 
 private:
   std::vector<GLuint>    getIndices(const aiMesh* mesh);
@@ -147,7 +299,20 @@ private:
                                       unsigned char tex_coord_set = 0);
 
 public:
-  void uploadModelMatrices(const std::vector<glm::mat4>& matrices);
+  /// Uploads the per instance data for the next render call.
+  /** The vertex shader has to be told the format, see instance.glsl. */
+  void uploadInstances(const std::vector<AffineInstance>& instances);
+  void uploadInstances(const std::vector<SimilarityInstance>& instances);
+
+  /// Uploads the framebuffer layer of every uploaded instance, for the layered
+  /// shaders (see shadow_layered.vert).
+  /** The layers follow the order of the instances. */
+  void uploadInstanceLayers(const std::vector<GLuint>& layers);
+
+  /// Makes every instance use the same layer, instead of the uploaded ones.
+  /** This is needed for renderIndirect, and it is what the not layered
+    * passes expect, so it should be restored to 0 after the layered ones. */
+  void setInstanceLayer(GLuint layer);
 
   /// Checks if every mesh in the scene has tex_coords
   /** Returns true if all of the meshes in the scene have texture
@@ -160,38 +325,74 @@ public:
    *        but a single color is specified, then sets up an 1x1 texture with
    *        that color (so you can use the same shader).
    *
-   * Changes the currently active texture unit and Texture2D binding.
-   * @param texture_unit      Specifies the texture unit to use for the textures.
-   * @param tex_type          The type of the texture to load in. For ex
-   *                          aiTextureType_DIFFUSE.
+   * The image files are decoded asynchronously by the TextureManager, the
+   * material table contains a placeholder until they are uploaded.
+   * Must be called after setup().
+   *
+   * @param tex_type          The type of the texture to load in. Either
+   *                          aiTextureType_DIFFUSE or aiTextureType_SPECULAR.
    * @param pKey, type, idx   These parameters identify the color parameter to
    *                          load in case there isn't any texture specified.
    *                          Use the assimp macros to fill these 3 parameters
    *                          all at once, for ex: AI_MATKEY_COLOR_DIFFUSE
    * @param srgb              Specifies weather the image is in srgb colorspace
    */
-  void setupTextures(unsigned short texture_unit,
-                     aiTextureType tex_type,
+  void setupTextures(aiTextureType tex_type,
                      const char *pKey,
                      unsigned int type,
                      unsigned int idx,
                      bool srgb = true);
 
-  /// Sets the diffuse textures up to a specified texture unit.
-  /** Changes the currently active texture unit and Texture2D binding.
-    * @param texture_unit - Specifies the texture unit to use for the diffuse textures. */
-  void setupDiffuseTextures(unsigned short texture_unit, bool srbg = true);
+  /// Sets the diffuse textures of the materials up.
+  void setupDiffuseTextures(bool srbg = true);
 
-  /// Sets the specular textures up to a specified texture unit.
-  /** Changes the currently active texture unit and Texture2D binding.
-    * @param texture_unit - Specifies the texture unit to use for the specular textures. */
-  void setupSpecularTextures(unsigned short texture_unit);
+  /// Sets the specular textures of the materials up.
+  void setupSpecularTextures();
 
   /// Renders the mesh.
-  /** Changes the currently active VAO and may change the Texture2D binding */
+  /** All the entries are drawn with a single multi-draw call, the textures
+    * are accessed by the shaders through the material table (see material.frag).
+    * Changes the currently active VAO. */
   void render(size_t instance_count = 1);
 
+  /// Renders the instances with different levels of detail in a single call.
+  /** The instance_counts[i] instances that use the i-th level have to follow
+    * each other in the model matrix buffer, in the order of the levels. */
+  void renderLods(const std::vector<size_t>& instance_counts);
+
+  /// Renders like the other overload, but the meshlets of the base level are
+  /// culled for every instance separately.
+  /** The meshlets outside the frustum are dropped, and if cone_culling is
+    * enabled, the ones that entirely face away from the camera too (only
+    * correct for meshes whose back faces are never seen). With more than
+    * kMeshletCullingMaxInstanceCount instances the base level is drawn
+    * without the meshlet culling, like the other overload does.
+    * @param transforms - The uploaded instances' model matrices, in the same order. */
+  void renderLods(const std::vector<size_t>& instance_counts,
+                  const std::vector<glm::mat4>& transforms,
+                  const Frustum& frustum, const glm::vec3& camera_position,
+                  bool cone_culling);
+
+  /// Returns true if any of the meshes is split into meshlets.
+  bool hasMeshlets() const { return !meshlets_.empty(); }
+
+  /// Renders with draw commands and affine instances that are already on the GPU.
+  /** The commands have to be based on lodDrawCommands(). */
+  void renderIndirect(const gl::ArrayBuffer& instances,
+                      const gl::ArrayBuffer& commands, size_t command_count);
+
+  /// Returns the draw commands of every level of detail (with zero instances).
+  const std::vector<std::vector<DrawElementsIndirectCommand>>& lodDrawCommands() const {
+    return lod_draw_commands_;
+  }
+
 private:
+  /// Adds the draw commands of the visible meshlets of every instance.
+  void addCulledMeshletCommands(size_t instance_count, size_t base_instance,
+                                const std::vector<glm::mat4>& transforms,
+                                const Frustum& frustum, const glm::vec3& camera_position,
+                                bool cone_culling);
+
   /// Ensures that the model-space bounding box is calculated.
   void calculateModelSpaceBoundBox() const;
 
@@ -219,11 +420,24 @@ public:
 
   unsigned triangleCount() const { return triangle_count; }
 
-  /// Enables the use of textures for rendering.
-  void enableTextures() { textures_enabled_ = true; }
+  /// Returns the triangle count of the given level of detail.
+  unsigned triangleCount(unsigned lod_level) const { return lod_triangle_counts_[lod_level]; }
+
+  /// Returns the vertex cache statistics of the imported, unoptimized mesh.
+  const MeshOptimizer::CacheStatistics& vertexCacheStatisticsBefore() const {
+    return vertex_cache_statistics_before_;
+  }
+
+  /// Returns the vertex cache statistics of the optimized mesh.
+  const MeshOptimizer::CacheStatistics& vertexCacheStatisticsAfter() const {
+    return vertex_cache_statistics_after_;
+  }
+
+  /// Returns the number of generated levels of detail (including the base mesh).
+  unsigned lodCount() const { return lod_draw_commands_.size(); }
 
-  /// Disables the use of textures for rendering.
-  void disableTextures() { textures_enabled_ = true; }
+  /// Returns the index of the mesh's first material in the material table.
+  unsigned materialBase() const { return material_base_; }
 };
 
 }  // namespace Silice3D
@@ -0,0 +1,382 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <queue>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <Silice3D/mesh/mesh_simplifier.hpp>
+
+namespace Silice3D {
+namespace MeshSimplifier {
+
+namespace {
+
+// The weight of the attribute differences compared to the squared geometric
+// error, relative to the squared size of the mesh.
+constexpr double kNormalWeight = 1e-2;
+constexpr double kTexcoordWeight = 1e-2;
+
+// A symmetric 4x4 matrix, the sum of the squared distances from planes,
+// weighted by the areas of the triangles, and the sum of the weights.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0;
+  double b2 = 0, bc = 0, bd = 0;
+  double c2 = 0, cd = 0;
+  double d2 = 0;
+  double weight = 0;
+
+  Quadric() = default;
+
+  Quadric(const glm::dvec3& normal, double dist, double weight)
+      : a2(weight*normal.x*normal.x), ab(weight*normal.x*normal.y)
+      , ac(weight*normal.x*normal.z), ad(weight*normal.x*dist)
+      , b2(weight*normal.y*normal.y), bc(weight*normal.y*normal.z)
+      , bd(weight*normal.y*dist)
+      , c2(weight*normal.z*normal.z), cd(weight*normal.z*dist)
+      , d2(weight*dist*dist), weight(weight) {}
+
+  Quadric& operator+=(const Quadric& q) {
+    a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+    b2 += q.b2; bc += q.bc; bd += q.bd;
+    c2 += q.c2; cd += q.cd;
+    d2 += q.d2;
+    weight += q.weight;
+    return *this;
+  }
+
+  double Evaluate(const glm::dvec3& v) const {
+    return a2*v.x*v.x + 2*ab*v.x*v.y + 2*ac*v.x*v.z + 2*ad*v.x
+         + b2*v.y*v.y + 2*bc*v.y*v.z + 2*bd*v.y
+         + c2*v.z*v.z + 2*cd*v.z
+         + d2;
+  }
+
+  // The weighted mean of the squared distances, independent of the size and
+  // the count of the triangles, so it's comparable with a squared distance.
+  double EvaluateMean(const glm::dvec3& v) const {
+    return weight > 0 ? Evaluate(v) / weight : 0.0;
+  }
+};
+
+struct Collapse {
+  double cost;
+  unsigned from, to;
+  unsigned from_version, to_version;
+
+  bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+class Simplifier {
+ public:
+  Simplifier(const std::vector<glm::vec3>& positions,
+             const std::vector<glm::vec3>& normals,
+             const std::vector<glm::vec2>& texcoords,
+             const std::vector<unsigned>& indices)
+      : positions_(positions), normals_(normals), texcoords_(texcoords)
+      , indices_(indices), triangle_alive_(indices.size() / 3, true)
+      , vertex_alive_(positions.size(), true)
+      , vertex_version_(positions.size(), 0)
+      , locked_(positions.size(), false)
+      , vertex_triangles_(positions.size()) {
+    WeldPositions();
+    ComputeQuadrics();
+    LockBordersAndSeams();
+
+    for (size_t t = 0; t < triangle_alive_.size(); ++t) {
+      for (int i = 0; i < 3; ++i) {
+        vertex_triangles_[indices_[3*t + i]].push_back(t);
+      }
+    }
+    live_index_count_ = indices_.size();
+
+    for (size_t t = 0; t < triangle_alive_.size(); ++t) {
+      for (int i = 0; i < 3; ++i) {
+        unsigned a = indices_[3*t + i], b = indices_[3*t + (i+1) % 3];
+        PushCollapse(a, b);
+        PushCollapse(b, a);
+      }
+    }
+  }
+
+  std::vector<unsigned> Run(size_t target_index_count, double max_error,
+                            float* result_error) {
+    double max_cost = max_error * max_error;
+    double last_cost = 0.0;
+
+    while (live_index_count_ > target_index_count && !queue_.empty()) {
+      Collapse collapse = queue_.top();
+      queue_.pop();
+
+      if (!vertex_alive_[collapse.from] || !vertex_alive_[collapse.to]) {
+        continue;
+      }
+      if (collapse.from_version != vertex_version_[collapse.from] ||
+          collapse.to_version != vertex_version_[collapse.to]) {
+        // The neighbourhood has changed since this was computed
+        if (AreNeighbours(collapse.from, collapse.to)) {
+          PushCollapse(collapse.from, collapse.to);
+        }
+        continue;
+      }
+      if (collapse.cost > max_cost) {
+        break;
+      }
+      if (!AreNeighbours(collapse.from, collapse.to) ||
+          FlipsTriangle(collapse.from, collapse.to)) {
+        continue;
+      }
+
+      Apply(collapse.from, collapse.to);
+      last_cost = std::max(last_cost, collapse.cost);
+    }
+
+    if (result_error) {
+      *result_error = std::sqrt(last_cost);
+    }
+
+    std::vector<unsigned> result;
+    result.reserve(live_index_count_);
+    for (size_t t = 0; t < triangle_alive_.size(); ++t) {
+      if (triangle_alive_[t]) {
+        result.insert(result.end(), &indices_[3*t], &indices_[3*t] + 3);
+      }
+    }
+    return result;
+  }
+
+ private:
+  const std::vector<glm::vec3>& positions_;
+  const std::vector<glm::vec3>& normals_;
+  const std::vector<glm::vec2>& texcoords_;
+  std::vector<unsigned> indices_;
+  std::vector<bool> triangle_alive_;
+  std::vector<bool> vertex_alive_;
+  std::vector<unsigned> vertex_version_;
+  std::vector<bool> locked_;
+  std::vector<std::vector<unsigned>> vertex_triangles_;
+
+  // The vertices with the same position share a quadric
+  std::vector<unsigned> position_ids_;
+  std::vector<unsigned> position_vertex_counts_;
+  std::vector<Quadric> quadrics_;
+
+  double attribute_scale_ = 1.0;
+  size_t live_index_count_ = 0;
+  std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue_;
+
+  glm::dvec3 Position(unsigned v) const { return glm::dvec3(positions_[v]); }
+
+  void WeldPositions() {
+    std::vector<unsigned> order(positions_.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [this](unsigned a, unsigned b) {
+      const glm::vec3 &pa = positions_[a], &pb = positions_[b];
+      if (pa.x != pb.x) { return pa.x < pb.x; }
+      if (pa.y != pb.y) { return pa.y < pb.y; }
+      return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    position_ids_.resize(positions_.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+      if (i == 0 || positions_[order[i]] != positions_[order[i-1]]) {
+        position_vertex_counts_.push_back(0);
+      }
+      position_ids_[order[i]] = position_vertex_counts_.size() - 1;
+      position_vertex_counts_.back()++;
+    }
+  }
+
+  void ComputeQuadrics() {
+    quadrics_.resize(position_vertex_counts_.size());
+
+    glm::dvec3 mins{std::numeric_limits<double>::max()};
+    glm::dvec3 maxes{-std::numeric_limits<double>::max()};
+    for (const glm::vec3& pos : positions_) {
+      mins = glm::min(mins, glm::dvec3(pos));
+      maxes = glm::max(maxes, glm::dvec3(pos));
+    }
+    glm::dvec3 extent = positions_.empty() ? glm::dvec3{0.0} : maxes - mins;
+    attribute_scale_ = glm::dot(extent, extent);
+
+    for (size_t t = 0; t < indices_.size() / 3; ++t) {
+      glm::dvec3 p0 = Position(indices_[3*t]);
+      glm::dvec3 p1 = Position(indices_[3*t + 1]);
+      glm::dvec3 p2 = Position(indices_[3*t + 2]);
+      glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+      double double_area = glm::length(normal);
+      if (double_area == 0.0) {
+        continue;
+      }
+      normal /= double_area;
+
+      // Weighting by the area makes the result independent of the tessellation
+      Quadric quadric{normal, -glm::dot(normal, p0), double_area / 2};
+      for (int i = 0; i < 3; ++i) {
+        quadrics_[position_ids_[indices_[3*t + i]]] += quadric;
+      }
+    }
+  }
+
+  void LockBordersAndSeams() {
+    // An edge that only has a single triangle (in the position welded mesh)
+    // is on the border, moving its vertices would open holes.
+    std::vector<std::pair<unsigned, unsigned>> edges;
+    edges.reserve(indices_.size());
+    for (size_t t = 0; t < indices_.size() / 3; ++t) {
+      for (int i = 0; i < 3; ++i) {
+        unsigned a = position_ids_[indices_[3*t + i]];
+        unsigned b = position_ids_[indices_[3*t + (i+1) % 3]];
+        edges.emplace_back(std::min(a, b), std::max(a, b));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> locked_positions(position_vertex_counts_.size(), false);
+    for (size_t i = 0; i < edges.size(); ) {
+      size_t j = i + 1;
+      while (j < edges.size() && edges[j] == edges[i]) {
+        ++j;
+      }
+      if (j - i == 1) {
+        locked_positions[edges[i].first] = true;
+        locked_positions[edges[i].second] = true;
+      }
+      i = j;
+    }
+
+    for (size_t v = 0; v < positions_.size(); ++v) {
+      unsigned position_id = position_ids_[v];
+      locked_[v] = locked_positions[position_id] ||
+                   position_vertex_counts_[position_id] > 1;
+    }
+  }
+
+  double CollapseCost(unsigned from, unsigned to) const {
+    double geometric = quadrics_[position_ids_[from]].EvaluateMean(Position(to));
+
+    glm::dvec3 normal_diff = glm::dvec3(normals_[from] - normals_[to]);
+    glm::vec2 texcoord_diff = texcoords_[from] - texcoords_[to];
+    double attribute = kNormalWeight * glm::dot(normal_diff, normal_diff)
+                     + kTexcoordWeight * glm::dot(texcoord_diff, texcoord_diff);
+
+    return std::max(geometric, 0.0) + attribute * attribute_scale_;
+  }
+
+  void PushCollapse(unsigned from, unsigned to) {
+    if (from == to || locked_[from]) {
+      return;
+    }
+    queue_.push(Collapse{CollapseCost(from, to), from, to,
+                         vertex_version_[from], vertex_version_[to]});
+  }
+
+  bool AreNeighbours(unsigned a, unsigned b) const {
+    for (unsigned t : vertex_triangles_[a]) {
+      if (triangle_alive_[t] && (indices_[3*t] == b || indices_[3*t + 1] == b ||
+                                 indices_[3*t + 2] == b)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool FlipsTriangle(unsigned from, unsigned to) const {
+    for (unsigned t : vertex_triangles_[from]) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+
+      const unsigned* tri = &indices_[3*t];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        continue;  // this one will be removed
+      }
+
+      glm::dvec3 old_pos[3], new_pos[3];
+      for (int i = 0; i < 3; ++i) {
+        old_pos[i] = Position(tri[i]);
+        new_pos[i] = tri[i] == from ? Position(to) : old_pos[i];
+      }
+      glm::dvec3 old_normal = glm::cross(old_pos[1] - old_pos[0], old_pos[2] - old_pos[0]);
+      glm::dvec3 new_normal = glm::cross(new_pos[1] - new_pos[0], new_pos[2] - new_pos[0]);
+      if (glm::dot(old_normal, new_normal) <= 0.0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Apply(unsigned from, unsigned to) {
+    for (unsigned t : vertex_triangles_[from]) {
+      if (!triangle_alive_[t]) {
+        continue;
+      }
+
+      unsigned* tri = &indices_[3*t];
+      if (tri[0] == to || tri[1] == to || tri[2] == to) {
+        triangle_alive_[t] = false;
+        live_index_count_ -= 3;
+      } else {
+        for (int i = 0; i < 3; ++i) {
+          if (tri[i] == from) {
+            tri[i] = to;
+          }
+        }
+        vertex_triangles_[to].push_back(t);
+      }
+    }
+
+    vertex_alive_[from] = false;
+    vertex_triangles_[from].clear();
+    quadrics_[position_ids_[to]] += quadrics_[position_ids_[from]];
+    vertex_version_[to]++;
+
+    // Compact the triangle list of the target, and requeue its edges
+    std::vector<unsigned>& triangles = vertex_triangles_[to];
+    triangles.erase(std::remove_if(triangles.begin(), triangles.end(), [this](unsigned t) {
+      return !triangle_alive_[t];
+    }), triangles.end());
+    for (unsigned t : triangles) {
+      for (int i = 0; i < 3; ++i) {
+        unsigned neighbour = indices_[3*t + i];
+        if (neighbour != to) {
+          vertex_version_[neighbour]++;
+        }
+      }
+    }
+    for (unsigned t : triangles) {
+      for (int i = 0; i < 3; ++i) {
+        unsigned neighbour = indices_[3*t + i];
+        if (neighbour != to) {
+          PushCollapse(to, neighbour);
+          PushCollapse(neighbour, to);
+        }
+      }
+    }
+  }
+};
+
+}  // namespace
+
+std::vector<unsigned> Simplify(const std::vector<glm::vec3>& positions,
+                               const std::vector<glm::vec3>& normals,
+                               const std::vector<glm::vec2>& texcoords,
+                               const std::vector<unsigned>& indices,
+                               size_t target_index_count,
+                               float max_error,
+                               float* result_error) {
+  if (indices.size() <= target_index_count) {
+    if (result_error) {
+      *result_error = 0.0f;
+    }
+    return indices;
+  }
+
+  Simplifier simplifier{positions, normals, texcoords, indices};
+  return simplifier.Run(target_index_count, max_error, result_error);
+}
+
+}  // namespace MeshSimplifier
+}  // namespace Silice3D
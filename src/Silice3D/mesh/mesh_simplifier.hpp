@@ -0,0 +1,40 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_MESH_MESH_SIMPLIFIER_HPP_
+#define SILICE3D_MESH_MESH_SIMPLIFIER_HPP_
+
+#include <vector>
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// Reduces the triangle count of indexed triangle lists with edge collapses,
+// ordered by the quadric error metric (Garland & Heckbert). The collapses
+// only move a vertex onto one of its neighbours, so the result reuses the
+// input vertex buffer, only the index list changes, which lets every level of
+// a LOD chain share the vertex data of the base mesh.
+// The cost of a collapse also contains the difference of the normals and the
+// texture coordinates of the two vertices, the vertices on the open borders
+// and on the attribute seams (where the same position has multiple vertices)
+// are never moved, and the collapses that would flip a triangle are rejected.
+namespace MeshSimplifier {
+
+// Simplifies the triangle list until it has at most target_index_count indices,
+// or until the next collapse would move the surface more than max_error
+// (in model space units, as the area weighted RMS distance from the original
+// triangles around the collapsed vertex, so it doesn't depend on the scale or
+// the tessellation of the mesh). The indices must be smaller than positions.size(),
+// normals and texcoords must have the same size as positions.
+// If result_error isn't nullptr, it receives the largest collapse error.
+std::vector<unsigned> Simplify(const std::vector<glm::vec3>& positions,
+                               const std::vector<glm::vec3>& normals,
+                               const std::vector<glm::vec2>& texcoords,
+                               const std::vector<unsigned>& indices,
+                               size_t target_index_count,
+                               float max_error,
+                               float* result_error = nullptr);
+
+}  // namespace MeshSimplifier
+}  // namespace Silice3D
+
+#endif  // SILICE3D_MESH_MESH_SIMPLIFIER_HPP_
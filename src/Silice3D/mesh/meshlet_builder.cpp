@@ -0,0 +1,254 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+
+#include <Silice3D/mesh/meshlet_builder.hpp>
+#include <Silice3D/mesh/mesh_optimizer.hpp>
+
+namespace Silice3D {
+namespace MeshletBuilder {
+
+namespace {
+
+// Below this the normals are too different for a useful cone (about 85 degrees).
+constexpr float kMinConeCos = 0.1f;
+
+void ComputeBounds(const std::vector<glm::vec3>& positions,
+                   const unsigned* indices, size_t index_count, Meshlet* meshlet) {
+  glm::vec3 mins{std::numeric_limits<float>::max()};
+  glm::vec3 maxes{-std::numeric_limits<float>::max()};
+  for (size_t i = 0; i < index_count; ++i) {
+    mins = glm::min(mins, positions[indices[i]]);
+    maxes = glm::max(maxes, positions[indices[i]]);
+  }
+  glm::vec3 center = (mins + maxes) / 2.0f;
+  float radius = 0.0f;
+  for (size_t i = 0; i < index_count; ++i) {
+    radius = std::max(radius, glm::distance(center, positions[indices[i]]));
+  }
+  meshlet->bounding_sphere = glm::vec4(center, radius);
+
+  std::vector<glm::vec3> normals;
+  glm::vec3 normal_sum{0.0f};
+  for (size_t i = 0; i < index_count; i += 3) {
+    const glm::vec3& p0 = positions[indices[i]];
+    glm::vec3 normal = glm::cross(positions[indices[i+1]] - p0, positions[indices[i+2]] - p0);
+    float area = glm::length(normal);
+    if (area > 0.0f) {
+      normals.push_back(normal / area);
+      normal_sum += normals.back();
+    } else {
+      normals.push_back(glm::vec3());  // degenerate, visible from nowhere
+    }
+  }
+
+  meshlet->cone_axis = glm::vec3();
+  meshlet->cone_cutoff = 1.0f;
+  float normal_sum_length = glm::length(normal_sum);
+  if (normal_sum_length == 0.0f) {
+    return;
+  }
+  glm::vec3 axis = normal_sum / normal_sum_length;
+  float min_cos = 1.0f;
+  for (const glm::vec3& normal : normals) {
+    if (normal != glm::vec3()) {
+      min_cos = std::min(min_cos, glm::dot(axis, normal));
+    }
+  }
+  if (min_cos < kMinConeCos) {
+    return;
+  }
+
+  // The apex is moved back along the axis until it is behind every
+  // triangle's plane, then a camera inside the cone widened by 90 degrees
+  // sees all of them from behind.
+  float max_t = 0.0f;
+  for (size_t i = 0; i < index_count; i += 3) {
+    const glm::vec3& normal = normals[i / 3];
+    if (normal != glm::vec3()) {
+      float t = glm::dot(center - positions[indices[i]], normal) / glm::dot(axis, normal);
+      max_t = std::max(max_t, t);
+    }
+  }
+  meshlet->cone_apex = center - axis * max_t;
+  meshlet->cone_axis = axis;
+  meshlet->cone_cutoff = std::sqrt(1.0f - min_cos * min_cos);
+}
+
+// Optimizes the vertex cache of a meshlet with meshlet local vertex indices,
+// so the cost doesn't depend on the size of the whole mesh.
+void OptimizeMeshletVertexCache(unsigned* indices, size_t index_count,
+                                std::vector<unsigned>* local_index_of_vertex) {
+  std::vector<unsigned> global_index_of_local;
+  std::vector<unsigned> local_indices(index_count);
+  for (size_t i = 0; i < index_count; ++i) {
+    unsigned& local_index = (*local_index_of_vertex)[indices[i]];
+    if (local_index == unsigned(-1)) {
+      local_index = global_index_of_local.size();
+      global_index_of_local.push_back(indices[i]);
+    }
+    local_indices[i] = local_index;
+  }
+
+  MeshOptimizer::OptimizeVertexCache(&local_indices, global_index_of_local.size());
+
+  for (size_t i = 0; i < index_count; ++i) {
+    indices[i] = global_index_of_local[local_indices[i]];
+  }
+  for (unsigned vertex : global_index_of_local) {
+    (*local_index_of_vertex)[vertex] = unsigned(-1);
+  }
+}
+
+}  // namespace
+
+std::vector<Meshlet> Build(const std::vector<glm::vec3>& positions,
+                           std::vector<unsigned>* indices,
+                           unsigned max_vertices, unsigned max_triangles) {
+  std::vector<Meshlet> meshlets;
+  size_t triangle_count = indices->size() / 3;
+  if (triangle_count == 0) {
+    return meshlets;
+  }
+
+  // The triangles that use each vertex, in CSR format.
+  std::vector<unsigned> adjacency_offsets(positions.size() + 1, 0);
+  std::vector<unsigned> adjacency(indices->size());
+  for (unsigned index : *indices) {
+    adjacency_offsets[index + 1]++;
+  }
+  std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+  {
+    std::vector<unsigned> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < indices->size(); ++i) {
+      adjacency[fill[(*indices)[i]]++] = i / 3;
+    }
+  }
+
+  // The number of not yet used triangles per vertex, the vertices without
+  // any don't have to be searched for neighbours.
+  std::vector<unsigned> live_triangle_counts(positions.size());
+  for (size_t v = 0; v < positions.size(); ++v) {
+    live_triangle_counts[v] = adjacency_offsets[v + 1] - adjacency_offsets[v];
+  }
+
+  std::vector<glm::vec3> triangle_centers(triangle_count);
+  for (size_t t = 0; t < triangle_count; ++t) {
+    triangle_centers[t] = (positions[(*indices)[3*t]] + positions[(*indices)[3*t + 1]] +
+                           positions[(*indices)[3*t + 2]]) / 3.0f;
+  }
+
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<unsigned> local_index_of_vertex(positions.size(), unsigned(-1));
+  std::vector<unsigned> meshlet_vertices, meshlet_triangles;
+  std::vector<unsigned> result;
+  result.reserve(indices->size());
+
+  auto new_vertex_count = [&](unsigned triangle) {
+    unsigned count = 0;
+    for (int corner = 0; corner < 3; ++corner) {
+      count += local_index_of_vertex[(*indices)[3*triangle + corner]] == unsigned(-1);
+    }
+    return count;
+  };
+
+  auto add_triangle = [&](unsigned triangle) {
+    emitted[triangle] = true;
+    meshlet_triangles.push_back(triangle);
+    for (int corner = 0; corner < 3; ++corner) {
+      unsigned vertex = (*indices)[3*triangle + corner];
+      live_triangle_counts[vertex]--;
+      if (local_index_of_vertex[vertex] == unsigned(-1)) {
+        local_index_of_vertex[vertex] = meshlet_vertices.size();
+        meshlet_vertices.push_back(vertex);
+      }
+    }
+  };
+
+  size_t seed = 0;
+  while (true) {
+    while (seed < triangle_count && emitted[seed]) {
+      ++seed;
+    }
+    if (seed == triangle_count) {
+      break;
+    }
+
+    meshlet_vertices.clear();
+    meshlet_triangles.clear();
+    add_triangle(seed);
+    glm::vec3 center_sum = triangle_centers[seed];
+
+    while (meshlet_triangles.size() < max_triangles) {
+      // Prefer the triangles that add the fewest new vertices, and from those
+      // the ones closest to the meshlet's center, to keep the bounds tight.
+      glm::vec3 center = center_sum / float(meshlet_triangles.size());
+      unsigned best_triangle = unsigned(-1);
+      unsigned best_new_vertices = 4;
+      float best_distance = std::numeric_limits<float>::max();
+      for (unsigned vertex : meshlet_vertices) {
+        if (live_triangle_counts[vertex] == 0) {
+          continue;
+        }
+        for (unsigned i = adjacency_offsets[vertex]; i < adjacency_offsets[vertex + 1]; ++i) {
+          unsigned triangle = adjacency[i];
+          if (emitted[triangle]) {
+            continue;
+          }
+          unsigned new_vertices = new_vertex_count(triangle);
+          if (meshlet_vertices.size() + new_vertices > max_vertices ||
+              new_vertices > best_new_vertices) {
+            continue;
+          }
+          float distance = glm::distance(center, triangle_centers[triangle]);
+          if (new_vertices < best_new_vertices || distance < best_distance) {
+            best_triangle = triangle;
+            best_new_vertices = new_vertices;
+            best_distance = distance;
+          }
+        }
+      }
+
+      if (best_triangle == unsigned(-1)) {
+        break;
+      }
+      add_triangle(best_triangle);
+      center_sum += triangle_centers[best_triangle];
+    }
+
+    Meshlet meshlet;
+    meshlet.first_index = result.size();
+    meshlet.index_count = 3 * meshlet_triangles.size();
+    for (unsigned triangle : meshlet_triangles) {
+      for (int corner = 0; corner < 3; ++corner) {
+        result.push_back((*indices)[3*triangle + corner]);
+      }
+    }
+    meshlets.push_back(meshlet);
+
+    for (unsigned vertex : meshlet_vertices) {
+      local_index_of_vertex[vertex] = unsigned(-1);
+    }
+  }
+
+  for (Meshlet& meshlet : meshlets) {
+    OptimizeMeshletVertexCache(&result[meshlet.first_index], meshlet.index_count,
+                               &local_index_of_vertex);
+    ComputeBounds(positions, &result[meshlet.first_index], meshlet.index_count, &meshlet);
+  }
+
+  *indices = std::move(result);
+  return meshlets;
+}
+
+bool IsBackFacing(const Meshlet& meshlet, const glm::vec3& camera_position) {
+  glm::vec3 to_apex = meshlet.cone_apex - camera_position;
+  float distance = glm::length(to_apex);
+  return glm::dot(to_apex, meshlet.cone_axis) > meshlet.cone_cutoff * distance;
+}
+
+}  // namespace MeshletBuilder
+}  // namespace Silice3D
@@ -0,0 +1,53 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_MESH_MESHLET_BUILDER_HPP_
+#define SILICE3D_MESH_MESHLET_BUILDER_HPP_
+
+#include <vector>
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// Splits large triangle lists into small clusters (meshlets), that can be
+// culled separately: a huge mesh that is mostly off-screen, or whose far side
+// faces away from the camera, doesn't have to be drawn entirely.
+namespace MeshletBuilder {
+
+constexpr unsigned kMaxVertices = 64;
+constexpr unsigned kMaxTriangles = 124;
+
+struct Meshlet {
+  // The range of the meshlet's triangles in the index list.
+  unsigned first_index = 0;
+  unsigned index_count = 0;
+
+  // Center (as xyz) and radius (as w).
+  glm::vec4 bounding_sphere;
+
+  // Every triangle faces away from the cameras inside the cone with this apex
+  // and axis, and with a half angle of acos(cone_cutoff). If the normals are
+  // too different the cone is empty: the axis is zero, the cutoff is 1.
+  glm::vec3 cone_apex;
+  glm::vec3 cone_axis;
+  float cone_cutoff = 1.0f;
+};
+
+// Groups the triangles into meshlets, growing each of them from a seed
+// triangle with the neighbouring triangles that add the fewest new vertices.
+// The triangles are reordered so that every meshlet is a consecutive range,
+// and the post-transform vertex cache is optimized inside the meshlets. The
+// seeds are taken in the original order, so an overdraw optimized order is
+// roughly kept.
+std::vector<Meshlet> Build(const std::vector<glm::vec3>& positions,
+                           std::vector<unsigned>* indices,
+                           unsigned max_vertices = kMaxVertices,
+                           unsigned max_triangles = kMaxTriangles);
+
+// Returns true if every triangle of the meshlet faces away from the camera.
+// The camera position has to be in the space of the meshlet.
+bool IsBackFacing(const Meshlet& meshlet, const glm::vec3& camera_position);
+
+}  // namespace MeshletBuilder
+}  // namespace Silice3D
+
+#endif  // SILICE3D_MESH_MESHLET_BUILDER_HPP_
@@ -4,6 +4,7 @@
 
 #include <Silice3D/core/scene.hpp>
 #include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/physics/physics_thread.hpp>
 
 namespace Silice3D {
 
@@ -11,14 +12,14 @@ namespace Silice3D {
 BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
                                  std::unique_ptr<btCollisionShape>&& shape,
                                  CollisionType collision_type)
-    : GameObject(parent), shape_(std::move(shape)), up_to_date_(true) {
+    : GameObject(parent), shape_(std::move(shape)) {
   Init(mass, shape_.get(), collision_type);
 }
 
 BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
                                  btCollisionShape* shape,
                                  CollisionType collision_type)
-    : GameObject(parent), up_to_date_(true) {
+    : GameObject(parent) {
   Init(mass, shape, collision_type);
 }
 
@@ -26,7 +27,7 @@ BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
                                  btCollisionShape* shape,
                                  const glm::vec3& pos,
                                  CollisionType collision_type)
-    : GameObject(parent), up_to_date_(true) {
+    : GameObject(parent) {
   GetTransform().SetPos(pos);
   Init(mass, shape, collision_type);
 }
@@ -35,7 +36,7 @@ BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
                                  std::unique_ptr<btCollisionShape>&& shape,
                                  const glm::vec3& pos,
                                  CollisionType collision_type)
-    : GameObject(parent), shape_(std::move(shape)), up_to_date_(true) {
+    : GameObject(parent), shape_(std::move(shape)) {
   GetTransform().SetPos(pos);
   Init(mass, shape_.get(), collision_type);
 }
@@ -43,7 +44,7 @@ BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
 BulletRigidBody::BulletRigidBody(GameObject* parent, float mass, btCollisionShape* shape,
                                  const glm::vec3& pos, const glm::fquat& rot,
                                  CollisionType collision_type)
-    : GameObject(parent), up_to_date_(true) {
+    : GameObject(parent) {
   GetTransform().SetPos(pos);
   GetTransform().SetRot(rot);
   Init(mass, shape, collision_type);
@@ -53,10 +54,10 @@ BulletRigidBody::BulletRigidBody(GameObject* parent, float mass,
                                  std::unique_ptr<btCollisionShape>&& shape,
                                  const glm::vec3& pos, const glm::fquat& rot,
                                  CollisionType collision_type)
-    : GameObject(parent), shape_(std::move(shape)), up_to_date_(true) {
+    : GameObject(parent), shape_(std::move(shape)) {
   GetTransform().SetPos(pos);
   GetTransform().SetRot(rot);
-  Init(mass, shape.get(), collision_type);
+  Init(mass, shape_.get(), collision_type);
 }
 
 BulletRigidBody::Restrains::Restrains()
@@ -69,15 +70,55 @@ BulletRigidBody::Restrains::Restrains()
   , z_rot_lock{0}
 {}
 
+BulletRigidBody::PhysicsObjects::~PhysicsObjects() = default;
+
+BulletRigidBody::~BulletRigidBody() = default;
+
+btRigidBody* BulletRigidBody::GetBtRigidBody() {
+  return physics_objects_ ? physics_objects_->rigid_body.get() : nullptr;
+}
+
+const btRigidBody* BulletRigidBody::GetBtRigidBody() const {
+  return physics_objects_ ? physics_objects_->rigid_body.get() : nullptr;
+}
+
+void BulletRigidBody::QueuePhysicsCommand(std::function<void(btRigidBody*)> command) {
+  // The body outlives the commands that are queued before its removal
+  btRigidBody* rigid_body = GetBtRigidBody();
+  if (rigid_body != nullptr) {
+    GetScene()->QueuePhysicsCommand([rigid_body, command]() { command(rigid_body); });
+  }
+}
+
+void BulletRigidBody::ApplyCentralForce(const glm::vec3& force) {
+  QueuePhysicsCommand([force](btRigidBody* rigid_body) {
+    rigid_body->activate();
+    rigid_body->applyCentralForce(btVector3{force.x, force.y, force.z});
+  });
+}
+
+void BulletRigidBody::ApplyCentralImpulse(const glm::vec3& impulse) {
+  QueuePhysicsCommand([impulse](btRigidBody* rigid_body) {
+    rigid_body->activate();
+    rigid_body->applyCentralImpulse(btVector3{impulse.x, impulse.y, impulse.z});
+  });
+}
+
+void BulletRigidBody::SetLinearVelocity(const glm::vec3& velocity) {
+  QueuePhysicsCommand([velocity](btRigidBody* rigid_body) {
+    rigid_body->activate();
+    rigid_body->setLinearVelocity(btVector3{velocity.x, velocity.y, velocity.z});
+  });
+}
+
 void BulletRigidBody::SetRestrains(Restrains value) {
   restrains_ = value;
-  bt_rigid_body_->setLinearFactor(btVector3(
-    1-value.x_pos_lock, 1-value.y_pos_lock, 1-value.z_pos_lock
-  ));
-
-  bt_rigid_body_->setAngularFactor(btVector3(
-    1-value.x_rot_lock, 1-value.y_rot_lock, 1-value.z_rot_lock
-  ));
+  btVector3 linear_factor(1-value.x_pos_lock, 1-value.y_pos_lock, 1-value.z_pos_lock);
+  btVector3 angular_factor(1-value.x_rot_lock, 1-value.y_rot_lock, 1-value.z_rot_lock);
+  QueuePhysicsCommand([linear_factor, angular_factor](btRigidBody* rigid_body) {
+    rigid_body->setLinearFactor(linear_factor);
+    rigid_body->setAngularFactor(angular_factor);
+  });
 }
 
 void BulletRigidBody::Init(float mass, btCollisionShape* shape,
@@ -86,45 +127,43 @@ void BulletRigidBody::Init(float mass, btCollisionShape* shape,
   if (mass != 0.0f) {
     shape->calculateLocalInertia(mass, inertia);
   }
-  btRigidBody::btRigidBodyConstructionInfo info{mass, this, shape, inertia};
-  bt_rigid_body_ = make_unique<btRigidBody>(info);
-  bt_rigid_body_->setUserPointer(parent_);
-  if (mass == 0.0f) { bt_rigid_body_->setRestitution(1.0f); }
-  GetScene()->GetBtWorld()->addRigidBody(bt_rigid_body_.get(), static_cast<int>(collision_type), CollidesWith(collision_type));
-}
-
-void BulletRigidBody::getWorldTransform(btTransform &t) const {
-  if (up_to_date_) {
-    const glm::vec3& pos = GetTransform().GetPos();
-    t.setOrigin(btVector3{pos.x, pos.y, pos.z});
-    const glm::fquat& rot = GetTransform().GetRot();
-    t.setRotation(btQuaternion{rot.x, rot.y, rot.z, rot.w});
-  } else {
-    t = new_transform_;
-  }
-}
 
-void BulletRigidBody::setWorldTransform(const btTransform &t) {
-  new_transform_ = t;
-  up_to_date_ = false;
+  const glm::vec3& pos = GetTransform().GetPos();
+  const glm::fquat& rot = GetTransform().GetRot();
+  current_transform_ = btTransform{btQuaternion{rot.x, rot.y, rot.z, rot.w},
+                                   btVector3{pos.x, pos.y, pos.z}};
+  previous_transform_ = current_transform_;
+
+  body_id_ = GetScene()->GenerateRigidBodyId();
+  physics_objects_ = std::make_shared<PhysicsObjects>();
+  physics_objects_->owned_shape = std::move(shape_);
+  physics_objects_->motion_state = make_unique<PhysicsMotionState>(
+      GetScene()->GetPhysicsThread(), body_id_, current_transform_);
+
+  btRigidBody::btRigidBodyConstructionInfo info{
+      mass, physics_objects_->motion_state.get(), shape, inertia};
+  physics_objects_->rigid_body = make_unique<btRigidBody>(info);
+  btRigidBody* rigid_body = physics_objects_->rigid_body.get();
+  rigid_body->setUserPointer(parent_);
+  if (mass == 0.0f) { rigid_body->setRestitution(1.0f); }
+  GetScene()->AddRigidBody(this, static_cast<int>(collision_type), CollidesWith(collision_type));
 }
 
+// Applies the interpolated transform that Scene::SyncPhysics selected
 void BulletRigidBody::UpdatePhysics() {
-  if (!up_to_date_) {
-    const btVector3& o = new_transform_.getOrigin();
-    parent_->GetTransform().SetPos(glm::vec3{o.x(), o.y(), o.z()});
-    if (!restrains_.manual_rot) {
-      const btQuaternion& r = new_transform_.getRotation();
-      parent_->GetTransform().SetRot(glm::quat(r.getW(), r.getX(),
-                                            r.getY(), r.getZ()));
-    }
-    up_to_date_ = true;
+  btVector3 o = previous_transform_.getOrigin().lerp(current_transform_.getOrigin(),
+                                                     interpolation_alpha_);
+  parent_->GetTransform().SetPos(glm::vec3{o.x(), o.y(), o.z()});
+  if (!restrains_.manual_rot) {
+    btQuaternion r = previous_transform_.getRotation().slerp(current_transform_.getRotation(),
+                                                              interpolation_alpha_);
+    parent_->GetTransform().SetRot(glm::quat(r.getW(), r.getX(),
+                                             r.getY(), r.getZ()));
   }
 }
 
 void BulletRigidBody::RemovedFromScene() {
-  GetScene()->GetBtWorld()->removeCollisionObject(bt_rigid_body_.get());
+  GetScene()->RemoveRigidBody(this);
 }
 
 }
-
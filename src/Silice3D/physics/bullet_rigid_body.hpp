@@ -3,6 +3,8 @@
 #ifndef SILICE3D_PHYSICS_BULLET_RIGID_BODY_HPP_
 #define SILICE3D_PHYSICS_BULLET_RIGID_BODY_HPP_
 
+#include <memory>
+#include <functional>
 #include <btBulletDynamicsCommon.h>
 
 #include <Silice3D/core/game_object.hpp>
@@ -29,7 +31,13 @@ inline int CollidesWith(CollisionType collType) {
   }
 }
 
-class BulletRigidBody : public GameObject, public btMotionState {
+class PhysicsMotionState;
+
+// A rigid body that the scene's physics thread simulates (see PhysicsThread).
+// The body's transform is interpolated between the last two physics steps,
+// and it is applied to the parent GameObject. The Bullet objects can only be
+// used by the physics thread, the changes have to be queued as commands.
+class BulletRigidBody : public GameObject {
  public:
 
   BulletRigidBody(GameObject* parent, float mass,
@@ -55,8 +63,20 @@ class BulletRigidBody : public GameObject, public btMotionState {
                   const glm::vec3& pos, const glm::fquat& rot,
                   CollisionType collision_type);
 
-  btRigidBody* GetBtRigidBody() { return bt_rigid_body_.get(); }
-  const btRigidBody* GetBtRigidBody() const { return bt_rigid_body_.get(); }
+  virtual ~BulletRigidBody();
+
+  // Only safe to use in the commands (see QueuePhysicsCommand), or before the
+  // body is added to the scene. Returns nullptr after the body was removed.
+  btRigidBody* GetBtRigidBody();
+  const btRigidBody* GetBtRigidBody() const;
+
+  // Runs the command on the physics thread, before its next step (see
+  // Scene::QueuePhysicsCommand).
+  void QueuePhysicsCommand(std::function<void(btRigidBody*)> command);
+
+  void ApplyCentralForce(const glm::vec3& force);
+  void ApplyCentralImpulse(const glm::vec3& impulse);
+  void SetLinearVelocity(const glm::vec3& velocity);
 
   struct Restrains {
     unsigned int x_pos_lock : 1;
@@ -74,22 +94,33 @@ class BulletRigidBody : public GameObject, public btMotionState {
   void SetRestrains(Restrains value);
 
  private:
+  // Destroyed on the physics thread, after the body was removed from the world
+  struct PhysicsObjects {
+    std::unique_ptr<btCollisionShape> owned_shape;
+    std::unique_ptr<PhysicsMotionState> motion_state;
+    std::unique_ptr<btRigidBody> rigid_body;
+
+    ~PhysicsObjects();
+  };
+
   std::unique_ptr<btCollisionShape> shape_;
-  std::unique_ptr<btRigidBody> bt_rigid_body_;
-  bool up_to_date_;
-  btTransform new_transform_;
+  std::shared_ptr<PhysicsObjects> physics_objects_;
+  uint64_t body_id_ = 0;
   Restrains restrains_;
 
+  // The last two states of the physics (see Scene::SyncPhysics)
+  btTransform previous_transform_, current_transform_;
+  float interpolation_alpha_ = 1.0f;
+
   void Init(float mass, btCollisionShape* shape, CollisionType collision_type);
+  // Only called by the scene, for the bodies that moved in the latest physics
+  // snapshot (see Scene::SyncPhysics), not for the whole tree
+  void UpdatePhysics();
 
   // GameObject virtual functions
-  virtual void UpdatePhysics() override;
   virtual void RemovedFromScene() override;
 
-  // btMotionState virtual functions
-  virtual void getWorldTransform(btTransform &t) const override;
-  virtual void setWorldTransform(const btTransform &t) override;
-
+  friend class Scene;
 };
 
 } // namespace Silice3D
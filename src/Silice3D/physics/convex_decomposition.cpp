@@ -0,0 +1,347 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+#include <LinearMath/btConvexHullComputer.h>
+
+#include <Silice3D/physics/convex_decomposition.hpp>
+
+namespace Silice3D {
+namespace ConvexDecomposition {
+
+namespace {
+
+// The number of split planes tried per axis.
+constexpr int kSplitCandidates = 7;
+
+struct VoxelGrid {
+  glm::ivec3 size;
+  glm::vec3 origin;  // the min corner of the (0, 0, 0) voxel
+  float voxel_size = 1.0f;
+  std::vector<uint8_t> cells;
+
+  size_t Index(int x, int y, int z) const {
+    return x + size_t(size.x) * (y + size_t(size.y) * z);
+  }
+};
+
+enum VoxelState : uint8_t { kVoxelEmpty, kVoxelSurface, kVoxelOutside };
+
+struct Part {
+  std::vector<glm::ivec3> voxels;
+  glm::ivec3 mins, maxes;
+  Hull hull;
+  double concavity = 0.0;
+};
+
+// Separating axis test of a triangle and a cube (Akenine-Möller).
+bool TriangleOverlapsCube(const glm::vec3& center, float half_size,
+                          const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  glm::vec3 v[3] = {a - center, b - center, c - center};
+  glm::vec3 e[3] = {v[1] - v[0], v[2] - v[1], v[0] - v[2]};
+
+  auto separated = [&](const glm::vec3& axis) {
+    float p0 = glm::dot(axis, v[0]), p1 = glm::dot(axis, v[1]), p2 = glm::dot(axis, v[2]);
+    float r = half_size * (std::abs(axis.x) + std::abs(axis.y) + std::abs(axis.z));
+    return std::min({p0, p1, p2}) > r || std::max({p0, p1, p2}) < -r;
+  };
+
+  for (int i = 0; i < 3; ++i) {
+    glm::vec3 box_axis;
+    box_axis[i] = 1.0f;
+    if (separated(box_axis)) {
+      return false;
+    }
+    for (int j = 0; j < 3; ++j) {
+      if (separated(glm::cross(box_axis, e[j]))) {
+        return false;
+      }
+    }
+  }
+
+  return !separated(glm::cross(e[0], e[1]));
+}
+
+// Marks the voxels that intersect the triangles as surface, and the ones that
+// can be reached from the border without crossing the surface as outside.
+// The rest is inside (if the mesh is closed).
+VoxelGrid Voxelize(const std::vector<glm::vec3>& positions,
+                   const std::vector<unsigned>& indices, unsigned resolution) {
+  glm::vec3 mins{std::numeric_limits<float>::max()};
+  glm::vec3 maxes{-std::numeric_limits<float>::max()};
+  for (unsigned index : indices) {
+    mins = glm::min(mins, positions[index]);
+    maxes = glm::max(maxes, positions[index]);
+  }
+  glm::vec3 extent = maxes - mins;
+  float longest_side = std::max(extent.x, std::max(extent.y, extent.z));
+
+  VoxelGrid grid;
+  grid.voxel_size = longest_side > 0.0f ? longest_side / std::max(resolution, 1u) : 1.0f;
+  // One voxel wide empty border, so the outside is connected
+  grid.size = glm::ivec3(glm::ceil(extent / grid.voxel_size)) + 2;
+  grid.size = glm::max(grid.size, glm::ivec3(3));
+  grid.origin = mins - grid.voxel_size;
+  grid.cells.resize(size_t(grid.size.x) * grid.size.y * grid.size.z, kVoxelEmpty);
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const glm::vec3& a = positions[indices[i]];
+    const glm::vec3& b = positions[indices[i+1]];
+    const glm::vec3& c = positions[indices[i+2]];
+    glm::ivec3 first = glm::ivec3(glm::floor((glm::min(a, glm::min(b, c)) - grid.origin) / grid.voxel_size));
+    glm::ivec3 last = glm::ivec3(glm::floor((glm::max(a, glm::max(b, c)) - grid.origin) / grid.voxel_size));
+    first = glm::clamp(first, glm::ivec3(0), grid.size - 1);
+    last = glm::clamp(last, glm::ivec3(0), grid.size - 1);
+    for (int z = first.z; z <= last.z; ++z) {
+      for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+          uint8_t& cell = grid.cells[grid.Index(x, y, z)];
+          glm::vec3 center = grid.origin + (glm::vec3(x, y, z) + 0.5f) * grid.voxel_size;
+          if (cell != kVoxelSurface &&
+              TriangleOverlapsCube(center, grid.voxel_size / 2.0f, a, b, c)) {
+            cell = kVoxelSurface;
+          }
+        }
+      }
+    }
+  }
+
+  std::vector<glm::ivec3> stack;
+  stack.push_back(glm::ivec3(0));
+  grid.cells[0] = kVoxelOutside;
+  while (!stack.empty()) {
+    glm::ivec3 voxel = stack.back();
+    stack.pop_back();
+    for (int axis = 0; axis < 3; ++axis) {
+      for (int direction = -1; direction <= 1; direction += 2) {
+        glm::ivec3 neighbour = voxel;
+        neighbour[axis] += direction;
+        if (neighbour[axis] < 0 || neighbour[axis] >= grid.size[axis]) {
+          continue;
+        }
+        uint8_t& cell = grid.cells[grid.Index(neighbour.x, neighbour.y, neighbour.z)];
+        if (cell == kVoxelEmpty) {
+          cell = kVoxelOutside;
+          stack.push_back(neighbour);
+        }
+      }
+    }
+  }
+
+  return grid;
+}
+
+// Computes the exact convex hull, and returns its volume.
+double ComputeExactHull(const std::vector<glm::vec3>& points, Hull* hull, float shrink = 0.0f) {
+  hull->clear();
+  if (points.size() < 4) {
+    *hull = points;
+    return 0.0;
+  }
+
+  btConvexHullComputer computer;
+  computer.compute(&points[0].x, sizeof(glm::vec3), points.size(), shrink, 0.25f);
+  for (int i = 0; i < computer.vertices.size(); ++i) {
+    const btVector3& vertex = computer.vertices[i];
+    hull->push_back(glm::vec3(vertex.x(), vertex.y(), vertex.z()));
+  }
+
+  // Sum of the tetrahedrons formed by the origin and the triangles
+  // of the fan triangulated faces.
+  double volume = 0.0;
+  for (int i = 0; i < computer.faces.size(); ++i) {
+    const btConvexHullComputer::Edge* first_edge = &computer.edges[computer.faces[i]];
+    glm::dvec3 p0 = glm::dvec3((*hull)[first_edge->getSourceVertex()]);
+    const btConvexHullComputer::Edge* edge = first_edge->getNextEdgeOfFace();
+    while (edge->getTargetVertex() != first_edge->getSourceVertex()) {
+      glm::dvec3 p1 = glm::dvec3((*hull)[edge->getSourceVertex()]);
+      glm::dvec3 p2 = glm::dvec3((*hull)[edge->getTargetVertex()]);
+      volume += glm::dot(p0, glm::cross(p1, p2));
+      edge = edge->getNextEdgeOfFace();
+    }
+  }
+
+  return std::abs(volume) / 6.0;
+}
+
+// Only the voxels at the two ends of the z columns can touch the hull, and
+// only with their outer faces.
+std::vector<glm::vec3> HullCandidatePoints(const Part& part, const VoxelGrid& grid) {
+  glm::ivec3 size = part.maxes - part.mins + 1;
+  std::vector<glm::ivec2> column_ranges(size_t(size.x) * size.y,
+                                        glm::ivec2(std::numeric_limits<int>::max(),
+                                                   std::numeric_limits<int>::min()));
+  for (const glm::ivec3& voxel : part.voxels) {
+    glm::ivec2& range = column_ranges[(voxel.x - part.mins.x) + size_t(size.x) * (voxel.y - part.mins.y)];
+    range.x = std::min(range.x, voxel.z);
+    range.y = std::max(range.y, voxel.z + 1);
+  }
+
+  std::vector<glm::vec3> points;
+  for (int y = 0; y < size.y; ++y) {
+    for (int x = 0; x < size.x; ++x) {
+      const glm::ivec2& range = column_ranges[x + size_t(size.x) * y];
+      if (range.x > range.y) {
+        continue;  // empty column
+      }
+      for (int z : {range.x, range.y}) {
+        for (int corner = 0; corner < 4; ++corner) {
+          glm::ivec3 grid_point{part.mins.x + x + (corner & 1), part.mins.y + y + (corner >> 1), z};
+          points.push_back(grid.origin + glm::vec3(grid_point) * grid.voxel_size);
+        }
+      }
+    }
+  }
+
+  return points;
+}
+
+void EvaluatePart(const VoxelGrid& grid, Part* part) {
+  part->mins = glm::ivec3(std::numeric_limits<int>::max());
+  part->maxes = glm::ivec3(std::numeric_limits<int>::min());
+  for (const glm::ivec3& voxel : part->voxels) {
+    part->mins = glm::min(part->mins, voxel);
+    part->maxes = glm::max(part->maxes, voxel);
+  }
+
+  double hull_volume = ComputeExactHull(HullCandidatePoints(*part, grid), &part->hull);
+  double voxel_volume = std::pow(double(grid.voxel_size), 3.0);
+  part->concavity = std::max(0.0, hull_volume - part->voxels.size() * voxel_volume);
+}
+
+// Tries a few planes on every axis, and keeps the split where the sum of
+// the halves' concavities is the smallest.
+bool SplitPart(const VoxelGrid& grid, const Part& part, Part* best_left, Part* best_right) {
+  double best_cost = std::numeric_limits<double>::max();
+  for (int axis = 0; axis < 3; ++axis) {
+    int extent = part.maxes[axis] - part.mins[axis] + 1;
+    int last_plane = part.mins[axis];
+    for (int i = 1; i <= kSplitCandidates; ++i) {
+      int plane = part.mins[axis] + extent * i / (kSplitCandidates + 1);
+      if (plane == last_plane) {
+        continue;
+      }
+      last_plane = plane;
+
+      Part left, right;
+      for (const glm::ivec3& voxel : part.voxels) {
+        (voxel[axis] < plane ? left : right).voxels.push_back(voxel);
+      }
+      if (left.voxels.empty() || right.voxels.empty()) {
+        continue;
+      }
+      EvaluatePart(grid, &left);
+      EvaluatePart(grid, &right);
+
+      double cost = left.concavity + right.concavity;
+      if (cost < best_cost) {
+        best_cost = cost;
+        *best_left = std::move(left);
+        *best_right = std::move(right);
+      }
+    }
+  }
+
+  return best_cost != std::numeric_limits<double>::max();
+}
+
+// Keeps the vertices that are the furthest in evenly distributed directions.
+Hull SimplifyHull(const Hull& hull, unsigned max_vertices) {
+  if (hull.size() <= max_vertices) {
+    return hull;
+  }
+
+  // Directions on a Fibonacci sphere
+  constexpr float kGoldenAngle = 2.39996323f;
+  std::vector<bool> used(hull.size(), false);
+  Hull result;
+  for (unsigned i = 0; i < max_vertices; ++i) {
+    float z = 1.0f - 2.0f * (i + 0.5f) / max_vertices;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+    glm::vec3 direction{r * std::cos(i * kGoldenAngle), r * std::sin(i * kGoldenAngle), z};
+
+    size_t furthest = 0;
+    for (size_t v = 1; v < hull.size(); ++v) {
+      if (glm::dot(hull[v], direction) > glm::dot(hull[furthest], direction)) {
+        furthest = v;
+      }
+    }
+    if (!used[furthest]) {
+      used[furthest] = true;
+      result.push_back(hull[furthest]);
+    }
+  }
+
+  return result;
+}
+
+}  // namespace
+
+Hull ComputeHull(const std::vector<glm::vec3>& positions, unsigned max_vertices) {
+  Hull hull;
+  ComputeExactHull(positions, &hull);
+  return SimplifyHull(hull, max_vertices);
+}
+
+std::vector<Hull> Decompose(const std::vector<glm::vec3>& positions,
+                            const std::vector<unsigned>& indices,
+                            const Parameters& parameters) {
+  if (indices.size() < 3) {
+    return {ComputeHull(positions, parameters.max_hull_vertices)};
+  }
+
+  VoxelGrid grid = Voxelize(positions, indices, parameters.resolution);
+
+  Part root;
+  for (int z = 0; z < grid.size.z; ++z) {
+    for (int y = 0; y < grid.size.y; ++y) {
+      for (int x = 0; x < grid.size.x; ++x) {
+        if (grid.cells[grid.Index(x, y, z)] != kVoxelOutside) {
+          root.voxels.push_back(glm::ivec3(x, y, z));
+        }
+      }
+    }
+  }
+  EvaluatePart(grid, &root);
+
+  double total_volume = root.voxels.size() * std::pow(double(grid.voxel_size), 3.0);
+  double max_concavity = parameters.max_concavity * total_volume;
+
+  std::vector<Part> parts;
+  parts.push_back(std::move(root));
+  while (parts.size() < parameters.max_hulls) {
+    auto worst = std::max_element(parts.begin(), parts.end(), [](const Part& a, const Part& b) {
+      return a.concavity < b.concavity;
+    });
+    if (worst->concavity <= max_concavity) {
+      break;
+    }
+
+    Part left, right;
+    if (!SplitPart(grid, *worst, &left, &right)) {
+      worst->concavity = 0.0;  // a single voxel, can't be split
+      continue;
+    }
+    *worst = std::move(left);
+    parts.push_back(std::move(right));
+  }
+
+  // The voxels stick out of the surface by up to a voxel, the hulls are
+  // shrunk by half of that.
+  std::vector<Hull> hulls;
+  for (const Part& part : parts) {
+    Hull hull;
+    ComputeExactHull(part.hull, &hull, grid.voxel_size / 2.0f);
+    if (hull.empty()) {
+      hull = part.hull;
+    }
+    hulls.push_back(SimplifyHull(hull, parameters.max_hull_vertices));
+  }
+
+  return hulls;
+}
+
+}  // namespace ConvexDecomposition
+}  // namespace Silice3D
@@ -0,0 +1,48 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_PHYSICS_CONVEX_DECOMPOSITION_HPP_
+#define SILICE3D_PHYSICS_CONVEX_DECOMPOSITION_HPP_
+
+#include <vector>
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// Approximates a triangle mesh with convex hulls, that Bullet can use for
+// moving bodies (unlike the concave triangle mesh shapes).
+namespace ConvexDecomposition {
+
+// The vertices of a convex hull (in any order).
+using Hull = std::vector<glm::vec3>;
+
+struct Parameters {
+  // The number of voxels along the longest side of the mesh's bounding box.
+  unsigned resolution = 48;
+
+  // The decomposition stops at this many hulls.
+  unsigned max_hulls = 16;
+
+  // A part is split further while its hull's volume is larger than the
+  // volume of the part by more than this fraction of the whole mesh's volume.
+  float max_concavity = 0.02f;
+
+  // The hulls are simplified to at most this many vertices.
+  unsigned max_hull_vertices = 64;
+};
+
+// Returns the convex hull of the points, simplified to at most max_vertices
+// vertices. The simplified hull is inside the exact one.
+Hull ComputeHull(const std::vector<glm::vec3>& positions, unsigned max_vertices);
+
+// An approximate convex decomposition, in the style of V-HACD: the mesh is
+// voxelized (with its inside filled if it is closed), and the voxels are
+// recursively split by axis aligned planes, always the part whose convex
+// hull is the worst fit, with the plane that minimizes the hulls' extra volume.
+std::vector<Hull> Decompose(const std::vector<glm::vec3>& positions,
+                            const std::vector<unsigned>& indices,
+                            const Parameters& parameters = Parameters{});
+
+}  // namespace ConvexDecomposition
+}  // namespace Silice3D
+
+#endif  // SILICE3D_PHYSICS_CONVEX_DECOMPOSITION_HPP_
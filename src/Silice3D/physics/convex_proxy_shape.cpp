@@ -0,0 +1,144 @@
+// Copyright (c) Tamas Csala
+
+#include <fstream>
+#include <algorithm>
+
+#include <Silice3D/common/cache_file.hpp>
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/physics/convex_proxy_shape.hpp>
+
+namespace Silice3D {
+
+namespace {
+
+// Bump this if the cache file layout or the decomposition changes.
+constexpr uint32_t kCacheVersion = 1;
+constexpr char kCacheMagic[4] = {'S', '3', 'D', 'H'};
+
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t hull_count;
+};
+
+std::string GetCachePath(const std::vector<glm::vec3>& positions,
+                         const std::vector<unsigned>& indices,
+                         ConvexProxyShape::Type type,
+                         const ConvexDecomposition::Parameters& parameters,
+                         const std::string& cache_directory) {
+  uint32_t format[] = {kCacheVersion, uint32_t(type), parameters.resolution,
+                       parameters.max_hulls, parameters.max_hull_vertices};
+  uint64_t hash = CacheFile::HashBytes(format, sizeof(format));
+  hash = CacheFile::HashBytes(&parameters.max_concavity, sizeof(float), hash);
+  hash = CacheFile::HashBytes(positions.data(), positions.size() * sizeof(glm::vec3), hash);
+  hash = CacheFile::HashBytes(indices.data(), indices.size() * sizeof(unsigned), hash);
+  return CacheFile::GetPath(cache_directory, hash, ".s3dhull");
+}
+
+}  // namespace
+
+ConvexProxyShape::ConvexProxyShape(const std::vector<glm::vec3>& positions,
+                                   const std::vector<unsigned>& indices, Type type,
+                                   const ConvexDecomposition::Parameters& parameters,
+                                   const std::string& cache_directory) {
+  std::string cache_path;
+  if (!cache_directory.empty()) {
+    cache_path = GetCachePath(positions, indices, type, parameters, cache_directory);
+    loaded_from_cache_ = ReadCache(cache_path);
+  }
+
+  if (!loaded_from_cache_) {
+    if (type == Type::kHull) {
+      hulls_.push_back(ConvexDecomposition::ComputeHull(positions, parameters.max_hull_vertices));
+    } else {
+      hulls_ = ConvexDecomposition::Decompose(positions, indices, parameters);
+    }
+    if (!cache_path.empty()) {
+      WriteCache(cache_path);
+    }
+  }
+
+  CreateShape();
+}
+
+void ConvexProxyShape::CreateShape() {
+  for (const ConvexDecomposition::Hull& hull : hulls_) {
+    hull_shapes_.push_back(make_unique<btConvexHullShape>());
+    for (const glm::vec3& vertex : hull) {
+      hull_shapes_.back()->addPoint(btVector3(vertex.x, vertex.y, vertex.z), false);
+    }
+    hull_shapes_.back()->recalcLocalAabb();
+  }
+
+  if (hull_shapes_.size() == 1) {
+    shape_ = hull_shapes_.front().get();
+  } else {
+    compound_shape_ = make_unique<btCompoundShape>(true, hull_shapes_.size());
+    btTransform identity;
+    identity.setIdentity();
+    for (const auto& hull_shape : hull_shapes_) {
+      compound_shape_->addChildShape(identity, hull_shape.get());
+    }
+    shape_ = compound_shape_.get();
+  }
+}
+
+bool ConvexProxyShape::ReadCache(const std::string& cache_path) {
+  std::ifstream file(cache_path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  size_t file_size = file.tellg();
+  file.seekg(0);
+
+  CacheHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || !std::equal(header.magic, header.magic + 4, kCacheMagic) ||
+      header.version != kCacheVersion) {
+    return false;
+  }
+
+  // The counts are checked against the bytes left in the file before
+  // allocating anything, so a corrupted entry can't make us allocate
+  // gigabytes (every hull has at least its vertex count).
+  size_t remaining_size = file_size - sizeof(header);
+  if (header.hull_count > remaining_size / sizeof(uint32_t)) {
+    return false;
+  }
+  remaining_size -= header.hull_count * sizeof(uint32_t);
+
+  std::vector<ConvexDecomposition::Hull> hulls(header.hull_count);
+  for (ConvexDecomposition::Hull& hull : hulls) {
+    uint32_t vertex_count = 0;
+    file.read(reinterpret_cast<char*>(&vertex_count), sizeof(vertex_count));
+    if (!file || vertex_count > remaining_size / sizeof(glm::vec3)) {
+      return false;
+    }
+    remaining_size -= vertex_count * sizeof(glm::vec3);
+    hull.resize(vertex_count);
+    file.read(reinterpret_cast<char*>(hull.data()), vertex_count * sizeof(glm::vec3));
+  }
+  if (!file) {
+    return false;
+  }
+
+  hulls_ = std::move(hulls);
+  return true;
+}
+
+void ConvexProxyShape::WriteCache(const std::string& cache_path) const {
+  CacheFile::WriteAtomically(cache_path, [this](std::ostream& file) {
+    CacheHeader header;
+    std::copy(kCacheMagic, kCacheMagic + 4, header.magic);
+    header.version = kCacheVersion;
+    header.hull_count = hulls_.size();
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const ConvexDecomposition::Hull& hull : hulls_) {
+      uint32_t vertex_count = hull.size();
+      file.write(reinterpret_cast<const char*>(&vertex_count), sizeof(vertex_count));
+      file.write(reinterpret_cast<const char*>(hull.data()), hull.size() * sizeof(glm::vec3));
+    }
+  });
+}
+
+}  // namespace Silice3D
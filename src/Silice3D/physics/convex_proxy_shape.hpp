@@ -0,0 +1,53 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_PHYSICS_CONVEX_PROXY_SHAPE_HPP_
+#define SILICE3D_PHYSICS_CONVEX_PROXY_SHAPE_HPP_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <btBulletDynamicsCommon.h>
+
+#include <Silice3D/physics/convex_decomposition.hpp>
+
+namespace Silice3D {
+
+// A convex approximation of a triangle mesh, for dynamic rigid bodies:
+// either a single simplified hull, or a compound of the hulls of an
+// approximate convex decomposition.
+//
+// The decomposition is slow, so the hulls are saved into an on-disk cache,
+// keyed by the hash of the triangles and the parameters.
+class ConvexProxyShape {
+ public:
+  enum class Type { kHull, kDecomposition };
+
+  // An empty cache_directory disables the cache. The directory has to exist.
+  ConvexProxyShape(const std::vector<glm::vec3>& positions,
+                   const std::vector<unsigned>& indices, Type type,
+                   const ConvexDecomposition::Parameters& parameters = {},
+                   const std::string& cache_directory = "");
+
+  // A btConvexHullShape, or a btCompoundShape of them.
+  btCollisionShape* GetShape() { return shape_; }
+  const btCollisionShape* GetShape() const { return shape_; }
+
+  const std::vector<ConvexDecomposition::Hull>& GetHulls() const { return hulls_; }
+
+  bool IsLoadedFromCache() const { return loaded_from_cache_; }
+
+ private:
+  std::vector<ConvexDecomposition::Hull> hulls_;
+  std::vector<std::unique_ptr<btConvexHullShape>> hull_shapes_;
+  std::unique_ptr<btCompoundShape> compound_shape_;
+  btCollisionShape* shape_ = nullptr;
+  bool loaded_from_cache_ = false;
+
+  void CreateShape();
+  bool ReadCache(const std::string& cache_path);
+  void WriteCache(const std::string& cache_path) const;
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_PHYSICS_CONVEX_PROXY_SHAPE_HPP_
@@ -0,0 +1,87 @@
+// Copyright (c) Tamas Csala
+
+#include <vector>
+#include <algorithm>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/physics/physics_task_scheduler.hpp>
+
+namespace Silice3D {
+
+PhysicsTaskScheduler::PhysicsTaskScheduler(ThreadPool* thread_pool)
+    : btITaskScheduler("Silice3D")
+    , thread_pool_(thread_pool)
+    , thread_count_(std::min(int(thread_pool->GetWorkerCount()) + 1, BT_MAX_THREAD_COUNT)) {}
+
+int PhysicsTaskScheduler::getMaxNumThreads() const {
+  return BT_MAX_THREAD_COUNT;
+}
+
+int PhysicsTaskScheduler::getNumThreads() const {
+  return BT_MAX_THREAD_COUNT;
+}
+
+void PhysicsTaskScheduler::setNumThreads(int thread_count) {
+  int max_thread_count = std::min(int(thread_pool_->GetWorkerCount()) + 1, BT_MAX_THREAD_COUNT);
+  thread_count_ = std::min(std::max(thread_count, 1), max_thread_count);
+}
+
+size_t PhysicsTaskScheduler::GetTaskCount(int begin, int end, int grain_size) const {
+  if (begin >= end) {
+    return 0;
+  }
+  int chunk_count = (end - begin + grain_size - 1) / grain_size;
+  return size_t(std::min(chunk_count, thread_count_.load(std::memory_order_relaxed)));
+}
+
+template<typename ChunkFunction>
+void PhysicsTaskScheduler::RunChunks(int begin, int end, int grain_size, size_t task_count,
+                                     const ChunkFunction& function) {
+  if (task_count == 0) {
+    return;
+  } else if (task_count == 1) {
+    function(0, begin, end);
+    return;
+  }
+
+  // The chunks are taken dynamically, as their costs can be very different
+  // (like the islands of the solver)
+  int chunk_count = (end - begin + grain_size - 1) / grain_size;
+  std::atomic<int> next_chunk{0};
+  thread_pool_->ParallelFor(task_count, [&](size_t task_index) {
+    int chunk;
+    while ((chunk = next_chunk++) < chunk_count) {
+      int chunk_begin = begin + chunk * grain_size;
+      function(task_index, chunk_begin, std::min(chunk_begin + grain_size, end));
+    }
+  });
+}
+
+void PhysicsTaskScheduler::parallelFor(int begin, int end, int grain_size,
+                                       const btIParallelForBody& body) {
+  grain_size = std::max(grain_size, 1);
+  size_t task_count = GetTaskCount(begin, end, grain_size);
+  RunChunks(begin, end, grain_size, task_count,
+            [&body](size_t, int chunk_begin, int chunk_end) {
+    body.forLoop(chunk_begin, chunk_end);
+  });
+}
+
+btScalar PhysicsTaskScheduler::parallelSum(int begin, int end, int grain_size,
+                                           const btIParallelSumBody& body) {
+  grain_size = std::max(grain_size, 1);
+  size_t task_count = GetTaskCount(begin, end, grain_size);
+  std::vector<btScalar> sums(task_count, btScalar(0));
+  RunChunks(begin, end, grain_size, task_count,
+            [&body, &sums](size_t task_index, int chunk_begin, int chunk_end) {
+    sums[task_index] += body.sumLoop(chunk_begin, chunk_end);
+  });
+
+  btScalar sum = 0;
+  for (btScalar task_sum : sums) {
+    sum += task_sum;
+  }
+  return sum;
+}
+
+}  // namespace Silice3D
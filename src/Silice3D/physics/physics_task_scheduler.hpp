@@ -0,0 +1,54 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_PHYSICS_PHYSICS_TASK_SCHEDULER_HPP_
+#define SILICE3D_PHYSICS_PHYSICS_TASK_SCHEDULER_HPP_
+
+#include <atomic>
+#include <LinearMath/btThreads.h>
+
+namespace Silice3D {
+
+class ThreadPool;
+
+// Runs the parallel loops of Bullet's multithreaded pipeline (collision
+// dispatch, island solving, integration) on the engine's ThreadPool, instead
+// of a thread pool of Bullet's own, that would compete with the workers for
+// the cores. The calling thread (the physics thread) takes part in the work.
+class PhysicsTaskScheduler : public btITaskScheduler {
+ public:
+  explicit PhysicsTaskScheduler(ThreadPool* thread_pool);
+
+  // Bullet sizes its per thread data by these, and indexes it with
+  // btGetCurrentThreadIndex(), that is unique for every thread that has ever
+  // used it, not just for the ones that run the loops, so these are always
+  // the maximum. The index never reaches it, as only the long-lived threads
+  // of the engine run the loops (see GameEngine::GetPhysicsThreadPool).
+  virtual int getMaxNumThreads() const override;
+  virtual int getNumThreads() const override;
+
+  // Limits how many threads (the caller included) a loop runs on. Can be
+  // called while the physics thread is running. Defaults to every worker.
+  virtual void setNumThreads(int thread_count) override;
+  int GetThreadCount() const { return thread_count_; }
+
+  virtual void parallelFor(int begin, int end, int grain_size,
+                           const btIParallelForBody& body) override;
+  virtual btScalar parallelSum(int begin, int end, int grain_size,
+                               const btIParallelSumBody& body) override;
+
+ private:
+  ThreadPool* thread_pool_;
+  std::atomic<int> thread_count_;
+
+  size_t GetTaskCount(int begin, int end, int grain_size) const;
+
+  // Calls function(task_index, chunk_begin, chunk_end) for every grain_size
+  // sized chunk of [begin, end), distributed between task_count tasks.
+  template<typename ChunkFunction>
+  void RunChunks(int begin, int end, int grain_size, size_t task_count,
+                 const ChunkFunction& function);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_PHYSICS_PHYSICS_TASK_SCHEDULER_HPP_
@@ -0,0 +1,208 @@
+// Copyright (c) Tamas Csala
+
+#include <chrono>
+#include <algorithm>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/physics/physics_thread.hpp>
+
+namespace Silice3D {
+
+PhysicsMotionState::PhysicsMotionState(PhysicsThread* physics_thread, uint64_t body_id,
+                                       const btTransform& transform)
+    : physics_thread_(physics_thread), body_id_(body_id)
+    , transform_(transform), previous_transform_(transform) {}
+
+void PhysicsMotionState::getWorldTransform(btTransform &t) const {
+  t = transform_;
+}
+
+void PhysicsMotionState::setWorldTransform(const btTransform &t) {
+  // The transform is only set once in a step, so the current one is the
+  // state of the previous step
+  previous_transform_ = transform_;
+  transform_ = t;
+  if (!is_moved_.exchange(true, std::memory_order_acq_rel)) {
+    physics_thread_->AddMovedBody(this);
+  }
+}
+
+PhysicsThread::PhysicsThread(btDynamicsWorld* world, double time_step, ThreadPool* thread_pool)
+    : world_(world), time_step_(time_step) {
+  // The task has to be copyable
+  auto finished = std::make_shared<std::promise<void>>();
+  finished_ = finished->get_future();
+  thread_pool->Enqueue(0, [this, finished]() {
+    Run();
+    finished->set_value();
+  });
+}
+
+PhysicsThread::~PhysicsThread() {
+  Stop();
+}
+
+void PhysicsThread::QueueCommand(std::function<void()> command) {
+  queued_commands_.push_back(std::move(command));
+}
+
+void PhysicsThread::Advance(double time) {
+  if (!queued_commands_.empty()) {
+    std::lock_guard<std::mutex> lock(commands_mutex_);
+    for (auto& command : queued_commands_) {
+      commands_.push_back(std::move(command));
+    }
+    queued_commands_.clear();
+  }
+  target_time_.store(time, std::memory_order_release);
+  wake_.Set();
+}
+
+float PhysicsThread::GetInterpolationAlpha(double render_time, double snapshot_time,
+                                           double time_step) {
+  // The previous transforms are a step before the time of the snapshot
+  double alpha = (render_time - (snapshot_time - time_step)) / time_step;
+  return float(std::min(std::max(alpha, 0.0), 1.0));
+}
+
+const PhysicsThread::Snapshot* PhysicsThread::AcquireSnapshot() {
+  if ((latest_index_.load(std::memory_order_relaxed) & kNewSnapshotBit) == 0) {
+    return nullptr;
+  }
+  read_index_ = latest_index_.exchange(read_index_, std::memory_order_acq_rel) & kSnapshotIndexMask;
+  const Snapshot& snapshot = snapshots_[read_index_];
+  acknowledged_step_.store(snapshot.step, std::memory_order_release);
+  return &snapshot;
+}
+
+void PhysicsThread::Stop() {
+  if (finished_.valid()) {
+    should_quit_ = true;
+    wake_.Set();
+    finished_.get();
+
+    // Nothing is published anymore
+    for (PhysicsMotionState* motion_state : published_bodies_) {
+      motion_state->is_published_ = false;
+    }
+    published_bodies_.clear();
+  }
+}
+
+void PhysicsThread::RunQueuedCommands() {
+  Advance(time_);
+  RunCommands();
+}
+
+void PhysicsThread::AddMovedBody(PhysicsMotionState* motion_state) {
+  PhysicsMotionState* head = moved_bodies_.load(std::memory_order_relaxed);
+  do {
+    motion_state->next_moved_ = head;
+  } while (!moved_bodies_.compare_exchange_weak(head, motion_state, std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+void PhysicsThread::RemoveBody(PhysicsMotionState* motion_state) {
+  // The moved bodies are always collected right after the step, so only the
+  // published ones have to be forgotten
+  if (motion_state->is_published_) {
+    published_bodies_.erase(std::remove(published_bodies_.begin(), published_bodies_.end(),
+                                        motion_state),
+                            published_bodies_.end());
+    motion_state->is_published_ = false;
+  }
+}
+
+void PhysicsThread::Run() {
+  while (true) {
+    wake_.WaitOne();
+    if (should_quit_) {
+      return;
+    }
+
+    RunCommands();
+
+    double target_time = target_time_.load(std::memory_order_acquire);
+    unsigned step_count = 0;
+    auto steps_start = std::chrono::steady_clock::now();
+    while (time_ + time_step_ <= target_time && step_count < kMaxStepsPerAdvance) {
+      Step();
+      step_count++;
+    }
+    if (time_ + time_step_ <= target_time) {
+      time_ = target_time;
+    }
+
+    if (step_count > 0) {
+      std::chrono::duration<double, std::milli> steps_duration =
+          std::chrono::steady_clock::now() - steps_start;
+      PublishSnapshot(steps_duration.count() / step_count);
+    }
+  }
+}
+
+void PhysicsThread::RunCommands() {
+  {
+    std::lock_guard<std::mutex> lock(commands_mutex_);
+    std::swap(running_commands_, commands_);
+  }
+  for (const auto& command : running_commands_) {
+    command();
+  }
+  // The captures (like the objects of the removed bodies) are destroyed here
+  running_commands_.clear();
+}
+
+void PhysicsThread::Step() {
+  // Without substeps, Bullet does exactly one step of this length
+  world_->stepSimulation(btScalar(time_step_), 0);
+  time_ += time_step_;
+  step_++;
+
+  PhysicsMotionState* motion_state = moved_bodies_.exchange(nullptr, std::memory_order_acquire);
+  while (motion_state != nullptr) {
+    PhysicsMotionState* next = motion_state->next_moved_;
+    motion_state->is_moved_.store(false, std::memory_order_relaxed);
+    motion_state->last_moved_step_ = step_;
+    if (!motion_state->is_published_) {
+      motion_state->is_published_ = true;
+      published_bodies_.push_back(motion_state);
+    }
+    motion_state = next;
+  }
+}
+
+// The snapshot has every body that moved since the step of the snapshot that
+// the main thread acquired last, so it doesn't miss a move, even if it skips
+// snapshots, but the resting bodies are only published until it has seen them.
+void PhysicsThread::PublishSnapshot(double step_time) {
+  uint64_t acknowledged_step = acknowledged_step_.load(std::memory_order_acquire);
+
+  Snapshot& snapshot = snapshots_[write_index_];
+  snapshot.step = step_;
+  snapshot.time = time_;
+  snapshot.step_time = step_time;
+  snapshot.bodies.clear();
+
+  size_t kept_count = 0;
+  for (PhysicsMotionState* motion_state : published_bodies_) {
+    if (motion_state->last_moved_step_ <= acknowledged_step) {
+      motion_state->is_published_ = false;
+      continue;
+    }
+    published_bodies_[kept_count++] = motion_state;
+
+    bool moved_in_last_step = motion_state->last_moved_step_ == step_;
+    snapshot.bodies.push_back(BodyState{
+      motion_state->body_id_,
+      moved_in_last_step ? motion_state->previous_transform_ : motion_state->transform_,
+      motion_state->transform_
+    });
+  }
+  published_bodies_.resize(kept_count);
+
+  write_index_ = latest_index_.exchange(write_index_ | kNewSnapshotBit, std::memory_order_acq_rel)
+                 & kSnapshotIndexMask;
+}
+
+}  // namespace Silice3D
@@ -0,0 +1,166 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_PHYSICS_PHYSICS_THREAD_HPP_
+#define SILICE3D_PHYSICS_PHYSICS_THREAD_HPP_
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <btBulletDynamicsCommon.h>
+
+#include <Silice3D/common/auto_reset_event.hpp>
+
+namespace Silice3D {
+
+class ThreadPool;
+class PhysicsThread;
+
+// The motion state of a rigid body that the physics thread simulates. It's
+// owned by the physics thread once the body was added to the world.
+class PhysicsMotionState : public btMotionState {
+ public:
+  PhysicsMotionState(PhysicsThread* physics_thread, uint64_t body_id,
+                     const btTransform& transform);
+
+  virtual void getWorldTransform(btTransform &t) const override;
+  // Called from the physics thread, only for the active bodies
+  virtual void setWorldTransform(const btTransform &t) override;
+
+ private:
+  PhysicsThread* physics_thread_;
+  uint64_t body_id_;
+  btTransform transform_, previous_transform_;
+
+  // Set while the state is in the moved bodies of the current step
+  std::atomic<bool> is_moved_{false};
+  PhysicsMotionState* next_moved_ = nullptr;
+  // Until the main thread has seen the last move, the state is published in
+  // every snapshot (see PhysicsThread::PublishSnapshot)
+  uint64_t last_moved_step_ = 0;
+  bool is_published_ = false;
+
+  friend class PhysicsThread;
+};
+
+// Steps a Bullet world on its own thread with a fixed time step, so that
+// neither the physics nor the rendering waits for the other. The main thread
+// only tells the time that the simulation should catch up with, and hands
+// over the commands of the frame, the physics thread publishes the moved
+// bodies' transforms into a triple buffer, that is read without blocking.
+//
+// It doesn't start a thread of its own, but occupies a worker of the given
+// pool until it's stopped (see GameEngine::GetPhysicsThreadPool), as Bullet
+// gives a new index to every thread that ever takes part in its parallel
+// loops, and its per thread data runs out after BT_MAX_THREAD_COUNT threads.
+class PhysicsThread {
+ public:
+  // The state of a body that moved since the main thread's last snapshot.
+  // The previous transform is a time step before the current one.
+  struct BodyState {
+    uint64_t body_id;
+    btTransform previous, current;
+  };
+
+  struct Snapshot {
+    uint64_t step = 0;
+    // The simulation time of the current transforms
+    double time = 0.0;
+    // The average time that the steps since the previous snapshot took on
+    // the physics thread, in milliseconds
+    double step_time = 0.0;
+    std::vector<BodyState> bodies;
+  };
+
+  // At most this many steps are done to catch up with the main thread, the
+  // rest of the time is dropped instead of falling behind more and more.
+  static constexpr unsigned kMaxStepsPerAdvance = 16;
+
+  // If every worker of the pool is busy, the simulation only starts once one
+  // of them is free, but the commands and the Advances aren't lost.
+  PhysicsThread(btDynamicsWorld* world, double time_step, ThreadPool* thread_pool);
+  ~PhysicsThread();
+
+  double GetTimeStep() const { return time_step_; }
+
+  // The interpolation factor between the previous and the current transforms
+  // of the bodies of a snapshot at the given time, clamped to [0, 1]. As a
+  // snapshot only catches up with the time of the previous Advance, that time
+  // minus a step is always between the two transforms of the latest snapshot,
+  // unless the physics thread has fallen behind.
+  static float GetInterpolationAlpha(double render_time, double snapshot_time,
+                                     double time_step);
+
+  // These are only called from the main thread.
+
+  // The command runs on the physics thread before its next step. The
+  // commands run in order, and the commands queued before the same Advance
+  // run together: their captures are only destroyed after all of them ran.
+  void QueueCommand(std::function<void()> command);
+
+  // Hands over the queued commands, and lets the simulation catch up with the
+  // given time. Doesn't wait for the physics thread.
+  void Advance(double time);
+
+  // Returns the latest snapshot if a new one was published since the last
+  // call, nullptr otherwise. The snapshot is valid until the next call.
+  const Snapshot* AcquireSnapshot();
+
+  // Waits for the simulation to finish. The commands that are queued after
+  // this have to be run by RunQueuedCommands, on the caller thread.
+  void Stop();
+  void RunQueuedCommands();
+
+  // These are only called from the physics thread (from the commands).
+
+  void AddMovedBody(PhysicsMotionState* motion_state);
+  // Has to be called before the body's motion state is destroyed.
+  void RemoveBody(PhysicsMotionState* motion_state);
+
+ private:
+  static constexpr unsigned kSnapshotIndexMask = 0x3;
+  static constexpr unsigned kNewSnapshotBit = 0x4;
+
+  btDynamicsWorld* world_;
+  double time_step_;
+
+  // Physics thread data
+  double time_ = 0.0;
+  uint64_t step_ = 0;
+  // An intrusive stack through PhysicsMotionState::next_moved_
+  std::atomic<PhysicsMotionState*> moved_bodies_{nullptr};
+  std::vector<PhysicsMotionState*> published_bodies_;
+  std::vector<std::function<void()>> running_commands_;
+  unsigned write_index_ = 0;
+
+  // Shared data
+  Snapshot snapshots_[3];
+  // The index of the latest snapshot, with kNewSnapshotBit if the main thread
+  // hasn't acquired it yet
+  std::atomic<unsigned> latest_index_{1};
+  // The step of the snapshot that the main thread acquired last
+  std::atomic<uint64_t> acknowledged_step_{0};
+  std::atomic<double> target_time_{0.0};
+  std::mutex commands_mutex_;
+  std::vector<std::function<void()>> commands_;
+  std::atomic<bool> should_quit_{false};
+  AutoResetEvent wake_;
+
+  // Main thread data
+  std::vector<std::function<void()>> queued_commands_;
+  unsigned read_index_ = 2;
+
+  // Ready once Run has returned
+  std::future<void> finished_;
+
+  void Run();
+  void RunCommands();
+  void Step();
+  void PublishSnapshot(double step_time);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_PHYSICS_PHYSICS_THREAD_HPP_
@@ -0,0 +1,240 @@
+// Copyright (c) Tamas Csala
+
+#include <fstream>
+#include <numeric>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #define SILICE3D_USE_MMAP 1
+#endif
+
+#include <Silice3D/common/cache_file.hpp>
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/physics/triangle_mesh_shape.hpp>
+
+namespace Silice3D {
+
+namespace {
+
+// Bump this if the cache file layout changes.
+constexpr uint32_t kCacheVersion = 2;
+constexpr char kCacheMagic[4] = {'S', '3', 'D', 'B'};
+
+// The BVH has to be 16 byte aligned, the header keeps it that way.
+// The mesh the BVH was built for is stored too, so an entry is never used
+// for a different mesh, even if the hashes of their paths collide.
+struct CacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t bvh_size;
+  uint32_t vertex_count;
+  uint32_t triangle_count;
+  uint32_t index_size;
+  uint32_t padding;
+};
+static_assert(sizeof(CacheHeader) == 32, "The cache header should be 32 bytes");
+
+}  // namespace
+
+TriangleMeshShape::TriangleMeshShape(const std::vector<glm::vec3>& positions,
+                                     const std::vector<unsigned>& indices,
+                                     const std::string& cache_directory) {
+  Weld(positions, indices);
+
+  btIndexedMesh mesh;
+  mesh.m_numVertices = positions_.size();
+  mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(positions_.data());
+  mesh.m_vertexStride = sizeof(glm::vec3);
+  mesh.m_vertexType = PHY_FLOAT;
+  if (!short_indices_.empty()) {
+    mesh.m_numTriangles = short_indices_.size() / 3;
+    mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(short_indices_.data());
+    mesh.m_triangleIndexStride = 3 * sizeof(uint16_t);
+    mesh.m_indexType = PHY_SHORT;
+  } else {
+    mesh.m_numTriangles = indices_.size() / 3;
+    mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(indices_.data());
+    mesh.m_triangleIndexStride = 3 * sizeof(uint32_t);
+    mesh.m_indexType = PHY_INTEGER;
+  }
+  triangles_.addIndexedMesh(mesh, mesh.m_indexType);
+
+  std::string cache_path;
+  if (!cache_directory.empty()) {
+    cache_path = GetCachePath(cache_directory);
+    if (ReadCache(cache_path)) {
+      return;
+    }
+  }
+
+  shape_ = make_unique<btBvhTriangleMeshShape>(&triangles_, true);
+  if (!cache_path.empty()) {
+    WriteCache(cache_path);
+  }
+}
+
+TriangleMeshShape::~TriangleMeshShape() {
+  // The shape references the cached BVH
+  shape_ = nullptr;
+  FreeCachedBvh();
+}
+
+void TriangleMeshShape::Weld(const std::vector<glm::vec3>& positions,
+                             const std::vector<unsigned>& indices) {
+  // The render vertices are split by their normals and texcoords too, the
+  // collision shape only needs the distinct positions.
+  std::vector<unsigned> order(positions.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&positions](unsigned a, unsigned b) {
+    const glm::vec3& pa = positions[a];
+    const glm::vec3& pb = positions[b];
+    if (pa.x != pb.x) { return pa.x < pb.x; }
+    if (pa.y != pb.y) { return pa.y < pb.y; }
+    return pa.z < pb.z;
+  });
+
+  std::vector<unsigned> welded_index(positions.size());
+  positions_.clear();
+  for (unsigned vertex : order) {
+    if (positions_.empty() || positions_.back() != positions[vertex]) {
+      positions_.push_back(positions[vertex]);
+    }
+    welded_index[vertex] = positions_.size() - 1;
+  }
+
+  // The welding can make some triangles degenerate
+  indices_.clear();
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    unsigned a = welded_index[indices[i]];
+    unsigned b = welded_index[indices[i+1]];
+    unsigned c = welded_index[indices[i+2]];
+    if (a != b && b != c && a != c) {
+      indices_.push_back(a);
+      indices_.push_back(b);
+      indices_.push_back(c);
+    }
+  }
+
+  if (positions_.size() <= 0x10000) {
+    short_indices_.assign(indices_.begin(), indices_.end());
+    indices_.clear();
+    indices_.shrink_to_fit();
+  }
+}
+
+std::string TriangleMeshShape::GetCachePath(const std::string& cache_directory) const {
+  // The BVH's layout depends on the platform, and on Bullet's precision too
+  uint32_t format[] = {kCacheVersion, uint32_t(sizeof(void*)), uint32_t(sizeof(btScalar)),
+                       GetIndexSize()};
+  uint64_t hash = CacheFile::HashBytes(format, sizeof(format));
+  hash = CacheFile::HashBytes(positions_.data(), positions_.size() * sizeof(glm::vec3), hash);
+  hash = CacheFile::HashBytes(short_indices_.data(), short_indices_.size() * sizeof(uint16_t), hash);
+  hash = CacheFile::HashBytes(indices_.data(), indices_.size() * sizeof(uint32_t), hash);
+  return CacheFile::GetPath(cache_directory, hash, ".s3dbvh");
+}
+
+bool TriangleMeshShape::ReadCache(const std::string& cache_path) {
+#if SILICE3D_USE_MMAP
+  // Mapped privately, because the BVH is fixed up in place (copy on write)
+  int fd = open(cache_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || size_t(file_stat.st_size) < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t file_size = file_stat.st_size;
+  void* data = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+#else
+  std::ifstream file(cache_path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+  size_t file_size = file.tellg();
+  if (file_size < sizeof(CacheHeader)) {
+    return false;
+  }
+  void* data = btAlignedAlloc(file_size, 16);
+  file.seekg(0);
+  file.read(static_cast<char*>(data), file_size);
+  if (!file) {
+    btAlignedFree(data);
+    return false;
+  }
+#endif
+  cached_bvh_ = data;
+  cached_bvh_size_ = file_size;
+
+  const CacheHeader* header = static_cast<const CacheHeader*>(data);
+  if (!std::equal(header->magic, header->magic + 4, kCacheMagic) ||
+      header->version != kCacheVersion ||
+      header->bvh_size != file_size - sizeof(CacheHeader) ||
+      header->vertex_count != positions_.size() ||
+      header->triangle_count != GetTriangleCount() ||
+      header->index_size != GetIndexSize()) {
+    FreeCachedBvh();
+    return false;
+  }
+
+  void* bvh_data = static_cast<char*>(data) + sizeof(CacheHeader);
+  btQuantizedBvh* bvh = btQuantizedBvh::deSerializeInPlace(bvh_data, header->bvh_size, false);
+  if (bvh == nullptr) {
+    FreeCachedBvh();
+    return false;
+  }
+
+  shape_ = make_unique<btBvhTriangleMeshShape>(&triangles_, true, false);
+  shape_->setOptimizedBvh(static_cast<btOptimizedBvh*>(bvh));
+  return true;
+}
+
+void TriangleMeshShape::WriteCache(const std::string& cache_path) const {
+  const btOptimizedBvh* bvh = shape_->getOptimizedBvh();
+  unsigned bvh_size = bvh->calculateSerializeBufferSize();
+  void* bvh_data = btAlignedAlloc(bvh_size, 16);
+  bool serialized = bvh->serializeInPlace(bvh_data, bvh_size, false);
+
+  if (serialized) {
+    CacheFile::WriteAtomically(cache_path, [&](std::ostream& file) {
+      CacheHeader header;
+      std::copy(kCacheMagic, kCacheMagic + 4, header.magic);
+      header.version = kCacheVersion;
+      header.bvh_size = bvh_size;
+      header.vertex_count = positions_.size();
+      header.triangle_count = GetTriangleCount();
+      header.index_size = GetIndexSize();
+      header.padding = 0;
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(static_cast<const char*>(bvh_data), bvh_size);
+    });
+  }
+  btAlignedFree(bvh_data);
+}
+
+void TriangleMeshShape::FreeCachedBvh() {
+  if (cached_bvh_ == nullptr) {
+    return;
+  }
+
+  // The BVH is used in place, it doesn't own any memory, so it
+  // doesn't have to be destructed.
+#if SILICE3D_USE_MMAP
+  munmap(cached_bvh_, cached_bvh_size_);
+#else
+  btAlignedFree(cached_bvh_);
+#endif
+  cached_bvh_ = nullptr;
+  cached_bvh_size_ = 0;
+}
+
+}  // namespace Silice3D
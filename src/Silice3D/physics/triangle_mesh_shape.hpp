@@ -0,0 +1,64 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_PHYSICS_TRIANGLE_MESH_SHAPE_HPP_
+#define SILICE3D_PHYSICS_TRIANGLE_MESH_SHAPE_HPP_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <btBulletDynamicsCommon.h>
+
+#include <Silice3D/common/glm.hpp>
+
+namespace Silice3D {
+
+// A static triangle mesh collision shape, that owns a compact copy of its
+// triangles: the vertices are welded by their positions, and the indices are
+// 16 bit if possible.
+//
+// Building the BVH of a large mesh is slow, so it's serialized into an
+// on-disk cache, keyed by the hash of the triangles. If the cache has it, the
+// file is memory mapped and the BVH is used in place, without a rebuild.
+class TriangleMeshShape {
+ public:
+  // An empty cache_directory disables the cache. The directory has to exist.
+  TriangleMeshShape(const std::vector<glm::vec3>& positions,
+                    const std::vector<unsigned>& indices,
+                    const std::string& cache_directory = "");
+  ~TriangleMeshShape();
+
+  btBvhTriangleMeshShape* GetShape() { return shape_.get(); }
+  const btBvhTriangleMeshShape* GetShape() const { return shape_.get(); }
+
+  bool IsLoadedFromCache() const { return cached_bvh_ != nullptr; }
+
+ private:
+  std::vector<glm::vec3> positions_;
+  std::vector<uint16_t> short_indices_;
+  std::vector<uint32_t> indices_;
+
+  btTriangleIndexVertexArray triangles_;
+  std::unique_ptr<btBvhTriangleMeshShape> shape_;
+
+  // The cache file's content, if the BVH was loaded from it
+  void* cached_bvh_ = nullptr;
+  size_t cached_bvh_size_ = 0;
+
+  size_t GetTriangleCount() const {
+    return (short_indices_.empty() ? indices_.size() : short_indices_.size()) / 3;
+  }
+  uint32_t GetIndexSize() const {
+    return short_indices_.empty() ? sizeof(uint32_t) : sizeof(uint16_t);
+  }
+
+  void Weld(const std::vector<glm::vec3>& positions, const std::vector<unsigned>& indices);
+  std::string GetCachePath(const std::string& cache_directory) const;
+  bool ReadCache(const std::string& cache_path);
+  void WriteCache(const std::string& cache_path) const;
+  void FreeCachedBvh();
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_PHYSICS_TRIANGLE_MESH_SHAPE_HPP_
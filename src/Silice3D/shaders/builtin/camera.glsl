@@ -0,0 +1,31 @@
+// Copyright (c), Tamas Csala
+
+const char* camera_glsl_shader_string = R"""(
+
+#version 330 core
+
+// The data of the camera that renders the current pass, written once per
+// frame by FrameUniforms (which also sets the binding of the block).
+layout(std140) uniform Silice3D_CameraBlock {
+  mat4 uProjectionMatrix;
+  mat4 uCameraMatrix;
+  vec3 w_uCamPos;
+};
+
+#export mat4 Silice3D_GetProjectionMatrix();
+#export mat4 Silice3D_GetCameraMatrix();
+#export vec3 Silice3D_GetCameraPosition();
+
+mat4 Silice3D_GetProjectionMatrix() {
+  return uProjectionMatrix;
+}
+
+mat4 Silice3D_GetCameraMatrix() {
+  return uCameraMatrix;
+}
+
+vec3 Silice3D_GetCameraPosition() {
+  return w_uCamPos;
+}
+
+)""";
@@ -0,0 +1,13 @@
+// Copyright (c), Tamas Csala
+
+const char* deferred_vert_shader_string = R"""(
+
+#version 330 core
+
+// A triangle that covers the screen, without any vertex buffers
+void main() {
+  vec2 position = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID >> 1) * 4 - 1);
+  gl_Position = vec4(position, 0, 1);
+}
+
+)""";
@@ -0,0 +1,27 @@
+// Copyright (c), Tamas Csala
+
+const char* deferred_composite_frag_shader_string = R"""(
+
+#version 430 core
+
+#include "Silice3D/gbuffer.glsl"
+#include "Silice3D/post_process.frag"
+
+// The texture unit matches DeferredShading::kLightAccumulationTextureSlot
+layout(binding = 7) uniform sampler2D uLightAccumulation;
+
+out vec4 fragColor;
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  float depth = Silice3D_GetGBufferDepth(texel);
+  if (depth == 1.0) {
+    discard;  // keep the background
+  }
+
+  // The depth is copied too, so the forward passes after this are depth tested
+  gl_FragDepth = depth;
+  fragColor = vec4(PostProcess(texelFetch(uLightAccumulation, texel, 0).rgb), 1.0);
+}
+
+)""";
@@ -0,0 +1,27 @@
+// Copyright (c), Tamas Csala
+
+const char* deferred_point_frag_shader_string = R"""(
+
+#version 330 core
+
+#include "Silice3D/lighting.frag"
+#include "Silice3D/gbuffer.glsl"
+
+flat in uint vLightIndex;
+
+out vec4 fragColor;
+
+void main() {
+  vec3 position, normal, diffuse_color, specular_color;
+  bool recieve_shadows;
+  float shininess;
+  if (!Silice3D_ReadGBuffer(ivec2(gl_FragCoord.xy), position, normal, recieve_shadows,
+                            diffuse_color, specular_color, shininess)) {
+    discard;
+  }
+
+  fragColor = vec4(Silice3D_CalculatePointLighting(
+      vLightIndex, position, normal, recieve_shadows, diffuse_color, specular_color, shininess), 1.0);
+}
+
+)""";
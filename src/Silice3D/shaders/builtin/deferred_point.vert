@@ -0,0 +1,22 @@
+// Copyright (c), Tamas Csala
+
+const char* deferred_point_vert_shader_string = R"""(
+
+#version 330 core
+
+#include "Silice3D/camera.glsl"
+
+layout(location = 0) in vec3 aPosition;
+// Per instance: the light's bounding sphere, and its index in uPointLights
+layout(location = 1) in vec4 aLightSphere;
+layout(location = 2) in uint aLightIndex;
+
+flat out uint vLightIndex;
+
+void main() {
+  vLightIndex = aLightIndex;
+  vec3 w_pos = aLightSphere.xyz + aPosition * aLightSphere.w;
+  gl_Position = Silice3D_GetProjectionMatrix() * (Silice3D_GetCameraMatrix() * vec4(w_pos, 1.0));
+}
+
+)""";
@@ -0,0 +1,75 @@
+// Copyright (c), Tamas Csala
+
+const char* gbuffer_glsl_shader_string = R"""(
+
+#version 430 core
+
+#export vec2 Silice3D_EncodeNormal(vec3 normal);
+#export vec3 Silice3D_DecodeNormal(vec2 encoded);
+#export bool Silice3D_ReadGBuffer(ivec2 texel, out vec3 position, out vec3 normal, out bool recieve_shadows, out vec3 diffuse_color, out vec3 specular_color, out float shininess);
+#export float Silice3D_GetGBufferDepth(ivec2 texel);
+
+// The texture units match DeferredShading::kGBufferTextureSlot
+layout(binding = 3) uniform sampler2D uGBufferNormal;
+layout(binding = 4) uniform sampler2D uGBufferAlbedo;
+layout(binding = 5) uniform sampler2D uGBufferSpecular;
+layout(binding = 6) uniform sampler2D uGBufferDepth;
+
+// Set by DeferredShading, the position is reconstructed from the depth with it
+uniform mat4 uInverseProjectionCameraMatrix;
+
+// Octahedral encoding, that is accurate enough for two 16 bit channels. It's
+// remapped to [0, 1], as the signed normalized formats aren't required to be
+// renderable.
+vec2 SignNotZero(vec2 v) {
+  return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 Silice3D_EncodeNormal(vec3 normal) {
+  vec2 p = normal.xy / (abs(normal.x) + abs(normal.y) + abs(normal.z));
+  p = normal.z <= 0.0 ? (1.0 - abs(p.yx)) * SignNotZero(p) : p;
+  return p * 0.5 + 0.5;
+}
+
+vec3 Silice3D_DecodeNormal(vec2 encoded) {
+  encoded = encoded * 2.0 - 1.0;
+  vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+  if (normal.z < 0.0) {
+    normal.xy = (1.0 - abs(normal.yx)) * SignNotZero(normal.xy);
+  }
+  return normalize(normal);
+}
+
+float Silice3D_GetGBufferDepth(ivec2 texel) {
+  return texelFetch(uGBufferDepth, texel, 0).r;
+}
+
+// Returns false for the pixels that weren't covered by anything
+bool Silice3D_ReadGBuffer(ivec2 texel,
+                          out vec3 position,
+                          out vec3 normal,
+                          out bool recieve_shadows,
+                          out vec3 diffuse_color,
+                          out vec3 specular_color,
+                          out float shininess) {
+  float depth = Silice3D_GetGBufferDepth(texel);
+  if (depth == 1.0) {
+    return false;
+  }
+
+  // The depth range is [0, 1], like the NDC z
+  vec2 ndc_xy = (vec2(texel) + 0.5) / vec2(textureSize(uGBufferDepth, 0)) * 2.0 - 1.0;
+  vec4 world_pos = uInverseProjectionCameraMatrix * vec4(ndc_xy, depth, 1.0);
+  position = world_pos.xyz / world_pos.w;
+
+  normal = Silice3D_DecodeNormal(texelFetch(uGBufferNormal, texel, 0).rg);
+  vec4 albedo = texelFetch(uGBufferAlbedo, texel, 0);
+  diffuse_color = albedo.rgb;
+  recieve_shadows = albedo.a > 0.5;
+  vec4 specular = texelFetch(uGBufferSpecular, texel, 0);
+  specular_color = specular.rgb;
+  shininess = specular.a * 255.0;
+  return true;
+}
+
+)""";
@@ -0,0 +1,59 @@
+// Copyright (c), Tamas Csala
+
+const char* instance_glsl_shader_string = R"""(
+
+#version 330 core
+
+// Decodes the per instance data of the meshes (see MeshRenderer::InstanceFormat).
+// With the affine format the data is the first three rows of the model matrix,
+// with the similarity format it's the translation and the uniform scale in [0],
+// and the rotation quaternion in [1].
+uniform bool uSimilarityInstances;
+
+#export vec3 Silice3D_TransformPosition(vec4 instance_data[3], vec4 position);
+#export vec3 Silice3D_TransformDirection(vec4 instance_data[3], vec3 direction);
+#export vec3 Silice3D_TransformNormal(vec4 instance_data[3], vec3 normal);
+
+vec3 RotateByQuaternion(vec4 q, vec3 v) {
+  return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+vec3 Silice3D_TransformPosition(vec4 instance_data[3], vec4 position) {
+  if (uSimilarityInstances) {
+    return instance_data[0].xyz +
+           instance_data[0].w * RotateByQuaternion(instance_data[1], position.xyz);
+  } else {
+    return vec3(dot(instance_data[0], position),
+                dot(instance_data[1], position),
+                dot(instance_data[2], position));
+  }
+}
+
+// The result isn't normalized.
+vec3 Silice3D_TransformDirection(vec4 instance_data[3], vec3 direction) {
+  if (uSimilarityInstances) {
+    return RotateByQuaternion(instance_data[1], direction);
+  } else {
+    return vec3(dot(instance_data[0].xyz, direction),
+                dot(instance_data[1].xyz, direction),
+                dot(instance_data[2].xyz, direction));
+  }
+}
+
+// The result isn't normalized.
+vec3 Silice3D_TransformNormal(vec4 instance_data[3], vec3 normal) {
+  if (uSimilarityInstances) {
+    return RotateByQuaternion(instance_data[1], normal);
+  } else {
+    // The cofactor matrix is the inverse transpose multiplied by the
+    // determinant, so it doesn't need a division, only its sign matters.
+    vec3 x = vec3(instance_data[0].x, instance_data[1].x, instance_data[2].x);
+    vec3 y = vec3(instance_data[0].y, instance_data[1].y, instance_data[2].y);
+    vec3 z = vec3(instance_data[0].z, instance_data[1].z, instance_data[2].z);
+    vec3 yz = cross(y, z);
+    vec3 result = yz * normal.x + cross(z, x) * normal.y + cross(x, y) * normal.z;
+    return dot(x, yz) < 0.0 ? -result : result;
+  }
+}
+
+)""";
@@ -2,43 +2,97 @@
 
 const char* lighting_frag_shader_string = R"""(
 
-#version 400 core
+#version 430 core
 #extension GL_ARB_bindless_texture : require
 
 #include "Silice3D/bicubic_sampling.glsl"
+#include "Silice3D/camera.glsl"
 
 #export vec3 Silice3D_CalculateLighting(vec3 position, vec3 normal, bool recieve_shadows, vec3 diffuse_color, vec3 specular_color, float shininess);
+#export vec3 Silice3D_CalculateDirectionalLighting(vec3 position, vec3 normal, bool recieve_shadows, vec3 diffuse_color, vec3 specular_color, float shininess);
+#export vec3 Silice3D_CalculatePointLighting(uint light_index, vec3 position, vec3 normal, bool recieve_shadows, vec3 diffuse_color, vec3 specular_color, float shininess);
 
 #define kMaxCascadesCount 4
-#define DEBUG_VISUALIZATION_OF_CASCADES 0
+#define kAmbientPower 0.05
 
+// The features that a program variant can fix at compile time (see
+// ShaderManager::GetProgram), the generic variant decides them at runtime:
+//  - SILICE3D_RECIEVE_SHADOWS: 0 or 1, overrides the recieve_shadows arguments
+//  - SILICE3D_DIRECTIONAL_LIGHT_COUNT: must match uDirectionalLightCount
+//  - DEBUG_VISUALIZATION_OF_CASCADES: 0 or 1
+#ifdef SILICE3D_RECIEVE_SHADOWS
+  #define RECIEVE_SHADOWS(value) bool(SILICE3D_RECIEVE_SHADOWS)
+#else
+  #define RECIEVE_SHADOWS(value) (value)
+#endif
+
+#ifndef DEBUG_VISUALIZATION_OF_CASCADES
+  #define DEBUG_VISUALIZATION_OF_CASCADES 0
+#endif
+
+// The std140 layout matches FrameUniforms
 struct DirectionalLightSource {
   vec3 direction, color;
   uvec2 shadowMapId;
-  mat4 shadowCP[kMaxCascadesCount];
   int cascades_count;
+  mat4 shadowCP[kMaxCascadesCount];
 };
 
+// Bindings and layouts match ClusteredLighting
 struct PointLightSource {
-  vec3 position, color, attenuation;
+  vec4 position_range;  // range: where the light gets dimmer than 1/256
+  vec4 color, attenuation;
+  ivec4 shadow;  // x: the first of its faces in uPointShadowFaces, or -1
+};
+
+// The layout matches PointLightShadows
+struct PointShadowFace {
+  mat4 shadowCP;
+  vec4 rect;  // the face's tile in the atlas: min uv, max uv
 };
 
 #define MAX_DIR_LIGHTS 16
-uniform DirectionalLightSource uDirectionalLights[MAX_DIR_LIGHTS];
-uniform int uDirectionalLightCount;
+layout(std140) uniform Silice3D_LightBlock {
+  int uDirectionalLightCount;
+  DirectionalLightSource uDirectionalLights[MAX_DIR_LIGHTS];
+};
+
+#ifdef SILICE3D_DIRECTIONAL_LIGHT_COUNT
+  #define DIRECTIONAL_LIGHT_COUNT SILICE3D_DIRECTIONAL_LIGHT_COUNT
+#else
+  #define DIRECTIONAL_LIGHT_COUNT min(uDirectionalLightCount, MAX_DIR_LIGHTS)
+#endif
+
+layout(std430, binding = 8) readonly buffer PointLightBuffer {
+  PointLightSource uPointLights[];
+};
+
+// The point lights are binned into a view frustum shaped grid (see
+// LightClusterGrid), every cluster has a range in uLightIndices.
+layout(std430, binding = 9) readonly buffer LightClusterBuffer {
+  mat4 uClusterCameraMatrix;
+  vec4 uClusterParams;  // projection scale x, y, z near, slice scale
+  uvec4 uClusterSize;   // size x, y, z, point light count
+  uvec2 uClusterRanges[];  // offset, count
+};
 
-#define MAX_POINT_LIGHTS 128
-uniform PointLightSource uPointLights[MAX_POINT_LIGHTS];
-uniform int uPointLightCount;
+layout(std430, binding = 10) readonly buffer LightIndexBuffer {
+  uint uLightIndices[];
+};
 
-uniform vec3 w_uCamPos;
+// The six cube faces of every point light with shadows, in a shared atlas
+layout(std430, binding = 11) readonly buffer PointShadowFaceBuffer {
+  uvec2 uShadowAtlasId;
+  uvec2 uShadowAtlasPadding;
+  PointShadowFace uPointShadowFaces[];
+};
 
 float GetDiffusePower(vec3 normal, vec3 light_dir) {
   return max(dot(normal, light_dir), 0);
 }
 
 float GetSpecularPower(vec3 position, vec3 normal, vec3 light_dir, float shininess) {
-  vec3 view_vector = normalize(w_uCamPos - position);
+  vec3 view_vector = normalize(Silice3D_GetCameraPosition() - position);
   vec3 half_vector = normalize(light_dir + view_vector);
   return pow(max(dot(half_vector, normal), 0.0f), shininess);
 }
@@ -51,6 +105,49 @@ vec4 GetShadowCoord(vec3 position, int lightNum, int selected_cascade) {
   return vec4(shadow_coord.xy, selected_cascade, shadow_coord.z);
 }
 
+float GetPointLightVisibility(vec3 position, vec3 normal, vec3 light_position, int first_face) {
+  // The face is selected by the major axis, in the order of the cube map faces
+  vec3 light_to_surface = position - light_position;
+  vec3 abs_dir = abs(light_to_surface);
+  int face;
+  if (abs_dir.x >= abs_dir.y && abs_dir.x >= abs_dir.z) {
+    face = light_to_surface.x > 0.0 ? 0 : 1;
+  } else if (abs_dir.y >= abs_dir.z) {
+    face = light_to_surface.y > 0.0 ? 2 : 3;
+  } else {
+    face = light_to_surface.z > 0.0 ? 4 : 5;
+  }
+  PointShadowFace shadow_face = uPointShadowFaces[first_face + face];
+  sampler2DShadow atlas = sampler2DShadow(uShadowAtlasId);
+
+  // Offset the position along the normal by about a texel against the
+  // shadow acne (a 90 degree face's texel is 2 * distance / size wide)
+  vec2 texel_size = 1.0 / vec2(textureSize(atlas, 0));
+  float tile_size = (shadow_face.rect.z - shadow_face.rect.x) / texel_size.x;
+  vec3 offset_position = position + normal * (2.0 * length(light_to_surface) / tile_size);
+
+  vec4 shadow_coord = shadow_face.shadowCP * vec4(offset_position, 1.0);
+  shadow_coord.xyz /= shadow_coord.w;
+  vec2 uv = mix(shadow_face.rect.xy, shadow_face.rect.zw, shadow_coord.xy * 0.5 + 0.5);
+  // The filtering mustn't read the neighbouring tiles
+  uv = clamp(uv, shadow_face.rect.xy + 0.5*texel_size, shadow_face.rect.zw - 0.5*texel_size);
+  return texture(atlas, vec3(uv, shadow_coord.z));  // the depth range is [0, 1]
+}
+
+// Uses the world space position instead of gl_FragCoord, so that it doesn't
+// depend on the viewport.
+uvec2 GetLightCluster(vec3 position) {
+  vec3 view_pos = vec3(uClusterCameraMatrix * vec4(position, 1.0));
+  float depth = max(-view_pos.z, 1e-6);
+  vec2 ndc = view_pos.xy * uClusterParams.xy / depth;
+  uvec3 cluster;
+  cluster.xy = uvec2(clamp(ivec2(floor((ndc*0.5 + 0.5) * vec2(uClusterSize.xy))),
+                           ivec2(0), ivec2(uClusterSize.xy) - 1));
+  cluster.z = uint(clamp(int(floor(log(depth / uClusterParams.z) * uClusterParams.w)),
+                         0, int(uClusterSize.z) - 1));
+  return uClusterRanges[cluster.x + uClusterSize.x * (cluster.y + uClusterSize.y * cluster.z)];
+}
+
 #if DEBUG_VISUALIZATION_OF_CASCADES
 vec3 GetColorForCascade(int selected_cascade) {
   switch (selected_cascade) {
@@ -64,16 +161,15 @@ vec3 GetColorForCascade(int selected_cascade) {
 }
 #endif
 
-vec3 Silice3D_CalculateLighting(vec3 position,
-                                vec3 normal,
-                                bool recieve_shadows,
-                                vec3 diffuse_color,
-                                vec3 specular_color,
-                                float shininess) {
+vec3 Silice3D_CalculateDirectionalLighting(vec3 position,
+                                           vec3 normal,
+                                           bool recieve_shadows,
+                                           vec3 diffuse_color,
+                                           vec3 specular_color,
+                                           float shininess) {
   vec3 sum_lighting = vec3(0.0);
-  float kAmbientPower = 0.05;
 
-  for (int i = 0; i < min(uDirectionalLightCount, MAX_DIR_LIGHTS); ++i) {
+  for (int i = 0; i < DIRECTIONAL_LIGHT_COUNT; ++i) {
     vec3 light_dir = normalize(uDirectionalLights[i].direction);
 
     float diffuse_power = GetDiffusePower(normal, light_dir);
@@ -82,7 +178,7 @@ vec3 Silice3D_CalculateLighting(vec3 position,
     float shadow_mult = 1.0;
     vec3 light_color = uDirectionalLights[i].color;
 
-    if (recieve_shadows) {
+    if (RECIEVE_SHADOWS(recieve_shadows)) {
       int selected_cascade = 0;
       float morph_alpha = 0.0;
       int cascades_count = uDirectionalLights[i].cascades_count;
@@ -114,17 +210,57 @@ vec3 Silice3D_CalculateLighting(vec3 position,
     sum_lighting += (kAmbientPower*diffuse_color + shadow_mult * (diffuse_power*diffuse_color + specular_power*specular_color)) * light_color;
   }
 
-  for (int i = 0; i < min(uPointLightCount, MAX_POINT_LIGHTS); ++i) {
-    vec3 surface_to_light = uPointLights[i].position-position;
-    vec3 light_dir = normalize(surface_to_light);
+  return sum_lighting;
+}
 
-    float diffuse_power = GetDiffusePower(normal, light_dir);
-    float specular_power = GetSpecularPower(position, normal, light_dir, shininess);
+// The light_index is an index into uPointLights
+vec3 Silice3D_CalculatePointLighting(uint light_index,
+                                     vec3 position,
+                                     vec3 normal,
+                                     bool recieve_shadows,
+                                     vec3 diffuse_color,
+                                     vec3 specular_color,
+                                     float shininess) {
+  PointLightSource light = uPointLights[light_index];
+  vec3 surface_to_light = light.position_range.xyz - position;
+  float distance_from_light = length(surface_to_light);
+  if (distance_from_light >= light.position_range.w) {
+    return vec3(0.0);
+  }
+  vec3 light_dir = surface_to_light / distance_from_light;
 
-    float distance_from_light = length(surface_to_light);
-    float attenuation_mult = 1.0 / dot(uPointLights[i].attenuation, vec3(pow(distance_from_light, 2), distance_from_light, 1));
+  float diffuse_power = GetDiffusePower(normal, light_dir);
+  float specular_power = GetSpecularPower(position, normal, light_dir, shininess);
+
+  float attenuation_mult = 1.0 / dot(light.attenuation.xyz, vec3(pow(distance_from_light, 2), distance_from_light, 1));
+  // Fade out smoothly over the last 15% of the range, instead of having a
+  // visible edge (the light isn't dimmed any closer than that)
+  float range = light.position_range.w;
+  float range_fade = 1.0 - smoothstep(0.85 * range, range, distance_from_light);
+
+  float shadow_mult = 1.0;
+  if (RECIEVE_SHADOWS(recieve_shadows) && light.shadow.x >= 0) {
+    float visibility = GetPointLightVisibility(position, normal, light.position_range.xyz, light.shadow.x);
+    shadow_mult = visibility*0.95 + 0.05;
+  }
+
+  return range_fade * attenuation_mult * ((kAmbientPower + shadow_mult*diffuse_power) * diffuse_color + shadow_mult*specular_power*specular_color) * light.color.rgb;
+}
+
+vec3 Silice3D_CalculateLighting(vec3 position,
+                                vec3 normal,
+                                bool recieve_shadows,
+                                vec3 diffuse_color,
+                                vec3 specular_color,
+                                float shininess) {
+  vec3 sum_lighting = Silice3D_CalculateDirectionalLighting(
+      position, normal, recieve_shadows, diffuse_color, specular_color, shininess);
 
-    sum_lighting += attenuation_mult * ((kAmbientPower + diffuse_power) * diffuse_color + specular_power*specular_color) * uPointLights[i].color;
+  uvec2 cluster_range = GetLightCluster(position);
+  for (uint j = 0; j < cluster_range.y; ++j) {
+    sum_lighting += Silice3D_CalculatePointLighting(
+        uLightIndices[cluster_range.x + j], position, normal, recieve_shadows,
+        diffuse_color, specular_color, shininess);
   }
 
   return sum_lighting;
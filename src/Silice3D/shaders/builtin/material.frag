@@ -0,0 +1,30 @@
+// Copyright (c), Tamas Csala
+
+const char* material_frag_shader_string = R"""(
+
+#version 430 core
+#extension GL_ARB_bindless_texture : require
+
+#export vec3 Silice3D_GetDiffuseColor(uint material_id, vec2 tex_coord);
+#export vec3 Silice3D_GetSpecularColor(uint material_id, vec2 tex_coord);
+
+// Matches MeshRenderer::MeshDataStorage::updateMaterialBuffer
+struct Silice3D_Material {
+  uvec2 diffuse_texture;
+  uvec2 specular_texture;
+};
+
+// binding = MeshRenderer::kMaterialBufferBinding
+layout(std430, binding = 0) readonly buffer Silice3D_MaterialBuffer {
+  Silice3D_Material uMaterials[];
+};
+
+vec3 Silice3D_GetDiffuseColor(uint material_id, vec2 tex_coord) {
+  return texture(sampler2D(uMaterials[material_id].diffuse_texture), tex_coord).rgb;
+}
+
+vec3 Silice3D_GetSpecularColor(uint material_id, vec2 tex_coord) {
+  return texture(sampler2D(uMaterials[material_id].specular_texture), tex_coord).rgb;
+}
+
+)""";
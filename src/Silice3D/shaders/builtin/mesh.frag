@@ -5,20 +5,28 @@ const char* mesh_frag_shader_string = R"""(
 #version 330 core
 
 #include "Silice3D/lighting.frag"
+#include "Silice3D/material.frag"
 #include "Silice3D/post_process.frag"
 #include "Silice3D/bicubic_sampling.glsl"
 
 in vec3 w_vPos;
 in vec3 w_vNormal;
 in vec2 vTexCoord;
+flat in uint vMaterialId;
 
 out vec4 fragColor;
 
-uniform sampler2D uDiffuseTexture;
+// The variants of MeshObjectRenderer define this, the generic program reads
+// it from a uniform
+#ifndef SILICE3D_RECIEVE_SHADOWS
+uniform bool uRecieveShadows;
+#define SILICE3D_RECIEVE_SHADOWS uRecieveShadows
+#endif
 
 void main() {
-  vec3 diffuse_color = texture(uDiffuseTexture, vTexCoord).rgb;
-  vec3 output_color = Silice3D_CalculateLighting(w_vPos, normalize(w_vNormal), false,
+  vec3 diffuse_color = Silice3D_GetDiffuseColor(vMaterialId, vTexCoord);
+  vec3 output_color = Silice3D_CalculateLighting(w_vPos, normalize(w_vNormal),
+                                                 bool(SILICE3D_RECIEVE_SHADOWS),
                                                  diffuse_color, diffuse_color, 16);
   fragColor = vec4(PostProcess(output_color), 1.0);
 }
@@ -4,26 +4,29 @@ const char* mesh_vert_shader_string = R"""(
 
 #version 330 core
 
+#include "Silice3D/camera.glsl"
+#include "Silice3D/instance.glsl"
+
 layout(location = 0) in vec4 aPosition;
 layout(location = 1) in vec2 aTexCoord;
 layout(location = 2) in vec3 aNormal;
 layout(location = 3) in vec3 aTangent;
-layout(location = 4) in mat4 aModelMatrix;
-
-uniform mat4 uProjectionMatrix, uCameraMatrix;
+layout(location = 4) in vec4 aInstanceData[3];
+layout(location = 8) in uint aMaterialId;
 
 out vec3 w_vPos;
 out vec3 w_vNormal;
 out vec2 vTexCoord;
 out vec3 w_vTangent;
+flat out uint vMaterialId;
 
 void main() {
-  mat3 normalMatrix = inverse(mat3(aModelMatrix));
-  w_vNormal = aNormal * normalMatrix;
-  w_vTangent = aTangent * normalMatrix;
+  w_vNormal = Silice3D_TransformNormal(aInstanceData, aNormal);
+  w_vTangent = Silice3D_TransformDirection(aInstanceData, aTangent);
   vTexCoord = aTexCoord;
-  w_vPos = vec3(aModelMatrix * aPosition);
-  gl_Position = uProjectionMatrix * uCameraMatrix * aModelMatrix * aPosition;
+  vMaterialId = aMaterialId;
+  w_vPos = Silice3D_TransformPosition(aInstanceData, aPosition);
+  gl_Position = Silice3D_GetProjectionMatrix() * (Silice3D_GetCameraMatrix() * vec4(w_vPos, 1.0));
 }
 
 )""";
@@ -0,0 +1,29 @@
+// Copyright (c), Tamas Csala
+
+const char* mesh_gbuffer_frag_shader_string = R"""(
+
+#version 330 core
+
+#include "Silice3D/material.frag"
+#include "Silice3D/gbuffer.glsl"
+
+in vec3 w_vPos;
+in vec3 w_vNormal;
+in vec2 vTexCoord;
+flat in uint vMaterialId;
+
+uniform bool uRecieveShadows;
+
+// The attachments of DeferredShading's G-buffer
+layout(location = 0) out vec2 gNormal;
+layout(location = 1) out vec4 gAlbedo;    // a: recieve shadows
+layout(location = 2) out vec4 gSpecular;  // a: shininess / 255
+
+void main() {
+  vec3 diffuse_color = Silice3D_GetDiffuseColor(vMaterialId, vTexCoord);
+  gNormal = Silice3D_EncodeNormal(normalize(w_vNormal));
+  gAlbedo = vec4(diffuse_color, uRecieveShadows ? 1.0 : 0.0);
+  gSpecular = vec4(diffuse_color, 16.0 / 255.0);
+}
+
+)""";
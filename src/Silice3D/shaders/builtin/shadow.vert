@@ -4,13 +4,15 @@ const char* shadow_vert_shader_string = R"""(
 
 #version 330 core
 
-layout(location = 0) in vec4 aPosition;
-layout(location = 4) in mat4 aModelMatrix;
+#include "Silice3D/camera.glsl"
+#include "Silice3D/instance.glsl"
 
-uniform mat4 uProjectionMatrix, uCameraMatrix;
+layout(location = 0) in vec4 aPosition;
+layout(location = 4) in vec4 aInstanceData[3];
 
 void main() {
-  gl_Position = uProjectionMatrix * (uCameraMatrix * (aModelMatrix * aPosition));
+  vec3 w_pos = Silice3D_TransformPosition(aInstanceData, aPosition);
+  gl_Position = Silice3D_GetProjectionMatrix() * (Silice3D_GetCameraMatrix() * vec4(w_pos, 1.0));
 }
 
 )""";
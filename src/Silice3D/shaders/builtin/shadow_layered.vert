@@ -0,0 +1,33 @@
+// Copyright (c), Tamas Csala
+
+const char* shadow_layered_vert_shader_string = R"""(
+
+#version 430 core
+
+// Without the extension the layer is selected by shadow_layered.geom
+#extension GL_ARB_shader_viewport_layer_array : enable
+
+#include "Silice3D/instance.glsl"
+
+// The view-projection matrices of the layers (see ShadowCaster)
+const int kMaxShadowLayers = 8;
+layout(std140) uniform Silice3D_ShadowLayerBlock {
+  mat4 uShadowLayerMatrices[kMaxShadowLayers];
+};
+
+layout(location = 0) in vec4 aPosition;
+layout(location = 4) in vec4 aInstanceData[3];
+layout(location = 7) in uint aInstanceLayer;
+
+flat out uint vLayer;
+
+void main() {
+  vec3 w_pos = Silice3D_TransformPosition(aInstanceData, aPosition);
+  gl_Position = uShadowLayerMatrices[aInstanceLayer] * vec4(w_pos, 1.0);
+  vLayer = aInstanceLayer;
+#ifdef GL_ARB_shader_viewport_layer_array
+  gl_Layer = int(aInstanceLayer);
+#endif
+}
+
+)""";
@@ -0,0 +1,137 @@
+// Copyright (c) Tamas Csala
+
+#include <cstring>
+#include <algorithm>
+
+#include <Silice3D/camera/icamera.hpp>
+#include <Silice3D/lighting/shadow_caster.hpp>
+#include <Silice3D/lighting/directional_light_source.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
+
+namespace Silice3D {
+
+static_assert(sizeof(GLuint64) == sizeof(glm::uvec2), "Expected 32 bit ints");
+
+FrameUniforms::FrameUniforms() {
+  GLint alignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  alignment = std::max(alignment, 1);
+  camera_stride_ = (sizeof(GpuCamera) + alignment - 1) / alignment * alignment;
+
+  std::memset(&light_data_, 0, sizeof(light_data_));
+  gl::Bind(light_buffer_);
+  light_buffer_.data(sizeof(light_data_), &light_data_, gl::kDynamicDraw);
+  gl::Unbind(light_buffer_);
+}
+
+void FrameUniforms::BindBlocks(const gl::Program& program) {
+  GLuint camera_block = glGetUniformBlockIndex(program.expose(), kCameraBlockName);
+  if (camera_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program.expose(), camera_block, kCameraBlockBinding);
+  }
+  GLuint light_block = glGetUniformBlockIndex(program.expose(), kLightBlockName);
+  if (light_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program.expose(), light_block, kLightBlockBinding);
+  }
+  GLuint shadow_layer_block = glGetUniformBlockIndex(program.expose(), kShadowLayerBlockName);
+  if (shadow_layer_block != GL_INVALID_INDEX) {
+    glUniformBlockBinding(program.expose(), shadow_layer_block, kShadowLayerBlockBinding);
+  }
+}
+
+FrameUniforms::GpuCamera FrameUniforms::GetCameraData(const ICamera& camera) {
+  GpuCamera data;
+  data.projection_matrix = camera.GetProjectionMatrix();
+  data.camera_matrix = camera.GetCameraMatrix();
+  data.camera_pos = glm::inverse(data.camera_matrix)[3];
+  return data;
+}
+
+void FrameUniforms::UpdateCameras(const std::vector<const ICamera*>& cameras) {
+  cameras_ = cameras;
+
+  // One more slot for the unknown cameras
+  std::vector<unsigned char> camera_data((cameras.size() + 1) * camera_stride_, 0);
+  for (size_t i = 0; i < cameras.size(); ++i) {
+    GpuCamera data = GetCameraData(*cameras[i]);
+    std::memcpy(&camera_data[i * camera_stride_], &data, sizeof(data));
+  }
+
+  gl::Bind(camera_buffer_);
+  if (camera_data.size() > camera_buffer_size_) {
+    camera_buffer_.data(camera_data.size(), camera_data.data(), gl::kDynamicDraw);
+    camera_buffer_size_ = camera_data.size();
+  } else if (camera_data != camera_data_) {
+    camera_buffer_.subData(0, camera_data.size(), camera_data.data());
+  }
+  gl::Unbind(camera_buffer_);
+
+  camera_data_ = std::move(camera_data);
+  bound_camera_slot_ = -1;
+}
+
+void FrameUniforms::BindCamera(const ICamera& camera) {
+  int slot = std::find(cameras_.begin(), cameras_.end(), &camera) - cameras_.begin();
+  if (slot == int(cameras_.size())) {
+    // Not one of the frame's cameras, so it has to be uploaded now
+    if (camera_buffer_size_ == 0) {
+      UpdateCameras(cameras_);
+    }
+    GpuCamera data = GetCameraData(camera);
+    unsigned char* slot_data = &camera_data_[slot * camera_stride_];
+    if (std::memcmp(slot_data, &data, sizeof(data)) != 0) {
+      std::memcpy(slot_data, &data, sizeof(data));
+      gl::Bind(camera_buffer_);
+      camera_buffer_.subData(slot * camera_stride_, sizeof(data), &data);
+      gl::Unbind(camera_buffer_);
+    }
+  } else if (slot == bound_camera_slot_) {
+    return;
+  }
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, kCameraBlockBinding, camera_buffer_.expose(),
+                    slot * camera_stride_, sizeof(GpuCamera));
+  bound_camera_slot_ = slot;
+}
+
+void FrameUniforms::UpdateLights(const std::set<DirectionalLightSource*>& lights) {
+  GpuLightBlock data;
+  std::memset(&data, 0, sizeof(data));
+
+  size_t light_count = 0;
+  for (DirectionalLightSource* light : lights) {
+    if (light_count >= kMaxDirectionalLightCount) {
+      break;
+    }
+
+    GpuDirectionalLight& gpu_light = data.directional_lights[light_count++];
+    gpu_light.direction = glm::vec4(light->GetTransform().GetPos(), 0.0f);
+    gpu_light.color = glm::vec4(light->GetColor(), 0.0f);
+    ShadowCaster* shadow_caster = light->GetShadowCaster();
+    if (shadow_caster != nullptr) {
+      size_t cascades_count = shadow_caster->GetCascadesCount();
+      if (cascades_count > kMaxCascadesCount) {
+        cascades_count = kMaxCascadesCount;
+      }
+      gpu_light.cascades_count = cascades_count;
+      GLuint64 bindless_handle = shadow_caster->GetShadowTexture().bindless_handle();
+      std::memcpy(&gpu_light.shadow_map_id, &bindless_handle, sizeof(bindless_handle));
+      for (size_t i = 0; i < cascades_count; ++i) {
+        gpu_light.shadow_cp[i] = shadow_caster->GetProjectionMatrix(i) *
+                                 shadow_caster->GetCameraMatrix(i);
+      }
+    }
+  }
+  data.directional_light_count = light_count;
+
+  if (!has_light_data_ || std::memcmp(&data, &light_data_, sizeof(data)) != 0) {
+    light_data_ = data;
+    has_light_data_ = true;
+    gl::Bind(light_buffer_);
+    light_buffer_.subData(0, sizeof(light_data_), &light_data_);
+    gl::Unbind(light_buffer_);
+  }
+  glBindBufferBase(GL_UNIFORM_BUFFER, kLightBlockBinding, light_buffer_.expose());
+}
+
+}  // namespace Silice3D
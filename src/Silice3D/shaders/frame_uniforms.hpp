@@ -0,0 +1,95 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_SHADERS_FRAME_UNIFORMS_HPP_
+#define SILICE3D_SHADERS_FRAME_UNIFORMS_HPP_
+
+#include <set>
+#include <vector>
+
+#include <Silice3D/common/glm.hpp>
+#include <Silice3D/common/oglwrap.hpp>
+
+namespace Silice3D {
+
+class ICamera;
+class DirectionalLightSource;
+
+// The uniforms that are the same for every program in a pass, in std140
+// uniform buffers at fixed binding points: the cameras of the frame (see
+// camera.glsl) and the directional lights (see lighting.frag). They are
+// uploaded once per frame, and only if they changed, instead of being set
+// by name in every program that uses them.
+class FrameUniforms {
+ public:
+  static constexpr GLuint kCameraBlockBinding = 0;
+  static constexpr GLuint kLightBlockBinding = 1;
+  // Not uploaded here, the layered passes bind their own (see ShadowCaster)
+  static constexpr GLuint kShadowLayerBlockBinding = 2;
+  static constexpr const char* kCameraBlockName = "Silice3D_CameraBlock";
+  static constexpr const char* kLightBlockName = "Silice3D_LightBlock";
+  static constexpr const char* kShadowLayerBlockName = "Silice3D_ShadowLayerBlock";
+
+  // These must match lighting.frag
+  static constexpr size_t kMaxDirectionalLightCount = 16;
+  static constexpr size_t kMaxCascadesCount = 4;
+  // This must match shadow_layered.vert
+  static constexpr size_t kMaxShadowLayers = 8;
+
+  FrameUniforms();
+
+  // Connects the program's blocks (if it has any) to their binding points,
+  // ShaderProgram calls it after linking.
+  static void BindBlocks(const gl::Program& program);
+
+  // Uploads the data of the frame's cameras, so BindCamera only has to
+  // select one of them.
+  void UpdateCameras(const std::vector<const ICamera*>& cameras);
+  void UpdateLights(const std::set<DirectionalLightSource*>& lights);
+
+  // Binds the camera's data to kCameraBlockBinding. It's cheap for the
+  // cameras given to UpdateCameras, the others are uploaded on every call.
+  void BindCamera(const ICamera& camera);
+
+ private:
+  // The std140 layout of Silice3D_CameraBlock
+  struct GpuCamera {
+    glm::mat4 projection_matrix;
+    glm::mat4 camera_matrix;
+    glm::vec4 camera_pos;
+  };
+
+  // The std140 layout of Silice3D_LightBlock
+  struct GpuDirectionalLight {
+    glm::vec4 direction;
+    glm::vec4 color;
+    glm::uvec2 shadow_map_id;
+    GLint cascades_count;
+    GLint padding;
+    glm::mat4 shadow_cp[kMaxCascadesCount];
+  };
+
+  struct GpuLightBlock {
+    GLint directional_light_count;
+    GLint padding[3];
+    GpuDirectionalLight directional_lights[kMaxDirectionalLightCount];
+  };
+
+  // The cameras are at multiples of the uniform buffer offset alignment in
+  // camera_buffer_, the last slot is for the cameras that weren't known in advance.
+  size_t camera_stride_ = 0;
+  std::vector<const ICamera*> cameras_;
+  std::vector<unsigned char> camera_data_;
+  gl::ArrayBuffer camera_buffer_;
+  size_t camera_buffer_size_ = 0;
+  int bound_camera_slot_ = -1;
+
+  GpuLightBlock light_data_;
+  gl::ArrayBuffer light_buffer_;
+  bool has_light_data_ = false;
+
+  static GpuCamera GetCameraData(const ICamera& camera);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_SHADERS_FRAME_UNIFORMS_HPP_
@@ -1,5 +1,9 @@
 // Copyright (c) Tamas Csala
 
+#include <iostream>
+#include <algorithm>
+
+#include <Silice3D/common/cache_file.hpp>
 #include <Silice3D/shaders/shader_file.hpp>
 #include <Silice3D/shaders/shader_manager.hpp>
 
@@ -8,20 +12,51 @@ namespace Silice3D {
 ShaderFile::ShaderFile(ShaderManager& shader_manager,
                        std::string filename,
                        const gl::ShaderSource& src,
-                       const ShaderFile* included_from)
-    : gl::Shader(GetShaderType(filename, included_from, &filename)) {
+                       const ShaderFile* included_from,
+                       const ShaderDefines& defines,
+                       bool compile_async)
+    : gl::Shader(GetShaderType(filename, included_from, &filename))
+    , defines_(defines)
+    , is_compiling_(compile_async) {
   std::string src_str = src.source();
+  source_hash_ = CacheFile::HashString(src_str);
   FindIncludes(src_str, shader_manager);
   for (ShaderFile *included : includes_) {
     if (included->state_ == gl::Shader::kCompileFailure) {
       state_ = gl::Shader::kCompileFailure;
+      is_compiling_ = false;
       return;
     }
   }
   FindExports(src_str);
+  InsertDefines(src_str);
   set_source(src_str);
   set_source_file_name(filename);
-  compile();
+  if (is_compiling_) {
+    // Unlike compile(), this doesn't query the result, which would wait for it
+    const char* source = src_str.c_str();
+    glShaderSource(expose(), 1, &source, nullptr);
+    glCompileShader(expose());
+  } else {
+    compile();
+  }
+}
+
+bool ShaderFile::FinishCompiling() {
+  if (is_compiling_) {
+    is_compiling_ = false;
+    GLint status = GL_FALSE;
+    glGetShaderiv(expose(), GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+      GLint log_length = 0;
+      glGetShaderiv(expose(), GL_INFO_LOG_LENGTH, &log_length);
+      std::vector<char> log(std::max(log_length, 1));
+      glGetShaderInfoLog(expose(), log.size(), nullptr, log.data());
+      std::cerr << source_file_name() << " failed to compile:\n" << log.data() << std::endl;
+      state_ = gl::Shader::kCompileFailure;
+    }
+  }
+  return state_ != gl::Shader::kCompileFailure;
 }
 
 void ShaderFile::SetUpdateFunc(std::function<void(const gl::Program&)> func) {
@@ -80,6 +115,34 @@ void ShaderFile::FindIncludes(std::string &src, ShaderManager& shader_manager) {
   }
 }
 
+void ShaderFile::InsertDefines(std::string &src) const {
+  if (defines_.empty()) {
+    return;
+  }
+
+  // The definitions have to be after the #version directive
+  size_t insert_pos = 0;
+  size_t version_pos = src.find("#version");
+  if (version_pos != std::string::npos) {
+    insert_pos = src.find("\n", version_pos);
+    if (insert_pos == std::string::npos) {
+      src += "\n";
+      insert_pos = src.size() - 1;
+    }
+    insert_pos++;
+  }
+
+  std::string definitions;
+  for (const auto& define : defines_) {
+    definitions += "#define " + define.first + " " + define.second + "\n";
+  }
+  // Keep the line numbers of the error messages
+  size_t line = std::count(src.begin(), src.begin() + insert_pos, '\n') + 1;
+  definitions += "#line " + std::to_string(line) + "\n";
+
+  src.insert(insert_pos, definitions);
+}
+
 gl::ShaderType ShaderFile::GetShaderType(const std::string& filename,
                                          const ShaderFile* included_from,
                                          std::string* filename_with_correct_extension /* = nullptr*/) {
@@ -96,6 +159,8 @@ gl::ShaderType ShaderFile::GetShaderType(const std::string& filename,
       return gl::kVertexShader;
     } else if (extension == "geom") {
       return gl::kGeometryShader;
+    } else if (extension == "comp") {
+      return static_cast<gl::ShaderType>(GL_COMPUTE_SHADER);
     } else if (extension == "glsl" && included_from != nullptr) {
       gl::ShaderType type = included_from->shader_type();
 
@@ -103,6 +168,8 @@ gl::ShaderType ShaderFile::GetShaderType(const std::string& filename,
         filename_with_correct_extension->replace(dot_position+1, 4, "frag");
       } else if (type == gl::kVertexShader) {
         filename_with_correct_extension->replace(dot_position+1, 4, "vert");
+      } else if (type == static_cast<gl::ShaderType>(GL_COMPUTE_SHADER)) {
+        filename_with_correct_extension->replace(dot_position+1, 4, "comp");
       } else {
         filename_with_correct_extension->replace(dot_position+1, 4, "geom");
       }
@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
 #include <Silice3D/common/oglwrap.hpp>
 
@@ -18,31 +19,59 @@ namespace Silice3D {
 class ShaderProgram;
 class ShaderManager;
 
+// The preprocessor definitions of a shader variant, by their names. The
+// variants of a shader are compiled separately, and their includes are
+// compiled with the same definitions.
+using ShaderDefines = std::map<std::string, std::string>;
+
 class ShaderFile : public gl::Shader {
  public:
   ShaderFile(ShaderManager& shader_manager,
              std::string filename,
-             const ShaderFile* included_from = nullptr)
-      : ShaderFile(shader_manager, filename,
-                   gl::ShaderSource{filename}, included_from)
-  { }
-
+             const ShaderFile* included_from = nullptr,
+             const ShaderDefines& defines = ShaderDefines{},
+             bool compile_async = false)
+      : ShaderFile(shader_manager, filename, gl::ShaderSource{filename},
+                   included_from, defines, compile_async) {
+    source_path_ = filename;
+  }
+
+  // If compile_async is set, the compilation isn't waited for, and its result
+  // is only checked by FinishCompiling (see ShaderProgram::StartLinking).
   ShaderFile(ShaderManager& shader_manager,
              std::string filename,
              const gl::ShaderSource& src,
-             const ShaderFile* included_from = nullptr);
+             const ShaderFile* included_from = nullptr,
+             const ShaderDefines& defines = ShaderDefines{},
+             bool compile_async = false);
 
   void SetUpdateFunc(std::function<void(const gl::Program&)> func);
 
   void Update(const gl::Program& prog) const;
 
+  // The hash of the source before the preprocessing
+  uint64_t GetSourceHash() const { return source_hash_; }
+  // The file the source was loaded from, empty for the published shaders
+  const std::string& GetSourcePath() const { return source_path_; }
+
+  const ShaderDefines& GetDefines() const { return defines_; }
+
+  // Returns false if the compilation failed. Waits for the compilation if
+  // it's still running.
+  bool FinishCompiling();
+
  private:
   std::function<void(const gl::Program&)> update_func_;
+  uint64_t source_hash_ = 0;
+  std::string source_path_;
+  ShaderDefines defines_;
+  bool is_compiling_ = false;
   std::vector<ShaderFile*> includes_;
   std::string exports_;
 
   void FindExports(std::string &src);
   void FindIncludes(std::string &src, ShaderManager& shader_manager);
+  void InsertDefines(std::string &src) const;
 
   static gl::ShaderType GetShaderType(const std::string& filename,
                                       const ShaderFile* included_from,
@@ -1,108 +1,397 @@
 // Copyright (c) Tamas Csala
 
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <Silice3D/common/cache_file.hpp>
+#include <Silice3D/common/make_unique.hpp>
 #include <Silice3D/shaders/shader_manager.hpp>
 #include <Silice3D/shaders/builtin/bicubic_sampling.glsl>
+#include <Silice3D/shaders/builtin/camera.glsl>
+#include <Silice3D/shaders/builtin/culling.comp>
+#include <Silice3D/shaders/builtin/culling_commands.comp>
 #include <Silice3D/shaders/builtin/debug_shape.frag>
 #include <Silice3D/shaders/builtin/debug_shape.vert>
 #include <Silice3D/shaders/builtin/debug_texture.frag>
 #include <Silice3D/shaders/builtin/debug_texture.vert>
+#include <Silice3D/shaders/builtin/deferred.vert>
+#include <Silice3D/shaders/builtin/deferred_composite.frag>
+#include <Silice3D/shaders/builtin/deferred_directional.frag>
+#include <Silice3D/shaders/builtin/deferred_point.frag>
+#include <Silice3D/shaders/builtin/deferred_point.vert>
+#include <Silice3D/shaders/builtin/gbuffer.glsl>
+#include <Silice3D/shaders/builtin/hi_z.comp>
+#include <Silice3D/shaders/builtin/instance.glsl>
 #include <Silice3D/shaders/builtin/lighting.frag>
+#include <Silice3D/shaders/builtin/material.frag>
 #include <Silice3D/shaders/builtin/mesh.frag>
 #include <Silice3D/shaders/builtin/mesh.vert>
-#include <Silice3D/shaders/builtin/mesh_shadow.frag>
+#include <Silice3D/shaders/builtin/mesh_gbuffer.frag>
 #include <Silice3D/shaders/builtin/post_process.frag>
 #include <Silice3D/shaders/builtin/shadow.frag>
 #include <Silice3D/shaders/builtin/shadow.vert>
+#include <Silice3D/shaders/builtin/shadow_layered.geom>
+#include <Silice3D/shaders/builtin/shadow_layered.vert>
 
 namespace Silice3D {
 
+namespace {
+
+// Bump this if the cache file layout changes.
+constexpr uint32_t kProgramCacheVersion = 1;
+constexpr char kProgramCacheMagic[4] = {'S', '3', 'D', 'P'};
+constexpr uint32_t kMaxStringLength = 4096;
+
+struct ProgramCacheHeader {
+  char magic[4];
+  uint32_t version;
+  GLenum binary_format;
+  uint32_t shader_count;
+  uint32_t binary_size;
+};
+
+std::string ReadString(std::istream& stream) {
+  uint32_t length = 0;
+  stream.read(reinterpret_cast<char*>(&length), sizeof(length));
+  if (length > kMaxStringLength) {
+    stream.setstate(std::ios::failbit);  // a corrupted entry
+  }
+  std::string str(stream ? length : 0, '\0');
+  stream.read(&str[0], str.size());
+  return str;
+}
+
+void WriteString(std::ostream& stream, const std::string& str) {
+  uint32_t length = str.size();
+  stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+  stream.write(str.data(), str.size());
+}
+
+// The key of a shader variant in ShaderManager::shaders_
+std::string GetVariantName(const std::string& shader_name, const ShaderDefines& defines) {
+  std::string name = shader_name;
+  for (const auto& define : defines) {
+    name += '|' + define.first + '=' + define.second;
+  }
+  return name;
+}
+
+}  // namespace
+
 ShaderManager::ShaderManager() {
-  // Publish builtin shaders
-  gl::ShaderSource bicubic_sampling_glsl_shader_source;
-  bicubic_sampling_glsl_shader_source.set_source_file("Silice3D/bicubic_sampling.glsl");
-  bicubic_sampling_glsl_shader_source.set_source(bicubic_sampling_glsl_shader_string);
-  PublishShader("Silice3D/bicubic_sampling.frag", bicubic_sampling_glsl_shader_source);
-  PublishShader("Silice3D/bicubic_sampling.vert", bicubic_sampling_glsl_shader_source);
-
-  gl::ShaderSource debug_shape_frag_shader_source;
-  debug_shape_frag_shader_source.set_source_file("Silice3D/debug_shape.frag");
-  debug_shape_frag_shader_source.set_source(debug_shape_frag_shader_string);
-  PublishShader(debug_shape_frag_shader_source.source_file(), debug_shape_frag_shader_source);
-
-  gl::ShaderSource debug_shape_vert_shader_source;
-  debug_shape_vert_shader_source.set_source_file("Silice3D/debug_shape.vert");
-  debug_shape_vert_shader_source.set_source(debug_shape_vert_shader_string);
-  PublishShader(debug_shape_vert_shader_source.source_file(), debug_shape_vert_shader_source);
-
-  gl::ShaderSource debug_texture_frag_shader_source;
-  debug_texture_frag_shader_source.set_source_file("Silice3D/debug_texture.frag");
-  debug_texture_frag_shader_source.set_source(debug_texture_frag_shader_string);
-  PublishShader(debug_texture_frag_shader_source.source_file(), debug_texture_frag_shader_source);
-
-  gl::ShaderSource debug_texture_vert_shader_source;
-  debug_texture_vert_shader_source.set_source_file("Silice3D/debug_texture.vert");
-  debug_texture_vert_shader_source.set_source(debug_texture_vert_shader_string);
-  PublishShader(debug_texture_vert_shader_source.source_file(), debug_texture_vert_shader_source);
-
-  gl::ShaderSource post_process_frag_shader_source;
-  post_process_frag_shader_source.set_source_file("Silice3D/post_process.frag");
-  post_process_frag_shader_source.set_source(post_process_frag_shader_string);
-  PublishShader(post_process_frag_shader_source.source_file(), post_process_frag_shader_source);
-
-  gl::ShaderSource lighting_frag_shader_source;
-  lighting_frag_shader_source.set_source_file("Silice3D/lighting.frag");
-  lighting_frag_shader_source.set_source(lighting_frag_shader_string);
-  PublishShader(lighting_frag_shader_source.source_file(), lighting_frag_shader_source);
-
-  gl::ShaderSource mesh_frag_shader_source;
-  mesh_frag_shader_source.set_source_file("Silice3D/mesh.frag");
-  mesh_frag_shader_source.set_source(mesh_frag_shader_string);
-  PublishShader(mesh_frag_shader_source.source_file(), mesh_frag_shader_source);
-
-  gl::ShaderSource mesh_vert_shader_source;
-  mesh_vert_shader_source.set_source_file("Silice3D/mesh.vert");
-  mesh_vert_shader_source.set_source(mesh_vert_shader_string);
-  PublishShader(mesh_vert_shader_source.source_file(), mesh_vert_shader_source);
-
-  gl::ShaderSource mesh_shadow_frag_shader_source;
-  mesh_shadow_frag_shader_source.set_source_file("Silice3D/mesh_shadow.frag");
-  mesh_shadow_frag_shader_source.set_source(mesh_shadow_frag_shader_string);
-  PublishShader(mesh_shadow_frag_shader_source.source_file(), mesh_shadow_frag_shader_source);
-
-  gl::ShaderSource shadow_frag_shader_source;
-  shadow_frag_shader_source.set_source_file("Silice3D/shadow.frag");
-  shadow_frag_shader_source.set_source(shadow_frag_shader_string);
-  PublishShader(shadow_frag_shader_source.source_file(), shadow_frag_shader_source);
-
-  gl::ShaderSource shadow_vert_shader_source;
-  shadow_vert_shader_source.set_source_file("Silice3D/shadow.vert");
-  shadow_vert_shader_source.set_source(shadow_vert_shader_string);
-  PublishShader(shadow_vert_shader_source.source_file(), shadow_vert_shader_source);
+  // The builtin shaders are only compiled on their first use
+  AddBuiltinShader("Silice3D/bicubic_sampling.frag", "Silice3D/bicubic_sampling.glsl", bicubic_sampling_glsl_shader_string);
+  AddBuiltinShader("Silice3D/bicubic_sampling.vert", "Silice3D/bicubic_sampling.glsl", bicubic_sampling_glsl_shader_string);
+  AddBuiltinShader("Silice3D/camera.frag", "Silice3D/camera.glsl", camera_glsl_shader_string);
+  AddBuiltinShader("Silice3D/camera.vert", "Silice3D/camera.glsl", camera_glsl_shader_string);
+  AddBuiltinShader("Silice3D/culling.comp", "Silice3D/culling.comp", culling_comp_shader_string);
+  AddBuiltinShader("Silice3D/culling_commands.comp", "Silice3D/culling_commands.comp", culling_commands_comp_shader_string);
+  AddBuiltinShader("Silice3D/debug_shape.frag", "Silice3D/debug_shape.frag", debug_shape_frag_shader_string);
+  AddBuiltinShader("Silice3D/debug_shape.vert", "Silice3D/debug_shape.vert", debug_shape_vert_shader_string);
+  AddBuiltinShader("Silice3D/debug_texture.frag", "Silice3D/debug_texture.frag", debug_texture_frag_shader_string);
+  AddBuiltinShader("Silice3D/debug_texture.vert", "Silice3D/debug_texture.vert", debug_texture_vert_shader_string);
+  AddBuiltinShader("Silice3D/deferred.vert", "Silice3D/deferred.vert", deferred_vert_shader_string);
+  AddBuiltinShader("Silice3D/deferred_composite.frag", "Silice3D/deferred_composite.frag", deferred_composite_frag_shader_string);
+  AddBuiltinShader("Silice3D/deferred_directional.frag", "Silice3D/deferred_directional.frag", deferred_directional_frag_shader_string);
+  AddBuiltinShader("Silice3D/deferred_point.frag", "Silice3D/deferred_point.frag", deferred_point_frag_shader_string);
+  AddBuiltinShader("Silice3D/deferred_point.vert", "Silice3D/deferred_point.vert", deferred_point_vert_shader_string);
+  AddBuiltinShader("Silice3D/gbuffer.frag", "Silice3D/gbuffer.glsl", gbuffer_glsl_shader_string);
+  AddBuiltinShader("Silice3D/gbuffer.vert", "Silice3D/gbuffer.glsl", gbuffer_glsl_shader_string);
+  AddBuiltinShader("Silice3D/hi_z.comp", "Silice3D/hi_z.comp", hi_z_comp_shader_string);
+  AddBuiltinShader("Silice3D/post_process.frag", "Silice3D/post_process.frag", post_process_frag_shader_string);
+  AddBuiltinShader("Silice3D/instance.vert", "Silice3D/instance.glsl", instance_glsl_shader_string);
+  AddBuiltinShader("Silice3D/lighting.frag", "Silice3D/lighting.frag", lighting_frag_shader_string);
+  AddBuiltinShader("Silice3D/material.frag", "Silice3D/material.frag", material_frag_shader_string);
+  AddBuiltinShader("Silice3D/mesh.frag", "Silice3D/mesh.frag", mesh_frag_shader_string);
+  AddBuiltinShader("Silice3D/mesh.vert", "Silice3D/mesh.vert", mesh_vert_shader_string);
+  AddBuiltinShader("Silice3D/mesh_gbuffer.frag", "Silice3D/mesh_gbuffer.frag", mesh_gbuffer_frag_shader_string);
+  AddBuiltinShader("Silice3D/shadow.frag", "Silice3D/shadow.frag", shadow_frag_shader_string);
+  AddBuiltinShader("Silice3D/shadow.vert", "Silice3D/shadow.vert", shadow_vert_shader_string);
+  AddBuiltinShader("Silice3D/shadow_layered.geom", "Silice3D/shadow_layered.geom", shadow_layered_geom_shader_string);
+  AddBuiltinShader("Silice3D/shadow_layered.vert", "Silice3D/shadow_layered.vert", shadow_layered_vert_shader_string);
 }
 
 ShaderFile* ShaderManager::PublishShader(const std::string& filename,
                                          const gl::ShaderSource& src) {
-  return LoadShader(*this, filename, src);
+  ShaderFile* shader = LoadShader(*this, filename, src);
+  published_sources_[shader->source_file_name()] = src.source();
+  return shader;
 }
 
 ShaderFile* ShaderManager::GetShader(const std::string& filename,
                                      const ShaderFile* included_from) {
+  // The includes are the same variant as the shader that includes them
+  if (included_from != nullptr) {
+    return GetShaderVariant(filename, included_from, included_from->GetDefines(),
+                            included_from->is_compiling_);
+  }
+  return GetShaderVariant(filename, nullptr, ShaderDefines{}, false);
+}
+
+ShaderFile* ShaderManager::GetShader(const std::string& filename,
+                                     const ShaderDefines& defines) {
+  return GetShaderVariant(filename, nullptr, defines, false);
+}
+
+ShaderFile* ShaderManager::GetShaderVariant(const std::string& filename,
+                                            const ShaderFile* included_from,
+                                            const ShaderDefines& defines,
+                                            bool compile_async) {
   std::string filename_with_correct_extension;
   ShaderFile::GetShaderType(filename, included_from, &filename_with_correct_extension);
 
-  auto iter = shaders_.find(filename_with_correct_extension);
+  auto iter = shaders_.find(GetVariantName(filename_with_correct_extension, defines));
   if (iter != shaders_.end()) {
     return iter->second.get();
-  } else {
-    ShaderFile* shader = LoadShader(*this, filename, included_from);
-    return shader;
   }
+
+  auto builtin = builtin_shaders_.find(filename_with_correct_extension);
+  if (builtin != builtin_shaders_.end()) {
+    gl::ShaderSource src;
+    src.set_source_file(builtin->second.source_file);
+    src.set_source(builtin->second.source);
+    return LoadShader(*this, filename_with_correct_extension, src,
+                      included_from, defines, compile_async);
+  }
+
+  auto published = published_sources_.find(filename_with_correct_extension);
+  if (published != published_sources_.end()) {
+    gl::ShaderSource src;
+    src.set_source_file(filename_with_correct_extension);
+    src.set_source(published->second);
+    return LoadShader(*this, filename_with_correct_extension, src,
+                      included_from, defines, compile_async);
+  }
+
+  ShaderFile* shader = LoadShader(*this, filename, included_from, defines, compile_async);
+  return shader;
+}
+
+const ShaderFile* ShaderManager::FindShader(const std::string& shader_name,
+                                            const ShaderDefines& defines) const {
+  auto iter = shaders_.find(GetVariantName(shader_name, defines));
+  return iter != shaders_.end() ? iter->second.get() : nullptr;
+}
+
+ShaderProgram* ShaderManager::GetProgram(const std::vector<std::string>& shader_names,
+                                         const ShaderDefines& defines) {
+  ProgramEntry& entry = GetProgramEntry(shader_names, defines, false);
+  if (entry.is_linking) {
+    FinishLinking(&entry);
+  }
+  return entry.program.get();
+}
+
+ShaderProgram* ShaderManager::GetProgramAsync(const std::vector<std::string>& shader_names,
+                                              const ShaderDefines& defines) {
+  if (!SupportsParallelCompile()) {
+    ShaderProgram* program = GetProgram(shader_names, defines);
+    return program->IsLinked() ? program : nullptr;
+  }
+
+  ProgramEntry& entry = GetProgramEntry(shader_names, defines, true);
+  if (entry.is_linking) {
+    if (entry.program->IsLinking()) {
+      return nullptr;
+    }
+    FinishLinking(&entry);
+  }
+  return entry.program->IsLinked() ? entry.program.get() : nullptr;
+}
+
+bool ShaderManager::SupportsParallelCompile() {
+  static bool supported = [] {
+    if (!GLAD_GL_KHR_parallel_shader_compile) {
+      return false;
+    }
+    // Let the driver decide the number of threads
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    return true;
+  }();
+  return supported;
+}
+
+ShaderManager::ProgramEntry& ShaderManager::GetProgramEntry(
+    const std::vector<std::string>& shader_names, const ShaderDefines& defines,
+    bool compile_async) {
+  // The key doesn't depend on the order, or the extensions of the names
+  std::vector<std::string> key;
+  for (const std::string& shader_name : shader_names) {
+    std::string filename_with_correct_extension;
+    ShaderFile::GetShaderType(shader_name, nullptr, &filename_with_correct_extension);
+    key.push_back(filename_with_correct_extension);
+  }
+  std::sort(key.begin(), key.end());
+  key.erase(std::unique(key.begin(), key.end()), key.end());
+
+  auto iter = programs_.find(std::make_pair(key, defines));
+  if (iter != programs_.end()) {
+    return iter->second;
+  }
+
+  ProgramEntry& entry = programs_[std::make_pair(key, defines)];
+  entry.program = make_unique<ShaderProgram>();
+  if (!program_cache_directory_.empty()) {
+    entry.cache_path = GetProgramCachePath(key, defines);
+  }
+  if (entry.cache_path.empty() ||
+      !ReadProgramCache(entry.cache_path, defines, entry.program.get())) {
+    for (const std::string& shader_name : key) {
+      entry.program->AttachShader(GetShaderVariant(shader_name, nullptr, defines, compile_async));
+    }
+    if (compile_async) {
+      entry.program->StartLinking();
+      entry.is_linking = true;
+    } else {
+      entry.program->link();
+      if (!entry.cache_path.empty() && entry.program->IsLinked()) {
+        WriteProgramCache(entry.cache_path, *entry.program);
+      }
+    }
+  }
+  return entry;
+}
+
+void ShaderManager::FinishLinking(ProgramEntry* entry) {
+  entry->is_linking = false;
+  if (entry->program->FinishLinking() && !entry->cache_path.empty()) {
+    WriteProgramCache(entry->cache_path, *entry->program);
+  }
+}
+
+void ShaderManager::AddBuiltinShader(const std::string& shader_name,
+                                     const std::string& source_file,
+                                     const char* source) {
+  builtin_shaders_[shader_name] = BuiltinShader{source_file, source};
+}
+
+uint64_t ShaderManager::GetSourceHash(const std::string& shader_name,
+                                      const std::string& source_path) {
+  auto shader = shaders_.find(shader_name);
+  if (shader != shaders_.end()) {
+    return shader->second->GetSourceHash();
+  }
+
+  auto iter = source_hashes_.find(shader_name);
+  if (iter != source_hashes_.end()) {
+    return iter->second;
+  }
+
+  uint64_t hash = 0;
+  auto builtin = builtin_shaders_.find(shader_name);
+  if (builtin != builtin_shaders_.end()) {
+    hash = CacheFile::HashString(builtin->second.source);
+  } else if (!source_path.empty()) {
+    try {
+      hash = CacheFile::HashString(gl::ShaderSource{source_path}.source());
+    } catch (const std::exception&) {
+      hash = 0;  // the file was removed, the cache entry is invalid
+    }
+  }
+  source_hashes_[shader_name] = hash;
+  return hash;
+}
+
+const std::string& ShaderManager::GetDriverString() {
+  if (driver_string_.empty()) {
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+      const GLubyte* str = glGetString(name);
+      driver_string_ += str != nullptr ? reinterpret_cast<const char*>(str) : "";
+      driver_string_ += '\n';
+    }
+  }
+  return driver_string_;
+}
+
+std::string ShaderManager::GetProgramCachePath(const std::vector<std::string>& shader_names,
+                                               const ShaderDefines& defines) {
+  // The drivers without binary formats can't cache anything
+  GLint format_count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  if (format_count == 0) {
+    return "";
+  }
+
+  // The sources aren't part of the key, only of the entry, so they can be
+  // checked without preprocessing the includes
+  std::string key = std::to_string(kProgramCacheVersion) + '\n' + GetDriverString();
+  for (const std::string& shader_name : shader_names) {
+    key += shader_name + '\n';
+  }
+  for (const auto& define : defines) {
+    key += "#define " + define.first + ' ' + define.second + '\n';
+  }
+
+  return CacheFile::GetPath(program_cache_directory_, CacheFile::HashString(key), ".s3dprog");
+}
+
+// The cache file contains the shaders the program was linked from (with the
+// includes), and the hashes of their sources, then the binary itself.
+bool ShaderManager::ReadProgramCache(const std::string& cache_path, const ShaderDefines& defines,
+                                     ShaderProgram* program) {
+  std::ifstream file(cache_path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  ProgramCacheHeader header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!file || !std::equal(header.magic, header.magic + 4, kProgramCacheMagic) ||
+      header.version != kProgramCacheVersion) {
+    return false;
+  }
+
+  std::vector<std::string> shader_names;
+  for (uint32_t i = 0; i < header.shader_count; ++i) {
+    std::string shader_name = ReadString(file), source_path = ReadString(file);
+    uint64_t source_hash = 0;
+    file.read(reinterpret_cast<char*>(&source_hash), sizeof(source_hash));
+    if (!file || source_hash == 0 || GetSourceHash(shader_name, source_path) != source_hash) {
+      return false;
+    }
+    shader_names.push_back(shader_name);
+  }
+
+  std::vector<char> binary(header.binary_size);
+  file.read(binary.data(), binary.size());
+  if (!file || !program->LoadBinary(header.binary_format, binary)) {
+    return false;
+  }
+
+  program->SetCachedShaders(this, shader_names, defines);
+  return true;
+}
+
+void ShaderManager::WriteProgramCache(const std::string& cache_path,
+                                      const ShaderProgram& program) {
+  ProgramCacheHeader header;
+  std::vector<char> binary;
+  if (!program.GetBinary(&header.binary_format, &binary)) {
+    return;
+  }
+  std::copy(kProgramCacheMagic, kProgramCacheMagic + 4, header.magic);
+  header.version = kProgramCacheVersion;
+  header.shader_count = program.GetShaders().size();
+  header.binary_size = binary.size();
+
+  CacheFile::WriteAtomically(cache_path, [&](std::ostream& file) {
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const ShaderFile* shader : program.GetShaders()) {
+      WriteString(file, shader->source_file_name());
+      WriteString(file, shader->GetSourcePath());
+      uint64_t source_hash = shader->GetSourceHash();
+      file.write(reinterpret_cast<const char*>(&source_hash), sizeof(source_hash));
+    }
+    file.write(binary.data(), binary.size());
+  });
 }
 
 template<typename... Args>
 ShaderFile* ShaderManager::LoadShader(Args&&... args) {
   auto shader = new ShaderFile{std::forward<Args>(args)...};
-  shaders_[shader->source_file_name()] = std::unique_ptr<ShaderFile>{shader};
+  shaders_[GetVariantName(shader->source_file_name(), shader->GetDefines())] =
+      std::unique_ptr<ShaderFile>{shader};
   return shader;
 }
 
@@ -3,6 +3,13 @@
 #ifndef SILICE3D_SHADERS_SHADER_MANAGER_HPP_
 #define SILICE3D_SHADERS_SHADER_MANAGER_HPP_
 
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <utility>
+
 #include <Silice3D/shaders/shader_file.hpp>
 #include <Silice3D/shaders/shader_program.hpp>
 
@@ -18,13 +25,105 @@ class ShaderManager {
 
   // Retrieves the shader that was published with the given name,
   // or if there was no such shader, tries to load it from file.
+  // The builtin shaders are compiled on their first use.
   ShaderFile* GetShader(const std::string& shader_name,
                         const ShaderFile* included_from = nullptr);
+
+  // Retrieves the variant of the shader, that is compiled with the given
+  // #defines after its #version line (see ShaderDefines).
+  ShaderFile* GetShader(const std::string& shader_name, const ShaderDefines& defines);
+
+  // Returns the program linked from the given shaders (and their includes).
+  // The programs are shared, the same set of shaders always returns the same
+  // program, so the users mustn't relink it, and should only set the
+  // uniforms that they use right before their draw calls.
+  //
+  // If the program cache is enabled, the binaries of the linked programs are
+  // stored there, keyed by the shaders' sources and the driver, and a cached
+  // binary is loaded without preprocessing or compiling any of the shaders.
+  // The cached programs still call the update functions of their shaders
+  // (see ShaderFile::SetUpdateFunc), once the shaders are loaded by GetShader.
+  //
+  // The defines select a variant of the program, every shader (and include)
+  // of it is compiled with them. The variants let the shaders decide the
+  // features that are constant for a draw call at compile time, instead of
+  // branching on them at runtime.
+  ShaderProgram* GetProgram(const std::vector<std::string>& shader_names,
+                            const ShaderDefines& defines = ShaderDefines{});
+
+  // Like GetProgram, but if the driver compiles in the background
+  // (GL_KHR_parallel_shader_compile), it never waits for the compilation:
+  // it returns nullptr until the program is ready (or if it failed), and the
+  // caller should use a more generic variant until then. Without the
+  // extension, the program is compiled on the first call, like by GetProgram.
+  ShaderProgram* GetProgramAsync(const std::vector<std::string>& shader_names,
+                                 const ShaderDefines& defines = ShaderDefines{});
+
+  // Starts compiling a variant that will be needed later, so that it might
+  // be ready by the first GetProgramAsync call.
+  void PrecompileProgram(const std::vector<std::string>& shader_names,
+                         const ShaderDefines& defines = ShaderDefines{}) {
+    GetProgramAsync(shader_names, defines);
+  }
+
+  // Returns the variant of the shader if it's loaded already, without loading it.
+  const ShaderFile* FindShader(const std::string& shader_name, const ShaderDefines& defines) const;
+  size_t GetShaderCount() const { return shaders_.size(); }
+
+  // Whether the driver can compile the shaders on its own threads. Lets it
+  // use as many threads as it wants on the first call.
+  static bool SupportsParallelCompile();
+
+  // The directory has to exist. An empty string disables the cache.
+  void SetProgramCacheDirectory(const std::string& directory) { program_cache_directory_ = directory; }
+  const std::string& GetProgramCacheDirectory() const { return program_cache_directory_; }
+
  private:
+  struct BuiltinShader {
+    std::string source_file;
+    const char* source;
+  };
+
+  struct ProgramEntry {
+    std::unique_ptr<ShaderProgram> program;
+    std::string cache_path;
+    // Compiled and linked in the background, and not checked yet
+    bool is_linking = false;
+  };
+
+  // The variants are stored with their defines appended to their names
   std::map<std::string, std::unique_ptr<ShaderFile>> shaders_;
+  // The builtin shaders that aren't compiled yet, by their published names
+  std::map<std::string, BuiltinShader> builtin_shaders_;
+  // The sources of the published shaders, for their variants
+  std::map<std::string, std::string> published_sources_;
+  std::map<std::pair<std::vector<std::string>, ShaderDefines>, ProgramEntry> programs_;
+
+  std::string program_cache_directory_;
+  // The hashes of the sources, that the cached programs were checked against
+  std::map<std::string, uint64_t> source_hashes_;
+  std::string driver_string_;
 
   template<typename... Args>
   ShaderFile* LoadShader(Args&&... args);
+
+  ShaderFile* GetShaderVariant(const std::string& shader_name, const ShaderFile* included_from,
+                               const ShaderDefines& defines, bool compile_async);
+  ProgramEntry& GetProgramEntry(const std::vector<std::string>& shader_names,
+                                const ShaderDefines& defines, bool compile_async);
+  void FinishLinking(ProgramEntry* entry);
+
+  void AddBuiltinShader(const std::string& shader_name, const std::string& source_file,
+                        const char* source);
+
+  // Returns 0 if the source isn't available
+  uint64_t GetSourceHash(const std::string& shader_name, const std::string& source_path);
+  const std::string& GetDriverString();
+  std::string GetProgramCachePath(const std::vector<std::string>& shader_names,
+                                  const ShaderDefines& defines);
+  bool ReadProgramCache(const std::string& cache_path, const ShaderDefines& defines,
+                        ShaderProgram* program);
+  void WriteProgramCache(const std::string& cache_path, const ShaderProgram& program);
 };
 
 }  // namespace Silice3D
@@ -1,6 +1,12 @@
 // Copyright (c) Tamas Csala
 
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
 #include <Silice3D/shaders/shader_program.hpp>
+#include <Silice3D/shaders/shader_manager.hpp>
+#include <Silice3D/shaders/frame_uniforms.hpp>
 
 namespace Silice3D {
 
@@ -8,6 +14,32 @@ void ShaderProgram::Update() const {
   for (auto shader : shaders_) {
     shader->Update(*this);
   }
+
+  if (shader_manager_ != nullptr) {
+    if (looked_up_shader_count_ != shader_manager_->GetShaderCount()) {
+      looked_up_shader_count_ = shader_manager_->GetShaderCount();
+      cached_shaders_.clear();
+      for (const std::string& shader_name : cached_shader_names_) {
+        const ShaderFile* shader = shader_manager_->FindShader(shader_name, cached_shader_defines_);
+        if (shader != nullptr) {
+          cached_shaders_.push_back(shader);
+        }
+      }
+    }
+    for (const ShaderFile* shader : cached_shaders_) {
+      shader->Update(*this);
+    }
+  }
+}
+
+void ShaderProgram::SetCachedShaders(const ShaderManager* shader_manager,
+                                     const std::vector<std::string>& shader_names,
+                                     const ShaderDefines& defines) {
+  shader_manager_ = shader_manager;
+  cached_shader_names_ = shader_names;
+  cached_shader_defines_ = defines;
+  cached_shaders_.clear();
+  looked_up_shader_count_ = 0;
 }
 
 // Depth First Search for all the included files, recursively
@@ -25,9 +57,80 @@ const gl::Program& ShaderProgram::link() {
     const gl::Shader& shader = *shader_file;
     gl::Program::attachShader(shader);
   }
+  // For the program cache of ShaderManager
+  glProgramParameteri(expose(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   gl::Program::link();
+  FrameUniforms::BindBlocks(*this);
 
   return *this;
 }
 
+void ShaderProgram::StartLinking() {
+  for (auto shader_file : shaders_) {
+    glAttachShader(expose(), shader_file->expose());
+  }
+  glProgramParameteri(expose(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(expose());
+}
+
+bool ShaderProgram::IsLinking() const {
+  GLint completed = GL_TRUE;
+  glGetProgramiv(expose(), GL_COMPLETION_STATUS_KHR, &completed);
+  return completed == GL_FALSE;
+}
+
+bool ShaderProgram::FinishLinking() {
+  // The failed shaders report their own errors
+  bool shaders_compiled = true;
+  for (auto shader_file : shaders_) {
+    shaders_compiled = shader_file->FinishCompiling() && shaders_compiled;
+  }
+
+  if (!IsLinked()) {
+    if (shaders_compiled) {
+      GLint log_length = 0;
+      glGetProgramiv(expose(), GL_INFO_LOG_LENGTH, &log_length);
+      std::vector<char> log(std::max(log_length, 1));
+      glGetProgramInfoLog(expose(), log.size(), nullptr, log.data());
+      std::cerr << "Failed to link a program:\n" << log.data() << std::endl;
+    }
+    return false;
+  }
+
+  FrameUniforms::BindBlocks(*this);
+  return true;
+}
+
+bool ShaderProgram::IsLinked() const {
+  GLint link_status = GL_FALSE;
+  glGetProgramiv(expose(), GL_LINK_STATUS, &link_status);
+  return link_status == GL_TRUE;
+}
+
+bool ShaderProgram::GetBinary(GLenum* format, std::vector<char>* binary) const {
+  GLint length = 0;
+  if (IsLinked()) {
+    glGetProgramiv(expose(), GL_PROGRAM_BINARY_LENGTH, &length);
+  }
+  if (length <= 0) {
+    return false;
+  }
+
+  binary->resize(length);
+  GLsizei written_length = 0;
+  glGetProgramBinary(expose(), length, &written_length, format, binary->data());
+  binary->resize(written_length);
+  return written_length > 0;
+}
+
+bool ShaderProgram::LoadBinary(GLenum format, const std::vector<char>& binary) {
+  glProgramBinary(expose(), format, binary.data(), binary.size());
+  if (!IsLinked()) {
+    return false;
+  }
+  // The block bindings aren't part of the binary
+  FrameUniforms::BindBlocks(*this);
+  return true;
+}
+
 }  // namespace Silice3D
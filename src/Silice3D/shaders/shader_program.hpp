@@ -3,14 +3,22 @@
 #ifndef SILICE3D_SHADERS_SHADER_PROGRAM_HPP_
 #define SILICE3D_SHADERS_SHADER_PROGRAM_HPP_
 
+#include <string>
+#include <vector>
+
 #include <Silice3D/shaders/shader_file.hpp>
 
 namespace Silice3D {
 
+class ShaderManager;
+
 class ShaderProgram : public gl::Program {
  public:
   //using gl::Program::Program;
 
+  // An empty program, that has to be linked, or loaded with LoadBinary
+  ShaderProgram() = default;
+
   template <typename... Shaders>
   explicit ShaderProgram(ShaderFile *shader, Shaders&&... shaders) {
     AttachShaders(shader, shaders...);
@@ -30,8 +38,44 @@ class ShaderProgram : public gl::Program {
 
   virtual const Program& link() override;
 
+  // Links without waiting for the attached shaders or the result, if the
+  // driver compiles in the background (see ShaderManager::GetProgramAsync).
+  // The program can only be used after IsLinking() returned false, and
+  // FinishLinking() was called.
+  void StartLinking();
+  bool IsLinking() const;
+  // Returns false if a shader or the program failed. Waits for the linking
+  // if it's still running.
+  bool FinishLinking();
+
+  // The binary of the linked program, that LoadBinary accepts with the same
+  // driver. Returns false if it isn't available.
+  bool GetBinary(GLenum* format, std::vector<char>* binary) const;
+  // Returns false if the driver rejected the binary.
+  bool LoadBinary(GLenum format, const std::vector<char>& binary);
+
+  bool IsLinked() const;
+
+  // The attached shaders, with their includes
+  const std::set<ShaderFile*>& GetShaders() const { return shaders_; }
+
+  // For the programs loaded from a binary: the shaders (with their includes)
+  // that it was linked from, which aren't attached, but their update
+  // functions are called by Update, if they are loaded.
+  void SetCachedShaders(const ShaderManager* shader_manager,
+                        const std::vector<std::string>& shader_names,
+                        const ShaderDefines& defines);
+
  private:
   std::set<ShaderFile*> shaders_;
+
+  const ShaderManager* shader_manager_ = nullptr;
+  std::vector<std::string> cached_shader_names_;
+  ShaderDefines cached_shader_defines_;
+  // The loaded ones of the cached shaders, they are only looked up again,
+  // when the manager loaded a new shader
+  mutable std::vector<const ShaderFile*> cached_shaders_;
+  mutable size_t looked_up_shader_count_ = 0;
 };
 
 }  // namespace Silice3D
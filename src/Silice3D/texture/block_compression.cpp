@@ -0,0 +1,192 @@
+// Copyright (c) Tamas Csala
+
+#include <cstdlib>
+#include <algorithm>
+#include <Silice3D/texture/block_compression.hpp>
+
+namespace Silice3D {
+namespace BlockCompression {
+
+// The encoders are based on J.M.P. van Waveren's "Real-Time DXT Compression":
+// the endpoints are the corners of the block's color bounding box (inset a
+// bit), and every pixel gets the nearest color of the resulting palette.
+
+namespace {
+
+using Block = unsigned char[16][4];
+
+unsigned BlockCount(unsigned size) {
+  return (size + 3) / 4;
+}
+
+void ExtractBlock(const unsigned char* rgba, unsigned width, unsigned height,
+                  unsigned block_x, unsigned block_y, Block block) {
+  for (unsigned y = 0; y < 4; ++y) {
+    unsigned src_y = std::min(block_y*4 + y, height - 1);
+    for (unsigned x = 0; x < 4; ++x) {
+      unsigned src_x = std::min(block_x*4 + x, width - 1);
+      const unsigned char* pixel = rgba + 4 * (src_y*width + src_x);
+      std::copy(pixel, pixel + 4, block[y*4 + x]);
+    }
+  }
+}
+
+unsigned short ToRGB565(const unsigned char* color) {
+  return ((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3);
+}
+
+void FromRGB565(unsigned short c, unsigned char* color) {
+  unsigned char r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+int ColorDistance(const unsigned char* a, const unsigned char* b) {
+  int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+  return dr*dr + dg*dg + db*db;
+}
+
+void EncodeColorBlock(const Block block, unsigned char* out) {
+  unsigned char mins[3] = {255, 255, 255}, maxes[3] = {0, 0, 0};
+  for (int i = 0; i < 16; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      mins[c] = std::min(mins[c], block[i][c]);
+      maxes[c] = std::max(maxes[c], block[i][c]);
+    }
+  }
+
+  // Inset the bounding box by 1/16th of its size, which reduces the error
+  // for the pixels that are in the middle of the range.
+  for (int c = 0; c < 3; ++c) {
+    int inset = (maxes[c] - mins[c]) >> 4;
+    mins[c] = std::min(mins[c] + inset, 255);
+    maxes[c] = std::max(maxes[c] - inset, 0);
+  }
+
+  unsigned short c0 = ToRGB565(maxes), c1 = ToRGB565(mins);
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+
+  out[0] = c0 & 0xFF;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xFF;
+  out[3] = c1 >> 8;
+
+  unsigned indices = 0;
+  if (c0 != c1) {
+    unsigned char palette[4][3];
+    FromRGB565(c0, palette[0]);
+    FromRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+      palette[2][c] = (2*palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2*palette[1][c]) / 3;
+    }
+
+    for (int i = 0; i < 16; ++i) {
+      unsigned best_index = 0;
+      int best_dist = ColorDistance(block[i], palette[0]);
+      for (unsigned p = 1; p < 4; ++p) {
+        int dist = ColorDistance(block[i], palette[p]);
+        if (dist < best_dist) {
+          best_dist = dist;
+          best_index = p;
+        }
+      }
+      indices |= best_index << (2*i);
+    }
+  }
+
+  out[4] = indices & 0xFF;
+  out[5] = (indices >> 8) & 0xFF;
+  out[6] = (indices >> 16) & 0xFF;
+  out[7] = indices >> 24;
+}
+
+void EncodeAlphaBlock(const Block block, unsigned char* out) {
+  unsigned char min_alpha = 255, max_alpha = 0;
+  for (int i = 0; i < 16; ++i) {
+    min_alpha = std::min(min_alpha, block[i][3]);
+    max_alpha = std::max(max_alpha, block[i][3]);
+  }
+
+  out[0] = max_alpha;
+  out[1] = min_alpha;
+
+  // With a0 > a1 the palette is 8 alphas interpolated between the endpoints.
+  unsigned long long indices = 0;
+  if (max_alpha != min_alpha) {
+    int palette[8];
+    palette[0] = max_alpha;
+    palette[1] = min_alpha;
+    for (int p = 1; p < 7; ++p) {
+      palette[p+1] = ((7-p)*max_alpha + p*min_alpha) / 7;
+    }
+
+    for (int i = 0; i < 16; ++i) {
+      unsigned long long best_index = 0;
+      int best_dist = 256;
+      for (unsigned p = 0; p < 8; ++p) {
+        int dist = std::abs(block[i][3] - palette[p]);
+        if (dist < best_dist) {
+          best_dist = dist;
+          best_index = p;
+        }
+      }
+      indices |= best_index << (3*i);
+    }
+  }
+
+  for (int b = 0; b < 6; ++b) {
+    out[2 + b] = (indices >> (8*b)) & 0xFF;
+  }
+}
+
+template<size_t kBlockSize, typename Encoder>
+std::vector<unsigned char> Compress(const unsigned char* rgba,
+                                    unsigned width, unsigned height,
+                                    Encoder encode) {
+  unsigned blocks_x = BlockCount(width), blocks_y = BlockCount(height);
+  std::vector<unsigned char> result(blocks_x * blocks_y * kBlockSize);
+
+  Block block;
+  unsigned char* out = result.data();
+  for (unsigned y = 0; y < blocks_y; ++y) {
+    for (unsigned x = 0; x < blocks_x; ++x) {
+      ExtractBlock(rgba, width, height, x, y, block);
+      encode(block, out);
+      out += kBlockSize;
+    }
+  }
+
+  return result;
+}
+
+}  // namespace
+
+size_t GetBC1Size(unsigned width, unsigned height) {
+  return BlockCount(width) * BlockCount(height) * 8;
+}
+
+size_t GetBC3Size(unsigned width, unsigned height) {
+  return BlockCount(width) * BlockCount(height) * 16;
+}
+
+std::vector<unsigned char> CompressBC1(const unsigned char* rgba,
+                                       unsigned width, unsigned height) {
+  return Compress<8>(rgba, width, height, [](const Block block, unsigned char* out) {
+    EncodeColorBlock(block, out);
+  });
+}
+
+std::vector<unsigned char> CompressBC3(const unsigned char* rgba,
+                                       unsigned width, unsigned height) {
+  return Compress<16>(rgba, width, height, [](const Block block, unsigned char* out) {
+    EncodeAlphaBlock(block, out);
+    EncodeColorBlock(block, out + 8);
+  });
+}
+
+}  // namespace BlockCompression
+}  // namespace Silice3D
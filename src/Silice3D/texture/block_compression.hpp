@@ -0,0 +1,32 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_TEXTURE_BLOCK_COMPRESSION_HPP_
+#define SILICE3D_TEXTURE_BLOCK_COMPRESSION_HPP_
+
+#include <vector>
+#include <cstddef>
+
+namespace Silice3D {
+
+// CPU encoders for the S3TC block formats. They take tightly packed 8 bit
+// RGBA images, and produce the block data in the layout expected by
+// glCompressedTexImage2D. The images don't have to be a multiple of 4 in
+// size, the edge pixels are repeated to fill the partial blocks.
+namespace BlockCompression {
+
+// Returns the size of a compressed image in bytes.
+size_t GetBC1Size(unsigned width, unsigned height);
+size_t GetBC3Size(unsigned width, unsigned height);
+
+// BC1 (DXT1): 4 bits per pixel, opaque color only.
+std::vector<unsigned char> CompressBC1(const unsigned char* rgba,
+                                       unsigned width, unsigned height);
+
+// BC3 (DXT5): 8 bits per pixel, color + interpolated alpha.
+std::vector<unsigned char> CompressBC3(const unsigned char* rgba,
+                                       unsigned width, unsigned height);
+
+}  // namespace BlockCompression
+}  // namespace Silice3D
+
+#endif  // SILICE3D_TEXTURE_BLOCK_COMPRESSION_HPP_
@@ -0,0 +1,413 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <lodepng.h>
+
+#include <Silice3D/common/cache_file.hpp>
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/texture/block_compression.hpp>
+#include <Silice3D/texture/texture_manager.hpp>
+
+namespace Silice3D {
+
+namespace {
+
+// Bump this if the cache file layout or the mipmap generation changes.
+constexpr uint32_t kCacheVersion = 1;
+constexpr char kCacheMagic[4] = {'S', '3', 'D', 'T'};
+
+std::string GetCachePath(const std::string& directory,
+                         const std::vector<unsigned char>& file_content,
+                         bool srgb, TextureCompression compression) {
+  unsigned char format[] = {static_cast<unsigned char>(kCacheVersion),
+                            static_cast<unsigned char>(srgb),
+                            static_cast<unsigned char>(compression)};
+  uint64_t hash = CacheFile::HashBytes(format, sizeof(format));
+  hash = CacheFile::HashBytes(file_content.data(), file_content.size(), hash);
+  return CacheFile::GetPath(directory, hash, ".s3dtex");
+}
+
+float SrgbToLinear(float value) {
+  return value <= 0.04045f ? value / 12.92f
+                           : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float LinearToSrgb(float value) {
+  return value <= 0.0031308f ? value * 12.92f
+                             : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+}  // namespace
+
+TextureManager::TextureManager(ThreadPool* thread_pool)
+    : thread_pool_(thread_pool) {
+  glm::vec4 placeholder_color{0.5f, 0.5f, 0.5f, 1.0f};
+  gl::Bind(placeholder_texture_);
+  placeholder_texture_.upload(gl::kRgba32F, 1, 1, gl::kRgba, gl::kFloat, &placeholder_color.r);
+  placeholder_texture_.minFilter(gl::kNearest);
+  placeholder_texture_.magFilter(gl::kNearest);
+  gl::Unbind(placeholder_texture_);
+  placeholder_handle_ = MakeResident(&placeholder_texture_);
+}
+
+TextureManager::~TextureManager() {
+  // The workers reference the entries, they must finish before those die.
+  std::unique_lock<std::mutex> lock(mutex_);
+  entry_ready_.wait(lock, [this] { return in_flight_count_ == 0; });
+}
+
+void TextureManager::SetCacheDirectory(const std::string& directory) {
+  cache_directory_ = directory;
+  while (!cache_directory_.empty() && cache_directory_.back() == '/') {
+    cache_directory_.pop_back();
+  }
+}
+
+gl::Texture2D* TextureManager::GetTexture(const std::string& path, bool srgb) {
+  auto key = std::make_pair(path, srgb);
+  auto iter = textures_.find(key);
+  if (iter != textures_.end()) {
+    return &iter->second->texture;
+  }
+
+  TextureEntry* entry = new TextureEntry{};
+  textures_[key] = std::unique_ptr<TextureEntry>{entry};
+  entry_for_texture_[&entry->texture] = entry;
+  entry->path = path;
+  entry->srgb = srgb;
+  entry->compression = compression_;
+  entry->cache_directory = cache_directory_;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_count_++;
+    pending_count_++;
+  }
+  thread_pool_->Enqueue(0, [this, entry] { Load(entry); });
+
+  return &entry->texture;
+}
+
+gl::Texture2D* TextureManager::GetColorTexture(const glm::vec4& color) {
+  for (auto& pair : color_textures_) {
+    if (pair.first == color) {
+      return pair.second.get();
+    }
+  }
+
+  auto texture = make_unique<gl::Texture2D>();
+  gl::Bind(*texture);
+  texture->upload(gl::kRgba32F, 1, 1, gl::kRgba, gl::kFloat, &color.r);
+  texture->minFilter(gl::kNearest);
+  texture->magFilter(gl::kNearest);
+  gl::Unbind(*texture);
+  MakeResident(texture.get());
+
+  gl::Texture2D* result = texture.get();
+  color_textures_.emplace_back(color, std::move(texture));
+  return result;
+}
+
+bool TextureManager::IsLoaded(const gl::Texture2D* texture) const {
+  auto iter = entry_for_texture_.find(texture);
+  if (iter == entry_for_texture_.end()) {
+    return true;  // color textures are always loaded
+  }
+  return iter->second->loaded;
+}
+
+GLuint64 TextureManager::GetBindlessHandle(const gl::Texture2D* texture) const {
+  auto iter = bindless_handles_.find(texture);
+  if (iter == bindless_handles_.end()) {
+    return placeholder_handle_;
+  }
+  return iter->second;
+}
+
+GLuint64 TextureManager::MakeResident(gl::Texture2D* texture) {
+  // The texture's content and parameters are immutable from here on.
+  GLuint64 handle = glGetTextureHandleARB(texture->expose());
+  glMakeTextureHandleResidentARB(handle);
+  bindless_handles_[texture] = handle;
+  return handle;
+}
+
+size_t TextureManager::GetPendingCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_count_;
+}
+
+size_t TextureManager::Update(size_t upload_budget) {
+  size_t upload_count = 0;
+  while (upload_budget == 0 || upload_count < upload_budget) {
+    TextureEntry* entry = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (ready_queue_.empty()) {
+        break;
+      }
+      entry = ready_queue_.front();
+      ready_queue_.pop_front();
+    }
+
+    Upload(entry);
+    upload_count++;
+    upload_count_++;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_count_--;
+  }
+
+  return upload_count;
+}
+
+void TextureManager::WaitForAll() {
+  while (true) {
+    Update(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (pending_count_ == 0) {
+      return;
+    }
+    entry_ready_.wait(lock, [this] { return !ready_queue_.empty(); });
+  }
+}
+
+// Runs on a worker thread
+void TextureManager::Load(TextureEntry* entry) {
+  std::vector<unsigned char> file_content;
+  unsigned error = lodepng::load_file(file_content, entry->path);
+  if (error || file_content.empty()) {
+    std::cerr << "Couldn't read image file '" << entry->path << "'" << std::endl;
+    entry->failed = true;
+  } else {
+    if (!entry->cache_directory.empty()) {
+      entry->cache_path = GetCachePath(entry->cache_directory, file_content,
+                                       entry->srgb, entry->compression);
+    }
+
+    if (!entry->cache_path.empty() && ReadCache(entry->cache_path, &entry->levels)) {
+      entry->compressed_data = entry->compression != TextureCompression::kNone;
+    } else {
+      MipLevel base_level;
+      error = lodepng::decode(base_level.data, base_level.width, base_level.height,
+                              file_content, LCT_RGBA, 8);
+      if (error) {
+        std::cerr << "Image decoder error " << error << " in '" << entry->path
+                  << "': " << lodepng_error_text(error) << std::endl;
+        entry->failed = true;
+      } else {
+        entry->levels.push_back(std::move(base_level));
+        GenerateMipChain(entry->srgb, &entry->levels);
+
+        // BC7 is compressed by the driver during the upload, and the
+        // result is read back from the GL thread for the cache.
+        if (entry->compression == TextureCompression::kBC1 ||
+            entry->compression == TextureCompression::kBC3) {
+          CompressMipChain(entry->compression, &entry->levels);
+          entry->compressed_data = true;
+        }
+
+        if (!entry->cache_path.empty()) {
+          if (entry->compression == TextureCompression::kBC7) {
+            entry->should_write_cache = true;
+          } else {
+            WriteCache(entry->cache_path, entry->levels);
+          }
+        }
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ready_queue_.push_back(entry);
+  in_flight_count_--;
+  entry_ready_.notify_all();
+}
+
+void TextureManager::Upload(TextureEntry* entry) {
+  entry->loaded = true;
+  if (entry->failed) {
+    return;  // keep using the placeholder
+  }
+
+  GLenum internal_format = GetInternalFormat(entry->compression, entry->srgb);
+  GLint level_count = entry->levels.size();
+
+  gl::Bind(entry->texture);
+  for (GLint level = 0; level < level_count; ++level) {
+    const MipLevel& mip = entry->levels[level];
+    if (entry->compressed_data) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format,
+                             mip.width, mip.height, 0, mip.data.size(),
+                             mip.data.data());
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, level, internal_format, mip.width, mip.height,
+                   0, GL_RGBA, GL_UNSIGNED_BYTE, mip.data.data());
+    }
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+  entry->texture.minFilter(gl::kLinearMipmapLinear);
+  entry->texture.magFilter(gl::kLinear);
+  entry->texture.maxAnisotropy();
+
+  if (entry->should_write_cache) {
+    // Read back what the driver compressed
+    for (GLint level = 0; level < level_count; ++level) {
+      GLint compressed_size = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, level,
+                               GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressed_size);
+      entry->levels[level].data.resize(compressed_size);
+      glGetCompressedTexImage(GL_TEXTURE_2D, level, entry->levels[level].data.data());
+    }
+    WriteCacheAsync(entry);
+  }
+  gl::Unbind(entry->texture);
+  MakeResident(&entry->texture);
+
+  // The data lives on the GPU from now on
+  entry->levels = std::vector<MipLevel>{};
+}
+
+void TextureManager::WriteCacheAsync(TextureEntry* entry) {
+  auto levels = std::make_shared<std::vector<MipLevel>>(std::move(entry->levels));
+  std::string cache_path = entry->cache_path;
+  entry->should_write_cache = false;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_count_++;
+  }
+  thread_pool_->Enqueue(0, [this, levels, cache_path] {
+    WriteCache(cache_path, *levels);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_count_--;
+    entry_ready_.notify_all();
+  });
+}
+
+void TextureManager::GenerateMipChain(bool srgb, std::vector<MipLevel>* levels) {
+  // Box filter, that averages in linear space for srgb textures
+  float to_linear[256];
+  for (int i = 0; i < 256; ++i) {
+    to_linear[i] = srgb ? SrgbToLinear(i / 255.0f) : i / 255.0f;
+  }
+
+  while (levels->back().width > 1 || levels->back().height > 1) {
+    const MipLevel& src = levels->back();
+    MipLevel dst;
+    dst.width = std::max(src.width / 2, 1u);
+    dst.height = std::max(src.height / 2, 1u);
+    dst.data.resize(4 * dst.width * dst.height);
+
+    for (unsigned y = 0; y < dst.height; ++y) {
+      unsigned y0 = std::min(2*y, src.height - 1), y1 = std::min(2*y + 1, src.height - 1);
+      for (unsigned x = 0; x < dst.width; ++x) {
+        unsigned x0 = std::min(2*x, src.width - 1), x1 = std::min(2*x + 1, src.width - 1);
+        const unsigned char* texels[4] = {
+          &src.data[4 * (y0*src.width + x0)], &src.data[4 * (y0*src.width + x1)],
+          &src.data[4 * (y1*src.width + x0)], &src.data[4 * (y1*src.width + x1)]
+        };
+
+        unsigned char* out = &dst.data[4 * (y*dst.width + x)];
+        for (int c = 0; c < 3; ++c) {
+          float sum = 0.0f;
+          for (const unsigned char* texel : texels) {
+            sum += to_linear[texel[c]];
+          }
+          float value = srgb ? LinearToSrgb(sum / 4.0f) : sum / 4.0f;
+          out[c] = static_cast<unsigned char>(std::round(glm::clamp(value, 0.0f, 1.0f) * 255.0f));
+        }
+        out[3] = (texels[0][3] + texels[1][3] + texels[2][3] + texels[3][3] + 2) / 4;
+      }
+    }
+
+    levels->push_back(std::move(dst));
+  }
+}
+
+void TextureManager::CompressMipChain(TextureCompression compression,
+                                      std::vector<MipLevel>* levels) {
+  for (MipLevel& level : *levels) {
+    if (compression == TextureCompression::kBC1) {
+      level.data = BlockCompression::CompressBC1(level.data.data(), level.width, level.height);
+    } else {
+      level.data = BlockCompression::CompressBC3(level.data.data(), level.width, level.height);
+    }
+  }
+}
+
+bool TextureManager::ReadCache(const std::string& cache_path,
+                               std::vector<MipLevel>* levels) {
+  std::ifstream file(cache_path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  char magic[4];
+  uint32_t version = 0, level_count = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  file.read(reinterpret_cast<char*>(&level_count), sizeof(level_count));
+  if (!file || !std::equal(magic, magic + 4, kCacheMagic) ||
+      version != kCacheVersion || level_count == 0) {
+    return false;
+  }
+
+  std::vector<MipLevel> result(level_count);
+  for (MipLevel& level : result) {
+    uint32_t header[3];
+    file.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!file) {
+      return false;
+    }
+    level.width = header[0];
+    level.height = header[1];
+    level.data.resize(header[2]);
+    file.read(reinterpret_cast<char*>(level.data.data()), level.data.size());
+    if (!file) {
+      return false;
+    }
+  }
+
+  *levels = std::move(result);
+  return true;
+}
+
+bool TextureManager::WriteCache(const std::string& cache_path,
+                                const std::vector<MipLevel>& levels) {
+  return CacheFile::WriteAtomically(cache_path, [&levels](std::ostream& file) {
+    uint32_t level_count = levels.size();
+    file.write(kCacheMagic, sizeof(kCacheMagic));
+    file.write(reinterpret_cast<const char*>(&kCacheVersion), sizeof(kCacheVersion));
+    file.write(reinterpret_cast<const char*>(&level_count), sizeof(level_count));
+    for (const MipLevel& level : levels) {
+      uint32_t header[3] = {level.width, level.height,
+                            static_cast<uint32_t>(level.data.size())};
+      file.write(reinterpret_cast<const char*>(header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(level.data.data()), level.data.size());
+    }
+  });
+}
+
+GLenum TextureManager::GetInternalFormat(TextureCompression compression, bool srgb) {
+  switch (compression) {
+    case TextureCompression::kBC1:
+      return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureCompression::kBC3:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureCompression::kBC7:
+      return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+    case TextureCompression::kNone:
+    default:
+      return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+  }
+}
+
+}  // namespace Silice3D
@@ -0,0 +1,129 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_TEXTURE_TEXTURE_MANAGER_HPP_
+#define SILICE3D_TEXTURE_TEXTURE_MANAGER_HPP_
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <condition_variable>
+
+#include <Silice3D/common/oglwrap.hpp>
+
+namespace Silice3D {
+
+class ThreadPool;
+
+enum class TextureCompression { kNone, kBC1, kBC3, kBC7 };
+
+// Loads the textures from files, and makes sure that every file is only
+// loaded once. The decoding, the mipmap generation and the (BC1/BC3)
+// compression happens on the ThreadPool's workers, the GL thread only does
+// the uploads in Update(). The compressed mip chains can be persisted into an
+// on-disk cache, keyed by the hash of the source file's content.
+// Every texture is made resident as a bindless texture once it's uploaded,
+// until then GetBindlessHandle returns the handle of a placeholder texture.
+class TextureManager {
+ public:
+  static constexpr size_t kDefaultUploadBudget = 8;
+
+  explicit TextureManager(ThreadPool* thread_pool);
+  ~TextureManager();
+
+  // Returns the texture loaded from the given file. The texture is empty
+  // until it is uploaded by Update(). Calling this multiple times with the
+  // same path returns the same texture.
+  gl::Texture2D* GetTexture(const std::string& path, bool srgb = true);
+
+  // Returns an 1x1 texture with the given color. Also deduplicated.
+  gl::Texture2D* GetColorTexture(const glm::vec4& color);
+
+  // Returns true if the texture's real content has already been uploaded.
+  bool IsLoaded(const gl::Texture2D* texture) const;
+
+  // Returns the resident bindless handle of the texture, or the placeholder's
+  // handle if the texture isn't uploaded yet (or is nullptr).
+  GLuint64 GetBindlessHandle(const gl::Texture2D* texture) const;
+
+  // Increases every time a texture is uploaded, so the users of the bindless
+  // handles know when they should query them again.
+  size_t GetUploadCount() const { return upload_count_; }
+
+  // Uploads at most upload_budget textures that have finished decoding.
+  // Must be called from the GL thread. Returns the number of uploads.
+  size_t Update(size_t upload_budget = kDefaultUploadBudget);
+
+  // Blocks until every requested texture is decoded and uploaded.
+  void WaitForAll();
+
+  size_t GetPendingCount() const;
+
+  TextureCompression GetCompression() const { return compression_; }
+  // Only affects the textures requested after this call.
+  void SetCompression(TextureCompression compression) { compression_ = compression; }
+
+  const std::string& GetCacheDirectory() const { return cache_directory_; }
+  // The directory has to exist. An empty string disables the cache.
+  void SetCacheDirectory(const std::string& directory);
+
+ private:
+  struct MipLevel {
+    unsigned width = 0, height = 0;
+    std::vector<unsigned char> data;
+  };
+
+  struct TextureEntry {
+    std::string path;
+    bool srgb = true;
+    TextureCompression compression = TextureCompression::kNone;
+    std::string cache_directory;
+    gl::Texture2D texture;
+
+    // Written by the worker thread, read by the GL thread once the
+    // entry is in the ready queue.
+    std::vector<MipLevel> levels;
+    std::string cache_path;
+    bool failed = false;
+    bool compressed_data = false;
+    bool should_write_cache = false;
+
+    bool loaded = false;
+  };
+
+  ThreadPool* thread_pool_;
+  TextureCompression compression_ = TextureCompression::kNone;
+  std::string cache_directory_;
+
+  std::map<std::pair<std::string, bool>, std::unique_ptr<TextureEntry>> textures_;
+  std::map<const gl::Texture2D*, TextureEntry*> entry_for_texture_;
+  std::vector<std::pair<glm::vec4, std::unique_ptr<gl::Texture2D>>> color_textures_;
+  std::map<const gl::Texture2D*, GLuint64> bindless_handles_;
+  gl::Texture2D placeholder_texture_;
+  GLuint64 placeholder_handle_ = 0;
+  size_t upload_count_ = 0;
+
+  mutable std::mutex mutex_;
+  std::condition_variable entry_ready_;
+  std::deque<TextureEntry*> ready_queue_;
+  size_t in_flight_count_ = 0;
+  size_t pending_count_ = 0;
+
+  void Load(TextureEntry* entry);
+  void Upload(TextureEntry* entry);
+  void WriteCacheAsync(TextureEntry* entry);
+  GLuint64 MakeResident(gl::Texture2D* texture);
+
+  static void GenerateMipChain(bool srgb, std::vector<MipLevel>* levels);
+  static void CompressMipChain(TextureCompression compression,
+                               std::vector<MipLevel>* levels);
+  static bool ReadCache(const std::string& cache_path, std::vector<MipLevel>* levels);
+  static bool WriteCache(const std::string& cache_path, const std::vector<MipLevel>& levels);
+  static GLenum GetInternalFormat(TextureCompression compression, bool srgb);
+};
+
+}  // namespace Silice3D
+
+#endif  // SILICE3D_TEXTURE_TEXTURE_MANAGER_HPP_
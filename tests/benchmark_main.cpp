@@ -0,0 +1,8 @@
+// Copyright (c) Tamas Csala
+
+#include "test.hpp"
+
+int main(int argc, char* argv[]) {
+  size_t run_count = Silice3D::Test::RunCases(Silice3D::Test::GetBenchmarks(), argc, argv);
+  return run_count == 0 ? 1 : 0;
+}
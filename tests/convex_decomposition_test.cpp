@@ -0,0 +1,99 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#include <Silice3D/physics/convex_decomposition.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+// The signed distance of the point from the hull along the direction
+// (positive if the point is outside)
+float GetSupportDistance(const ConvexDecomposition::Hull& hull, const glm::vec3& point,
+                         const glm::vec3& direction) {
+  float support = -std::numeric_limits<float>::max();
+  for (const glm::vec3& vertex : hull) {
+    support = std::max(support, glm::dot(vertex, direction));
+  }
+  return glm::dot(point, direction) - support;
+}
+
+// How far the point is outside of the hull, approximated with the support
+// distances along evenly distributed directions (and the axes)
+float GetDistanceFromHull(const ConvexDecomposition::Hull& hull, const glm::vec3& point) {
+  std::vector<glm::vec3> directions = {glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0),
+                                       glm::vec3(0, 1, 0), glm::vec3(0, -1, 0),
+                                       glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)};
+  constexpr int kDirectionCount = 256;
+  constexpr float kGoldenAngle = 2.39996323f;
+  for (int i = 0; i < kDirectionCount; ++i) {
+    float z = 1.0f - 2.0f * (i + 0.5f) / kDirectionCount;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z*z));
+    directions.push_back(glm::vec3(r * std::cos(i * kGoldenAngle), r * std::sin(i * kGoldenAngle), z));
+  }
+
+  float distance = -std::numeric_limits<float>::max();
+  for (const glm::vec3& direction : directions) {
+    distance = std::max(distance, GetSupportDistance(hull, point, direction));
+  }
+  return distance;
+}
+
+}  // namespace
+
+SILICE3D_TEST(ConvexDecompositionConcaveShape) {
+  // An L shaped prism: a 2x2 square without its (1, 1) - (2, 2) quarter,
+  // extruded from z = 0 to z = 1
+  std::vector<glm::vec2> outline = {glm::vec2(0, 0), glm::vec2(2, 0), glm::vec2(2, 1),
+                                    glm::vec2(1, 1), glm::vec2(1, 2), glm::vec2(0, 2)};
+  unsigned n = outline.size();
+  std::vector<glm::vec3> positions;
+  for (float z : {0.0f, 1.0f}) {
+    for (const glm::vec2& point : outline) {
+      positions.push_back(glm::vec3(point.x, point.y, z));
+    }
+  }
+  std::vector<unsigned> indices;
+  for (unsigned i = 1; i + 1 < n; ++i) {
+    // The caps are fans around the (0, 0) corner, that sees the whole outline
+    indices.insert(indices.end(), {0, i + 1, i, n, n + i, n + i + 1});
+  }
+  for (unsigned i = 0; i < n; ++i) {
+    unsigned next = (i + 1) % n;
+    indices.insert(indices.end(), {i, next, n + next, i, n + next, n + i});
+  }
+
+  ConvexDecomposition::Parameters parameters;
+  parameters.resolution = 24;
+  std::vector<ConvexDecomposition::Hull> hulls =
+      ConvexDecomposition::Decompose(positions, indices, parameters);
+
+  // A single hull would fill the missing quarter
+  SILICE3D_EXPECT(hulls.size() >= 2);
+  SILICE3D_EXPECT(hulls.size() <= parameters.max_hulls);
+  for (const ConvexDecomposition::Hull& hull : hulls) {
+    SILICE3D_EXPECT(4 <= hull.size() && hull.size() <= parameters.max_hull_vertices);
+  }
+
+  // The hulls are built from the voxels, they can be off by about a voxel
+  float voxel_size = 2.0f / parameters.resolution;
+  for (const glm::vec3& position : positions) {
+    float distance = std::numeric_limits<float>::max();
+    for (const ConvexDecomposition::Hull& hull : hulls) {
+      distance = std::min(distance, GetDistanceFromHull(hull, position));
+    }
+    SILICE3D_EXPECT(distance <= voxel_size);
+  }
+
+  // And none of them reaches into the missing quarter
+  glm::vec3 notch{1.5f, 1.5f, 0.5f};
+  for (const ConvexDecomposition::Hull& hull : hulls) {
+    SILICE3D_EXPECT(GetDistanceFromHull(hull, notch) > 0.25f);
+  }
+}
@@ -0,0 +1,61 @@
+// Copyright (c) Tamas Csala
+
+#include <random>
+#include <algorithm>
+
+#include <Silice3D/culling/frustum_culling.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+using FrustumCulling::InstructionSet;
+
+SILICE3D_BENCHMARK(FrustumCullingBoxes) {
+  glm::mat4 camera_matrix = glm::lookAt(glm::vec3(0, 10, 0), glm::vec3(0, 10, -1), glm::vec3(0, 1, 0));
+  glm::mat4 projection_matrix = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.5f, 500.0f);
+  glm::mat4 m = projection_matrix * camera_matrix;
+  Frustum frustum;
+  for (int i = 0; i < 6; ++i) {
+    int row = i / 2;
+    float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+    frustum.planes[i] = Plane{m[0][3] + sign * m[0][row], m[1][3] + sign * m[1][row],
+                              m[2][3] + sign * m[2][row], m[3][3] + sign * m[3][row]};
+  }
+
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> position{-1000.0f, 1000.0f};
+  std::uniform_real_distribution<float> size{0.1f, 10.0f};
+
+  for (size_t box_count : {1000, 10000, 100000, 1000000}) {
+    BoundingBoxArray boxes;
+    std::vector<BoundingBox> bboxes;
+    for (size_t i = 0; i < box_count; ++i) {
+      boxes.Add(glm::vec3(position(random), position(random) * 0.1f, position(random)),
+                glm::vec3(size(random), size(random), size(random)));
+      bboxes.push_back(boxes.Get(i));
+    }
+    unsigned repetitions = std::max<unsigned>(10, 10000000 / box_count);
+
+    std::cout << box_count << " boxes:";
+    size_t visible_count = 0;
+    double time = Test::MeasureMilliseconds(repetitions, [&]() {
+      visible_count = 0;
+      for (const BoundingBox& bbox : bboxes) {
+        visible_count += bbox.CollidesWithFrustum(frustum);
+      }
+    });
+    std::cout << " BoundingBox " << time << " ms";
+
+    std::vector<uint64_t> mask;
+    for (InstructionSet instruction_set : {InstructionSet::kScalar, InstructionSet::kSse2,
+                                           InstructionSet::kAvx2}) {
+      if (FrustumCulling::IsSupported(instruction_set)) {
+        time = Test::MeasureMilliseconds(repetitions, [&]() {
+          FrustumCulling::CullToMask(frustum, boxes, &mask, instruction_set);
+        });
+        std::cout << ", " << FrustumCulling::GetName(instruction_set) << " " << time << " ms";
+      }
+    }
+    std::cout << " (" << visible_count << " visible)" << std::endl;
+  }
+}
@@ -0,0 +1,134 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/culling/frustum_culling.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+using FrustumCulling::InstructionSet;
+
+namespace {
+
+// The planes of the frustum of a projection * camera matrix, like ICamera::UpdateFrustum
+Frustum GetFrustum(const glm::mat4& m) {
+  Frustum frustum;
+  for (int i = 0; i < 6; ++i) {
+    int row = i / 2;
+    float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+    frustum.planes[i] = Plane{m[0][3] + sign * m[0][row], m[1][3] + sign * m[1][row],
+                              m[2][3] + sign * m[2][row], m[3][3] + sign * m[3][row]};
+  }
+  return frustum;
+}
+
+Frustum GetTestFrustum() {
+  glm::mat4 camera_matrix = glm::lookAt(glm::vec3(5, 10, 20), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+  glm::mat4 projection_matrix = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.5f, 150.0f);
+  return GetFrustum(projection_matrix * camera_matrix);
+}
+
+// An odd count, so the kernels' scalar tails are tested too
+BoundingBoxArray GetRandomBoxes(size_t count = 10007) {
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> position{-200.0f, 200.0f};
+  std::uniform_real_distribution<float> size{0.01f, 20.0f};
+  BoundingBoxArray boxes;
+  for (size_t i = 0; i < count; ++i) {
+    boxes.Add(glm::vec3(position(random), position(random) * 0.25f, position(random)),
+              glm::vec3(size(random), size(random), size(random)));
+  }
+  return boxes;
+}
+
+bool IsVisible(const std::vector<uint64_t>& mask, size_t index) {
+  return (mask[index / 64] >> (index % 64)) & 1;
+}
+
+// How far the box is from the nearest decision of the plane tests, the
+// single and double precision results might only differ near zero
+double GetDecisionMargin(const BoundingBox& bbox, const Frustum& frustum) {
+  double margin = std::numeric_limits<double>::max();
+  for (const Plane& plane : frustum.planes) {
+    double d = glm::dot(bbox.GetCenter(), plane.normal) + plane.dist;
+    double r = glm::dot(bbox.GetExtent() / 2.0, glm::abs(plane.normal));
+    margin = std::min(margin, std::abs(d + r));
+  }
+  return margin;
+}
+
+}  // namespace
+
+SILICE3D_TEST(FrustumCullingKernelsGiveIdenticalResults) {
+  Frustum frustum = GetTestFrustum();
+  BoundingBoxArray boxes = GetRandomBoxes();
+
+  std::vector<uint64_t> scalar_mask;
+  FrustumCulling::CullToMask(frustum, boxes, &scalar_mask, InstructionSet::kScalar);
+
+  for (InstructionSet instruction_set : {InstructionSet::kSse2, InstructionSet::kAvx2}) {
+    if (!FrustumCulling::IsSupported(instruction_set)) {
+      std::cout << FrustumCulling::GetName(instruction_set) << " is not supported, skipped"
+                << std::endl;
+      continue;
+    }
+    std::vector<uint64_t> mask;
+    FrustumCulling::CullToMask(frustum, boxes, &mask, instruction_set);
+    SILICE3D_EXPECT(mask == scalar_mask);
+  }
+}
+
+SILICE3D_TEST(FrustumCullingMatchesBoundingBoxCollidesWithFrustum) {
+  Frustum frustum = GetTestFrustum();
+  BoundingBoxArray boxes = GetRandomBoxes();
+
+  std::vector<uint64_t> mask;
+  FrustumCulling::CullToMask(frustum, boxes, &mask);
+
+  size_t visible_count = 0, compared_count = 0;
+  for (size_t i = 0; i < boxes.GetSize(); ++i) {
+    BoundingBox bbox = boxes.Get(i);
+    visible_count += IsVisible(mask, i);
+    if (GetDecisionMargin(bbox, frustum) > 1e-2) {
+      SILICE3D_EXPECT(IsVisible(mask, i) == bbox.CollidesWithFrustum(frustum));
+      compared_count++;
+    }
+  }
+
+  // The test is only meaningful if both outcomes are common
+  SILICE3D_EXPECT(visible_count > boxes.GetSize() / 50);
+  SILICE3D_EXPECT(visible_count < boxes.GetSize() / 2);
+  SILICE3D_EXPECT(compared_count > boxes.GetSize() * 9 / 10);
+}
+
+SILICE3D_TEST(FrustumCullingOfSeveralViewsMatchesTheSingleViewResults) {
+  std::vector<Frustum> frustums = {
+    GetTestFrustum(), GetFrustum(glm::ortho(-50.0f, 50.0f, -50.0f, 50.0f, -100.0f, 100.0f))
+  };
+  // More than a parallel chunk
+  BoundingBoxArray boxes = GetRandomBoxes(3 * FrustumCulling::kParallelChunkSize + 5);
+
+  ThreadPool thread_pool{3};
+  std::vector<std::vector<uint64_t>> masks;
+  FrustumCulling::CullToMasks(frustums, boxes, &masks, &thread_pool);
+  SILICE3D_EXPECT(masks.size() == frustums.size());
+  for (size_t v = 0; v < frustums.size(); ++v) {
+    std::vector<uint64_t> mask;
+    FrustumCulling::CullToMask(frustums[v], boxes, &mask);
+    SILICE3D_EXPECT(masks[v] == mask);
+
+    std::vector<unsigned> indices, expected_indices;
+    FrustumCulling::CullToIndices(frustums[v], boxes, &indices);
+    for (size_t i = 0; i < boxes.GetSize(); ++i) {
+      if (IsVisible(mask, i)) {
+        expected_indices.push_back(i);
+      }
+    }
+    SILICE3D_EXPECT(indices == expected_indices);
+  }
+}
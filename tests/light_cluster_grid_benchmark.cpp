@@ -0,0 +1,44 @@
+// Copyright (c) Tamas Csala
+
+#include <random>
+#include <thread>
+#include <algorithm>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/lighting/light_cluster_grid.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+SILICE3D_BENCHMARK(LightClusterGridBuild) {
+  glm::mat4 camera_matrix = glm::lookAt(glm::vec3(0, 10, 0), glm::vec3(0, 10, -1), glm::vec3(0, 1, 0));
+  glm::mat4 projection_matrix = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.5f, 500.0f);
+  ThreadPool thread_pool{std::max(std::thread::hardware_concurrency(), 2u) - 1};
+
+  // The lights are scattered in front of the camera, with ranges like the
+  // ones of PointLightSource
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> horizontal{-250.0f, 250.0f};
+  std::uniform_real_distribution<float> depth{-500.0f, 50.0f};
+  std::uniform_real_distribution<float> range{2.0f, 40.0f};
+
+  for (size_t light_count : {64, 256, 1024, 4096, 16384}) {
+    std::vector<glm::vec4> light_spheres;
+    for (size_t i = 0; i < light_count; ++i) {
+      light_spheres.push_back(glm::vec4(horizontal(random), horizontal(random) * 0.1f,
+                                        depth(random), range(random)));
+    }
+
+    LightClusterGrid grid;
+    double serial_time = Test::MeasureMilliseconds(20, [&]() {
+      grid.Build(camera_matrix, projection_matrix, 0.5f, 500.0f, light_spheres);
+    });
+    double parallel_time = Test::MeasureMilliseconds(20, [&]() {
+      grid.Build(camera_matrix, projection_matrix, 0.5f, 500.0f, light_spheres, &thread_pool);
+    });
+    std::cout << light_count << " lights: " << serial_time << " ms serial, "
+              << parallel_time << " ms parallel, " << grid.GetLightIndices().size()
+              << " light indices" << std::endl;
+  }
+}
@@ -0,0 +1,108 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/lighting/light_cluster_grid.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+constexpr float kZNear = 0.5f;
+constexpr float kZFar = 100.0f;
+
+// The camera is at the origin, looking towards -z
+void Build(LightClusterGrid* grid, const std::vector<glm::vec4>& light_spheres,
+           ThreadPool* thread_pool = nullptr) {
+  glm::mat4 projection_matrix = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, kZNear, kZFar);
+  grid->Build(glm::mat4(1.0f), projection_matrix, kZNear, kZFar, light_spheres, thread_pool);
+}
+
+bool ClusterHasLight(const LightClusterGrid& grid, unsigned x, unsigned y, unsigned z,
+                     uint32_t light) {
+  const glm::uvec2& range = grid.GetClusterRanges()[grid.GetClusterIndex(x, y, z)];
+  for (uint32_t i = range.x; i < range.x + range.y; ++i) {
+    if (grid.GetLightIndices()[i] == light) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The depth slice of a view space depth, the way the shaders calculate it
+unsigned GetSlice(const LightClusterGrid& grid, float depth) {
+  float slice = std::floor(std::log(depth / grid.GetZNear()) * grid.GetSliceScale());
+  return unsigned(std::min(std::max(slice, 0.0f), float(grid.GetSize().z - 1)));
+}
+
+// Checks that the light is in every cluster of the slices [first_slice, last_slice],
+// and in none of the others.
+void ExpectLightInSlices(const LightClusterGrid& grid, uint32_t light,
+                         unsigned first_slice, unsigned last_slice) {
+  const glm::uvec3& size = grid.GetSize();
+  for (unsigned z = 0; z < size.z; ++z) {
+    bool expected = first_slice <= z && z <= last_slice;
+    for (unsigned y = 0; y < size.y; ++y) {
+      for (unsigned x = 0; x < size.x; ++x) {
+        SILICE3D_EXPECT(ClusterHasLight(grid, x, y, z, light) == expected);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+SILICE3D_TEST(LightBehindTheCameraIsNotBinned) {
+  LightClusterGrid grid;
+  Build(&grid, {glm::vec4(0, 0, 10, 2)});
+  SILICE3D_EXPECT(grid.GetLightIndices().empty());
+}
+
+SILICE3D_TEST(LightOffScreenIsNotBinned) {
+  LightClusterGrid grid;
+  Build(&grid, {glm::vec4(50, 0, -10, 1), glm::vec4(0, -30, -10, 1)});
+  SILICE3D_EXPECT(grid.GetLightIndices().empty());
+}
+
+SILICE3D_TEST(LightStraddlingTheNearPlaneCoversTheFirstSlices) {
+  // The eye is inside the sphere, so its projection covers the whole screen
+  LightClusterGrid grid;
+  Build(&grid, {glm::vec4(0, 0, -0.5f, 1)});
+  ExpectLightInSlices(grid, 0, 0, GetSlice(grid, 1.5f));
+}
+
+SILICE3D_TEST(LightCoveringTheScreenIsInEveryClusterOfItsSlices) {
+  LightClusterGrid grid;
+  Build(&grid, {glm::vec4(0, 0, -20, 15)});
+  ExpectLightInSlices(grid, 0, GetSlice(grid, 5.0f), GetSlice(grid, 35.0f));
+}
+
+SILICE3D_TEST(SmallLightIsOnlyInItsOwnCluster) {
+  LightClusterGrid grid{glm::uvec3{16, 8, 24}};
+  Build(&grid, {glm::vec4(0.5f, 0.5f, -10, 0.01f), glm::vec4(-50, 0, -10, 1)});
+  SILICE3D_EXPECT(grid.GetLightIndices().size() == 1);
+
+  // The center of the screen is on the border of the clusters 7 and 8, the
+  // light is a bit to the right and up from it
+  SILICE3D_EXPECT(ClusterHasLight(grid, 8, 4, GetSlice(grid, 10.0f), 0));
+}
+
+SILICE3D_TEST(ParallelBinningMatchesTheSerialOne) {
+  std::vector<glm::vec4> light_spheres;
+  for (int i = 0; i < 256; ++i) {
+    float angle = i * 0.37f;
+    light_spheres.push_back(glm::vec4(std::cos(angle) * i * 0.2f, std::sin(angle) * 5.0f,
+                                      -i * 0.4f, 1.0f + (i % 7)));
+  }
+
+  LightClusterGrid serial_grid, parallel_grid;
+  ThreadPool thread_pool{3};
+  Build(&serial_grid, light_spheres);
+  Build(&parallel_grid, light_spheres, &thread_pool);
+  SILICE3D_EXPECT(serial_grid.GetClusterRanges() == parallel_grid.GetClusterRanges());
+  SILICE3D_EXPECT(serial_grid.GetLightIndices() == parallel_grid.GetLightIndices());
+  SILICE3D_EXPECT(!serial_grid.GetLightIndices().empty());
+}
@@ -0,0 +1,140 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include <Silice3D/mesh/mesh_simplifier.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+struct Mesh {
+  std::vector<glm::vec3> positions, normals;
+  std::vector<glm::vec2> texcoords;
+  std::vector<unsigned> indices;
+};
+
+// A UV sphere around the origin, with a texture seam
+Mesh CreateSphere(float radius, unsigned rings, unsigned segments) {
+  Mesh mesh;
+  for (unsigned y = 0; y <= rings; ++y) {
+    for (unsigned x = 0; x <= segments; ++x) {
+      float theta = M_PI * y / rings;
+      float phi = 2 * M_PI * x / segments;
+      glm::vec3 dir{std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+      mesh.positions.push_back(dir * radius);
+      mesh.normals.push_back(dir);
+      mesh.texcoords.push_back(glm::vec2(float(x) / segments, float(y) / rings));
+    }
+  }
+  for (unsigned y = 0; y < rings; ++y) {
+    for (unsigned x = 0; x < segments; ++x) {
+      unsigned corner = y * (segments + 1) + x, below = corner + segments + 1;
+      mesh.indices.insert(mesh.indices.end(), {corner, below, corner + 1,
+                                               corner + 1, below, below + 1});
+    }
+  }
+  return mesh;
+}
+
+// A flat size x size grid on the y = 0 plane
+Mesh CreatePlane(float size, unsigned resolution) {
+  Mesh mesh;
+  for (unsigned y = 0; y <= resolution; ++y) {
+    for (unsigned x = 0; x <= resolution; ++x) {
+      glm::vec2 texcoord = glm::vec2(x, y) / float(resolution);
+      mesh.positions.push_back(glm::vec3(texcoord.x, 0, texcoord.y) * size);
+      mesh.normals.push_back(glm::vec3(0, 1, 0));
+      mesh.texcoords.push_back(texcoord);
+    }
+  }
+  for (unsigned y = 0; y < resolution; ++y) {
+    for (unsigned x = 0; x < resolution; ++x) {
+      unsigned corner = y * (resolution + 1) + x, below = corner + resolution + 1;
+      mesh.indices.insert(mesh.indices.end(), {corner, below, corner + 1,
+                                               corner + 1, below, below + 1});
+    }
+  }
+  return mesh;
+}
+
+// Builds a LOD chain like MeshRenderer::prepare, every level from the
+// previous one, and returns the triangle counts of the levels.
+std::vector<size_t> BuildLodChain(const Mesh& mesh, float max_error,
+                                  const std::function<void(const std::vector<unsigned>&)>& check) {
+  std::vector<size_t> triangle_counts;
+  std::vector<unsigned> indices = mesh.indices;
+  for (int level = 1; level < 5; ++level) {
+    float result_error = 0.0f;
+    indices = MeshSimplifier::Simplify(mesh.positions, mesh.normals, mesh.texcoords, indices,
+                                       indices.size() / 2 / 3 * 3, max_error, &result_error);
+    SILICE3D_EXPECT(result_error <= max_error);
+    check(indices);
+    triangle_counts.push_back(indices.size() / 3);
+  }
+  return triangle_counts;
+}
+
+// How far the simplified surface sinks below the sphere, sampled at the
+// vertices, the edge midpoints and the centers of the triangles
+float GetSphereDeviation(const Mesh& mesh, const std::vector<unsigned>& indices, float radius) {
+  float deviation = 0.0f;
+  for (size_t i = 0; i < indices.size(); i += 3) {
+    glm::vec3 a = mesh.positions[indices[i]];
+    glm::vec3 b = mesh.positions[indices[i + 1]];
+    glm::vec3 c = mesh.positions[indices[i + 2]];
+    for (glm::vec3 point : {(a + b) / 2.0f, (b + c) / 2.0f, (c + a) / 2.0f, (a + b + c) / 3.0f}) {
+      deviation = std::max(deviation, radius - glm::length(point));
+    }
+  }
+  return deviation;
+}
+
+}  // namespace
+
+SILICE3D_TEST(MeshSimplifierSphereErrorBound) {
+  std::vector<size_t> triangle_counts[2];
+  float radii[2] = {1.0f, 100.0f};
+  for (int i = 0; i < 2; ++i) {
+    float radius = radii[i];
+    Mesh sphere = CreateSphere(radius, 32, 64);
+    float max_error = 0.02f * radius;
+    triangle_counts[i] = BuildLodChain(sphere, max_error, [&](const std::vector<unsigned>& indices) {
+      SILICE3D_EXPECT(GetSphereDeviation(sphere, indices, radius) <= max_error);
+    });
+    SILICE3D_EXPECT(triangle_counts[i].front() < sphere.indices.size() / 3);
+  }
+
+  // The error is a distance, the same mesh is simplified the same way at any scale
+  for (size_t level = 0; level < triangle_counts[0].size(); ++level) {
+    float ratio = float(triangle_counts[0][level]) / triangle_counts[1][level];
+    SILICE3D_EXPECT(std::abs(ratio - 1.0f) < 0.01f);
+  }
+}
+
+SILICE3D_TEST(MeshSimplifierPlaneErrorBound) {
+  std::vector<size_t> triangle_counts[2];
+  float sizes[2] = {1.0f, 100.0f};
+  for (int i = 0; i < 2; ++i) {
+    Mesh plane = CreatePlane(sizes[i], 32);
+    triangle_counts[i] = BuildLodChain(plane, 0.01f * sizes[i], [&](const std::vector<unsigned>& indices) {
+      // Every collapse stays on the plane, and no triangle gets flipped (they
+      // are all facing up)
+      for (size_t t = 0; t < indices.size(); t += 3) {
+        glm::vec3 a = plane.positions[indices[t]];
+        glm::vec3 b = plane.positions[indices[t + 1]];
+        glm::vec3 c = plane.positions[indices[t + 2]];
+        SILICE3D_EXPECT(a.y == 0.0f && b.y == 0.0f && c.y == 0.0f);
+        SILICE3D_EXPECT(glm::cross(b - a, c - a).y > 0.0f);
+      }
+    });
+    // A plane can be simplified a lot within any error
+    SILICE3D_EXPECT(triangle_counts[i].back() < plane.indices.size() / 3 / 4);
+  }
+  SILICE3D_EXPECT(triangle_counts[0] == triangle_counts[1]);
+}
@@ -0,0 +1,175 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include <Silice3D/mesh/meshlet_builder.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+struct Mesh {
+  std::vector<glm::vec3> positions;
+  std::vector<unsigned> indices;
+};
+
+// A flat size x size grid on the y = 0 plane, facing up (+y)
+Mesh CreatePlane(unsigned size) {
+  Mesh mesh;
+  for (unsigned y = 0; y <= size; ++y) {
+    for (unsigned x = 0; x <= size; ++x) {
+      mesh.positions.push_back(glm::vec3(x, 0, y));
+    }
+  }
+  for (unsigned y = 0; y < size; ++y) {
+    for (unsigned x = 0; x < size; ++x) {
+      unsigned corner = y * (size + 1) + x, below = corner + size + 1;
+      mesh.indices.insert(mesh.indices.end(), {corner, below, corner + 1,
+                                               corner + 1, below, below + 1});
+    }
+  }
+  return mesh;
+}
+
+// A UV sphere around the origin, with its triangles facing outwards
+Mesh CreateSphere(unsigned rings, unsigned segments) {
+  Mesh mesh;
+  for (unsigned y = 0; y <= rings; ++y) {
+    for (unsigned x = 0; x <= segments; ++x) {
+      float theta = M_PI * y / rings;
+      float phi = 2 * M_PI * x / segments;
+      mesh.positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                         std::sin(theta) * std::sin(phi)));
+    }
+  }
+  for (unsigned y = 0; y < rings; ++y) {
+    for (unsigned x = 0; x < segments; ++x) {
+      unsigned corner = y * (segments + 1) + x, below = corner + segments + 1;
+      if (y != 0) {
+        mesh.indices.insert(mesh.indices.end(), {corner, corner + 1, below});
+      }
+      if (y != rings - 1) {
+        mesh.indices.insert(mesh.indices.end(), {corner + 1, below + 1, below});
+      }
+    }
+  }
+  return mesh;
+}
+
+// The triangles rotated to start with their smallest index (keeping the
+// winding), and sorted, so two index lists can be compared as sets
+std::vector<glm::uvec3> GetSortedTriangles(const std::vector<unsigned>& indices) {
+  std::vector<glm::uvec3> triangles;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    glm::uvec3 triangle{indices[i], indices[i + 1], indices[i + 2]};
+    while (triangle.x > triangle.y || triangle.x > triangle.z) {
+      triangle = glm::uvec3(triangle.y, triangle.z, triangle.x);
+    }
+    triangles.push_back(triangle);
+  }
+  std::sort(triangles.begin(), triangles.end(), [](const glm::uvec3& a, const glm::uvec3& b) {
+    if (a.x != b.x) { return a.x < b.x; }
+    if (a.y != b.y) { return a.y < b.y; }
+    return a.z < b.z;
+  });
+  return triangles;
+}
+
+// Checks the limits, and that the meshlets partition the triangles
+void CheckMeshlets(const Mesh& mesh, unsigned max_vertices, unsigned max_triangles) {
+  std::vector<unsigned> indices = mesh.indices;
+  std::vector<MeshletBuilder::Meshlet> meshlets =
+      MeshletBuilder::Build(mesh.positions, &indices, max_vertices, max_triangles);
+  SILICE3D_EXPECT(!meshlets.empty());
+
+  // Every triangle is in exactly one meshlet: the meshlets are consecutive
+  // ranges that cover the index list, which only has the triangles reordered
+  unsigned next_index = 0;
+  for (const MeshletBuilder::Meshlet& meshlet : meshlets) {
+    SILICE3D_EXPECT(meshlet.first_index == next_index);
+    SILICE3D_EXPECT(meshlet.index_count % 3 == 0);
+    SILICE3D_EXPECT(0 < meshlet.index_count && meshlet.index_count <= 3 * max_triangles);
+    next_index += meshlet.index_count;
+
+    std::vector<unsigned> vertices(indices.begin() + meshlet.first_index,
+                                   indices.begin() + meshlet.first_index + meshlet.index_count);
+    std::sort(vertices.begin(), vertices.end());
+    size_t vertex_count = std::unique(vertices.begin(), vertices.end()) - vertices.begin();
+    SILICE3D_EXPECT(vertex_count <= max_vertices);
+  }
+  SILICE3D_EXPECT(next_index == indices.size());
+  SILICE3D_EXPECT(GetSortedTriangles(indices) == GetSortedTriangles(mesh.indices));
+}
+
+}  // namespace
+
+SILICE3D_TEST(MeshletBuilderRespectsTheLimits) {
+  for (const Mesh& mesh : {CreatePlane(64), CreateSphere(32, 64)}) {
+    CheckMeshlets(mesh, MeshletBuilder::kMaxVertices, MeshletBuilder::kMaxTriangles);
+    CheckMeshlets(mesh, 32, 40);
+  }
+
+  // The meshlets of a regular grid can be filled to nearly the triangle limit
+  Mesh plane = CreatePlane(64);
+  std::vector<MeshletBuilder::Meshlet> meshlets = MeshletBuilder::Build(plane.positions, &plane.indices);
+  SILICE3D_EXPECT(meshlets.size() < 2 * plane.indices.size() / 3 / MeshletBuilder::kMaxTriangles);
+}
+
+SILICE3D_TEST(MeshletBuilderFlatPatchCone) {
+  Mesh plane = CreatePlane(4);
+  std::vector<MeshletBuilder::Meshlet> meshlets = MeshletBuilder::Build(plane.positions, &plane.indices);
+  SILICE3D_EXPECT(meshlets.size() == 1);
+  const MeshletBuilder::Meshlet& meshlet = meshlets[0];
+
+  // The bounding sphere of the 4 x 4 square
+  SILICE3D_EXPECT(glm::length(glm::vec3(meshlet.bounding_sphere) - glm::vec3(2, 0, 2)) < 1e-5f);
+  SILICE3D_EXPECT(std::abs(meshlet.bounding_sphere.w - std::sqrt(8.0f)) < 1e-5f);
+
+  // Every normal is +y, so the cone is the whole half space below the patch
+  SILICE3D_EXPECT(glm::length(meshlet.cone_axis - glm::vec3(0, 1, 0)) < 1e-5f);
+  SILICE3D_EXPECT(std::abs(meshlet.cone_cutoff) < 1e-3f);
+  SILICE3D_EXPECT(std::abs(meshlet.cone_apex.y) < 1e-5f);
+
+  SILICE3D_EXPECT(MeshletBuilder::IsBackFacing(meshlet, glm::vec3(2, -1, 2)));
+  SILICE3D_EXPECT(MeshletBuilder::IsBackFacing(meshlet, glm::vec3(-50, -1, 30)));
+  SILICE3D_EXPECT(!MeshletBuilder::IsBackFacing(meshlet, glm::vec3(2, 1, 2)));
+  SILICE3D_EXPECT(!MeshletBuilder::IsBackFacing(meshlet, glm::vec3(-50, 1, 30)));
+}
+
+SILICE3D_TEST(MeshletBuilderConeCullingIsConservative) {
+  Mesh sphere = CreateSphere(32, 64);
+  std::vector<MeshletBuilder::Meshlet> meshlets = MeshletBuilder::Build(sphere.positions, &sphere.indices);
+
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> coordinate{-4.0f, 4.0f};
+  size_t culled_count = 0, tested_count = 0;
+  for (int i = 0; i < 256; ++i) {
+    glm::vec3 camera_position{coordinate(random), coordinate(random), coordinate(random)};
+    if (glm::length(camera_position) < 1.1f) {
+      continue;
+    }
+    for (const MeshletBuilder::Meshlet& meshlet : meshlets) {
+      tested_count++;
+      if (!MeshletBuilder::IsBackFacing(meshlet, camera_position)) {
+        continue;
+      }
+      culled_count++;
+
+      // A culled meshlet can't have any triangle that faces the camera
+      for (unsigned t = meshlet.first_index; t < meshlet.first_index + meshlet.index_count; t += 3) {
+        glm::vec3 a = sphere.positions[sphere.indices[t]];
+        glm::vec3 b = sphere.positions[sphere.indices[t + 1]];
+        glm::vec3 c = sphere.positions[sphere.indices[t + 2]];
+        SILICE3D_EXPECT(glm::dot(glm::cross(b - a, c - a), camera_position - a) <= 0.0f);
+      }
+    }
+  }
+
+  // Roughly the far half of a sphere faces away, a good part of it is culled
+  SILICE3D_EXPECT(culled_count > tested_count / 5);
+}
@@ -0,0 +1,124 @@
+// Copyright (c) Tamas Csala
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <btBulletDynamicsCommon.h>
+#include <BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h>
+#include <BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h>
+
+#include <Silice3D/common/make_unique.hpp>
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/physics/physics_task_scheduler.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+constexpr btScalar kTimeStep = 1.0 / 60.0;
+
+// A pile of boxes falling on the ground, with the same setup as the worlds of
+// the Scene (see Scene::Scene)
+class BoxPile {
+ public:
+  BoxPile(size_t width, size_t height, bool multithreaded) {
+    collision_config_ = make_unique<btDefaultCollisionConfiguration>();
+    broadphase_ = make_unique<btDbvtBroadphase>();
+    if (multithreaded) {
+      auto solver_pool = make_unique<btConstraintSolverPoolMt>(btGetTaskScheduler()->getMaxNumThreads());
+      dispatcher_ = make_unique<btCollisionDispatcherMt>(collision_config_.get());
+      world_ = make_unique<btDiscreteDynamicsWorldMt>(dispatcher_.get(), broadphase_.get(),
+                                                      solver_pool.get(), nullptr,
+                                                      collision_config_.get());
+      solver_ = std::move(solver_pool);
+    } else {
+      dispatcher_ = make_unique<btCollisionDispatcher>(collision_config_.get());
+      solver_ = make_unique<btSequentialImpulseConstraintSolver>();
+      world_ = make_unique<btDiscreteDynamicsWorld>(dispatcher_.get(), broadphase_.get(),
+                                                    solver_.get(), collision_config_.get());
+    }
+    world_->setGravity(btVector3(0, -9.81, 0));
+
+    ground_shape_ = make_unique<btStaticPlaneShape>(btVector3(0, 1, 0), 0);
+    AddBody(ground_shape_.get(), 0.0f, btVector3(0, 0, 0));
+
+    // Slightly apart, and slightly shifted per layer, so they topple
+    box_shape_ = make_unique<btBoxShape>(btVector3(0.5, 0.5, 0.5));
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        for (size_t z = 0; z < width; ++z) {
+          btVector3 pos(x * 1.1 + y * 0.1, 0.6 + y * 1.1, z * 1.1 - y * 0.1);
+          AddBody(box_shape_.get(), 1.0f, pos);
+        }
+      }
+    }
+  }
+
+  ~BoxPile() {
+    for (const auto& body : bodies_) {
+      world_->removeRigidBody(body.get());
+    }
+  }
+
+  void Step() { world_->stepSimulation(kTimeStep, 1, kTimeStep); }
+
+ private:
+  std::unique_ptr<btCollisionConfiguration> collision_config_;
+  std::unique_ptr<btBroadphaseInterface> broadphase_;
+  std::unique_ptr<btCollisionDispatcher> dispatcher_;
+  std::unique_ptr<btConstraintSolver> solver_;
+  std::unique_ptr<btDiscreteDynamicsWorld> world_;
+  std::unique_ptr<btCollisionShape> ground_shape_, box_shape_;
+  std::vector<std::unique_ptr<btDefaultMotionState>> motion_states_;
+  std::vector<std::unique_ptr<btRigidBody>> bodies_;
+
+  void AddBody(btCollisionShape* shape, btScalar mass, const btVector3& pos) {
+    btVector3 inertia(0, 0, 0);
+    if (mass != 0.0f) {
+      shape->calculateLocalInertia(mass, inertia);
+    }
+    motion_states_.push_back(make_unique<btDefaultMotionState>(
+        btTransform(btQuaternion::getIdentity(), pos)));
+    btRigidBody::btRigidBodyConstructionInfo info(mass, motion_states_.back().get(), shape, inertia);
+    bodies_.push_back(make_unique<btRigidBody>(info));
+    world_->addRigidBody(bodies_.back().get());
+  }
+};
+
+// The average step time, once the pile is in contact
+double MeasureStepTime(size_t width, size_t height, bool multithreaded) {
+  BoxPile pile{width, height, multithreaded};
+  for (int i = 0; i < 60; ++i) {
+    pile.Step();
+  }
+  return Test::MeasureMilliseconds(100, [&]() { pile.Step(); });
+}
+
+}  // namespace
+
+SILICE3D_BENCHMARK(PhysicsStep) {
+  ThreadPool thread_pool{std::max(std::thread::hardware_concurrency(), 2u) - 1};
+  PhysicsTaskScheduler task_scheduler{&thread_pool};
+
+  for (size_t width : {8, 16, 32}) {
+    const size_t height = 8;
+    std::cout << width * width * height << " boxes:" << std::endl;
+
+    // The task scheduler is global in Bullet, and it has to be set from the
+    // main thread
+    btSetTaskScheduler(btGetSequentialTaskScheduler());
+    std::cout << "  btDiscreteDynamicsWorld: "
+              << MeasureStepTime(width, height, false) << " ms" << std::endl;
+
+    btSetTaskScheduler(&task_scheduler);
+    for (int thread_count = 1; thread_count <= int(thread_pool.GetWorkerCount()) + 1; ++thread_count) {
+      task_scheduler.setNumThreads(thread_count);
+      std::cout << "  btDiscreteDynamicsWorldMt, " << task_scheduler.GetThreadCount()
+                << " threads: " << MeasureStepTime(width, height, true) << " ms" << std::endl;
+    }
+  }
+  btSetTaskScheduler(btGetSequentialTaskScheduler());
+}
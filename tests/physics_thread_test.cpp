@@ -0,0 +1,74 @@
+// Copyright (c) Tamas Csala
+
+#include <cmath>
+#include <functional>
+
+#include <Silice3D/physics/physics_thread.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+constexpr double kTimeStep = 1.0 / 60.0;
+
+// Simulates the frames of the scene (see Scene::SyncPhysics), with a physics
+// thread that catches up with every Advance before the next frame. A body
+// that moves with a unit speed has to be rendered exactly at the render time,
+// so the alpha is never clamped, and the render time never goes backwards.
+void CheckInterpolation(const std::function<double(int)>& frame_time) {
+  double game_time = 0.0, advance_time = 0.0;
+  double physics_time = 0.0, snapshot_time = 0.0;
+  double last_render_time = -kTimeStep;
+  for (int frame = 0; frame < 2000; ++frame) {
+    game_time += frame_time(frame);
+
+    double render_time = advance_time - kTimeStep;
+    float alpha = PhysicsThread::GetInterpolationAlpha(render_time, snapshot_time, kTimeStep);
+    double position = (snapshot_time - kTimeStep) + alpha * kTimeStep;
+    SILICE3D_EXPECT(std::abs(position - render_time) < 1e-5);
+    SILICE3D_EXPECT(render_time >= last_render_time);
+    last_render_time = render_time;
+
+    // The snapshot is only published if there was a step
+    advance_time = game_time;
+    unsigned step_count = 0;
+    while (physics_time + kTimeStep <= advance_time) {
+      physics_time += kTimeStep;
+      step_count++;
+    }
+    if (step_count > 0) {
+      snapshot_time = physics_time;
+    }
+  }
+}
+
+}  // namespace
+
+SILICE3D_TEST(PhysicsInterpolationAlpha) {
+  SILICE3D_EXPECT(PhysicsThread::GetInterpolationAlpha(1.0 - kTimeStep, 1.0, kTimeStep) == 0.0f);
+  SILICE3D_EXPECT(PhysicsThread::GetInterpolationAlpha(1.0, 1.0, kTimeStep) == 1.0f);
+  SILICE3D_EXPECT(std::abs(PhysicsThread::GetInterpolationAlpha(1.0 - kTimeStep / 4, 1.0, kTimeStep)
+                           - 0.75f) < 1e-4f);
+  // Clamped, if the physics thread has fallen behind, or is ahead
+  SILICE3D_EXPECT(PhysicsThread::GetInterpolationAlpha(2.0, 1.0, kTimeStep) == 1.0f);
+  SILICE3D_EXPECT(PhysicsThread::GetInterpolationAlpha(0.0, 1.0, kTimeStep) == 0.0f);
+}
+
+SILICE3D_TEST(PhysicsInterpolationAtFrameRates) {
+  for (double fps : {30.0, 59.0, 60.0, 61.0, 144.0, 240.0}) {
+    CheckInterpolation([fps](int) { return 1.0 / fps; });
+  }
+}
+
+SILICE3D_TEST(PhysicsInterpolationWithUnevenFrames) {
+  // Around 60 fps, so a frame gets zero or two steps every now and then
+  CheckInterpolation([](int frame) {
+    return (frame % 2 == 0 ? 0.8 : 1.2) * kTimeStep + (frame % 7) * 0.0005;
+  });
+  // Occasional long frames
+  CheckInterpolation([](int frame) {
+    return frame % 50 == 0 ? 5 * kTimeStep : kTimeStep / 3;
+  });
+}
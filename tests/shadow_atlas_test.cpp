@@ -0,0 +1,219 @@
+// Copyright (c) Tamas Csala
+
+#include <vector>
+#include <algorithm>
+
+#include <Silice3D/lighting/shadow_atlas_allocator.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+using Tile = ShadowAtlasAllocator::Tile;
+using Request = ShadowAtlasAllocator::Request;
+
+// The owners are only used as keys
+int light_a, light_b, light_c;
+
+std::vector<size_t> GetFreeTileCounts(const ShadowAtlasAllocator& atlas) {
+  std::vector<size_t> counts;
+  for (const std::vector<glm::uvec2>& level : atlas.GetFreeTiles()) {
+    counts.push_back(level.size());
+  }
+  return counts;
+}
+
+// Every allocated tile is inside the atlas, they don't overlap, and together
+// with the free tiles they cover the whole atlas
+void CheckTiles(const ShadowAtlasAllocator& atlas, const std::vector<const void*>& owners) {
+  std::vector<Tile> tiles;
+  for (const void* owner : owners) {
+    if (const ShadowAtlasAllocator::Allocation* allocation = atlas.GetAllocation(owner)) {
+      tiles.insert(tiles.end(), allocation->tiles.begin(), allocation->tiles.end());
+    }
+  }
+  size_t used_texel_count = 0;
+  for (const Tile& tile : tiles) {
+    used_texel_count += size_t(tile.size) * tile.size;
+  }
+  SILICE3D_EXPECT(used_texel_count == atlas.GetStats().used_texel_count);
+
+  std::vector<std::vector<glm::uvec2>> free_tiles = atlas.GetFreeTiles();
+  for (size_t level = 0; level < free_tiles.size(); ++level) {
+    for (const glm::uvec2& offset : free_tiles[level]) {
+      Tile tile;
+      tile.offset = offset;
+      tile.size = atlas.GetSize() >> level;
+      tiles.push_back(tile);
+    }
+  }
+
+  size_t texel_count = 0;
+  for (size_t i = 0; i < tiles.size(); ++i) {
+    const Tile& a = tiles[i];
+    SILICE3D_EXPECT(a.offset.x + a.size <= atlas.GetSize());
+    SILICE3D_EXPECT(a.offset.y + a.size <= atlas.GetSize());
+    SILICE3D_EXPECT(a.offset.x % a.size == 0 && a.offset.y % a.size == 0);
+    texel_count += size_t(a.size) * a.size;
+    for (size_t j = i + 1; j < tiles.size(); ++j) {
+      const Tile& b = tiles[j];
+      bool overlap = a.offset.x < b.offset.x + b.size && b.offset.x < a.offset.x + a.size &&
+                     a.offset.y < b.offset.y + b.size && b.offset.y < a.offset.y + a.size;
+      SILICE3D_EXPECT(!overlap);
+    }
+  }
+  SILICE3D_EXPECT(texel_count == atlas.GetStats().total_texel_count);
+}
+
+std::vector<unsigned> GetTileSizes(const ShadowAtlasAllocator& atlas, const void* owner) {
+  std::vector<unsigned> sizes;
+  if (const ShadowAtlasAllocator::Allocation* allocation = atlas.GetAllocation(owner)) {
+    for (const Tile& tile : allocation->tiles) {
+      sizes.push_back(tile.size);
+    }
+  }
+  return sizes;
+}
+
+}  // namespace
+
+SILICE3D_TEST(ShadowAtlasSplitsAndMergesTiles) {
+  // The levels are 1024, 512, 256 and 128 texels large
+  ShadowAtlasAllocator atlas{1024, 128};
+  SILICE3D_EXPECT(GetFreeTileCounts(atlas) == (std::vector<size_t>{1, 0, 0, 0}));
+
+  // The first tile splits the whole atlas, and then one of its quarters
+  atlas.Update({Request{&light_a, 1, 256, 1.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a) == std::vector<unsigned>{256});
+  SILICE3D_EXPECT(GetFreeTileCounts(atlas) == (std::vector<size_t>{0, 3, 3, 0}));
+  CheckTiles(atlas, {&light_a});
+
+  // The requested sizes are rounded down to the levels, and the largest tile
+  // is a quarter of the atlas
+  atlas.Update({Request{&light_a, 1, 256, 1.0f, false},
+                Request{&light_b, 2, 200, 1.0f, false},
+                Request{&light_c, 1, 4096, 1.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_b) == (std::vector<unsigned>{128, 128}));
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_c) == std::vector<unsigned>{512});
+  CheckTiles(atlas, {&light_a, &light_b, &light_c});
+
+  // Freeing the tiles merges the buddies back into the whole atlas
+  atlas.Update({Request{&light_b, 2, 128, 1.0f, false}});
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_a) == nullptr);
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_c) == nullptr);
+  CheckTiles(atlas, {&light_b});
+  atlas.Update({});
+  SILICE3D_EXPECT(GetFreeTileCounts(atlas) == (std::vector<size_t>{1, 0, 0, 0}));
+  SILICE3D_EXPECT(atlas.GetStats().used_texel_count == 0);
+
+  // So the largest tiles fill the whole atlas again
+  atlas.Update({Request{&light_a, 4, 512, 1.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a) == (std::vector<unsigned>{512, 512, 512, 512}));
+  SILICE3D_EXPECT(atlas.GetStats().GetOccupancy() == 1.0f);
+  CheckTiles(atlas, {&light_a});
+}
+
+SILICE3D_TEST(ShadowAtlasShrinksTheLeastImportantTiles) {
+  // 16 tiles of 256 texels fit into the atlas, 18 are requested
+  ShadowAtlasAllocator atlas{1024, 128};
+  std::vector<Request> requests = {Request{&light_a, 6, 256, 3.0f, false},
+                                   Request{&light_b, 6, 256, 1.0f, false},
+                                   Request{&light_c, 6, 256, 2.0f, false}};
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetStats().denied_count == 0);
+  SILICE3D_EXPECT(atlas.GetStats().allocated_count == 3);
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a) == std::vector<unsigned>(6, 256));
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_b) == std::vector<unsigned>(6, 128));
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_c) == std::vector<unsigned>(6, 256));
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_b)->requested_tile_size == 128);
+  CheckTiles(atlas, {&light_a, &light_b, &light_c});
+
+  // If the least important one isn't requested anymore, the others don't
+  // have to shrink, and the tiles of the unchanged requests are kept
+  std::vector<Tile> tiles_of_a = atlas.GetAllocation(&light_a)->tiles;
+  requests[1].importance = 4.0f;
+  requests[2].importance = 0.5f;
+  atlas.Update(requests);
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_b) == std::vector<unsigned>(6, 256));
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_c) == std::vector<unsigned>(6, 128));
+  const std::vector<Tile>& new_tiles_of_a = atlas.GetAllocation(&light_a)->tiles;
+  SILICE3D_EXPECT(new_tiles_of_a.size() == tiles_of_a.size());
+  for (size_t i = 0; i < tiles_of_a.size(); ++i) {
+    SILICE3D_EXPECT(new_tiles_of_a[i].offset == tiles_of_a[i].offset);
+  }
+  CheckTiles(atlas, {&light_a, &light_b, &light_c});
+}
+
+SILICE3D_TEST(ShadowAtlasEvictsTheLessImportant) {
+  // Only 512 texel large tiles, so the requests can't shrink
+  ShadowAtlasAllocator atlas{1024, 512};
+  atlas.Update({Request{&light_a, 4, 512, 1.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a).size() == 4);
+
+  // An equally important request can't evict it
+  atlas.Update({Request{&light_a, 4, 512, 1.0f, false}, Request{&light_b, 1, 512, 1.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a).size() == 4);
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_b) == nullptr);
+  SILICE3D_EXPECT(atlas.GetStats().denied_count == 1);
+
+  // But a more important one can, and the evicted one doesn't fit back
+  atlas.Update({Request{&light_a, 4, 512, 1.0f, false}, Request{&light_b, 1, 512, 2.0f, false}});
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_a) == nullptr);
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_b).size() == 1);
+  SILICE3D_EXPECT(atlas.GetStats().requested_count == 2);
+  SILICE3D_EXPECT(atlas.GetStats().allocated_count == 1);
+  SILICE3D_EXPECT(atlas.GetStats().denied_count == 1);
+  CheckTiles(atlas, {&light_a, &light_b});
+
+  // The remaining space is still usable for the smaller requests
+  atlas.Update({Request{&light_a, 3, 512, 1.0f, false}, Request{&light_b, 1, 512, 2.0f, false}});
+  SILICE3D_EXPECT(GetTileSizes(atlas, &light_a).size() == 3);
+  SILICE3D_EXPECT(atlas.GetStats().denied_count == 0);
+  SILICE3D_EXPECT(atlas.GetStats().GetOccupancy() == 1.0f);
+  CheckTiles(atlas, {&light_a, &light_b});
+}
+
+SILICE3D_TEST(ShadowAtlasRespectsTheUpdateBudget) {
+  ShadowAtlasAllocator atlas{1024, 128};
+  atlas.SetUpdateBudget(6);
+  std::vector<Request> requests = {Request{&light_a, 6, 128, 3.0f, false},
+                                   Request{&light_b, 6, 128, 2.0f, false},
+                                   Request{&light_c, 6, 128, 1.0f, false}};
+  using Owners = std::vector<const void*>;
+
+  // The new tiles are rendered first, by importance, one owner per frame
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates() == Owners{&light_a});
+  SILICE3D_EXPECT(atlas.GetStats().updated_tile_count == 6);
+  SILICE3D_EXPECT(atlas.GetAllocation(&light_a)->valid);
+  SILICE3D_EXPECT(!atlas.GetAllocation(&light_b)->valid);
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates() == Owners{&light_b});
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates() == Owners{&light_c});
+
+  // Then the importance is weighted with the frames since the last update
+  // (a: 3 * 3, b: 2 * 2, c: 1 * 1)
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates() == Owners{&light_a});
+
+  // The changed ones go before everything else
+  requests[2].changed = true;
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates() == Owners{&light_c});
+  requests[2].changed = false;
+
+  // A larger budget updates more owners
+  atlas.SetUpdateBudget(12);
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates().size() == 2);
+  SILICE3D_EXPECT(atlas.GetStats().updated_tile_count == 12);
+
+  // And one owner is always updated, even if it doesn't fit into the budget
+  atlas.SetUpdateBudget(4);
+  atlas.Update(requests);
+  SILICE3D_EXPECT(atlas.GetScheduledUpdates().size() == 1);
+  SILICE3D_EXPECT(atlas.GetStats().updated_tile_count == 6);
+}
@@ -0,0 +1,128 @@
+// Copyright (c) Tamas Csala
+
+#include <random>
+#include <vector>
+
+#include <Silice3D/common/thread_pool.hpp>
+#include <Silice3D/culling/software_occlusion_culler.hpp>
+
+#include "test.hpp"
+
+using namespace Silice3D;
+
+namespace {
+
+// The camera is at (0, 0, 10), and looks at the origin
+glm::mat4 GetViewProjectionMatrix(const SoftwareOcclusionCuller& culler) {
+  glm::mat4 camera_matrix = glm::lookAt(glm::vec3(0, 0, 10), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+  float aspect_ratio = float(culler.GetWidth()) / culler.GetHeight();
+  glm::mat4 projection_matrix = glm::perspective(glm::radians(60.0f), aspect_ratio, 0.5f, 150.0f);
+  return projection_matrix * camera_matrix;
+}
+
+// A square on the z = 0 plane, facing the camera
+OccluderMesh CreateQuad(float half_size) {
+  OccluderMesh mesh;
+  mesh.positions = {glm::vec3(-half_size, -half_size, 0), glm::vec3(half_size, -half_size, 0),
+                    glm::vec3(half_size, half_size, 0), glm::vec3(-half_size, half_size, 0)};
+  mesh.indices = {0, 1, 2, 0, 2, 3};
+  return mesh;
+}
+
+// Culls the boxes behind the occluder, and returns which of them are visible
+std::vector<bool> Cull(SoftwareOcclusionCuller* culler, const OccluderMesh& occluder,
+                       const std::vector<BoundingBox>& boxes) {
+  std::vector<bool> visible(boxes.size(), false);
+  culler->AddOccluder(&occluder, glm::mat4(1.0f));
+  for (size_t i = 0; i < boxes.size(); ++i) {
+    culler->AddOccludee(boxes[i], [&visible, i]() { visible[i] = true; });
+  }
+  culler->Cull(GetViewProjectionMatrix(*culler));
+  return visible;
+}
+
+}  // namespace
+
+SILICE3D_TEST(SoftwareOcclusionCullerFullScreenOccluder) {
+  ThreadPool thread_pool{2};
+  SoftwareOcclusionCuller culler{&thread_pool};
+  OccluderMesh quad = CreateQuad(100.0f);
+
+  std::vector<BoundingBox> boxes = {
+    BoundingBox{glm::dvec3(-1, -1, -4), glm::dvec3(1, 1, -2)},  // behind
+    BoundingBox{glm::dvec3(-1, -1, 2), glm::dvec3(1, 1, 4)},  // in front
+    BoundingBox{glm::dvec3(-1, -1, -1), glm::dvec3(1, 1, 1)},  // intersects it
+  };
+  std::vector<bool> visible = Cull(&culler, quad, boxes);
+  SILICE3D_EXPECT(!visible[0]);
+  SILICE3D_EXPECT(visible[1]);
+  SILICE3D_EXPECT(visible[2]);
+  SILICE3D_EXPECT(culler.GetStatistics().tested_count == 3);
+  SILICE3D_EXPECT(culler.GetStatistics().culled_count == 1);
+
+  // The whole depth buffer is covered
+  for (float depth : culler.GetDepthBuffer()) {
+    SILICE3D_EXPECT(depth < 1.0f);
+  }
+}
+
+SILICE3D_TEST(SoftwareOcclusionCullerBoxBesideOccluder) {
+  ThreadPool thread_pool{2};
+  SoftwareOcclusionCuller culler{&thread_pool};
+  OccluderMesh quad = CreateQuad(2.0f);
+
+  std::vector<BoundingBox> boxes = {
+    BoundingBox{glm::dvec3(-0.5, -0.5, -4), glm::dvec3(0.5, 0.5, -2)},  // behind
+    BoundingBox{glm::dvec3(5, -1, -5), glm::dvec3(7, 1, -3)},  // behind the plane, but beside it
+    BoundingBox{glm::dvec3(1, -1, -4), glm::dvec3(4, 1, -2)},  // partially behind
+  };
+  std::vector<bool> visible = Cull(&culler, quad, boxes);
+  SILICE3D_EXPECT(!visible[0]);
+  SILICE3D_EXPECT(visible[1]);
+  SILICE3D_EXPECT(visible[2]);
+}
+
+SILICE3D_TEST(SoftwareOcclusionCullerKernelsGiveIdenticalResults) {
+  if (!SoftwareOcclusionCuller::IsSseSupported()) {
+    std::cout << "SSE2 is not supported, skipped" << std::endl;
+    return;
+  }
+
+  // Random triangles in front of the camera, some of them crossing the near plane
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> xy{-8.0f, 8.0f};
+  std::uniform_real_distribution<float> z{-10.0f, 12.0f};
+  std::uniform_real_distribution<float> offset{-5.0f, 5.0f};
+  OccluderMesh occluder;
+  for (unsigned i = 0; i < 50; ++i) {
+    glm::vec3 center{xy(random), xy(random), z(random)};
+    for (int v = 0; v < 3; ++v) {
+      occluder.positions.push_back(center + glm::vec3(offset(random), offset(random), offset(random)));
+      occluder.indices.push_back(3 * i + v);
+    }
+  }
+
+  // Boxes behind most of the triangles
+  std::uniform_real_distribution<float> size{0.05f, 2.0f};
+  std::vector<BoundingBox> boxes;
+  for (int i = 0; i < 2000; ++i) {
+    glm::dvec3 mins{xy(random), xy(random), z(random) - 20.0f};
+    boxes.push_back(BoundingBox{mins, mins + glm::dvec3(size(random), size(random), size(random))});
+  }
+
+  ThreadPool thread_pool{2};
+  SoftwareOcclusionCuller sse_culler{&thread_pool};
+  SoftwareOcclusionCuller scalar_culler{&thread_pool};
+  scalar_culler.SetSseEnabled(false);
+  SILICE3D_EXPECT(sse_culler.IsSseEnabled());
+  SILICE3D_EXPECT(!scalar_culler.IsSseEnabled());
+
+  std::vector<bool> sse_visible = Cull(&sse_culler, occluder, boxes);
+  std::vector<bool> scalar_visible = Cull(&scalar_culler, occluder, boxes);
+  SILICE3D_EXPECT(sse_culler.GetDepthBuffer() == scalar_culler.GetDepthBuffer());
+  SILICE3D_EXPECT(sse_visible == scalar_visible);
+
+  // Some of the boxes are culled and some aren't, so the comparison means something
+  size_t culled_count = sse_culler.GetStatistics().culled_count;
+  SILICE3D_EXPECT(0 < culled_count && culled_count < boxes.size());
+}
@@ -0,0 +1,104 @@
+// Copyright (c) Tamas Csala
+
+#ifndef SILICE3D_TESTS_TEST_HPP_
+#define SILICE3D_TESTS_TEST_HPP_
+
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+
+// A minimal test and benchmark harness for the parts of the engine that don't
+// need an OpenGL context. The cases register themselves with the macros below,
+// and test_main.cpp / benchmark_main.cpp run them (or only the ones whose
+// names are given as arguments).
+
+namespace Silice3D {
+namespace Test {
+
+struct Case {
+  const char* name;
+  void (*function)();
+};
+
+inline std::vector<Case>& GetTests() {
+  static std::vector<Case> tests;
+  return tests;
+}
+
+inline std::vector<Case>& GetBenchmarks() {
+  static std::vector<Case> benchmarks;
+  return benchmarks;
+}
+
+inline size_t& GetFailureCount() {
+  static size_t failure_count = 0;
+  return failure_count;
+}
+
+struct Registration {
+  Registration(std::vector<Case>& cases, const char* name, void (*function)()) {
+    cases.push_back(Case{name, function});
+  }
+};
+
+inline void ReportFailure(const char* expression, const char* file, int line) {
+  std::cerr << file << ":" << line << ": expectation failed: " << expression << std::endl;
+  GetFailureCount()++;
+}
+
+// Runs the cases whose names are in the arguments, or all of them if there
+// aren't any. Returns the number of cases that were run.
+inline size_t RunCases(const std::vector<Case>& cases, int argc, char* argv[]) {
+  size_t run_count = 0;
+  for (const Case& test_case : cases) {
+    bool selected = argc <= 1;
+    for (int i = 1; i < argc; ++i) {
+      selected = selected || std::strcmp(argv[i], test_case.name) == 0;
+    }
+    if (selected) {
+      std::cout << "[ RUN ] " << test_case.name << std::endl;
+      size_t failure_count = GetFailureCount();
+      test_case.function();
+      std::cout << (GetFailureCount() == failure_count ? "[  OK ] " : "[FAIL ] ")
+                << test_case.name << std::endl;
+      run_count++;
+    }
+  }
+  return run_count;
+}
+
+// The average time of a call of the function, in milliseconds, after a
+// warm-up call.
+template<typename Function>
+double MeasureMilliseconds(unsigned repetitions, const Function& function) {
+  function();
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned i = 0; i < repetitions; ++i) {
+    function();
+  }
+  std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+  return duration.count() / repetitions;
+}
+
+}  // namespace Test
+}  // namespace Silice3D
+
+#define SILICE3D_TEST(name) \
+  static void name(); \
+  static Silice3D::Test::Registration name##_registration{Silice3D::Test::GetTests(), #name, &name}; \
+  static void name()
+
+#define SILICE3D_BENCHMARK(name) \
+  static void name(); \
+  static Silice3D::Test::Registration name##_registration{Silice3D::Test::GetBenchmarks(), #name, &name}; \
+  static void name()
+
+#define SILICE3D_EXPECT(condition) \
+  do { \
+    if (!(condition)) { \
+      Silice3D::Test::ReportFailure(#condition, __FILE__, __LINE__); \
+    } \
+  } while (false)
+
+#endif  // SILICE3D_TESTS_TEST_HPP_
@@ -0,0 +1,10 @@
+// Copyright (c) Tamas Csala
+
+#include "test.hpp"
+
+int main(int argc, char* argv[]) {
+  size_t run_count = Silice3D::Test::RunCases(Silice3D::Test::GetTests(), argc, argv);
+  size_t failure_count = Silice3D::Test::GetFailureCount();
+  std::cout << run_count << " tests, " << failure_count << " failed expectations" << std::endl;
+  return (run_count == 0 || failure_count != 0) ? 1 : 0;
+}